@@ -0,0 +1,1248 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64	// enable large file support
+#define _DEFAULT_SOURCE		// st_mtim (glibc)
+#define _DARWIN_C_SOURCE	// st_mtimespec (macOS)
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "../lib/utf8lite/src/utf8lite.h"
+#include "array.h"
+#include "error.h"
+#include "memory.h"
+#include "table.h"
+#include "textset.h"
+#include "stem.h"
+#include "symtab.h"
+#include "datatype.h"
+#include "data.h"
+#include "decoder.h"
+#include "filebuf.h"
+#include "filestream.h"
+#include "colfile.h"
+
+intmax_t corpus_strntoimax(const char *string, size_t maxlen, char **endptr);
+
+/*
+ * Column files have a fixed-size header, followed by a descriptor for
+ * each column, followed by the column data. The data for each column
+ * comes in sections (name, null bitmap, values, text attribute bitmaps,
+ * and blob), each starting at a multiple of 8 bytes; a section offset
+ * of 0 means that the section is absent. Bitmaps have one bit per row,
+ * starting from the low bit of the first byte. All integers get stored
+ * in little-endian byte order:
+ *
+ *   magic          8 bytes, "CORPUSCL"
+ *   version        4 bytes
+ *   ncolumn        4 bytes
+ *   file size      8 bytes
+ *   file mtime     8 bytes, in nanoseconds
+ *   nrow           8 bytes
+ *   columns        56 bytes each:
+ *     type           4 bytes
+ *     name size      4 bytes
+ *     name           8 bytes, offset
+ *     nulls          8 bytes, offset
+ *     values         8 bytes, offset
+ *     attributes     8 bytes, offset of the escape bitmap, followed by
+ *                    the non-ASCII bitmap
+ *     blob           8 bytes, offset
+ *     blob size      8 bytes
+ */
+
+#define COLFILE_MAGIC "CORPUSCL"
+#define COLFILE_VERSION 2
+#define COLFILE_HEADER_SIZE 40
+#define COLFILE_COLUMN_SIZE 56
+
+#define COLFILE_PAD(size) (((size) + 7) & ~(uint64_t)7)
+
+/*
+ * A column being built, with its sections in their stored form.
+ */
+struct colfile_column {
+	int name_id;
+	int type;
+	uint64_t nrow;
+	uint8_t *nulls;
+	uint8_t *values;
+	uint8_t *attrs;
+	uint8_t *blob;
+	size_t blob_size;
+	size_t blob_max;
+};
+
+static uint64_t colfile_bitmap_size(uint64_t nrow);
+static uint64_t colfile_values_size(int type, uint64_t nrow);
+
+
+static void colfile_put_u32(uint8_t *ptr, uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		ptr[i] = (uint8_t)(val >> (8 * i));
+	}
+}
+
+
+static void colfile_put_u64(uint8_t *ptr, uint64_t val)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		ptr[i] = (uint8_t)(val >> (8 * i));
+	}
+}
+
+
+static uint32_t colfile_get_u32(const uint8_t *ptr)
+{
+	uint32_t val = 0;
+	int i;
+
+	for (i = 3; i >= 0; i--) {
+		val = (val << 8) | ptr[i];
+	}
+	return val;
+}
+
+
+static uint64_t colfile_get_u64(const uint8_t *ptr)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		val = (val << 8) | ptr[i];
+	}
+	return val;
+}
+
+
+static int colfile_bit(const uint8_t *bits, uint64_t i)
+{
+	return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+
+static void colfile_bit_set(uint8_t *bits, uint64_t i)
+{
+	bits[i >> 3] |= (uint8_t)(1 << (i & 7));
+}
+
+
+static void colfile_bit_clear(uint8_t *bits, uint64_t i)
+{
+	bits[i >> 3] &= (uint8_t)~(1 << (i & 7));
+}
+
+
+uint64_t colfile_bitmap_size(uint64_t nrow)
+{
+	return nrow / 8 + (nrow % 8 ? 1 : 0);
+}
+
+
+uint64_t colfile_values_size(int type, uint64_t nrow)
+{
+	switch (type) {
+	case CORPUS_DATATYPE_BOOLEAN:
+		return colfile_bitmap_size(nrow);
+	case CORPUS_DATATYPE_INTEGER:
+	case CORPUS_DATATYPE_REAL:
+		return 8 * nrow;
+	case CORPUS_DATATYPE_TEXT:
+	case CORPUS_DATATYPE_ANY:
+		return 8 * (nrow + 1);
+	default:
+		return 0;
+	}
+}
+
+
+static char *colfile_name(const char *file_name)
+{
+	size_t len = strlen(file_name);
+	size_t ext_len = strlen(CORPUS_COLFILE_EXT);
+	char *name;
+
+	if (!(name = corpus_malloc(len + ext_len + 1))) {
+		corpus_log(CORPUS_ERROR_NOMEM,
+			   "failed allocating column file name");
+		return NULL;
+	}
+	memcpy(name, file_name, len);
+	memcpy(name + len, CORPUS_COLFILE_EXT, ext_len + 1);
+	return name;
+}
+
+
+/*
+ * Get a file's size and modification time, in nanoseconds where the
+ * platform provides them, so that rewriting a file within the same
+ * second still makes its column file stale.
+ */
+static int colfile_stat(const char *file_name, uint64_t *sizeptr,
+			int64_t *mtimeptr)
+{
+	struct stat st;
+	int64_t nsec;
+
+	if (stat(file_name, &st) < 0) {
+		return CORPUS_ERROR_OS;
+	}
+#if defined(__APPLE__)
+	nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#elif defined(st_mtime)	// st_mtime is an alias for st_mtim.tv_sec
+	nsec = (int64_t)st.st_mtim.tv_nsec;
+#else
+	nsec = 0;
+#endif
+
+	*sizeptr = (uint64_t)st.st_size;
+	*mtimeptr = (int64_t)st.st_mtime * 1000000000 + nsec;
+	return 0;
+}
+
+
+/*
+ * Column building.
+ */
+
+static int colfile_column_init(struct colfile_column *col, int name_id,
+			       int type_id, const struct corpus_schema *s,
+			       uint64_t nrow)
+{
+	uint64_t nbits = colfile_bitmap_size(nrow);
+	uint64_t nvalues;
+	int err;
+
+	col->name_id = name_id;
+	col->nrow = nrow;
+	if (type_id < 0) {
+		col->type = CORPUS_DATATYPE_ANY;
+	} else {
+		switch (s->types[type_id].kind) {
+		case CORPUS_DATATYPE_NULL:
+		case CORPUS_DATATYPE_BOOLEAN:
+		case CORPUS_DATATYPE_INTEGER:
+		case CORPUS_DATATYPE_REAL:
+		case CORPUS_DATATYPE_TEXT:
+			col->type = s->types[type_id].kind;
+			break;
+		default:
+			col->type = CORPUS_DATATYPE_ANY;
+			break;
+		}
+	}
+
+	col->nulls = NULL;
+	col->values = NULL;
+	col->attrs = NULL;
+	col->blob = NULL;
+	col->blob_size = 0;
+	col->blob_max = 0;
+
+	nvalues = colfile_values_size(col->type, nrow);
+	if (nbits > SIZE_MAX / 2 || nvalues > SIZE_MAX) {
+		err = CORPUS_ERROR_OVERFLOW;
+		corpus_log(err, "number of rows (%"PRIu64") exceeds maximum",
+			   nrow);
+		goto error;
+	}
+
+	if (!(col->nulls = corpus_malloc((size_t)nbits + 1))) {
+		goto error_nomem;
+	}
+	memset(col->nulls, 0xFF, (size_t)nbits + 1);
+
+	if (nvalues > 0) {
+		if (!(col->values = corpus_calloc((size_t)nvalues, 1))) {
+			goto error_nomem;
+		}
+	}
+
+	if (col->type == CORPUS_DATATYPE_TEXT) {
+		if (!(col->attrs = corpus_calloc(2 * (size_t)nbits + 1, 1))) {
+			goto error_nomem;
+		}
+	}
+
+	return 0;
+
+error_nomem:
+	err = CORPUS_ERROR_NOMEM;
+	corpus_log(err, "failed allocating column");
+error:
+	corpus_free(col->attrs);
+	corpus_free(col->values);
+	corpus_free(col->nulls);
+	return err;
+}
+
+
+static void colfile_column_destroy(struct colfile_column *col)
+{
+	corpus_free(col->blob);
+	corpus_free(col->attrs);
+	corpus_free(col->values);
+	corpus_free(col->nulls);
+}
+
+
+static int colfile_column_append(struct colfile_column *col,
+				 const uint8_t *ptr, size_t size)
+{
+	void *base;
+	int err;
+
+	if (col->blob_max - col->blob_size < size) {
+		base = col->blob;
+		if ((err = corpus_bigarray_grow(&base, &col->blob_max, 1,
+						col->blob_size, size))) {
+			corpus_log(err, "failed growing column data");
+			return err;
+		}
+		col->blob = base;
+	}
+
+	memcpy(col->blob + col->blob_size, ptr, size);
+	col->blob_size += size;
+	return 0;
+}
+
+
+/*
+ * Convert an integer column to real, for when a value does not fit in
+ * 64 bits. The values take the same space in both forms.
+ */
+static void colfile_column_demote(struct colfile_column *col, uint64_t nrow)
+{
+	uint64_t bits, i;
+	double val;
+
+	for (i = 0; i < nrow; i++) {
+		if (colfile_bit(col->nulls, i)) {
+			continue;
+		}
+		val = (double)(int64_t)colfile_get_u64(col->values + 8 * i);
+		memcpy(&bits, &val, sizeof(bits));
+		colfile_put_u64(col->values + 8 * i, bits);
+	}
+	col->type = CORPUS_DATATYPE_REAL;
+}
+
+
+static int colfile_column_put(struct colfile_column *col, uint64_t row,
+			      const struct corpus_data *val)
+{
+	struct utf8lite_text text;
+	const uint8_t *end;
+	uint64_t bits;
+	intmax_t ival;
+	double dval;
+	int bval, err;
+	size_t size;
+
+	if (val->type_id == CORPUS_DATATYPE_NULL) {
+		return 0;
+	}
+
+	switch (col->type) {
+	case CORPUS_DATATYPE_BOOLEAN:
+		if (corpus_data_bool(val, &bval)) {
+			return 0;
+		}
+		if (bval) {
+			colfile_bit_set(col->values, row);
+		}
+		break;
+
+	case CORPUS_DATATYPE_INTEGER:
+		if (val->type_id == CORPUS_DATATYPE_INTEGER) {
+			errno = 0;
+			ival = corpus_strntoimax((const char *)val->ptr,
+						 val->size, NULL);
+			if (errno != ERANGE
+					&& (intmax_t)(int64_t)ival == ival) {
+				colfile_put_u64(col->values + 8 * row,
+						(uint64_t)(int64_t)ival);
+				break;
+			}
+		}
+		colfile_column_demote(col, row);
+		// fall through
+
+	case CORPUS_DATATYPE_REAL:
+		err = corpus_data_double(val, &dval);
+		if (err && err != CORPUS_ERROR_RANGE) {
+			return 0;
+		}
+		memcpy(&bits, &dval, sizeof(bits));
+		colfile_put_u64(col->values + 8 * row, bits);
+		break;
+
+	case CORPUS_DATATYPE_TEXT:
+		if (corpus_data_text(val, &text)) {
+			return 0;
+		}
+		// keep the quotes, so that the value can get used as data
+		size = UTF8LITE_TEXT_SIZE(&text) + 2;
+		if ((err = colfile_column_append(col, text.ptr - 1, size))) {
+			return err;
+		}
+		if (UTF8LITE_TEXT_HAS_ESC(&text)) {
+			colfile_bit_set(col->attrs, row);
+		}
+		if (!UTF8LITE_TEXT_IS_ASCII(&text)) {
+			colfile_bit_set(col->attrs
+					+ colfile_bitmap_size(col->nrow), row);
+		}
+		break;
+
+	case CORPUS_DATATYPE_ANY:
+		// drop the trailing whitespace
+		end = val->ptr + val->size;
+		while (end != val->ptr && (end[-1] == ' ' || end[-1] == '\t'
+					   || end[-1] == '\r'
+					   || end[-1] == '\n')) {
+			end--;
+		}
+		if ((err = colfile_column_append(col, val->ptr,
+						 (size_t)(end - val->ptr)))) {
+			return err;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	colfile_bit_clear(col->nulls, row);
+	return 0;
+}
+
+
+/*
+ * Determine the schema of a data file, and count its lines.
+ */
+static int colfile_scan(struct corpus_schema *s, const char *file_name,
+			int *type_idptr, uint64_t *nrowptr)
+{
+	struct corpus_filestream fs;
+	uint64_t nrow = 0;
+	int err, id, type_id = CORPUS_DATATYPE_NULL;
+
+	if ((err = corpus_filestream_init(&fs, file_name))) {
+		return err;
+	}
+
+	while (corpus_filestream_advance(&fs)) {
+		if ((err = corpus_schema_scan(s, fs.current.ptr,
+					      fs.current.size, &id))) {
+			goto out;
+		}
+		if ((err = corpus_schema_union(s, type_id, id, &type_id))) {
+			goto out;
+		}
+		nrow++;
+	}
+	err = fs.error;
+
+out:
+	corpus_filestream_destroy(&fs);
+	*type_idptr = type_id;
+	*nrowptr = nrow;
+	return err;
+}
+
+
+/*
+ * Read the lines of a data file a second time, copying the record
+ * fields into their columns. The `colmap` array maps each field name ID
+ * less than `nmap` to its column, or to -1 if it has none.
+ */
+static int colfile_fill(struct colfile_column *cols, int ncol,
+			const int *colmap, int nmap, struct corpus_schema *s,
+			const char *file_name, uint64_t nrow)
+{
+	struct corpus_filestream fs;
+	struct corpus_data data;
+	struct corpus_data_fields fields;
+	uint64_t row = 0;
+	int err, i, name_id, type;
+
+	if ((err = corpus_filestream_init(&fs, file_name))) {
+		return err;
+	}
+
+	while (corpus_filestream_advance(&fs)) {
+		if (row == nrow) {
+			err = CORPUS_ERROR_INVAL;
+			goto changed;
+		}
+
+		if ((err = corpus_data_assign(&data, s, fs.current.ptr,
+					      fs.current.size))) {
+			goto out;
+		}
+
+		if (data.type_id >= 0 && s->types[data.type_id].kind
+					== CORPUS_DATATYPE_RECORD) {
+			if ((err = corpus_data_fields(&data, s, &fields))) {
+				goto out;
+			}
+			while (corpus_data_fields_advance(&fields)) {
+				name_id = fields.name_id;
+				if (name_id >= nmap || colmap[name_id] < 0) {
+					continue;
+				}
+				if ((err = colfile_column_put(
+						&cols[colmap[name_id]], row,
+						&fields.current))) {
+					goto out;
+				}
+			}
+		}
+
+		// the value offsets for the row end where the blob ends,
+		// whether or not the row has a value
+		for (i = 0; i < ncol; i++) {
+			type = cols[i].type;
+			if (type == CORPUS_DATATYPE_TEXT
+					|| type == CORPUS_DATATYPE_ANY) {
+				colfile_put_u64(cols[i].values + 8 * (row + 1),
+						(uint64_t)cols[i].blob_size);
+			}
+		}
+		row++;
+	}
+
+	if ((err = fs.error)) {
+		goto out;
+	}
+	if (row != nrow) {
+		err = CORPUS_ERROR_INVAL;
+		goto changed;
+	}
+	goto out;
+
+changed:
+	corpus_log(err, "file (%s) changed while compiling", file_name);
+out:
+	corpus_filestream_destroy(&fs);
+	return err;
+}
+
+
+static int colfile_write_section(FILE *stream, const uint8_t *ptr,
+				 uint64_t size)
+{
+	static const uint8_t zeros[8];
+	size_t pad = (size_t)(COLFILE_PAD(size) - size);
+
+	if (size > 0 && fwrite(ptr, 1, (size_t)size, stream) != size) {
+		return CORPUS_ERROR_OS;
+	}
+	if (pad > 0 && fwrite(zeros, 1, pad, stream) != pad) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+static int colfile_save(const struct colfile_column *cols, int ncol,
+			const struct corpus_schema *s, uint64_t nrow,
+			uint64_t file_size, int64_t mtime, FILE *stream)
+{
+	uint8_t header[COLFILE_HEADER_SIZE];
+	uint8_t desc[COLFILE_COLUMN_SIZE];
+	const struct utf8lite_text *name;
+	const struct colfile_column *col;
+	uint64_t nbits = colfile_bitmap_size(nrow);
+	uint64_t pos, name_size, nvalues;
+	int err, i;
+
+	memcpy(header, COLFILE_MAGIC, 8);
+	colfile_put_u32(header + 8, COLFILE_VERSION);
+	colfile_put_u32(header + 12, (uint32_t)ncol);
+	colfile_put_u64(header + 16, file_size);
+	colfile_put_u64(header + 24, (uint64_t)mtime);
+	colfile_put_u64(header + 32, nrow);
+
+	if (fwrite(header, 1, sizeof(header), stream) != sizeof(header)) {
+		return CORPUS_ERROR_OS;
+	}
+
+	pos = COLFILE_HEADER_SIZE + (uint64_t)ncol * COLFILE_COLUMN_SIZE;
+
+	for (i = 0; i < ncol; i++) {
+		col = &cols[i];
+		name = &s->names.types[col->name_id].text;
+		name_size = UTF8LITE_TEXT_SIZE(name);
+		nvalues = colfile_values_size(col->type, nrow);
+
+		memset(desc, 0, sizeof(desc));
+		colfile_put_u32(desc, (uint32_t)col->type);
+		colfile_put_u32(desc + 4, (uint32_t)name_size);
+
+		colfile_put_u64(desc + 8, pos);
+		pos += COLFILE_PAD(name_size);
+
+		colfile_put_u64(desc + 16, pos);
+		pos += COLFILE_PAD(nbits);
+
+		if (nvalues > 0) {
+			colfile_put_u64(desc + 24, pos);
+			pos += COLFILE_PAD(nvalues);
+		}
+
+		if (col->attrs) {
+			colfile_put_u64(desc + 32, pos);
+			pos += COLFILE_PAD(2 * nbits);
+		}
+
+		if (col->type == CORPUS_DATATYPE_TEXT
+				|| col->type == CORPUS_DATATYPE_ANY) {
+			colfile_put_u64(desc + 40, pos);
+			colfile_put_u64(desc + 48, (uint64_t)col->blob_size);
+			pos += COLFILE_PAD((uint64_t)col->blob_size);
+		}
+
+		if (fwrite(desc, 1, sizeof(desc), stream) != sizeof(desc)) {
+			return CORPUS_ERROR_OS;
+		}
+	}
+
+	for (i = 0; i < ncol; i++) {
+		col = &cols[i];
+		name = &s->names.types[col->name_id].text;
+		nvalues = colfile_values_size(col->type, nrow);
+
+		if ((err = colfile_write_section(stream, name->ptr,
+						 UTF8LITE_TEXT_SIZE(name)))) {
+			return err;
+		}
+		if ((err = colfile_write_section(stream, col->nulls, nbits))) {
+			return err;
+		}
+		if ((err = colfile_write_section(stream, col->values,
+						 nvalues))) {
+			return err;
+		}
+		if (col->attrs && (err = colfile_write_section(stream,
+							col->attrs,
+							2 * nbits))) {
+			return err;
+		}
+		if ((err = colfile_write_section(stream, col->blob,
+						 col->blob_size))) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+
+int corpus_colfile_write(const char *file_name)
+{
+	struct corpus_schema schema;
+	const struct corpus_datatype_record *record;
+	struct colfile_column *cols = NULL;
+	int *colmap = NULL;
+	FILE *stream;
+	char *name, *temp_name;
+	uint64_t nrow, file_size, file_size2;
+	int64_t mtime, mtime2;
+	int err, i, type_id, ncol = 0, ninit = 0, nmap;
+
+	if (strcmp(file_name, "-") == 0) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "cannot compile standard input");
+		goto name_fail;
+	}
+
+	if (!(name = colfile_name(file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto name_fail;
+	}
+
+	// build the column file under a temporary name, so that a failure
+	// leaves the old one in place
+	if (!(temp_name = corpus_filebuf_temp_name(name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto temp_fail;
+	}
+
+	if ((err = colfile_stat(file_name, &file_size, &mtime))) {
+		corpus_log(err, "failed determining modification time of"
+			   " file (%s): %s", file_name, strerror(errno));
+		goto stat_fail;
+	}
+
+	if ((err = corpus_schema_init(&schema))) {
+		goto schema_fail;
+	}
+
+	if ((err = colfile_scan(&schema, file_name, &type_id, &nrow))) {
+		goto scan_fail;
+	}
+
+	if (type_id != CORPUS_DATATYPE_NULL && (type_id < 0
+			|| schema.types[type_id].kind
+				!= CORPUS_DATATYPE_RECORD)) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "file (%s) has lines that are not records",
+			   file_name);
+		goto scan_fail;
+	}
+
+	if (type_id != CORPUS_DATATYPE_NULL) {
+		record = &schema.types[type_id].meta.record;
+		ncol = record->nfield;
+	} else {
+		record = NULL;
+	}
+
+	nmap = schema.names.ntype;
+	cols = corpus_calloc((size_t)ncol + 1, sizeof(*cols));
+	colmap = corpus_malloc(((size_t)nmap + 1) * sizeof(*colmap));
+	if (!cols || !colmap) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating columns");
+		goto columns_fail;
+	}
+
+	for (i = 0; i < nmap; i++) {
+		colmap[i] = -1;
+	}
+
+	for (i = 0; i < ncol; i++) {
+		if ((err = colfile_column_init(&cols[i], record->name_ids[i],
+					       record->type_ids[i], &schema,
+					       nrow))) {
+			goto columns_fail;
+		}
+		ninit++;
+		colmap[record->name_ids[i]] = i;
+	}
+
+	if ((err = colfile_fill(cols, ncol, colmap, nmap, &schema, file_name,
+				nrow))) {
+		goto columns_fail;
+	}
+
+	if (colfile_stat(file_name, &file_size2, &mtime2) == 0
+			&& (file_size2 != file_size || mtime2 != mtime)) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "file (%s) changed while compiling",
+			   file_name);
+		goto columns_fail;
+	}
+
+	if (!(stream = fopen(temp_name, "wb"))) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed opening column file (%s): %s",
+			   temp_name, strerror(errno));
+		goto columns_fail;
+	}
+
+	err = colfile_save(cols, ncol, &schema, nrow, file_size, mtime,
+			   stream);
+	if (fclose(stream) == EOF && !err) {
+		err = CORPUS_ERROR_OS;
+	}
+	if (err) {
+		corpus_log(err, "failed writing column file (%s): %s",
+			   temp_name, strerror(errno));
+		remove(temp_name);
+	} else {
+		err = corpus_filebuf_replace(temp_name, name);
+	}
+
+columns_fail:
+	for (i = 0; i < ninit; i++) {
+		colfile_column_destroy(&cols[i]);
+	}
+	corpus_free(colmap);
+	corpus_free(cols);
+scan_fail:
+	corpus_schema_destroy(&schema);
+schema_fail:
+stat_fail:
+	corpus_free(temp_name);
+temp_fail:
+	corpus_free(name);
+name_fail:
+	if (err) {
+		corpus_log(err, "failed compiling file (%s)", file_name);
+	}
+	return err;
+}
+
+
+/*
+ * Column file reading.
+ */
+
+/*
+ * Find a section of a column file, checking that it is in bounds.
+ */
+static int colfile_section(const uint8_t *data, uint64_t size, uint64_t off,
+			   uint64_t len, const uint8_t **ptrptr)
+{
+	if (off == 0) {
+		*ptrptr = NULL;
+		return len == 0 ? 0 : CORPUS_ERROR_INVAL;
+	}
+	if (off > size || len > size - off) {
+		return CORPUS_ERROR_INVAL;
+	}
+	*ptrptr = data + off;
+	return 0;
+}
+
+
+/*
+ * Check that the offsets for a text or JSON column increase, and stay
+ * within the blob, so that reading the values can skip the checks.
+ */
+static int colfile_check_offsets(const struct corpus_colfile_column *col,
+				 uint64_t nrow, uint64_t blob_size)
+{
+	uint64_t row, start, end;
+
+	start = colfile_get_u64(col->values);
+	if (start != 0) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	for (row = 0; row < nrow; row++) {
+		end = colfile_get_u64(col->values + 8 * (row + 1));
+		if (end < start || end > blob_size) {
+			return CORPUS_ERROR_INVAL;
+		}
+		if (col->type == CORPUS_DATATYPE_TEXT
+				&& !colfile_bit(col->nulls, row)
+				&& (end - start < 2 || col->blob[start] != '"'
+				    || col->blob[end - 1] != '"')) {
+			return CORPUS_ERROR_INVAL;
+		}
+		start = end;
+	}
+
+	return start == blob_size ? 0 : CORPUS_ERROR_INVAL;
+}
+
+
+/*
+ * Parse the header and column descriptors of a column file, checking
+ * that it matches the data file. Returns CORPUS_ERROR_INVAL (without
+ * logging) if the column file is stale or malformed.
+ */
+static int colfile_parse(struct corpus_colfile *cf, uint64_t file_size,
+			 int64_t mtime)
+{
+	struct corpus_colfile_column *col;
+	const uint8_t *data = cf->buf.map_addr;
+	const uint8_t *desc, *ptr;
+	uint64_t size = cf->buf.file_size;
+	uint64_t ncol, nrow, nbits, nvalues, name_size, blob_size;
+	uint64_t i;
+	int err;
+
+	if (size < COLFILE_HEADER_SIZE
+			|| memcmp(data, COLFILE_MAGIC, 8) != 0
+			|| colfile_get_u32(data + 8) != COLFILE_VERSION
+			|| colfile_get_u64(data + 16) != file_size
+			|| colfile_get_u64(data + 24) != (uint64_t)mtime) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	ncol = colfile_get_u32(data + 12);
+	nrow = colfile_get_u64(data + 32);
+
+	// every line has at least one byte
+	if (nrow > file_size || ncol > INT_MAX
+			|| ncol > (size - COLFILE_HEADER_SIZE)
+				  / COLFILE_COLUMN_SIZE) {
+		return CORPUS_ERROR_INVAL;
+	}
+	nbits = colfile_bitmap_size(nrow);
+
+	if (!(cf->columns = corpus_calloc((size_t)ncol + 1,
+					  sizeof(*cf->columns)))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating column file columns");
+		return err;
+	}
+
+	err = CORPUS_ERROR_INVAL;
+
+	for (i = 0; i < ncol; i++) {
+		desc = data + COLFILE_HEADER_SIZE + i * COLFILE_COLUMN_SIZE;
+		col = &cf->columns[i];
+		col->type = (int)(int32_t)colfile_get_u32(desc);
+
+		switch (col->type) {
+		case CORPUS_DATATYPE_NULL:
+		case CORPUS_DATATYPE_BOOLEAN:
+		case CORPUS_DATATYPE_INTEGER:
+		case CORPUS_DATATYPE_REAL:
+		case CORPUS_DATATYPE_TEXT:
+		case CORPUS_DATATYPE_ANY:
+			break;
+		default:
+			goto error;
+		}
+
+		name_size = colfile_get_u32(desc + 4);
+		if (colfile_section(data, size, colfile_get_u64(desc + 8),
+				    name_size, &ptr)
+				|| utf8lite_text_assign(&col->name, ptr,
+							(size_t)name_size, 0,
+							NULL)) {
+			goto error;
+		}
+
+		if (colfile_section(data, size, colfile_get_u64(desc + 16),
+				    nbits, &col->nulls) || !col->nulls) {
+			goto error;
+		}
+
+		nvalues = colfile_values_size(col->type, nrow);
+		if (colfile_section(data, size, colfile_get_u64(desc + 24),
+				    nvalues, &col->values)) {
+			goto error;
+		}
+
+		if (col->type == CORPUS_DATATYPE_TEXT) {
+			if (colfile_section(data, size,
+					    colfile_get_u64(desc + 32),
+					    2 * nbits, &ptr)) {
+				goto error;
+			}
+			col->esc = ptr;
+			col->utf8 = ptr + nbits;
+		}
+
+		if (col->type == CORPUS_DATATYPE_TEXT
+				|| col->type == CORPUS_DATATYPE_ANY) {
+			blob_size = colfile_get_u64(desc + 48);
+			if (colfile_section(data, size,
+					    colfile_get_u64(desc + 40),
+					    blob_size, &col->blob)
+					|| !col->blob
+					|| colfile_check_offsets(col, nrow,
+								 blob_size)) {
+				goto error;
+			}
+		}
+	}
+
+	cf->nrow = nrow;
+	cf->ncolumn = (int)ncol;
+	return 0;
+
+error:
+	corpus_free(cf->columns);
+	cf->columns = NULL;
+	return err;
+}
+
+
+int corpus_colfile_init(struct corpus_colfile *cf, const char *file_name)
+{
+	struct stat st;
+	uint64_t file_size;
+	int64_t mtime;
+	char *name;
+	int err;
+
+	cf->nrow = 0;
+	cf->columns = NULL;
+	cf->ncolumn = 0;
+
+	if (!(name = colfile_name(file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto name_fail;
+	}
+
+	// a missing column file is not an error
+	if (stat(name, &st) < 0
+			|| colfile_stat(file_name, &file_size, &mtime)) {
+		err = CORPUS_ERROR_INVAL;
+		goto stat_fail;
+	}
+
+	if ((err = corpus_filebuf_init(&cf->buf, name))) {
+		goto stat_fail;
+	}
+
+	if ((err = colfile_parse(cf, file_size, mtime))) {
+		goto parse_fail;
+	}
+
+	corpus_free(name);
+	return 0;
+
+parse_fail:
+	corpus_filebuf_destroy(&cf->buf);
+stat_fail:
+	corpus_free(name);
+name_fail:
+	return err;
+}
+
+
+void corpus_colfile_destroy(struct corpus_colfile *cf)
+{
+	corpus_free(cf->columns);
+	corpus_filebuf_destroy(&cf->buf);
+}
+
+
+int corpus_colfile_column(const struct corpus_colfile *cf,
+			  const struct utf8lite_text *name)
+{
+	int i;
+
+	for (i = 0; i < cf->ncolumn; i++) {
+		if (utf8lite_text_equals(name, &cf->columns[i].name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+int corpus_colfile_is_null(const struct corpus_colfile *cf, int col,
+			   uint64_t row)
+{
+	assert(0 <= col && col < cf->ncolumn);
+	assert(row < cf->nrow);
+
+	return colfile_bit(cf->columns[col].nulls, row);
+}
+
+
+int corpus_colfile_bool(const struct corpus_colfile *cf, int col,
+			uint64_t row, int *valptr)
+{
+	const struct corpus_colfile_column *c = &cf->columns[col];
+	int val;
+	int err;
+
+	if (c->type != CORPUS_DATATYPE_BOOLEAN
+			|| corpus_colfile_is_null(cf, col, row)) {
+		val = INT_MIN;
+		err = CORPUS_ERROR_INVAL;
+	} else {
+		val = colfile_bit(c->values, row);
+		err = 0;
+	}
+
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
+
+
+int corpus_colfile_int(const struct corpus_colfile *cf, int col,
+		       uint64_t row, int *valptr)
+{
+	const struct corpus_colfile_column *c = &cf->columns[col];
+	int64_t lval;
+	int val;
+	int err;
+
+	if (c->type != CORPUS_DATATYPE_INTEGER
+			|| corpus_colfile_is_null(cf, col, row)) {
+		val = INT_MIN;
+		err = CORPUS_ERROR_INVAL;
+		goto out;
+	}
+
+	lval = (int64_t)colfile_get_u64(c->values + 8 * row);
+	if (lval > INT_MAX) {
+		val = INT_MAX;
+		err = CORPUS_ERROR_RANGE;
+	} else if (lval < INT_MIN) {
+		val = INT_MIN;
+		err = CORPUS_ERROR_RANGE;
+	} else {
+		val = (int)lval;
+		err = 0;
+	}
+
+out:
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
+
+
+int corpus_colfile_double(const struct corpus_colfile *cf, int col,
+			  uint64_t row, double *valptr)
+{
+	const struct corpus_colfile_column *c = &cf->columns[col];
+	uint64_t bits;
+	double val;
+	int err;
+
+	if (corpus_colfile_is_null(cf, col, row)) {
+		goto nullval;
+	}
+
+	switch (c->type) {
+	case CORPUS_DATATYPE_INTEGER:
+		val = (double)(int64_t)colfile_get_u64(c->values + 8 * row);
+		break;
+	case CORPUS_DATATYPE_REAL:
+		bits = colfile_get_u64(c->values + 8 * row);
+		memcpy(&val, &bits, sizeof(val));
+		break;
+	default:
+		goto nullval;
+	}
+
+	err = 0;
+	goto out;
+
+nullval:
+	val = (double)NAN;
+	err = CORPUS_ERROR_INVAL;
+
+out:
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
+
+
+int corpus_colfile_text(const struct corpus_colfile *cf, int col,
+			uint64_t row, struct utf8lite_text *valptr)
+{
+	const struct corpus_colfile_column *c = &cf->columns[col];
+	struct utf8lite_text val;
+	uint64_t start, end;
+	int err;
+
+	if (c->type != CORPUS_DATATYPE_TEXT
+			|| corpus_colfile_is_null(cf, col, row)) {
+		val.ptr = NULL;
+		val.attr = 0;
+		err = CORPUS_ERROR_INVAL;
+		goto out;
+	}
+
+	// skip over the quotes
+	start = colfile_get_u64(c->values + 8 * row);
+	end = colfile_get_u64(c->values + 8 * (row + 1));
+	val.ptr = (uint8_t *)c->blob + start + 1;
+	val.attr = (size_t)(end - start - 2);
+	if (colfile_bit(c->esc, row)) {
+		val.attr |= UTF8LITE_TEXT_ESC_BIT;
+	}
+	if (colfile_bit(c->utf8, row)) {
+		val.attr |= UTF8LITE_TEXT_UTF8_BIT;
+	}
+	err = 0;
+
+out:
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
+
+
+int corpus_colfile_data(const struct corpus_colfile *cf,
+			struct corpus_schema *s, int col, uint64_t row,
+			struct corpus_data *valptr)
+{
+	const struct corpus_colfile_column *c = &cf->columns[col];
+	struct corpus_data val;
+	uint64_t start, end;
+	int err = 0;
+
+	val.ptr = NULL;
+	val.size = 0;
+	val.type_id = CORPUS_DATATYPE_NULL;
+	val.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
+
+	if (corpus_colfile_is_null(cf, col, row)) {
+		goto out;
+	}
+
+	switch (c->type) {
+	case CORPUS_DATATYPE_BOOLEAN:
+		if (colfile_bit(c->values, row)) {
+			val.ptr = (const uint8_t *)"true";
+			val.size = 4;
+		} else {
+			val.ptr = (const uint8_t *)"false";
+			val.size = 5;
+		}
+		val.type_id = CORPUS_DATATYPE_BOOLEAN;
+		break;
+
+	case CORPUS_DATATYPE_TEXT:
+		start = colfile_get_u64(c->values + 8 * row);
+		end = colfile_get_u64(c->values + 8 * (row + 1));
+		val.ptr = c->blob + start;
+		val.size = (size_t)(end - start);
+		val.type_id = CORPUS_DATATYPE_TEXT;
+		val.text_attr = CORPUS_DATA_TEXT_KNOWN;
+		if (colfile_bit(c->esc, row)) {
+			val.text_attr |= CORPUS_DATA_TEXT_ESC;
+		}
+		if (colfile_bit(c->utf8, row)) {
+			val.text_attr |= CORPUS_DATA_TEXT_UTF8;
+		}
+		break;
+
+	case CORPUS_DATATYPE_ANY:
+		start = colfile_get_u64(c->values + 8 * row);
+		end = colfile_get_u64(c->values + 8 * (row + 1));
+		err = corpus_data_assign(&val, s, c->blob + start,
+					 (size_t)(end - start));
+		break;
+
+	default:
+		err = CORPUS_ERROR_INVAL;
+		break;
+	}
+
+out:
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CORPUS_COLFILE_H
+#define CORPUS_COLFILE_H
+
+/**
+ * \file colfile.h
+ *
+ * Column file, a compiled, memory-mappable copy of the records in a
+ * newline-delimited JSON file, for reading fields without parsing.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct corpus_data;
+struct corpus_schema;
+
+/**
+ * File name extension for column files. The column file for a data
+ * file gets stored next to it, with this extension appended to its name.
+ */
+#define CORPUS_COLFILE_EXT ".col"
+
+/**
+ * A column in a column file, holding the values of one record field,
+ * one per row. Every column has a null bitmap; the other parts depend
+ * on the column type:
+ *
+ *   + #CORPUS_DATATYPE_BOOLEAN: a bitmap of the values;
+ *
+ *   + #CORPUS_DATATYPE_INTEGER: 64-bit signed integers;
+ *
+ *   + #CORPUS_DATATYPE_REAL: 64-bit floating point numbers;
+ *
+ *   + #CORPUS_DATATYPE_TEXT: the JSON strings (quotes included),
+ *     concatenated into a blob, with their offsets, along with bitmaps
+ *     telling which ones have backslash escapes and non-ASCII
+ *     characters;
+ *
+ *   + #CORPUS_DATATYPE_ANY: the JSON values, for fields with other
+ *     types, stored in the same way as text.
+ *
+ * Numbers get stored in little-endian byte order.
+ */
+struct corpus_colfile_column {
+	struct utf8lite_text name; /**< the field name */
+	int type;		/**< the column type, a #corpus_datatype_kind
+				  value */
+	const uint8_t *nulls;	/**< the null bitmap, with a bit set for
+				  each row where the field is null or
+				  missing */
+	const uint8_t *values;	/**< the values, or for text and JSON, the
+				  value offsets */
+	const uint8_t *esc;	/**< for text, the escape bitmap */
+	const uint8_t *utf8;	/**< for text, the non-ASCII bitmap */
+	const uint8_t *blob;	/**< for text and JSON, the value bytes */
+};
+
+/**
+ * Column file, holding the top-level record fields from a data file.
+ * The file gets memory-mapped; reading a value does not copy or parse
+ * it.
+ */
+struct corpus_colfile {
+	struct corpus_filebuf buf;	/**< the memory-mapped column file */
+	uint64_t nrow;			/**< the number of rows (lines) */
+	struct corpus_colfile_column *columns; /**< the columns */
+	int ncolumn;			/**< the number of columns */
+};
+
+/**
+ * Compile a data file into a column file, stored next to it. This
+ * determines the schema of the file in a first pass, and then copies
+ * the top-level record fields into columns in a second pass. The
+ * columns get built in memory before being written out. Like a line
+ * index, the column file records the data file size and modification
+ * time, so that later loads can detect when it is stale.
+ *
+ * \param file_name the data file name
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the data file is
+ * 	standard input, or if its lines are not all records (or null)
+ */
+int corpus_colfile_write(const char *file_name);
+
+/**
+ * Open the column file for a data file.
+ *
+ * \param cf the column file
+ * \param file_name the data file name
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL (without logging an error)
+ * 	if the column file is missing, stale, or malformed
+ */
+int corpus_colfile_init(struct corpus_colfile *cf, const char *file_name);
+
+/**
+ * Release a column file's resources.
+ *
+ * \param cf the column file
+ */
+void corpus_colfile_destroy(struct corpus_colfile *cf);
+
+/**
+ * Find a column by its field name.
+ *
+ * \param cf the column file
+ * \param name the field name
+ *
+ * \returns the column index, or -1 if no column has the given name
+ */
+int corpus_colfile_column(const struct corpus_colfile *cf,
+			  const struct utf8lite_text *name);
+
+/**
+ * Test whether a value in a column file is null or missing.
+ *
+ * \param cf the column file
+ * \param col the column index
+ * \param row the row number, starting from 0
+ *
+ * \returns nonzero if the value is null, zero otherwise
+ */
+int corpus_colfile_is_null(const struct corpus_colfile *cf, int col,
+			   uint64_t row);
+
+/**
+ * Get a boolean value from a column file.
+ *
+ * \param cf the column file
+ * \param col the column index
+ * \param row the row number, starting from 0
+ * \param valptr if non-NULL, a location to store the value
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the column type is not
+ * 	boolean or the value is null
+ */
+int corpus_colfile_bool(const struct corpus_colfile *cf, int col,
+			uint64_t row, int *valptr);
+
+/**
+ * Get an integer value from a column file. As with #corpus_data_int,
+ * values outside the range of an `int` get clamped.
+ *
+ * \param cf the column file
+ * \param col the column index
+ * \param row the row number, starting from 0
+ * \param valptr if non-NULL, a location to store the value
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the column type is not
+ * 	integer or the value is null, #CORPUS_ERROR_RANGE if the value
+ * 	is out of range
+ */
+int corpus_colfile_int(const struct corpus_colfile *cf, int col,
+		       uint64_t row, int *valptr);
+
+/**
+ * Get a numeric value from a column file, as a double.
+ *
+ * \param cf the column file
+ * \param col the column index
+ * \param row the row number, starting from 0
+ * \param valptr if non-NULL, a location to store the value
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the column type is not
+ * 	integer or real, or the value is null
+ */
+int corpus_colfile_double(const struct corpus_colfile *cf, int col,
+			  uint64_t row, double *valptr);
+
+/**
+ * Get a text value from a column file. The text points into the
+ * memory-mapped file, and carries the escape and non-ASCII flags found
+ * when the file was compiled.
+ *
+ * \param cf the column file
+ * \param col the column index
+ * \param row the row number, starting from 0
+ * \param valptr if non-NULL, a location to store the value
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the column type is not
+ * 	text or the value is null
+ */
+int corpus_colfile_text(const struct corpus_colfile *cf, int col,
+			uint64_t row, struct utf8lite_text *valptr);
+
+/**
+ * Get a value from a column file as a data value. Text and boolean values
+ * get filled in directly; JSON values get scanned to determine their
+ * types. Numeric columns do not store their JSON representations; use
+ * #corpus_colfile_int or #corpus_colfile_double for these.
+ *
+ * \param cf the column file
+ * \param s the schema for the data value types
+ * \param col the column index
+ * \param row the row number, starting from 0
+ * \param valptr on exit, the value; null if the value is null or
+ * 	missing
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the column type is
+ * 	numeric
+ */
+int corpus_colfile_data(const struct corpus_colfile *cf,
+			struct corpus_schema *s, int col, uint64_t row,
+			struct corpus_data *valptr);
+
+#endif /* CORPUS_COLFILE_H */
@@ -17,39 +17,63 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../lib/utf8lite/src/utf8lite.h"
+#include "array.h"
 #include "error.h"
+#include "memory.h"
 #include "table.h"
 #include "textset.h"
 #include "stem.h"
 #include "symtab.h"
 #include "datatype.h"
 #include "data.h"
+#include "jsonscan.h"
 
 double corpus_strntod(const char *string, size_t maxlen, const char **endPtr);
 intmax_t corpus_strntoimax(const char *string, size_t maxlen, char **endptr);
 
-static void scan_value(const uint8_t **bufptr);
+// exact fast paths for the common numbers, falling back to strntoimax
+// and strntod for the rest
+static int parse_int(const uint8_t *ptr, const uint8_t *end,
+		     intmax_t *valptr);
+static int parse_double(const uint8_t *ptr, const uint8_t *end,
+			double *valptr);
+static const uint8_t *scan_digits(const uint8_t *ptr, const uint8_t *end,
+				  uint64_t *valptr, int *ndigitptr);
+
+static void scan_value(const uint8_t **bufptr, const uint8_t *end,
+		       int *text_attrptr);
+static int text_attr(const struct utf8lite_text *text);
 static void scan_numeric(const uint8_t **bufptr);
-static void scan_text(const uint8_t **bufptr);
 static void scan_spaces(const uint8_t **bufptr);
 static void scan_spaces_safe(const uint8_t **bufptr, const uint8_t *end);
+static int scan_value_safe(const uint8_t **bufptr, const uint8_t *end);
+static int scan_text_safe(const uint8_t **bufptr, const uint8_t *end,
+			  int *flagsptr);
 
 
 int corpus_data_assign(struct corpus_data *d, struct corpus_schema *s,
 		       const uint8_t *ptr, size_t size)
 {
+	struct utf8lite_text text;
 	const uint8_t *end = ptr + size;
-	int err, id;
+	int err, id, attr = CORPUS_DATA_TEXT_UNKNOWN;
 
 	scan_spaces_safe(&ptr, end);
 
-	if ((err = corpus_schema_scan(s, ptr, (size_t)(end - ptr), &id))) {
+	if ((err = corpus_schema_scan_text(s, ptr, (size_t)(end - ptr), &id,
+					   &text))) {
 		goto error;
 	}
+	if (id == CORPUS_DATATYPE_TEXT) {
+		attr = text_attr(&text);
+	}
 	goto out;
 
 error:
@@ -57,8 +81,9 @@ error:
 	size = 0;
 out:
 	d->ptr = ptr;
-	d->size = size;
+	d->size = ptr ? (size_t)(end - ptr) : 0;
 	d->type_id = id;
+	d->text_attr = attr;
 	return err;
 }
 
@@ -97,7 +122,9 @@ int corpus_data_int(const struct corpus_data *d, int *valptr)
 	}
 
 	errno = 0;
-	lval = corpus_strntoimax((const char *)d->ptr, d->size, NULL);
+	if (!parse_int(d->ptr, d->ptr + d->size, &lval)) {
+		lval = corpus_strntoimax((const char *)d->ptr, d->size, NULL);
+	}
 	if (errno == ERANGE) {
 		val = lval > 0 ? INT_MAX : INT_MIN;
 		err = CORPUS_ERROR_RANGE;
@@ -140,6 +167,11 @@ int corpus_data_double(const struct corpus_data *d, double *valptr)
 		goto nullval;
 	}
 
+	if (parse_double(d->ptr, d->ptr + d->size, &val)) {
+		err = 0;
+		goto out;
+	}
+
 	errno = 0;
 	val = corpus_strntod((const char *)d->ptr, d->size,
 			     (const char **)&ptr);
@@ -209,6 +241,21 @@ int corpus_data_text(const struct corpus_data *d, struct utf8lite_text *valptr)
 		end--;
 	}
 
+	// skip the second pass over the text if the scan found its
+	// attributes
+	if (d->text_attr & CORPUS_DATA_TEXT_KNOWN) {
+		val.ptr = (uint8_t *)ptr;
+		val.attr = (size_t)(end - ptr);
+		if (d->text_attr & CORPUS_DATA_TEXT_ESC) {
+			val.attr |= UTF8LITE_TEXT_ESC_BIT;
+		}
+		if (d->text_attr & CORPUS_DATA_TEXT_UTF8) {
+			val.attr |= UTF8LITE_TEXT_UTF8_BIT;
+		}
+		err = 0;
+		goto out;
+	}
+
 	err = utf8lite_text_assign(&val, ptr, (size_t)(end - ptr),
 			UTF8LITE_TEXT_VALID | UTF8LITE_TEXT_UNESCAPE, NULL);
 	goto out;
@@ -229,7 +276,7 @@ out:
 
 static void corpus_data_items_make(struct corpus_data_items *it,
 				   const struct corpus_schema *s,
-				   const uint8_t *ptr,
+				   const uint8_t *ptr, const uint8_t *end,
 				   const struct corpus_datatype_array *type)
 {
 	it->schema = s;
@@ -241,20 +288,23 @@ static void corpus_data_items_make(struct corpus_data_items *it,
 	}
 	it->length = type->length;
 	it->ptr = ptr;
+	it->end = end;
 	corpus_data_items_reset(it);
 }
 
 
 static void corpus_data_fields_make(struct corpus_data_fields *it,
 				    const struct corpus_schema *s,
-				    const uint8_t *ptr,
+				    const uint8_t *ptr, const uint8_t *end,
 				    const struct corpus_datatype_record *type)
 {
 	it->schema = s;
 	it->field_types = type->type_ids;
 	it->field_names = type->name_ids;
 	it->nfield = type->nfield;
+	it->record = type;
 	it->ptr = ptr;
+	it->end = end;
 	corpus_data_fields_reset(it);
 }
 
@@ -265,15 +315,18 @@ void corpus_data_items_reset(struct corpus_data_items *it)
 	it->current.ptr = NULL;
 	it->current.size = 0;
 	it->current.type_id = CORPUS_DATATYPE_NULL;
+	it->current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 }
 
 
 void corpus_data_fields_reset(struct corpus_data_fields *it)
 {
 	it->name_id = -1;
+	it->index = -1;
 	it->current.ptr = NULL;
 	it->current.size = 0;
 	it->current.type_id = CORPUS_DATATYPE_NULL;
+	it->current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 }
 
 
@@ -281,6 +334,7 @@ int corpus_data_items_advance(struct corpus_data_items *it)
 {
 	const uint8_t *ptr;
 	const uint8_t *end;
+	int attr;
 
 	if (it->index == -1) {
 		ptr = it->ptr;
@@ -307,7 +361,7 @@ int corpus_data_items_advance(struct corpus_data_items *it)
 		scan_spaces(&ptr);
 	}
 	end = ptr;
-	scan_value(&end);
+	scan_value(&end, it->end, &attr);
 
 	if (it->item_type == CORPUS_DATATYPE_ANY) {
 		// the call to data_assign won't fail because we already
@@ -320,6 +374,7 @@ int corpus_data_items_advance(struct corpus_data_items *it)
 		it->current.ptr = ptr;
 		it->current.size = (size_t)(end - ptr);
 		it->current.type_id = it->item_type;
+		it->current.text_attr = attr;
 	}
 	it->index++;
 	return 1;
@@ -328,6 +383,7 @@ end:
 	it->current.ptr = ptr;
 	it->current.size = 0;
 	it->current.type_id = CORPUS_DATATYPE_NULL;
+	it->current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 	return 0;
 }
 
@@ -350,13 +406,114 @@ static int compare_int(const void *x1, const void *x2)
 }
 
 
+/*
+ * Determine whether a raw field name (without the surrounding quotes) is
+ * exactly the schema's text for a name ID. A match is conclusive; a
+ * mismatch is not, since the raw name might have escapes or need
+ * normalization.
+ */
+static int data_name_match(const struct corpus_schema *s, int name_id,
+			   const uint8_t *ptr, size_t size, int has_esc)
+{
+	const struct utf8lite_text *text = &s->names.types[name_id].text;
+
+	return (!has_esc && size == UTF8LITE_TEXT_SIZE(text)
+		&& memcmp(ptr, text->ptr, size) == 0);
+}
+
+
+/*
+ * Remember the input position where we found a record field, to predict
+ * where it will be in the next record of the same type. Records of a
+ * supertype might have fewer fields than the type, never more.
+ */
+static void data_record_found(const struct corpus_datatype_record *rec,
+			      int field, int pos)
+{
+	if (pos < rec->nfield) {
+		rec->last_pos[field] = pos;
+		rec->last_field[pos] = field;
+	}
+}
+
+
+/*
+ * Look for a record field at the input position where we last found it,
+ * skipping over the fields before it without decoding their names. On
+ * success, return the start of the field value; otherwise, return NULL.
+ */
+static const uint8_t *data_field_predict(const struct corpus_schema *s,
+					 const struct corpus_datatype_record
+					 	*rec,
+					 int field, const uint8_t *ptr,
+					 const uint8_t *end)
+{
+	const uint8_t *begin;
+	int has_esc, i, pos = rec->last_pos[field];
+
+	// {
+	ptr++;
+
+	// ws
+	scan_spaces(&ptr);
+
+	if (*ptr == '}') {
+		return NULL;
+	}
+
+	for (i = 0; i < pos; i++) {
+		// "name"
+		ptr = corpus_json_scan_text(ptr + 1, end, &has_esc) + 1;
+
+		// ws : ws
+		scan_spaces(&ptr);
+		ptr++;
+		scan_spaces(&ptr);
+
+		// value
+		scan_value(&ptr, end, NULL);
+
+		// ws
+		scan_spaces(&ptr);
+
+		if (*ptr == '}') {
+			return NULL;
+		}
+
+		// , ws
+		ptr++;
+		scan_spaces(&ptr);
+	}
+
+	// "
+	ptr++;
+
+	// name
+	begin = ptr;
+	ptr = corpus_json_scan_text(ptr, end, &has_esc);
+	if (!data_name_match(s, rec->name_ids[field], begin,
+			     (size_t)(ptr - begin), has_esc)) {
+		return NULL;
+	}
+
+	// " ws : ws
+	ptr++;
+	scan_spaces(&ptr);
+	ptr++;
+	scan_spaces(&ptr);
+
+	return ptr;
+}
+
+
 int corpus_data_fields_advance(struct corpus_data_fields *it)
 {
+	const struct corpus_datatype_record *rec = it->record;
 	struct utf8lite_text name;
 	const uint8_t *begin;
 	const uint8_t *ptr;
 	const uint8_t *end;
-	int flags, name_id, type_id;
+	int attr, field, flags, has_esc, name_id, type_id;
 	int *idptr;
 
 	if (it->name_id == -1) {
@@ -378,28 +535,44 @@ int corpus_data_fields_advance(struct corpus_data_fields *it)
 		scan_spaces(&ptr);
 	}
 
+	it->index++;
+
 	// "
 	ptr++;
 
 	// name
 	begin = ptr;
-	flags = 0;
-	while (*ptr != '"') {
-		if (*ptr == '\\') {
-			flags = UTF8LITE_TEXT_UNESCAPE;
-			ptr++;
+	ptr = corpus_json_scan_text(ptr, it->end, &has_esc);
+
+	// try the field found at this position in the last record
+	field = -1;
+	if (it->index < it->nfield) {
+		field = rec->last_field[it->index];
+		if (!data_name_match(it->schema, it->field_names[field],
+				     begin, (size_t)(ptr - begin), has_esc)) {
+			field = -1;
 		}
-		ptr++;
 	}
-	utf8lite_text_assign(&name, begin, (size_t)(ptr - begin),
-			     flags | UTF8LITE_TEXT_VALID, NULL);
 
-	// the call to schema_name always succeeds and does not
-	// create a new name, because the field name already
-	// exists as part of the type
-	corpus_schema_name((struct corpus_schema *)it->schema, &name,
-			   &name_id);
-	it->name_id = name_id;
+	if (field < 0) {
+		flags = has_esc ? UTF8LITE_TEXT_UNESCAPE : 0;
+		utf8lite_text_assign(&name, begin, (size_t)(ptr - begin),
+				     flags | UTF8LITE_TEXT_VALID, NULL);
+
+		// the call to schema_name always succeeds and does not
+		// create a new name, because the field name already
+		// exists as part of the type
+		corpus_schema_name((struct corpus_schema *)it->schema, &name,
+				   &name_id);
+
+		idptr = bsearch(&name_id, it->field_names, (size_t)it->nfield,
+				sizeof(*it->field_names), compare_int);
+		assert(idptr); // name exists in the record
+		field = (int)(idptr - it->field_names);
+		data_record_found(rec, field, it->index);
+	}
+	it->name_id = it->field_names[field];
+	type_id = it->field_types[field];
 
 	// "
 	ptr++;
@@ -414,12 +587,7 @@ int corpus_data_fields_advance(struct corpus_data_fields *it)
 	scan_spaces(&ptr);
 
 	end = ptr;
-	scan_value(&end);
-
-	idptr = bsearch(&name_id, it->field_names, (size_t)it->nfield,
-			sizeof(*it->field_names), compare_int);
-	assert(idptr); // name exists in the record
-	type_id = it->field_types[idptr - it->field_names];
+	scan_value(&end, it->end, &attr);
 
 	if (type_id == CORPUS_DATATYPE_ANY) {
 		// this won't fail, because we already have enough
@@ -431,6 +599,7 @@ int corpus_data_fields_advance(struct corpus_data_fields *it)
 		it->current.ptr = ptr;
 		it->current.size = (size_t)(end - ptr);
 		it->current.type_id = type_id;
+		it->current.text_attr = attr;
 	}
 	return 1;
 
@@ -438,6 +607,7 @@ end:
 	it->current.ptr = ptr;
 	it->current.size = 0;
 	it->current.type_id = CORPUS_DATATYPE_NULL;
+	it->current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 	return 0;
 }
 
@@ -458,7 +628,8 @@ int corpus_data_items(const struct corpus_data *d,
 
 	scan_spaces(&ptr);
 
-	corpus_data_items_make(&it, s, ptr, &s->types[d->type_id].meta.array);
+	corpus_data_items_make(&it, s, ptr, d->ptr + d->size,
+			       &s->types[d->type_id].meta.array);
 	err = 0;
 	goto out;
 
@@ -467,9 +638,11 @@ nullval:
 	it.item_type = CORPUS_DATATYPE_NULL;
 	it.length = -1;
 	it.ptr = NULL;
+	it.end = NULL;
 	it.current.ptr = NULL;
 	it.current.size = 0;
 	it.current.type_id = CORPUS_DATATYPE_NULL;
+	it.current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 	it.index = -1;
 	err = CORPUS_ERROR_INVAL;
 out:
@@ -484,6 +657,7 @@ int corpus_data_nitem(const struct corpus_data *d,
 		      const struct corpus_schema *s, int *nitemptr)
 {
 	struct corpus_data_items it;
+	const uint8_t *ptr;
 	int err, nitem;
 
 	if (d->type_id < 0
@@ -495,10 +669,19 @@ int corpus_data_nitem(const struct corpus_data *d,
 	nitem = s->types[d->type_id].meta.array.length;
 
 	if (nitem < 0) {
+		// count the items without determining their types
 		nitem = 0;
 		corpus_data_items(d, s, &it);
-		while (corpus_data_items_advance(&it)) {
+		ptr = it.ptr + 1; // opening ([)
+		scan_spaces(&ptr);
+		while (*ptr != ']') {
+			scan_value(&ptr, it.end, NULL);
 			nitem++;
+			scan_spaces(&ptr);
+			if (*ptr == ',') {
+				ptr++;
+				scan_spaces(&ptr);
+			}
 		}
 	}
 	err = 0;
@@ -515,6 +698,91 @@ out:
 }
 
 
+void corpus_data_array_init(struct corpus_data_array *arr)
+{
+	arr->schema = NULL;
+	arr->item_type = CORPUS_DATATYPE_NULL;
+	arr->ptr = NULL;
+	arr->items = NULL;
+	arr->length = 0;
+	arr->length_max = 0;
+}
+
+
+void corpus_data_array_destroy(struct corpus_data_array *arr)
+{
+	corpus_free(arr->items);
+}
+
+
+int corpus_data_array_assign(struct corpus_data_array *arr,
+			     const struct corpus_data *d,
+			     const struct corpus_schema *s)
+{
+	struct corpus_data_items it;
+	void *base;
+	int err, n, size;
+
+	arr->length = 0;
+
+	if ((err = corpus_data_items(d, s, &it))) {
+		arr->schema = NULL;
+		arr->item_type = CORPUS_DATATYPE_NULL;
+		arr->ptr = NULL;
+		return err;
+	}
+
+	arr->schema = s;
+	arr->item_type = it.item_type;
+	arr->ptr = it.ptr;
+
+	n = 0;
+	while (corpus_data_items_advance(&it)) {
+		if (n == arr->length_max) {
+			base = arr->items;
+			size = arr->length_max;
+			if ((err = corpus_array_grow(&base, &size,
+						     sizeof(*arr->items),
+						     n, 1))) {
+				corpus_log(err, "failed allocating array"
+					   " view items");
+				return err;
+			}
+			arr->items = base;
+			arr->length_max = size;
+		}
+		arr->items[n++] = it.current;
+	}
+	arr->length = n;
+
+	return 0;
+}
+
+
+int corpus_data_array_item(const struct corpus_data_array *arr, int i,
+			   struct corpus_data *valptr)
+{
+	struct corpus_data val;
+	int err;
+
+	if (i < 0 || i >= arr->length) {
+		val.ptr = NULL;
+		val.size = 0;
+		val.type_id = CORPUS_DATATYPE_NULL;
+		val.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
+		err = CORPUS_ERROR_INVAL;
+	} else {
+		val = arr->items[i];
+		err = 0;
+	}
+
+	if (valptr) {
+		*valptr = val;
+	}
+	return err;
+}
+
+
 int corpus_data_nfield(const struct corpus_data *d,
 		       const struct corpus_schema *s, int *nfieldptr)
 {
@@ -567,7 +835,8 @@ int corpus_data_fields(const struct corpus_data *d,
 
 	scan_spaces(&ptr);
 
-	corpus_data_fields_make(&it, s, ptr, &s->types[d->type_id].meta.record);
+	corpus_data_fields_make(&it, s, ptr, d->ptr + d->size,
+				&s->types[d->type_id].meta.record);
 	err = 0;
 	goto out;
 
@@ -576,11 +845,15 @@ nullval:
 	it.field_types = NULL;
 	it.field_names = NULL;
 	it.nfield = 0;
+	it.record = NULL;
 	it.ptr = NULL;
+	it.end = NULL;
 	it.current.ptr = NULL;
 	it.current.size = 0;
 	it.current.type_id = CORPUS_DATATYPE_NULL;
+	it.current.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 	it.name_id = -1;
+	it.index = -1;
 	err = CORPUS_ERROR_INVAL;
 out:
 	if (valptr) {
@@ -599,9 +872,10 @@ int corpus_data_field(const struct corpus_data *d,
 	struct corpus_data val;
 	const uint8_t *begin;
 	const uint8_t *ptr = d->ptr;
+	const uint8_t *end = d->ptr + d->size;
 	const int *idptr;
 	struct utf8lite_text name;
-	int err, flags, id, type_id;
+	int err, field, flags, has_esc, id, pos, type_id;
 
 	if (d->type_id < 0
 		|| s->types[d->type_id].kind != CORPUS_DATATYPE_RECORD
@@ -615,7 +889,14 @@ int corpus_data_field(const struct corpus_data *d,
 	if (idptr == NULL) {
 		goto nullval;
 	}
-	type_id = rec->type_ids[idptr - rec->name_ids];
+	field = (int)(idptr - rec->name_ids);
+	type_id = rec->type_ids[field];
+
+	// look where we found the field last time
+	if ((begin = data_field_predict(s, rec, field, ptr, end))) {
+		ptr = begin;
+		goto found;
+	}
 
 	// {
 	ptr++;
@@ -627,20 +908,14 @@ int corpus_data_field(const struct corpus_data *d,
 		goto nullval;
 	}
 
-	while (1) {
+	for (pos = 0; ; pos++) {
 		// "
 		ptr++;
 
 		// name
 		begin = ptr;
-		flags = 0;
-		while (*ptr != '"') {
-			if (*ptr == '\\') {
-				flags = UTF8LITE_TEXT_UNESCAPE;
-				ptr++;
-			}
-			ptr++;
-		}
+		ptr = corpus_json_scan_text(ptr, end, &has_esc);
+		flags = has_esc ? UTF8LITE_TEXT_UNESCAPE : 0;
 		utf8lite_text_assign(&name, begin, (size_t)(ptr - begin),
 				flags | UTF8LITE_TEXT_VALID, NULL);
 
@@ -662,11 +937,12 @@ int corpus_data_field(const struct corpus_data *d,
 		scan_spaces(&ptr);
 
 		if (id == name_id) {
+			data_record_found(rec, field, pos);
 			goto found;
 		}
 
 		// value
-		scan_value(&ptr);
+		scan_value(&ptr, end, NULL);
 
 		// ws
 		scan_spaces(&ptr);
@@ -683,7 +959,7 @@ int corpus_data_field(const struct corpus_data *d,
 	}
 found:
 	val.ptr = ptr;
-	scan_value(&ptr);
+	scan_value(&ptr, end, &val.text_attr);
 	val.size = (size_t)(ptr - val.ptr);
 	val.type_id = type_id;
 	err = 0;
@@ -693,6 +969,7 @@ nullval:
 	val.ptr = NULL;
 	val.size = 0;
 	val.type_id = CORPUS_DATATYPE_NULL;
+	val.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
 	err = CORPUS_ERROR_INVAL;
 out:
 	if (valptr) {
@@ -702,135 +979,1040 @@ out:
 }
 
 
-void scan_value(const uint8_t **bufptr)
+int corpus_data_accessor_init(struct corpus_data_accessor *a,
+			      struct corpus_schema *s,
+			      const struct utf8lite_text *name)
 {
-	const uint8_t *ptr = *bufptr;
-	uint_fast8_t ch;
-	int depth;
-
-	ch = *ptr++;
-	switch (ch) {
-	case 'n':
-		ptr += 3; // ull
-		break;
-
-	case 'f':
-		ptr += 4; // alse
-		break;
+	const struct utf8lite_text *text;
+	int err;
 
-	case 't':
-		ptr += 3; // rue
-		break;
+	if ((err = corpus_schema_name(s, name, &a->name_id))) {
+		corpus_log(err, "failed initializing record field accessor");
+		return err;
+	}
 
-	case '"':
-		scan_text(&ptr);
-		break;
+	text = &s->names.types[a->name_id].text;
+	a->name_size = UTF8LITE_TEXT_SIZE(text);
+	a->name_ascii = (UTF8LITE_TEXT_IS_ASCII(text)
+			 && !UTF8LITE_TEXT_HAS_ESC(text)) ? 1 : 0;
+	return 0;
+}
 
-	case '[':
-		depth = 1;
-		while (depth > 0) {
-			ch = *ptr++;
-			switch (ch) {
-			case '[':
-				depth++;
-				break;
-			case ']':
-				depth--;
-				break;
-			case '"':
-				scan_text(&ptr);
-				break;
-			default:
-				break;
-			}
-		}
-		break;
 
-	case '{':
-		depth = 1;
-		while (depth > 0) {
-			ch = *ptr++;
-			switch (ch) {
-			case '{':
-				depth++;
-				break;
-			case '}':
-				depth--;
-				break;
-			case '"':
-				scan_text(&ptr);
-				break;
-			default:
-				break;
-			}
-		}
-		break;
+/*
+ * Determine whether a raw field name (without the surrounding quotes)
+ * matches the accessor's name. Most names are plain ASCII, and we can
+ * compare them bytewise against the name in the schema; for the rest,
+ * we defer to the schema, which handles escapes and normalization.
+ */
+static int data_accessor_match(const struct corpus_data_accessor *a,
+			       struct corpus_schema *s, const uint8_t *ptr,
+			       size_t size, int flags, int *matchptr)
+{
+	const struct utf8lite_text *text;
+	struct utf8lite_text name;
+	int err, id;
 
-	default:
-		ptr--;
-		scan_numeric(&ptr);
-		break;
+	if (a->name_ascii && !flags) {
+		text = &s->names.types[a->name_id].text;
+		*matchptr = (size == a->name_size
+			     && memcmp(ptr, text->ptr, size) == 0);
+		return 0;
 	}
 
-	*bufptr = ptr;
+	if ((err = utf8lite_text_assign(&name, ptr, size, flags, NULL))) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "invalid field name in record");
+		return err;
+	}
+	if ((err = corpus_schema_name(s, &name, &id))) {
+		return err;
+	}
+	*matchptr = (id == a->name_id);
+	return 0;
 }
 
 
-void scan_numeric(const uint8_t **bufptr)
+int corpus_data_access(const struct corpus_data_accessor *a,
+		       struct corpus_schema *s, const uint8_t *ptr,
+		       size_t size, struct corpus_data *valptr)
 {
-	const uint8_t *ptr = *bufptr;
+	const uint8_t *input = ptr;
+	const uint8_t *end = ptr + size;
+	const uint8_t *begin;
+	struct utf8lite_text text;
+	struct corpus_data val;
+	int err, flags, match;
 
-	// leading sign
-	if (*ptr == '-' || *ptr == '+') {
-		ptr++;
+	scan_spaces_safe(&ptr, end);
+
+	// not a record
+	if (ptr == end || *ptr != '{') {
+		goto nullval;
 	}
 
-	if (isdigit(*ptr) || *ptr == '.') {
-		while (isdigit(*ptr)) {
-			ptr++;
-		}
-		if (*ptr == '.') {
-			ptr++;
+	// {
+	ptr++;
+	scan_spaces_safe(&ptr, end);
+	if (ptr != end && *ptr == '}') {
+		goto nullval;
+	}
+
+	while (1) {
+		// "name"
+		if (ptr == end || *ptr != '"') {
+			goto error_inval_noname;
 		}
-		while (isdigit(*ptr)) {
-			ptr++;
+		ptr++;
+		begin = ptr;
+		if ((err = scan_text_safe(&ptr, end, &flags))) {
+			goto error;
 		}
-		if (*ptr == 'e' || *ptr == 'E') {
-			ptr++;
-			if (*ptr == '-' || *ptr == '+') {
-				ptr++;
-			}
-			while (isdigit(*ptr)) {
-				ptr++;
-			}
+		if ((err = data_accessor_match(a, s, begin,
+					       (size_t)(ptr - 1 - begin),
+					       flags, &match))) {
+			goto error;
 		}
-	} else if (*ptr == 'I') {
-		ptr += 8; // Infinity
-	} else {
-		ptr += 3; // NaN
-	}
-
-	*bufptr = ptr;
-}
 
+		// :
+		scan_spaces_safe(&ptr, end);
+		if (ptr == end || *ptr != ':') {
+			goto error_inval_nocolon;
+		}
+		ptr++;
+		scan_spaces_safe(&ptr, end);
 
-void scan_text(const uint8_t **bufptr)
-{
-	const uint8_t *ptr = *bufptr;
+		// value
+		begin = ptr;
+		if ((err = scan_value_safe(&ptr, end))) {
+			goto error;
+		}
+		if (match) {
+			goto found;
+		}
 
-	while (*ptr != '"') {
-		if (*ptr == '\\') {
-			ptr++;
+		// , or }
+		scan_spaces_safe(&ptr, end);
+		if (ptr == end) {
+			goto error_inval_noclose;
+		} else if (*ptr == '}') {
+			goto nullval;
+		} else if (*ptr != ',') {
+			goto error_inval_nocomma;
 		}
 		ptr++;
+		scan_spaces_safe(&ptr, end);
 	}
-	ptr++; // trailing "
 
-	*bufptr = ptr;
-}
+found:
+	val.ptr = begin;
+	val.size = (size_t)(ptr - begin);
+	if ((err = corpus_schema_scan_text(s, val.ptr, val.size,
+					   &val.type_id, &text))) {
+		goto error;
+	}
+	val.text_attr = (val.type_id == CORPUS_DATATYPE_TEXT
+			 ? text_attr(&text) : CORPUS_DATA_TEXT_UNKNOWN);
+	goto out;
 
+nullval:
+	val.ptr = NULL;
+	val.size = 0;
+	val.type_id = CORPUS_DATATYPE_NULL;
+	val.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
+	err = 0;
+	goto out;
 
-void scan_spaces(const uint8_t **bufptr)
+error_inval_noname:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "missing field name in record");
+	goto error;
+
+error_inval_nocolon:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "missing colon after field name in record");
+	goto error;
+
+error_inval_noclose:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "no closing bracket (}) at end of record");
+	goto error;
+
+error_inval_nocomma:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "missing comma (,) in record");
+	goto error;
+
+error:
+	corpus_log(err, "failed parsing value (%.*s)", (unsigned)size, input);
+	val.ptr = NULL;
+	val.size = 0;
+	val.type_id = -1;
+	val.text_attr = CORPUS_DATA_TEXT_UNKNOWN;
+
+out:
+	*valptr = val;
+	return err;
+}
+
+
+int corpus_data_projection_init(struct corpus_data_projection *p)
+{
+	struct corpus_data_step *root;
+	int err;
+
+	if (!(p->steps = corpus_malloc(sizeof(*p->steps)))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed initializing projection");
+		return err;
+	}
+	p->nstep = 1;
+	p->nstep_max = 1;
+
+	root = &p->steps[0];
+	root->type = CORPUS_DATA_STEP_ROOT;
+	root->field.name_id = -1;
+	root->field.name_size = 0;
+	root->field.name_ascii = 0;
+	root->index = -1;
+	root->path_id = -1;
+	root->child = -1;
+	root->sibling = -1;
+
+	p->path_multi = NULL;
+	p->npath = 0;
+	p->npath_max = 0;
+	p->matches = NULL;
+	p->nmatch = 0;
+	p->nmatch_max = 0;
+	return 0;
+}
+
+
+void corpus_data_projection_destroy(struct corpus_data_projection *p)
+{
+	corpus_free(p->matches);
+	corpus_free(p->path_multi);
+	corpus_free(p->steps);
+}
+
+
+/*
+ * Find the child of a step with the given type, name, and index, adding
+ * it if it does not exist.
+ */
+static int data_projection_step(struct corpus_data_projection *p,
+				struct corpus_schema *s, int parent_id,
+				int type, const struct utf8lite_text *name,
+				int index, int *idptr)
+{
+	struct corpus_data_step *step;
+	void *base;
+	int err, id, name_id = -1, size;
+
+	if (name) {
+		if ((err = corpus_schema_name(s, name, &name_id))) {
+			return err;
+		}
+	}
+
+	for (id = p->steps[parent_id].child; id >= 0;
+			id = p->steps[id].sibling) {
+		step = &p->steps[id];
+		if (step->type == type && step->index == index
+				&& (!name || step->field.name_id == name_id)) {
+			*idptr = id;
+			return 0;
+		}
+	}
+
+	if (p->nstep == p->nstep_max) {
+		base = p->steps;
+		size = p->nstep_max;
+		if ((err = corpus_array_grow(&base, &size, sizeof(*p->steps),
+					     p->nstep, 1))) {
+			corpus_log(err, "failed allocating projection steps");
+			return err;
+		}
+		p->steps = base;
+		p->nstep_max = size;
+	}
+
+	id = p->nstep;
+	step = &p->steps[id];
+	step->type = type;
+	if (name) {
+		if ((err = corpus_data_accessor_init(&step->field, s, name))) {
+			return err;
+		}
+	} else {
+		step->field.name_id = -1;
+		step->field.name_size = 0;
+		step->field.name_ascii = 0;
+	}
+	step->index = index;
+	step->path_id = -1;
+	step->child = -1;
+	step->sibling = p->steps[parent_id].child;
+	p->steps[parent_id].child = id;
+	p->nstep++;
+
+	*idptr = id;
+	return 0;
+}
+
+
+int corpus_data_projection_add(struct corpus_data_projection *p,
+			       struct corpus_schema *s,
+			       const struct utf8lite_text *path, int *idptr)
+{
+	struct utf8lite_text name;
+	const uint8_t *ptr = path->ptr;
+	const uint8_t *end = ptr + UTF8LITE_TEXT_SIZE(path);
+	const uint8_t *begin;
+	void *base;
+	int err, id = 0, index, multi = 0, size;
+
+	if (ptr == end) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "empty field path");
+		goto error;
+	}
+
+	while (ptr != end) {
+		if (*ptr == '[') {
+			ptr++;
+			if (ptr != end && *ptr == '*') {
+				ptr++;
+				index = -1;
+				multi = 1;
+			} else if (ptr != end && isdigit(*ptr)) {
+				index = 0;
+				while (ptr != end && isdigit(*ptr)) {
+					if (index > (INT_MAX - 9) / 10) {
+						goto error_inval;
+					}
+					index = 10 * index + (*ptr - '0');
+					ptr++;
+				}
+			} else {
+				goto error_inval;
+			}
+			if (ptr == end || *ptr != ']') {
+				goto error_inval;
+			}
+			ptr++;
+
+			err = data_projection_step(p, s, id, (index < 0)
+						   ? CORPUS_DATA_STEP_ITEMS
+						   : CORPUS_DATA_STEP_ITEM,
+						   NULL, index, &id);
+			if (err) {
+				goto error;
+			}
+			continue;
+		}
+
+		// a period separates a field from the previous step
+		if (id != 0) {
+			if (*ptr != '.') {
+				goto error_inval;
+			}
+			ptr++;
+		}
+
+		if (ptr != end && *ptr == '"') {
+			ptr++;
+			begin = ptr;
+			while (ptr != end && *ptr != '"') {
+				ptr++;
+			}
+			if (ptr == end) {
+				goto error_inval;
+			}
+			size = (int)(ptr - begin);
+			ptr++;
+		} else {
+			begin = ptr;
+			while (ptr != end && *ptr != '.' && *ptr != '[') {
+				ptr++;
+			}
+			size = (int)(ptr - begin);
+			if (size == 0) {
+				goto error_inval;
+			}
+		}
+
+		if ((err = utf8lite_text_assign(&name, begin, (size_t)size, 0,
+						NULL))) {
+			goto error_inval;
+		}
+		if ((err = data_projection_step(p, s, id,
+						CORPUS_DATA_STEP_FIELD,
+						&name, -1, &id))) {
+			goto error;
+		}
+	}
+
+	if (p->steps[id].path_id < 0) {
+		if (p->npath == p->npath_max) {
+			base = p->path_multi;
+			size = p->npath_max;
+			if ((err = corpus_array_grow(&base, &size,
+						     sizeof(*p->path_multi),
+						     p->npath, 1))) {
+				goto error;
+			}
+			p->path_multi = base;
+			p->npath_max = size;
+		}
+		p->path_multi[p->npath] = multi;
+		p->steps[id].path_id = p->npath;
+		p->npath++;
+	}
+
+	if (idptr) {
+		*idptr = p->steps[id].path_id;
+	}
+	return 0;
+
+error_inval:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "invalid field path (%.*s)",
+		   (unsigned)UTF8LITE_TEXT_SIZE(path), (const char *)path->ptr);
+error:
+	corpus_log(err, "failed adding path to projection");
+	return err;
+}
+
+
+static int data_project_value(struct corpus_data_projection *p,
+			      struct corpus_schema *s, int step_id,
+			      const uint8_t *ptr, const uint8_t *end);
+
+
+/*
+ * Record a value matched by a step, and follow the step's children into
+ * the value.
+ */
+static int data_project_match(struct corpus_data_projection *p,
+			      struct corpus_schema *s, int step_id,
+			      const uint8_t *ptr, const uint8_t *end)
+{
+	struct corpus_data_match *match;
+	struct utf8lite_text text;
+	void *base;
+	int err, path_id, size;
+
+	path_id = p->steps[step_id].path_id;
+
+	if (path_id >= 0) {
+		if (p->nmatch == p->nmatch_max) {
+			base = p->matches;
+			size = p->nmatch_max;
+			if ((err = corpus_array_grow(&base, &size,
+						     sizeof(*p->matches),
+						     p->nmatch, 1))) {
+				corpus_log(err, "failed allocating matches");
+				return err;
+			}
+			p->matches = base;
+			p->nmatch_max = size;
+		}
+
+		match = &p->matches[p->nmatch];
+		match->path_id = path_id;
+		match->value.ptr = ptr;
+		match->value.size = (size_t)(end - ptr);
+		if ((err = corpus_schema_scan_text(s, ptr,
+						   (size_t)(end - ptr),
+						   &match->value.type_id,
+						   &text))) {
+			return err;
+		}
+		match->value.text_attr =
+			(match->value.type_id == CORPUS_DATATYPE_TEXT
+			 ? text_attr(&text) : CORPUS_DATA_TEXT_UNKNOWN);
+		p->nmatch++;
+	}
+
+	if (p->steps[step_id].child < 0) {
+		return 0;
+	}
+	return data_project_value(p, s, step_id, ptr, end);
+}
+
+
+static int data_project_record(struct corpus_data_projection *p,
+			       struct corpus_schema *s, int step_id,
+			       const uint8_t *ptr, const uint8_t *end)
+{
+	const struct corpus_data_step *child;
+	const uint8_t *begin, *name;
+	size_t name_size;
+	int err, flags, id, match, nleft = 0;
+
+	for (id = p->steps[step_id].child; id >= 0; id = child->sibling) {
+		child = &p->steps[id];
+		if (child->type == CORPUS_DATA_STEP_FIELD) {
+			nleft++;
+		}
+	}
+	if (nleft == 0) {
+		return 0;
+	}
+
+	// {
+	ptr++;
+	scan_spaces_safe(&ptr, end);
+	if (ptr != end && *ptr == '}') {
+		return 0;
+	}
+
+	while (1) {
+		// "name"
+		if (ptr == end || *ptr != '"') {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "missing field name in record");
+			return err;
+		}
+		ptr++;
+		name = ptr;
+		if ((err = scan_text_safe(&ptr, end, &flags))) {
+			return err;
+		}
+		name_size = (size_t)(ptr - 1 - name);
+
+		// :
+		scan_spaces_safe(&ptr, end);
+		if (ptr == end || *ptr != ':') {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "missing colon after field name"
+				   " in record");
+			return err;
+		}
+		ptr++;
+		scan_spaces_safe(&ptr, end);
+
+		// value
+		begin = ptr;
+		if ((err = scan_value_safe(&ptr, end))) {
+			return err;
+		}
+
+		for (id = p->steps[step_id].child; id >= 0;
+				id = child->sibling) {
+			child = &p->steps[id];
+			if (child->type != CORPUS_DATA_STEP_FIELD) {
+				continue;
+			}
+			if ((err = data_accessor_match(&child->field, s, name,
+						       name_size, flags,
+						       &match))) {
+				return err;
+			}
+			if (match) {
+				if ((err = data_project_match(p, s, id, begin,
+							      ptr))) {
+					return err;
+				}
+				nleft--;
+				break;
+			}
+		}
+
+		// stop once all of the fields have been found
+		if (nleft == 0) {
+			return 0;
+		}
+
+		// , or }
+		scan_spaces_safe(&ptr, end);
+		if (ptr == end) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "no closing bracket (}) at end of record");
+			return err;
+		} else if (*ptr == '}') {
+			return 0;
+		} else if (*ptr != ',') {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "missing comma (,) in record");
+			return err;
+		}
+		ptr++;
+		scan_spaces_safe(&ptr, end);
+	}
+}
+
+
+static int data_project_array(struct corpus_data_projection *p,
+			      struct corpus_schema *s, int step_id,
+			      const uint8_t *ptr, const uint8_t *end)
+{
+	const struct corpus_data_step *child;
+	const uint8_t *begin;
+	int err, id, index, index_max = -1, has_items = 0;
+
+	for (id = p->steps[step_id].child; id >= 0; id = child->sibling) {
+		child = &p->steps[id];
+		if (child->type == CORPUS_DATA_STEP_ITEMS) {
+			has_items = 1;
+		} else if (child->type == CORPUS_DATA_STEP_ITEM
+				&& child->index > index_max) {
+			index_max = child->index;
+		}
+	}
+	if (!has_items && index_max < 0) {
+		return 0;
+	}
+
+	// [
+	ptr++;
+	scan_spaces_safe(&ptr, end);
+	if (ptr != end && *ptr == ']') {
+		return 0;
+	}
+
+	for (index = 0; ; index++) {
+		// value
+		begin = ptr;
+		if ((err = scan_value_safe(&ptr, end))) {
+			return err;
+		}
+
+		for (id = p->steps[step_id].child; id >= 0;
+				id = child->sibling) {
+			child = &p->steps[id];
+			if (child->type == CORPUS_DATA_STEP_ITEMS
+					|| (child->type == CORPUS_DATA_STEP_ITEM
+						&& child->index == index)) {
+				if ((err = data_project_match(p, s, id, begin,
+							      ptr))) {
+					return err;
+				}
+			}
+		}
+
+		// stop after the last requested item
+		if (!has_items && index == index_max) {
+			return 0;
+		}
+
+		// , or ]
+		scan_spaces_safe(&ptr, end);
+		if (ptr == end) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "no closing bracket (]) at end of array");
+			return err;
+		} else if (*ptr == ']') {
+			return 0;
+		} else if (*ptr != ',') {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "missing comma (,) in array");
+			return err;
+		}
+		ptr++;
+		scan_spaces_safe(&ptr, end);
+	}
+}
+
+
+int data_project_value(struct corpus_data_projection *p,
+		       struct corpus_schema *s, int step_id,
+		       const uint8_t *ptr, const uint8_t *end)
+{
+	if (ptr == end) {
+		return 0;
+	}
+
+	switch (*ptr) {
+	case '{':
+		return data_project_record(p, s, step_id, ptr, end);
+	case '[':
+		return data_project_array(p, s, step_id, ptr, end);
+	default:
+		return 0;
+	}
+}
+
+
+int corpus_data_project(struct corpus_data_projection *p,
+			struct corpus_schema *s, const uint8_t *ptr,
+			size_t size)
+{
+	const uint8_t *input = ptr;
+	const uint8_t *end = ptr + size;
+	int err;
+
+	p->nmatch = 0;
+
+	scan_spaces_safe(&ptr, end);
+	if ((err = data_project_value(p, s, 0, ptr, end))) {
+		corpus_log(err, "failed parsing value (%.*s)", (unsigned)size,
+			   input);
+		p->nmatch = 0;
+		return err;
+	}
+
+	return 0;
+}
+
+
+int corpus_data_projection_get(const struct corpus_data_projection *p,
+			       int path_id, struct corpus_data *valptr)
+{
+	int i;
+
+	for (i = 0; i < p->nmatch; i++) {
+		if (p->matches[i].path_id == path_id) {
+			*valptr = p->matches[i].value;
+			return 1;
+		}
+	}
+
+	valptr->ptr = NULL;
+	valptr->size = 0;
+	valptr->type_id = CORPUS_DATATYPE_NULL;
+	valptr->text_attr = CORPUS_DATA_TEXT_UNKNOWN;
+	return 0;
+}
+
+
+/*
+ * Skip over a value. For text, note whether it has escapes and non-ASCII
+ * characters; we only know the latter for text without escapes, since a
+ * `\\u` escape can encode a non-ASCII character.
+ */
+void scan_value(const uint8_t **bufptr, const uint8_t *end,
+		int *text_attrptr)
+{
+	const uint8_t *ptr = *bufptr;
+	uint_fast8_t ch;
+	int attr = CORPUS_DATA_TEXT_UNKNOWN;
+	int has_esc, has_utf8;
+
+	ch = *ptr++;
+	switch (ch) {
+	case 'n':
+		ptr += 3; // ull
+		break;
+
+	case 'f':
+		ptr += 4; // alse
+		break;
+
+	case 't':
+		ptr += 3; // rue
+		break;
+
+	case '"':
+		if (text_attrptr) {
+			ptr = corpus_json_scan_text_attr(ptr, end, &has_esc,
+							 &has_utf8);
+			if (!has_esc) {
+				attr = CORPUS_DATA_TEXT_KNOWN;
+				if (has_utf8) {
+					attr |= CORPUS_DATA_TEXT_UTF8;
+				}
+			}
+		} else {
+			ptr = corpus_json_scan_text(ptr, end, NULL);
+		}
+		ptr++; // trailing "
+		break;
+
+	case '[':
+	case '{':
+		ptr = corpus_json_scan_close(ptr - 1, end);
+		break;
+
+	default:
+		ptr--;
+		scan_numeric(&ptr);
+		break;
+	}
+
+	if (text_attrptr) {
+		*text_attrptr = attr;
+	}
+	*bufptr = ptr;
+}
+
+
+/*
+ * Get the data attributes for text validated by the schema scan.
+ */
+int text_attr(const struct utf8lite_text *text)
+{
+	int attr = CORPUS_DATA_TEXT_KNOWN;
+
+	if (UTF8LITE_TEXT_HAS_ESC(text)) {
+		attr |= CORPUS_DATA_TEXT_ESC;
+	}
+	if (!UTF8LITE_TEXT_IS_ASCII(text)) {
+		attr |= CORPUS_DATA_TEXT_UTF8;
+	}
+	return attr;
+}
+
+
+/*
+ * Maximum number of decimal digits that always fit in a uint64_t.
+ */
+#define DIGITS_MAX 19
+
+/*
+ * Test for an ASCII digit, without the locale lookup in `isdigit`.
+ */
+#define IS_DIGIT(ch) ((unsigned)((ch) - '0') < 10)
+
+/*
+ * Whether floating point arithmetic on doubles rounds to double
+ * precision, which Clinger's fast path needs to be exact. This is not
+ * the case for x87 extended precision.
+ */
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0 || FLT_EVAL_METHOD == 1)
+#  define PARSE_DOUBLE_EXACT 1
+#else
+#  define PARSE_DOUBLE_EXACT 0
+#endif
+
+/*
+ * Parse an integer with at most 18 digits, which cannot overflow an
+ * intmax_t. Return zero for anything else.
+ */
+int parse_int(const uint8_t *ptr, const uint8_t *end, intmax_t *valptr)
+{
+	const uint8_t *begin;
+	uint64_t val = 0;
+	int ndigit = 0, neg = 0;
+
+	if (*ptr == '-') {
+		neg = 1;
+		ptr++;
+	} else if (*ptr == '+') {
+		ptr++;
+	}
+
+	begin = ptr;
+	ptr = scan_digits(ptr, end, &val, &ndigit);
+	if (ptr == begin || ndigit >= DIGITS_MAX) {
+		return 0;
+	}
+
+	*valptr = neg ? -(intmax_t)val : (intmax_t)val;
+	return 1;
+}
+
+
+/*
+ * Parse a number using Clinger's fast path: if the decimal significand
+ * is exactly representable as a double (at most 2^53), and so is the
+ * power of ten (at most 10^22), then one correctly-rounded
+ * multiplication or division gives the correctly-rounded result. This
+ * covers most short decimals. Return zero for anything else, including
+ * Infinity and NaN.
+ */
+int parse_double(const uint8_t *ptr, const uint8_t *end, double *valptr)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22
+	};
+	const uint8_t *begin;
+	double val;
+	uint64_t mant = 0;
+	int exp = 0, exp_neg = 0, exp_val = 0, ndigit = 0, neg = 0;
+	int has_digit;
+
+	if (!PARSE_DOUBLE_EXACT) {
+		return 0;
+	}
+
+	if (*ptr == '-') {
+		neg = 1;
+		ptr++;
+	} else if (*ptr == '+') {
+		ptr++;
+	}
+
+	// integer part
+	begin = ptr;
+	ptr = scan_digits(ptr, end, &mant, &ndigit);
+	has_digit = (ptr != begin);
+
+	// fractional part
+	if (ptr != end && *ptr == '.') {
+		ptr++;
+		begin = ptr;
+		ptr = scan_digits(ptr, end, &mant, &ndigit);
+		if (ptr - begin > 22) {
+			return 0;
+		}
+		exp = -(int)(ptr - begin);
+		has_digit = has_digit || (ptr != begin);
+	}
+
+	if (!has_digit || ndigit > DIGITS_MAX) {
+		return 0;
+	}
+
+	// exponent
+	if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+		ptr++;
+		if (ptr != end && (*ptr == '-' || *ptr == '+')) {
+			exp_neg = (*ptr == '-');
+			ptr++;
+		}
+		begin = ptr;
+		while (ptr != end && IS_DIGIT(*ptr)) {
+			if (exp_val >= 1000) {
+				return 0;
+			}
+			exp_val = 10 * exp_val + (*ptr - '0');
+			ptr++;
+		}
+		if (ptr == begin) {
+			return 0;
+		}
+		exp += exp_neg ? -exp_val : exp_val;
+	}
+
+	if (mant == 0) {
+		val = 0;
+	} else if (mant > ((uint64_t)1 << 53) || exp < -22 || exp > 22) {
+		return 0;
+	} else if (exp < 0) {
+		val = (double)mant / pow10[-exp];
+	} else {
+		val = (double)mant * pow10[exp];
+	}
+
+	*valptr = neg ? -val : val;
+	return 1;
+}
+
+
+/*
+ * Accumulate a run of decimal digits into a value, up to eight at a time
+ * where possible. Leading zeros do not count toward the number of
+ * digits; once that reaches #DIGITS_MAX, the rest only get counted, and
+ * the value is no longer exact.
+ */
+const uint8_t *scan_digits(const uint8_t *ptr, const uint8_t *end,
+			   uint64_t *valptr, int *ndigitptr)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+		&& __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	static const uint64_t pow10[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+		100000000
+	};
+	uint64_t chunk, nondigit;
+	int n;
+#endif
+	uint64_t val = *valptr;
+	int ndigit = *ndigitptr;
+
+	while (val == 0 && ptr != end && *ptr == '0') {
+		ptr++;
+	}
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+		&& __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// SWAR: check and convert the ASCII digits in a 64-bit word, with
+	// the first character in the low byte
+	while (ndigit + 8 <= DIGITS_MAX && end - ptr >= 8) {
+		memcpy(&chunk, ptr, sizeof(chunk));
+
+		// set the high bits of the bytes that are not digits; carries
+		// only affect the bytes after the first non-digit
+		nondigit = ((chunk & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030)
+			| (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0)
+			   ^ 0x3030303030303030);
+
+		if (nondigit == 0) {
+			n = 8;
+		} else {
+			n = __builtin_ctzll(nondigit) / 8;
+			if (n == 0) {
+				break;
+			}
+			// shift out the non-digits, padding with leading zeros
+			chunk = (chunk << (8 * (8 - n)))
+				| (0x3030303030303030 >> (8 * n));
+		}
+
+		chunk -= 0x3030303030303030;
+		chunk = (chunk * 10) + (chunk >> 8);
+		chunk = (((chunk & 0x000000FF000000FF)
+			  * (100 + (1000000ULL << 32)))
+			 + (((chunk >> 16) & 0x000000FF000000FF)
+			    * (1 + (10000ULL << 32)))) >> 32;
+		val = pow10[n] * val + chunk;
+		ndigit += n;
+		ptr += n;
+
+		if (n < 8) {
+			break;
+		}
+	}
+#endif
+
+	while (ptr != end && IS_DIGIT(*ptr)) {
+		if (ndigit < DIGITS_MAX) {
+			val = 10 * val + (uint64_t)(*ptr - '0');
+		}
+		ndigit++;
+		ptr++;
+	}
+
+	*valptr = val;
+	*ndigitptr = ndigit;
+	return ptr;
+}
+
+
+void scan_numeric(const uint8_t **bufptr)
+{
+	const uint8_t *ptr = *bufptr;
+
+	// leading sign
+	if (*ptr == '-' || *ptr == '+') {
+		ptr++;
+	}
+
+	if (isdigit(*ptr) || *ptr == '.') {
+		while (isdigit(*ptr)) {
+			ptr++;
+		}
+		if (*ptr == '.') {
+			ptr++;
+		}
+		while (isdigit(*ptr)) {
+			ptr++;
+		}
+		if (*ptr == 'e' || *ptr == 'E') {
+			ptr++;
+			if (*ptr == '-' || *ptr == '+') {
+				ptr++;
+			}
+			while (isdigit(*ptr)) {
+				ptr++;
+			}
+		}
+	} else if (*ptr == 'I') {
+		ptr += 8; // Infinity
+	} else {
+		ptr += 3; // NaN
+	}
+
+	*bufptr = ptr;
+}
+
+
+void scan_spaces(const uint8_t **bufptr)
 {
 	const uint8_t *ptr = *bufptr;
 	while (isspace(*ptr)) {
@@ -855,3 +2037,94 @@ void scan_spaces_safe(const uint8_t **bufptr, const uint8_t *end)
 
 	*bufptr = ptr;
 }
+
+
+/*
+ * Skip over a value, without determining its type. Numbers and the
+ * literals extend up to the next delimiter; for arrays and records, we
+ * only check that the quotes and brackets balance.
+ */
+int scan_value_safe(const uint8_t **bufptr, const uint8_t *end)
+{
+	const uint8_t *ptr = *bufptr;
+	uint_fast8_t ch;
+	int err;
+
+	if (ptr == end) {
+		goto error_inval_noval;
+	}
+
+	switch (*ptr) {
+	case '"':
+		ptr++;
+		err = scan_text_safe(&ptr, end, NULL);
+		goto out;
+
+	case '[':
+	case '{':
+		break;
+
+	default:
+		while (ptr != end) {
+			ch = *ptr;
+			if (ch == ',' || ch == ']' || ch == '}'
+					|| isspace(ch)) {
+				break;
+			}
+			ptr++;
+		}
+		if (ptr == *bufptr) {
+			goto error_inval_noval;
+		}
+		err = 0;
+		goto out;
+	}
+
+	if (!(ptr = corpus_json_scan_close(ptr, end))) {
+		ptr = end;
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "no closing bracket at end of value");
+		goto out;
+	}
+
+	err = 0;
+	goto out;
+
+error_inval_noval:
+	err = CORPUS_ERROR_INVAL;
+	corpus_log(err, "missing value");
+out:
+	*bufptr = ptr;
+	return err;
+}
+
+
+/*
+ * Skip over the remainder of a string, up to and including the closing
+ * quote (\"). On exit, `*flagsptr` (if non-NULL) gets set to
+ * UTF8LITE_TEXT_UNESCAPE if the string contains a backslash (\\).
+ */
+int scan_text_safe(const uint8_t **bufptr, const uint8_t *end,
+		   int *flagsptr)
+{
+	const uint8_t *ptr = *bufptr;
+	int flags, has_esc, err;
+
+	ptr = corpus_json_scan_text(ptr, end, &has_esc);
+	flags = has_esc ? UTF8LITE_TEXT_UNESCAPE : 0;
+
+	if (ptr == end) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "no trailing quote (\") at end of text value");
+		goto out;
+	}
+	ptr++; // trailing "
+	err = 0;
+
+out:
+	if (flagsptr) {
+		*flagsptr = flags;
+	}
+	*bufptr = ptr;
+	return err;
+}
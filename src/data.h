@@ -27,14 +27,32 @@
 #include <stdint.h>
 
 struct corpus_schema;
+struct utf8lite_text;
 
 /**
- * A typed data value.
+ * Attributes of a text data value, found when the value gets scanned.
+ * If these are known, #corpus_data_text does not need to scan the text
+ * a second time.
+ */
+enum corpus_data_text_attr {
+	CORPUS_DATA_TEXT_UNKNOWN = 0,	/**< the attributes are unknown */
+	CORPUS_DATA_TEXT_KNOWN = (1 << 0), /**< the other bits are set */
+	CORPUS_DATA_TEXT_ESC = (1 << 1),   /**< the text has a backslash
+					     escape */
+	CORPUS_DATA_TEXT_UTF8 = (1 << 2)   /**< the text, once unescaped,
+					     has a non-ASCII character */
+};
+
+/**
+ * A typed data value. When filling in the value by hand, set the text
+ * attributes to #CORPUS_DATA_TEXT_UNKNOWN.
  */
 struct corpus_data {
 	const uint8_t *ptr;	/**< the value memory location */
 	size_t size;		/**< the value size, in bytes */
 	int type_id;		/**< the type ID */
+	int text_attr;		/**< for text values, a bitmask of
+				  #corpus_data_text_attr values */
 };
 
 /**
@@ -46,11 +64,28 @@ struct corpus_data_items {
 	int item_kind;			/**< the array item kind */
 	int length;			/**< the array length */
 	const uint8_t *ptr;		/**< the array memory location */
+	const uint8_t *end;		/**< the end of the array data */
 
 	struct corpus_data current;	/**< the current item value */
 	int index;			/**< the current item index */
 };
 
+/**
+ * An array view, giving constant-time access to the length and items of
+ * an array. Assigning an array to the view scans it once, recording
+ * where each item starts and ends; after that, getting the length or an
+ * item does not re-scan the data. A view can get re-used for many
+ * arrays, in which case it keeps its item buffer.
+ */
+struct corpus_data_array {
+	const struct corpus_schema *schema;	/**< the data schema */
+	int item_type;			/**< the array item type ID */
+	const uint8_t *ptr;		/**< the array memory location */
+	struct corpus_data *items;	/**< the array items */
+	int length;			/**< the array length */
+	int length_max;			/**< the item buffer capacity */
+};
+
 /**
  * An iterator over the fields in a record.
  */
@@ -59,10 +94,84 @@ struct corpus_data_fields {
 	const int *field_types;		/**< the record field types */
 	const int *field_names;		/**< the record field names*/
 	int nfield;			/**< the number of record fields */
+	const struct corpus_datatype_record *record; /**< the record type */
 	const uint8_t *ptr;		/**< the record memory location */
+	const uint8_t *end;		/**< the end of the record data */
 
 	struct corpus_data current;	/**< the current field value */
 	int name_id;			/**< the current field name */
+	int index;			/**< the current field position */
+};
+
+/**
+ * A record field accessor, for extracting a single named field from
+ * records without determining the types of the other fields.
+ */
+struct corpus_data_accessor {
+	int name_id;		/**< the field name ID */
+	size_t name_size;	/**< the field name size, in bytes */
+	int name_ascii;		/**< whether the field name is ASCII, in
+				  which case raw field names without
+				  escapes can be compared bytewise */
+};
+
+/**
+ * Step type in a compiled field path.
+ */
+enum corpus_data_step_type {
+	CORPUS_DATA_STEP_ROOT = 0,	/**< the input value */
+	CORPUS_DATA_STEP_FIELD,		/**< a named record field */
+	CORPUS_DATA_STEP_ITEM,		/**< an array item, by index */
+	CORPUS_DATA_STEP_ITEMS		/**< all array items (`[*]`) */
+};
+
+/**
+ * A step in a compiled field path. The steps for all of the paths in a
+ * projection form a tree, so that paths with a common prefix share their
+ * steps, and get followed in the same traversal.
+ */
+struct corpus_data_step {
+	int type;		/**< the step type, a #corpus_data_step_type */
+	struct corpus_data_accessor field; /**< the field name, for field
+					     steps */
+	int index;		/**< the item index, for item steps */
+	int path_id;		/**< the ID of the path ending at this step,
+				  or -1 if none */
+	int child;		/**< the first child step, or -1 if none */
+	int sibling;		/**< the next sibling step, or -1 if none */
+};
+
+/**
+ * A value matched by a path in a projection.
+ */
+struct corpus_data_match {
+	int path_id;		/**< the path ID */
+	struct corpus_data value; /**< the matched value */
+};
+
+/**
+ * A projection, a compiled set of field paths to extract from records in
+ * a single traversal.
+ *
+ * A path is a sequence of steps: record field names, separated by
+ * periods (`.`), and array subscripts, either an item index (`[0]`) or
+ * all items (`[*]`). Field names that contain periods, brackets, or
+ * quotes can get enclosed in double quotes (`"`). For example,
+ * `user.lang`, `entities.hashtags[*].text`, and `"a.b"[0]`.
+ */
+struct corpus_data_projection {
+	struct corpus_data_step *steps;	/**< the steps; step 0 is the root */
+	int nstep;			/**< the number of steps */
+	int nstep_max;			/**< the step array capacity */
+	int *path_multi;		/**< for each path, whether it has an
+					  all-items step, and can match
+					  more than one value */
+	int npath;			/**< the number of paths */
+	int npath_max;			/**< the path array capacity */
+	struct corpus_data_match *matches; /**< the matches for the last
+					     input, in input order */
+	int nmatch;			/**< the number of matches */
+	int nmatch_max;			/**< the match array capacity */
 };
 
 /**
@@ -172,7 +281,54 @@ int corpus_data_items_advance(struct corpus_data_items *it);
 void corpus_data_items_reset(struct corpus_data_items *it);
 
 /**
- * Get the number of fields of a record data value.
+ * Initialize an empty array view.
+ *
+ * \param arr the array view
+ */
+void corpus_data_array_init(struct corpus_data_array *arr);
+
+/**
+ * Release an array view's resources.
+ *
+ * \param arr the array view
+ */
+void corpus_data_array_destroy(struct corpus_data_array *arr);
+
+/**
+ * Assign an array data value to a view, scanning the array once to find
+ * its items. The view points into the data value's memory, and is
+ * valid until the next assignment. If the data value is null or is not
+ * an array, the view gets cleared to length 0.
+ *
+ * \param arr the array view
+ * \param d the data value
+ * \param s the data schema
+ *
+ * \returns 0 on success; #CORPUS_ERROR_INVAL if the data value is null or
+ * 	is not an array; #CORPUS_ERROR_NOMEM on memory allocation failure
+ */
+int corpus_data_array_assign(struct corpus_data_array *arr,
+			     const struct corpus_data *d,
+			     const struct corpus_schema *s);
+
+/**
+ * Get an item from an array view, by index.
+ *
+ * \param arr the array view
+ * \param i the item index, between 0 and `arr->length - 1`
+ * \param valptr if non-NULL, a location to store the item value; null
+ * 	if the index is out of range
+ *
+ * \returns 0 on success; #CORPUS_ERROR_INVAL if the index is out of range
+ */
+int corpus_data_array_item(const struct corpus_data_array *arr, int i,
+			   struct corpus_data *valptr);
+
+/**
+ * Get the number of fields of a record data value. This iterates over
+ * the fields with #corpus_data_fields_advance, which updates the record
+ * type's field position predictions, so concurrent calls must not share
+ * a schema.
  *
  * \param d the data value
  * \param s the data schema
@@ -186,7 +342,11 @@ int corpus_data_nfield(const struct corpus_data *d,
 		       int *nfieldptr);
 
 /**
- * Get a record field from a data value.
+ * Get a record field from a data value. The record type remembers the
+ * position where it last found each field; we look there first, skipping
+ * over the fields before it without decoding their names, and only
+ * search the whole record if the prediction is wrong. For this reason,
+ * concurrent calls must not share a schema.
  *
  * \param d the data value
  * \param s the data schema
@@ -202,7 +362,110 @@ int corpus_data_field(const struct corpus_data *d,
 		      int name_id, struct corpus_data *valptr);
 
 /**
- * Get the record fields from a data value.
+ * Initialize a record field accessor.
+ *
+ * \param a the accessor
+ * \param s the data schema
+ * \param name the record field name
+ *
+ * \returns 0 on success
+ */
+int corpus_data_accessor_init(struct corpus_data_accessor *a,
+			      struct corpus_schema *s,
+			      const struct utf8lite_text *name);
+
+/**
+ * Get a record field by parsing input in JavaScript Object Notation
+ * (JSON) format. This is equivalent to calling #corpus_data_assign
+ * followed by #corpus_data_field, except that it stops at the requested
+ * field, and only determines the type of that field's value. The other
+ * fields get skipped after checking that their quotes and brackets
+ * balance; they do not get validated otherwise.
+ *
+ * \param a the field accessor
+ * \param s the data schema
+ * \param ptr input, UTF-8 encoded characters
+ * \param size the input length, in bytes
+ * \param valptr on exit, the field value; this is null if the input is
+ * 	not a record or if the record does not have the field
+ *
+ * \returns 0 on success, nonzero for invalid input (a parse error),
+ * 	memory allocation failure, or overflow error
+ */
+int corpus_data_access(const struct corpus_data_accessor *a,
+		       struct corpus_schema *s, const uint8_t *ptr,
+		       size_t size, struct corpus_data *valptr);
+
+/**
+ * Initialize an empty projection.
+ *
+ * \param p the projection
+ *
+ * \returns 0 on success
+ */
+int corpus_data_projection_init(struct corpus_data_projection *p);
+
+/**
+ * Release a projection's resources.
+ *
+ * \param p the projection
+ */
+void corpus_data_projection_destroy(struct corpus_data_projection *p);
+
+/**
+ * Compile a field path and add it to a projection. Adding a path that
+ * already exists in the projection gives the existing path's ID.
+ *
+ * \param p the projection
+ * \param s the data schema
+ * \param path the field path
+ * \param idptr if non-NULL, on exit, the path ID
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the path is malformed,
+ * 	or #CORPUS_ERROR_NOMEM on memory allocation failure
+ */
+int corpus_data_projection_add(struct corpus_data_projection *p,
+			       struct corpus_schema *s,
+			       const struct utf8lite_text *path, int *idptr);
+
+/**
+ * Extract the values for all of the paths in a projection from input in
+ * JavaScript Object Notation (JSON) format, in a single traversal. On
+ * exit, `p->matches` holds the matched values, in the order they appear
+ * in the input. As with #corpus_data_access, only the matched values get
+ * their types determined; the other values get skipped after checking
+ * that their quotes and brackets balance, and the traversal of a record
+ * stops once it has found all of the fields that it needs.
+ *
+ * \param p the projection
+ * \param s the data schema
+ * \param ptr input, UTF-8 encoded characters
+ * \param size the input length, in bytes
+ *
+ * \returns 0 on success, nonzero for invalid input (a parse error),
+ * 	memory allocation failure, or overflow error
+ */
+int corpus_data_project(struct corpus_data_projection *p,
+			struct corpus_schema *s, const uint8_t *ptr,
+			size_t size);
+
+/**
+ * Get the first value matched by a path in the last call to
+ * #corpus_data_project.
+ *
+ * \param p the projection
+ * \param path_id the path ID
+ * \param valptr on exit, the value, or null if the path did not match
+ *
+ * \returns nonzero if the path matched, zero otherwise
+ */
+int corpus_data_projection_get(const struct corpus_data_projection *p,
+			       int path_id, struct corpus_data *valptr);
+
+/**
+ * Get the record fields from a data value. Advancing the iterator
+ * updates the schema (see #corpus_data_fields_advance), so iterators on
+ * different threads must not share a schema.
  *
  * \param d the data value
  * \param s the data schema
@@ -216,7 +479,12 @@ int corpus_data_fields(const struct corpus_data *d,
 		       struct corpus_data_fields *valptr);
 
 /**
- * Advance a record field iterator to the next field.
+ * Advance a record field iterator to the next field. If the field's name
+ * matches that of the field at the same position in the last record of
+ * this type, we skip the name lookup. Either way, the record type in the
+ * iterator's schema remembers where this record had the field, even
+ * though the iterator holds the schema through a `const` pointer. For
+ * this reason, concurrent calls must not share a schema.
  *
  * \param it the iterator
  *
@@ -30,6 +30,7 @@
 #include "symtab.h"
 #include "data.h"
 #include "datatype.h"
+#include "jsonscan.h"
 
 #define CORPUS_NUM_ATOMIC	5
 
@@ -58,9 +59,23 @@ static int corpus_schema_grow_types(struct corpus_schema *s, int nadd);
 static void corpus_schema_rehash_arrays(struct corpus_schema *s);
 static void corpus_schema_rehash_records(struct corpus_schema *s);
 
+// record shape cache
+static void shape_init(struct corpus_schema_shape *shape);
+static void shape_clear(struct corpus_schema_shape *shape);
+static struct corpus_schema_shape *shape_find(struct corpus_schema *s,
+					      const uint8_t *ptr,
+					      const uint8_t *end);
+static int shape_record(struct corpus_schema *s,
+			struct corpus_schema_shape *shape, int fstart,
+			int *idptr);
+static void shape_add(struct corpus_schema *s, int fstart, int nfield,
+		      int type_id);
+
 // compound types
 static int scan_field(struct corpus_schema *s, const uint8_t **bufptr,
-		      const uint8_t *end, int *name_idptr, int *type_idptr);
+		      const uint8_t *end,
+		      const struct corpus_schema_shape *shape, int index,
+		      size_t *key_sizeptr, int *name_idptr, int *type_idptr);
 static int scan_value(struct corpus_schema *s, const uint8_t **bufptr,
 		      const uint8_t *end, int *idptr);
 static int scan_array(struct corpus_schema *s, const uint8_t **bufptr,
@@ -100,6 +115,8 @@ int corpus_schema_buffer_init(struct corpus_schema_buffer *buf)
 {
 	buf->type_ids = NULL;
 	buf->name_ids = NULL;
+	buf->keys = NULL;
+	buf->key_sizes = NULL;
 	buf->nfield = 0;
 	buf->nfield_max = 0;
 	return 0;
@@ -108,6 +125,8 @@ int corpus_schema_buffer_init(struct corpus_schema_buffer *buf)
 
 void corpus_schema_buffer_destroy(struct corpus_schema_buffer *buf)
 {
+	corpus_free(buf->key_sizes);
+	corpus_free(buf->keys);
 	corpus_free(buf->name_ids);
 	corpus_free(buf->type_ids);
 }
@@ -117,6 +136,8 @@ int corpus_schema_buffer_grow(struct corpus_schema_buffer *buf, int nadd)
 {
 	void *tbase = buf->type_ids;
 	int *nbase = buf->name_ids;
+	const uint8_t **kbase = buf->keys;
+	size_t *ksbase = buf->key_sizes;
 	int size = buf->nfield_max;
 	int err;
 
@@ -135,6 +156,22 @@ int corpus_schema_buffer_grow(struct corpus_schema_buffer *buf, int nadd)
 			return err;
 		}
 		buf->name_ids = nbase;
+
+		kbase = corpus_realloc(kbase, (size_t)size * sizeof(*kbase));
+		if (!kbase) {
+			err = CORPUS_ERROR_NOMEM;
+			corpus_log(err, "failed allocating schema buffer");
+			return err;
+		}
+		buf->keys = kbase;
+
+		ksbase = corpus_realloc(ksbase, (size_t)size * sizeof(*ksbase));
+		if (!ksbase) {
+			err = CORPUS_ERROR_NOMEM;
+			corpus_log(err, "failed allocating schema buffer");
+			return err;
+		}
+		buf->key_sizes = ksbase;
 	}
 
 	buf->nfield_max = size;
@@ -249,6 +286,11 @@ int corpus_schema_init(struct corpus_schema *s)
 		s->types[i].kind = i;
 	}
 
+	for (i = 0; i < CORPUS_SCHEMA_SHAPE_MAX; i++) {
+		shape_init(&s->shapes[i]);
+	}
+	s->shape_next = 0;
+
 	return 0;
 
 error_types:
@@ -282,11 +324,18 @@ void corpus_schema_destroy(struct corpus_schema *s)
 void corpus_schema_clear(struct corpus_schema *s)
 {
 	const struct corpus_datatype *t;
-	int i = s->ntype;
+	int i;
 
+	for (i = 0; i < CORPUS_SCHEMA_SHAPE_MAX; i++) {
+		shape_clear(&s->shapes[i]);
+	}
+	s->shape_next = 0;
+
+	i = s->ntype;
 	while (i-- > 0) {
 		t = &s->types[i];
 		if (t->kind == CORPUS_DATATYPE_RECORD) {
+			corpus_free(t->meta.record.last_pos);
 			corpus_free(t->meta.record.name_ids);
 			corpus_free(t->meta.record.type_ids);
 		}
@@ -569,12 +618,18 @@ sorted:
 	if (nfield == 0) {
 		t->meta.record.type_ids = NULL;
 		t->meta.record.name_ids = NULL;
+		t->meta.record.last_pos = NULL;
+		t->meta.record.last_field = NULL;
 	} else {
 		t->meta.record.type_ids = corpus_malloc((size_t)nfield
 							* sizeof(*type_ids));
 		t->meta.record.name_ids = corpus_malloc((size_t)nfield
 							* sizeof(*name_ids));
-		if (!t->meta.record.type_ids || !t->meta.record.type_ids) {
+		t->meta.record.last_pos = corpus_malloc(2 * (size_t)nfield
+							* sizeof(int));
+		if (!t->meta.record.type_ids || !t->meta.record.name_ids
+				|| !t->meta.record.last_pos) {
+			corpus_free(t->meta.record.last_pos);
 			corpus_free(t->meta.record.type_ids);
 			corpus_free(t->meta.record.name_ids);
 			err = CORPUS_ERROR_NOMEM;
@@ -584,6 +639,14 @@ sorted:
 			(size_t)nfield * sizeof(*type_ids));
 		memcpy(t->meta.record.name_ids, name_ids,
 			(size_t)nfield * sizeof(*name_ids));
+
+		// until we see some data, guess that the fields appear in
+		// sorted order
+		t->meta.record.last_field = t->meta.record.last_pos + nfield;
+		for (i = 0; i < nfield; i++) {
+			t->meta.record.last_pos[i] = i;
+			t->meta.record.last_field[i] = i;
+		}
 	}
 	t->meta.record.nfield = nfield;
 	s->ntype++;
@@ -712,6 +775,82 @@ out:
 }
 
 
+int corpus_schema_import(struct corpus_schema *s,
+			 const struct corpus_schema *src, int src_id,
+			 int *idptr)
+{
+	const struct corpus_datatype *t;
+	const struct corpus_datatype_record *rec;
+	int *type_ids = NULL;
+	int *name_ids;
+	int err, i, id, nfield;
+
+	// atomic types have the same IDs in every schema
+	if (src_id < CORPUS_NUM_ATOMIC) {
+		id = src_id;
+		err = 0;
+		goto out;
+	}
+
+	t = &src->types[src_id];
+
+	switch (t->kind) {
+	case CORPUS_DATATYPE_ARRAY:
+		if ((err = corpus_schema_import(s, src, t->meta.array.type_id,
+						&id))) {
+			goto out;
+		}
+		err = corpus_schema_array(s, id, t->meta.array.length, &id);
+		break;
+
+	case CORPUS_DATATYPE_RECORD:
+		rec = &t->meta.record;
+		nfield = rec->nfield;
+
+		if (!(type_ids = corpus_malloc(2 * ((size_t)nfield + 1)
+					       * sizeof(*type_ids)))) {
+			err = CORPUS_ERROR_NOMEM;
+			corpus_log(err, "failed allocating record fields");
+			goto out;
+		}
+		name_ids = type_ids + nfield + 1;
+
+		// the names are already normalized, so they get the same
+		// IDs as they would from scanning the original input
+		for (i = 0; i < nfield; i++) {
+			if ((err = corpus_schema_import(s, src,
+							rec->type_ids[i],
+							&type_ids[i]))) {
+				goto out;
+			}
+			if ((err = corpus_schema_name(s,
+					&src->names.types[rec->name_ids[i]].text,
+					&name_ids[i]))) {
+				goto out;
+			}
+		}
+
+		err = corpus_schema_record(s, type_ids, name_ids, nfield, &id);
+		break;
+
+	default:
+		id = t->kind;
+		err = 0;
+		break;
+	}
+
+out:
+	corpus_free(type_ids);
+	if (err) {
+		id = CORPUS_DATATYPE_NULL;
+	}
+	if (idptr) {
+		*idptr = id;
+	}
+	return err;
+}
+
+
 
 int corpus_schema_union_array(struct corpus_schema *s, int id1, int id2,
 			      int *idptr)
@@ -992,6 +1131,14 @@ int corpus_schema_scan(struct corpus_schema *s, const uint8_t *ptr,
 		       size_t size, int *idptr)
 {
 	struct utf8lite_text text;
+	return corpus_schema_scan_text(s, ptr, size, idptr, &text);
+}
+
+
+int corpus_schema_scan_text(struct corpus_schema *s, const uint8_t *ptr,
+			    size_t size, int *idptr,
+			    struct utf8lite_text *textptr)
+{
 	const uint8_t *input = ptr;
 	const uint8_t *end = ptr + size;
 	uint_fast8_t ch;
@@ -1030,7 +1177,7 @@ int corpus_schema_scan(struct corpus_schema *s, const uint8_t *ptr,
 		break;
 
 	case '"':
-		if ((err = scan_text(&ptr, end, &text))) {
+		if ((err = scan_text(&ptr, end, textptr))) {
 			goto error;
 		}
 		id = CORPUS_DATATYPE_TEXT;
@@ -1257,13 +1404,185 @@ out:
 }
 
 
+void shape_init(struct corpus_schema_shape *shape)
+{
+	shape->keys = NULL;
+	shape->key_ends = NULL;
+	shape->name_ids = NULL;
+	shape->type_ids = NULL;
+	shape->order = NULL;
+	shape->nfield = -1;
+	shape->type_id = -1;
+	shape->gen = 0;
+}
+
+
+void shape_clear(struct corpus_schema_shape *shape)
+{
+	unsigned gen = shape->gen;
+
+	corpus_free(shape->key_ends);
+	corpus_free(shape->keys);
+	shape_init(shape);
+	shape->gen = gen + 1;
+}
+
+
+/*
+ * Find a cached shape whose first raw field name matches the start of
+ * a record's body.
+ */
+struct corpus_schema_shape *shape_find(struct corpus_schema *s,
+				       const uint8_t *ptr,
+				       const uint8_t *end)
+{
+	struct corpus_schema_shape *shape;
+	size_t size;
+	int i;
+
+	if (*ptr != '"') {
+		return NULL;
+	}
+	ptr++;
+
+	for (i = 0; i < CORPUS_SCHEMA_SHAPE_MAX; i++) {
+		shape = &s->shapes[i];
+		if (shape->nfield <= 0) {
+			continue;
+		}
+		size = (size_t)shape->key_ends[0];
+		if ((size_t)(end - ptr) > size && ptr[size] == '"'
+				&& memcmp(ptr, shape->keys, size) == 0) {
+			return shape;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Get the type ID for a record whose field names match a cached shape.
+ * If the field types match, too, then this is the shape's type;
+ * otherwise, we use the shape's ordering to put the fields in sorted
+ * order, which spares #corpus_schema_record from sorting them.
+ */
+int shape_record(struct corpus_schema *s, struct corpus_schema_shape *shape,
+		 int fstart, int *idptr)
+{
+	const int *type_ids;
+	int err, i, id, j, n = shape->nfield;
+
+	type_ids = s->buffer.type_ids + fstart;
+	if (memcmp(type_ids, shape->type_ids,
+		   (size_t)n * sizeof(*type_ids)) == 0) {
+		id = shape->type_id;
+		err = 0;
+		goto out;
+	}
+
+	if (s->buffer.nfield > s->buffer.nfield_max - n) {
+		if ((err = corpus_schema_buffer_grow(&s->buffer, n))) {
+			goto error;
+		}
+	}
+
+	// push the sorted (name,type) pairs onto the stack
+	type_ids = s->buffer.type_ids + fstart;
+	for (i = 0; i < n; i++) {
+		j = shape->order[i];
+		s->buffer.type_ids[s->buffer.nfield + i] = type_ids[j];
+		s->buffer.name_ids[s->buffer.nfield + i] = shape->name_ids[j];
+	}
+	s->buffer.nfield += n;
+
+	err = corpus_schema_record(s, s->buffer.type_ids + s->buffer.nfield - n,
+				   s->buffer.name_ids + s->buffer.nfield - n,
+				   n, &id);
+	s->buffer.nfield -= n;
+	if (err) {
+		goto error;
+	}
+
+	memcpy(shape->type_ids, s->buffer.type_ids + fstart,
+	       (size_t)n * sizeof(*shape->type_ids));
+	shape->type_id = id;
+	goto out;
+
+error:
+	id = -1;
+
+out:
+	*idptr = id;
+	return err;
+}
+
+
+/*
+ * Cache the shape of a record, replacing the least recently added one.
+ * This is an optimization, so we don't report allocation failures.
+ */
+void shape_add(struct corpus_schema *s, int fstart, int nfield, int type_id)
+{
+	struct corpus_schema_shape *shape = &s->shapes[s->shape_next];
+	const int *name_ids = s->buffer.name_ids + fstart;
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < nfield; i++) {
+		size += s->buffer.key_sizes[fstart + i];
+		if (size > INT_MAX) {
+			return;
+		}
+	}
+
+	if (sorter_sort(&s->sorter, name_ids, nfield)) {
+		return;
+	}
+
+	shape_clear(shape);
+	s->shape_next = (s->shape_next + 1) % CORPUS_SCHEMA_SHAPE_MAX;
+
+	if (!(shape->key_ends = corpus_malloc(4 * (size_t)nfield
+					      * sizeof(*shape->key_ends)))) {
+		return;
+	}
+	if (!(shape->keys = corpus_malloc(size ? size : 1))) {
+		corpus_free(shape->key_ends);
+		shape->key_ends = NULL;
+		return;
+	}
+	shape->name_ids = shape->key_ends + nfield;
+	shape->type_ids = shape->name_ids + nfield;
+	shape->order = shape->type_ids + nfield;
+
+	size = 0;
+	for (i = 0; i < nfield; i++) {
+		memcpy(shape->keys + size, s->buffer.keys[fstart + i],
+		       s->buffer.key_sizes[fstart + i]);
+		size += s->buffer.key_sizes[fstart + i];
+		shape->key_ends[i] = (int)size;
+		shape->order[i] = (int)(s->sorter.idptrs[i] - name_ids);
+	}
+	memcpy(shape->name_ids, name_ids, (size_t)nfield * sizeof(*name_ids));
+	memcpy(shape->type_ids, s->buffer.type_ids + fstart,
+	       (size_t)nfield * sizeof(*shape->type_ids));
+	shape->nfield = nfield;
+	shape->type_id = type_id;
+}
+
+
 int scan_record(struct corpus_schema *s, const uint8_t **bufptr,
 		const uint8_t *end, int *idptr)
 {
+	struct corpus_schema_shape *shape = NULL;
 	const uint8_t *ptr = *bufptr;
+	const uint8_t *key;
+	size_t key_size;
 	int name_id, type_id, id;
 	int fstart;
 	int nfield;
+	unsigned gen = 0;
 	int err;
 
 	nfield = 0;
@@ -1279,22 +1598,42 @@ int scan_record(struct corpus_schema *s, const uint8_t **bufptr,
 		goto close;
 	}
 
-	if ((err = scan_field(s, &ptr, end, &name_id, &type_id))) {
-		goto error;
+	// look for a recent record with the same first field name
+	if ((shape = shape_find(s, ptr, end))) {
+		gen = shape->gen;
 	}
 
-	if (s->buffer.nfield == s->buffer.nfield_max) {
-		if ((err = corpus_schema_buffer_grow(&s->buffer, 1))) {
+	while (1) {
+		if (nfield == INT_MAX) {
+			goto error_inval_nfield;
+		}
+
+		if (s->buffer.nfield == s->buffer.nfield_max) {
+			if ((err = corpus_schema_buffer_grow(&s->buffer, 1))) {
+				goto error;
+			}
+		}
+
+		key = ptr + 1;
+		if ((err = scan_field(s, &ptr, end, shape, nfield, &key_size,
+				      &name_id, &type_id))) {
 			goto error;
 		}
-	}
 
-	s->buffer.nfield++;
-	s->buffer.name_ids[fstart + nfield] = name_id;
-	s->buffer.type_ids[fstart + nfield] = type_id;
-	nfield++;
+		// the shape slot gets replaced if the value has a nested
+		// record with a different layout
+		if (shape && (shape->gen != gen || nfield >= shape->nfield
+				|| shape->name_ids[nfield] != name_id)) {
+			shape = NULL;
+		}
+
+		s->buffer.nfield++;
+		s->buffer.name_ids[fstart + nfield] = name_id;
+		s->buffer.type_ids[fstart + nfield] = type_id;
+		s->buffer.keys[fstart + nfield] = key;
+		s->buffer.key_sizes[fstart + nfield] = key_size;
+		nfield++;
 
-	while (1) {
 		scan_spaces(&ptr, end);
 		if (ptr == end) {
 			goto error_inval_noclose;
@@ -1307,29 +1646,6 @@ int scan_record(struct corpus_schema *s, const uint8_t **bufptr,
 		case ',':
 			ptr++;
 			scan_spaces(&ptr, end);
-
-			if ((err = scan_field(s, &ptr, end, &name_id,
-					      &type_id))) {
-				goto error;
-			}
-
-			if (nfield == INT_MAX) {
-				goto error_inval_nfield;
-			}
-
-			if (s->buffer.nfield == s->buffer.nfield_max) {
-				err = corpus_schema_buffer_grow(&s->buffer,
-								1);
-				if (err) {
-					goto error;
-				}
-			}
-
-			s->buffer.nfield++;
-			s->buffer.name_ids[fstart + nfield] = name_id;
-			s->buffer.type_ids[fstart + nfield] = type_id;
-			nfield++;
-
 			break;
 
 		default:
@@ -1339,8 +1655,16 @@ int scan_record(struct corpus_schema *s, const uint8_t **bufptr,
 close:
 	ptr++; // skip over closing bracket (})
 
-	err = corpus_schema_record(s, s->buffer.type_ids + fstart,
-			    s->buffer.name_ids + fstart, nfield, &id);
+	if (shape && nfield == shape->nfield) {
+		err = shape_record(s, shape, fstart, &id);
+	} else {
+		err = corpus_schema_record(s, s->buffer.type_ids + fstart,
+					   s->buffer.name_ids + fstart, nfield,
+					   &id);
+		if (!err && nfield > 0) {
+			shape_add(s, fstart, nfield, id);
+		}
+	}
 	goto out;
 
 error_inval_nfield:
@@ -1371,26 +1695,46 @@ out:
 
 
 int scan_field(struct corpus_schema *s, const uint8_t **bufptr,
-	       const uint8_t *end, int *name_idptr, int *type_idptr)
+	       const uint8_t *end, const struct corpus_schema_shape *shape,
+	       int index, size_t *key_sizeptr, int *name_idptr,
+	       int *type_idptr)
 {
 	struct utf8lite_text name;
 	const uint8_t *ptr = *bufptr;
-	int err, name_id, type_id;
+	const uint8_t *key;
+	size_t key_size = 0;
+	int err, key_start, name_id, type_id;
 
 	// leading "
 	if (*ptr != '"') {
 		goto error_inval_noname;
 	}
 	ptr++;
+	key = ptr;
+
+	// field name; if the raw name matches the shape's, then it is
+	// valid, and we already know its ID
+	if (shape && index < shape->nfield) {
+		key_start = index ? shape->key_ends[index - 1] : 0;
+		key_size = (size_t)(shape->key_ends[index] - key_start);
+		if ((size_t)(end - ptr) > key_size && ptr[key_size] == '"'
+				&& memcmp(ptr, shape->keys + key_start,
+					  key_size) == 0) {
+			name_id = shape->name_ids[index];
+			ptr += key_size + 1;
+			goto colon;
+		}
+	}
 
-	// field name
 	if ((err = scan_text(&ptr, end, &name))) {
 		goto error;
 	}
 	if ((err = corpus_schema_name(s, &name, &name_id))) {
 		goto error;
 	}
+	key_size = UTF8LITE_TEXT_SIZE(&name);
 
+colon:
 	// colon
 	scan_spaces(&ptr, end);
 	if (ptr == end || *ptr != ':') {
@@ -1418,19 +1762,19 @@ error_inval_noname:
 error_inval_nocolon:
 	err = CORPUS_ERROR_INVAL;
 	corpus_log(err, "missing colon after field name \"%.*s\" in record",
-		   (unsigned)UTF8LITE_TEXT_SIZE(&name), name.ptr);
+		   (unsigned)key_size, key);
 	goto error;
 
 error_inval_noval:
 	err = CORPUS_ERROR_INVAL;
 	corpus_log(err, "missing value for field \"%.*s\" in record",
-		   (unsigned)UTF8LITE_TEXT_SIZE(&name), name.ptr);
+		   (unsigned)key_size, key);
 	goto error;
 
 error_inval_val:
 	err = CORPUS_ERROR_INVAL;
 	corpus_log(err, "failed parsing value for field \"%.*s\" in record",
-		   (unsigned)UTF8LITE_TEXT_SIZE(&name), name.ptr);
+		   (unsigned)key_size, key);
 	goto error;
 
 error:
@@ -1439,6 +1783,7 @@ error:
 
 out:
 	*bufptr = ptr;
+	*key_sizeptr = key_size;
 	*name_idptr = name_id;
 	*type_idptr = type_id;
 	return err;
@@ -1603,31 +1948,17 @@ int scan_text(const uint8_t **bufptr, const uint8_t *end,
 {
 	struct utf8lite_message msg;
 	const uint8_t *input = *bufptr;
-	const uint8_t *ptr = input;
-	uint_fast8_t ch;
-	int err, flags;
+	const uint8_t *ptr;
+	int err, flags, has_esc;
 
-	flags = 0;
-	while (ptr != end) {
-		ch = *ptr;
-		if (ch == '"') {
-			goto close;
-		} else if (ch == '\\') {
-			flags = UTF8LITE_TEXT_UNESCAPE;
-			if (ptr == end) {
-				goto error_noclose;
-			}
-			ptr++; // skip over next character
-		}
-		ptr++;
+	ptr = corpus_json_scan_text(input, end, &has_esc);
+	flags = has_esc ? UTF8LITE_TEXT_UNESCAPE : 0;
+	if (ptr == end) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "no trailing quote (\") at end of text value");
+		goto out;
 	}
 
-error_noclose:
-	err = CORPUS_ERROR_INVAL;
-	corpus_log(err, "no trailing quote (\") at end of text value");
-	goto out;
-
-close:
 	if ((err = utf8lite_text_assign(text, input, (size_t)(ptr - input),
 					flags, &msg))) {
 		err = CORPUS_ERROR_INVAL;
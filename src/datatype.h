@@ -23,8 +23,15 @@
  * Data types and data schema.
  */
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+/**
+ * Number of recent record layouts in a schema's shape cache.
+ */
+#define CORPUS_SCHEMA_SHAPE_MAX 8
+
 /**
  * A basic data type.
  */
@@ -60,6 +67,12 @@ struct corpus_datatype_record {
 	int *type_ids;	/**< the field types */
 	int *name_ids;	/**< the field names */
 	int nfield;	/**< the number of fields */
+	int *last_pos;	/**< used internally to predict field locations:
+			  the input position where each field was last
+			  found */
+	int *last_field;	/**< used internally to predict field
+				  locations: the field last found at each
+				  input position */
 };
 
 /**
@@ -82,10 +95,33 @@ struct corpus_datatype {
 struct corpus_schema_buffer {
 	int *type_ids;	/**< type ID buffer */
 	int *name_ids;	/**< name ID buffer */
+	const uint8_t **keys; /**< raw name buffer */
+	size_t *key_sizes; /**< raw name size buffer */
 	int nfield;	/**< number of occupied buffer slots */
 	int nfield_max;	/**< maximum buffer capacity */
 };
 
+/**
+ * Used internally to cache the layout of a recently scanned record: the
+ * field names as they appear in the input (before unescaping and
+ * normalization), in input order, along with their name IDs. A record
+ * with the same raw names in the same order reuses the name IDs, and, if
+ * its field types also match, the record type ID, without looking up,
+ * sorting, or hashing the names.
+ */
+struct corpus_schema_shape {
+	uint8_t *keys;		/**< the raw field names, concatenated */
+	int *key_ends;		/**< the end offset of each raw name */
+	int *name_ids;		/**< the field name IDs, in input order */
+	int *type_ids;		/**< the field type IDs, in input order */
+	int *order;		/**< the input positions of the fields,
+				  sorted by name ID */
+	int nfield;		/**< the number of fields, or -1 if unused */
+	int type_id;		/**< the record type ID */
+	unsigned gen;		/**< the number of times the slot has been
+				  replaced */
+};
+
 /**
  * Used internally to sort record names.
  */
@@ -100,6 +136,9 @@ struct corpus_schema_sorter {
 struct corpus_schema {
 	struct corpus_schema_buffer buffer;/**< internal field buffer */
 	struct corpus_schema_sorter sorter;/**< internal field name sorter */
+	struct corpus_schema_shape shapes[CORPUS_SCHEMA_SHAPE_MAX];
+					/**< internal record shape cache */
+	int shape_next;			/**< next shape cache slot to replace */
 	struct corpus_symtab names;	/**< record field names */
 	struct corpus_table arrays;	/**< array type table */
 	struct corpus_table records;	/**< record type table */
@@ -182,6 +221,24 @@ int corpus_schema_record(struct corpus_schema *s, const int *type_ids,
  */
 int corpus_schema_union(struct corpus_schema *s, int id1, int id2, int *idptr);
 
+/**
+ * Copy a data type from another schema, along with the field names and
+ * the array and record types that it depends on. This allows schemas
+ * built independently (for example, on separate threads) to get merged
+ * by importing their types into a common schema and taking the union.
+ *
+ * \param s the destination schema
+ * \param src the source schema
+ * \param src_id the type ID in the source schema
+ * \param idptr on exit, a pointer to the type ID in the destination
+ * 	schema
+ *
+ * \returns 0 on success
+ */
+int corpus_schema_import(struct corpus_schema *s,
+			 const struct corpus_schema *src, int src_id,
+			 int *idptr);
+
 /**
  * Scan an input value and add its data type to the schema.
  *
@@ -195,6 +252,24 @@ int corpus_schema_union(struct corpus_schema *s, int id1, int id2, int *idptr);
 int corpus_schema_scan(struct corpus_schema *s, const uint8_t *ptr,
 		       size_t size, int *idptr);
 
+/**
+ * Scan an input value and add its data type to the schema, as with
+ * #corpus_schema_scan. If the value is text, also get the text, whose
+ * attributes record whether it has escapes or non-ASCII characters.
+ *
+ * \param s the schema
+ * \param ptr the input buffer
+ * \param size the size (in bytes) of the input buffer
+ * \param idptr on exit, a pointer to the value's type ID
+ * \param textptr on exit, if the value is text, the validated text
+ * 	(without the surrounding quotes)
+ *
+ * \returns 0 on success
+ */
+int corpus_schema_scan_text(struct corpus_schema *s, const uint8_t *ptr,
+			    size_t size, int *idptr,
+			    struct utf8lite_text *textptr);
+
 /**
  * Render a textual representation of a data type.
  *
@@ -0,0 +1,931 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _POSIX_C_SOURCE 200112L // sysconf
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(CORPUS_HAVE_ZLIB)
+#  define ZLIB_CONST
+#  include <zlib.h>
+#endif
+
+#if defined(CORPUS_HAVE_ZSTD)
+#  include <zstd.h>
+#endif
+
+#if !(defined(_WIN32) || defined(_WIN64))
+#  define DECODER_THREADS
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+
+#include "array.h"
+#include "error.h"
+#include "memory.h"
+#include "decoder.h"
+
+/* Size of the read buffer for stream sources. */
+#define DECODER_INBUF_SIZE ((size_t)256 * 1024)
+
+/* Minimum amount of compressed input (in bytes) to give to a worker
+ * thread at once. Units consist of whole blocks or frames, so they can be
+ * larger than this. */
+#define DECODER_UNIT_SIZE ((size_t)1024 * 1024)
+
+/* Number of decoded units to buffer per worker thread. */
+#define DECODER_SLOT_PER_THREAD 2
+
+static int decoder_state_init(int type, void **stateptr);
+static void decoder_state_destroy(int type, void *state);
+static int decoder_state_read(int type, void *state, const uint8_t **srcptr,
+			      const uint8_t *src_end, uint8_t **dstptr,
+			      uint8_t *dst_end, int *doneptr);
+static int decoder_fill(struct corpus_decoder *d);
+static int decoder_source_done(const struct corpus_decoder *d);
+static int decoder_unsupported(int type);
+
+static size_t bgzf_block_size(const uint8_t *ptr, size_t size);
+static size_t zstd_frame_size(const uint8_t *ptr, size_t size);
+
+#if defined(DECODER_THREADS)
+
+enum decoder_slot_state {
+	SLOT_FREE = 0,
+	SLOT_BUSY,
+	SLOT_READY
+};
+
+struct decoder_slot {
+	uint8_t *buf;		// decoded data
+	size_t size;		// decoded data size
+	size_t size_max;	// buffer capacity
+	size_t pos;		// read position
+	uint64_t unit;		// unit number
+	int state;		// decoder_slot_state value
+	int error;		// decoding error, if any
+};
+
+struct corpus_decoder_pool {
+	int type;
+	pthread_t threads[CORPUS_DECODER_NTHREAD_MAX];
+	int nthread;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;	// signaled when a slot becomes free
+	pthread_cond_t done;	// signaled when a slot becomes ready
+
+	struct decoder_slot *slots;
+	int nslot;
+
+	const uint8_t *next;	// unclaimed compressed input
+	const uint8_t *end;	// end of compressed input
+	uint64_t next_unit;	// number of units claimed
+	uint64_t read_unit;	// number of units consumed
+	int stop;		// whether the workers should exit
+	int error;		// framing error, if any
+};
+
+static int pool_init(struct corpus_decoder_pool **poolptr, int type,
+		     const uint8_t *ptr, size_t size, int nthread);
+static void pool_destroy(struct corpus_decoder_pool *pool);
+static int pool_read(struct corpus_decoder_pool *pool, uint8_t *buf,
+		     size_t size, size_t *nreadptr);
+static void *pool_worker(void *arg);
+
+#endif /* DECODER_THREADS */
+
+
+int corpus_compress_detect(const uint8_t *ptr, size_t size)
+{
+	if (size >= 2 && ptr[0] == 0x1F && ptr[1] == 0x8B) {
+		return CORPUS_COMPRESS_GZIP;
+	}
+
+	if (size >= 4 && ptr[0] == 0x28 && ptr[1] == 0xB5 && ptr[2] == 0x2F
+			&& ptr[3] == 0xFD) {
+		return CORPUS_COMPRESS_ZSTD;
+	}
+
+	return CORPUS_COMPRESS_NONE;
+}
+
+
+const char *corpus_compress_name(int type)
+{
+	switch (type) {
+	case CORPUS_COMPRESS_NONE:
+		return "none";
+	case CORPUS_COMPRESS_GZIP:
+		return "gzip";
+	case CORPUS_COMPRESS_ZSTD:
+		return "zstd";
+	default:
+		return "unknown";
+	}
+}
+
+
+int corpus_decoder_init_stream(struct corpus_decoder *d, FILE *stream)
+{
+	size_t nread;
+	int err;
+
+	d->stream = stream;
+	d->state = NULL;
+	d->pool = NULL;
+	d->boundary = 0;
+	d->eof = 0;
+
+	d->inbuf_size = DECODER_INBUF_SIZE;
+	if (!(d->inbuf = corpus_malloc(d->inbuf_size))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating decoder read buffer");
+		goto inbuf_fail;
+	}
+
+	// read the first chunk to detect the format
+	nread = fread(d->inbuf, 1, d->inbuf_size, stream);
+	if (nread < d->inbuf_size && ferror(stream)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed reading from input stream: %s",
+			   strerror(errno));
+		goto read_fail;
+	}
+	d->src = d->inbuf;
+	d->src_end = d->inbuf + nread;
+
+	d->type = corpus_compress_detect(d->src, nread);
+	if (d->type != CORPUS_COMPRESS_NONE) {
+		if ((err = decoder_state_init(d->type, &d->state))) {
+			goto state_fail;
+		}
+	}
+
+	return 0;
+
+state_fail:
+read_fail:
+	corpus_free(d->inbuf);
+inbuf_fail:
+	corpus_log(err, "failed initializing decoder");
+	return err;
+}
+
+
+int corpus_decoder_init_buffer(struct corpus_decoder *d, int type,
+			       const uint8_t *ptr, size_t size, int nthread)
+{
+	size_t first;
+	int err;
+
+	d->type = type;
+	d->stream = NULL;
+	d->src = ptr;
+	d->src_end = ptr + size;
+	d->inbuf = NULL;
+	d->inbuf_size = 0;
+	d->state = NULL;
+	d->pool = NULL;
+	d->boundary = 0;
+	d->eof = 0;
+
+	if ((err = decoder_unsupported(type))) {
+		goto error;
+	}
+
+#if defined(DECODER_THREADS)
+	if (nthread <= 0) {
+		nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nthread > CORPUS_DECODER_NTHREAD_MAX) {
+		nthread = CORPUS_DECODER_NTHREAD_MAX;
+	}
+
+	// only decode in parallel if the input consists of multiple
+	// independent blocks
+	switch (type) {
+	case CORPUS_COMPRESS_GZIP:
+		first = bgzf_block_size(ptr, size);
+		break;
+	case CORPUS_COMPRESS_ZSTD:
+		first = zstd_frame_size(ptr, size);
+		break;
+	default:
+		first = 0;
+		break;
+	}
+
+	if (nthread > 1 && first > 0 && first < size) {
+		if ((err = pool_init(&d->pool, type, ptr, size, nthread))) {
+			goto error;
+		}
+		return 0;
+	}
+#else
+	(void)nthread;
+	(void)first;
+#endif
+
+	if (type != CORPUS_COMPRESS_NONE) {
+		if ((err = decoder_state_init(type, &d->state))) {
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	corpus_log(err, "failed initializing decoder");
+	return err;
+}
+
+
+void corpus_decoder_destroy(struct corpus_decoder *d)
+{
+#if defined(DECODER_THREADS)
+	if (d->pool) {
+		pool_destroy(d->pool);
+	}
+#endif
+	if (d->state) {
+		decoder_state_destroy(d->type, d->state);
+	}
+	corpus_free(d->inbuf);
+}
+
+
+int corpus_decoder_read(struct corpus_decoder *d, uint8_t *buf, size_t size,
+			size_t *nreadptr)
+{
+	uint8_t *dst = buf, *dst_end = buf + size;
+	uint8_t *start;
+	size_t n;
+	int err = 0;
+
+#if defined(DECODER_THREADS)
+	if (d->pool) {
+		return pool_read(d->pool, buf, size, nreadptr);
+	}
+#endif
+
+	while (dst != dst_end && !d->eof) {
+		if (d->src == d->src_end && !decoder_source_done(d)) {
+			if ((err = decoder_fill(d))) {
+				break;
+			}
+			continue;
+		}
+
+		if (d->type == CORPUS_COMPRESS_NONE) {
+			if (d->src == d->src_end) {
+				d->eof = 1;
+				break;
+			}
+			n = (size_t)(d->src_end - d->src);
+			if (n > (size_t)(dst_end - dst)) {
+				n = (size_t)(dst_end - dst);
+			}
+			memcpy(dst, d->src, n);
+			d->src += n;
+			dst += n;
+			continue;
+		}
+
+		// the input may only end at a frame or member boundary
+		if (d->src == d->src_end && d->boundary) {
+			d->eof = 1;
+			break;
+		}
+
+		start = dst;
+		if ((err = decoder_state_read(d->type, d->state, &d->src,
+					      d->src_end, &dst, dst_end,
+					      &d->boundary))) {
+			break;
+		}
+
+		if (dst == start && !d->boundary && d->src == d->src_end
+				&& decoder_source_done(d)) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "%s input is truncated",
+				   corpus_compress_name(d->type));
+			break;
+		}
+	}
+
+	*nreadptr = (size_t)(dst - buf);
+	return err;
+}
+
+
+int decoder_fill(struct corpus_decoder *d)
+{
+	size_t nread;
+	int err;
+
+	assert(d->stream);
+
+	nread = fread(d->inbuf, 1, d->inbuf_size, d->stream);
+	if (nread < d->inbuf_size && ferror(d->stream)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed reading from input stream: %s",
+			   strerror(errno));
+		return err;
+	}
+
+	d->src = d->inbuf;
+	d->src_end = d->inbuf + nread;
+	return 0;
+}
+
+
+int decoder_source_done(const struct corpus_decoder *d)
+{
+	if (d->src != d->src_end) {
+		return 0;
+	}
+	return d->stream ? feof(d->stream) : 1;
+}
+
+
+int decoder_unsupported(int type)
+{
+	int err = 0;
+
+	switch (type) {
+	case CORPUS_COMPRESS_NONE:
+		break;
+	case CORPUS_COMPRESS_GZIP:
+#if !defined(CORPUS_HAVE_ZLIB)
+		err = CORPUS_ERROR_INVAL;
+#endif
+		break;
+	case CORPUS_COMPRESS_ZSTD:
+#if !defined(CORPUS_HAVE_ZSTD)
+		err = CORPUS_ERROR_INVAL;
+#endif
+		break;
+	default:
+		err = CORPUS_ERROR_INVAL;
+		break;
+	}
+
+	if (err) {
+		corpus_log(err, "input is compressed with %s, which is not"
+			   " supported by this build",
+			   corpus_compress_name(type));
+	}
+	return err;
+}
+
+
+/*
+ * Decompression state
+ */
+
+int decoder_state_init(int type, void **stateptr)
+{
+	int err;
+
+	if ((err = decoder_unsupported(type))) {
+		return err;
+	}
+
+	switch (type) {
+#if defined(CORPUS_HAVE_ZLIB)
+	case CORPUS_COMPRESS_GZIP: {
+		z_stream *z;
+
+		if (!(z = corpus_calloc(1, sizeof(*z)))) {
+			err = CORPUS_ERROR_NOMEM;
+			break;
+		}
+		// window bits 15, plus 16 to expect a gzip wrapper
+		if (inflateInit2(z, 15 + 16) != Z_OK) {
+			corpus_free(z);
+			err = CORPUS_ERROR_NOMEM;
+			break;
+		}
+		*stateptr = z;
+		break;
+	}
+#endif
+#if defined(CORPUS_HAVE_ZSTD)
+	case CORPUS_COMPRESS_ZSTD: {
+		ZSTD_DStream *ds;
+
+		if (!(ds = ZSTD_createDStream())) {
+			err = CORPUS_ERROR_NOMEM;
+			break;
+		}
+		ZSTD_initDStream(ds);
+		*stateptr = ds;
+		break;
+	}
+#endif
+	default:
+		(void)stateptr;
+		err = CORPUS_ERROR_INTERNAL;
+		break;
+	}
+
+	if (err) {
+		corpus_log(err, "failed initializing %s decompression state",
+			   corpus_compress_name(type));
+	}
+	return err;
+}
+
+
+void decoder_state_destroy(int type, void *state)
+{
+	switch (type) {
+#if defined(CORPUS_HAVE_ZLIB)
+	case CORPUS_COMPRESS_GZIP:
+		inflateEnd(state);
+		corpus_free(state);
+		break;
+#endif
+#if defined(CORPUS_HAVE_ZSTD)
+	case CORPUS_COMPRESS_ZSTD:
+		ZSTD_freeDStream(state);
+		break;
+#endif
+	default:
+		(void)state;
+		break;
+	}
+}
+
+
+/*
+ * Decompress from [*srcptr, src_end) into [*dstptr, dst_end), advancing
+ * both pointers. On exit, `*doneptr` is nonzero if the decoder is at a
+ * frame or member boundary (so that it is safe for the input to end).
+ */
+int decoder_state_read(int type, void *state, const uint8_t **srcptr,
+		       const uint8_t *src_end, uint8_t **dstptr,
+		       uint8_t *dst_end, int *doneptr)
+{
+	int err = 0;
+
+	*doneptr = 0;
+
+	switch (type) {
+#if defined(CORPUS_HAVE_ZLIB)
+	case CORPUS_COMPRESS_GZIP: {
+		z_stream *z = state;
+		size_t nsrc = (size_t)(src_end - *srcptr);
+		size_t ndst = (size_t)(dst_end - *dstptr);
+		int ret;
+
+		z->next_in = *srcptr;
+		z->avail_in = (uInt)(nsrc > UINT_MAX ? UINT_MAX : nsrc);
+		z->next_out = *dstptr;
+		z->avail_out = (uInt)(ndst > UINT_MAX ? UINT_MAX : ndst);
+
+		ret = inflate(z, Z_NO_FLUSH);
+
+		*srcptr = z->next_in;
+		*dstptr = z->next_out;
+
+		if (ret == Z_STREAM_END) {
+			// prepare for the next member, if any
+			inflateReset(z);
+			*doneptr = 1;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "failed decompressing gzip input: %s",
+				   z->msg ? z->msg : "unknown error");
+		}
+		break;
+	}
+#endif
+#if defined(CORPUS_HAVE_ZSTD)
+	case CORPUS_COMPRESS_ZSTD: {
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+		size_t ret;
+
+		in.src = *srcptr;
+		in.size = (size_t)(src_end - *srcptr);
+		in.pos = 0;
+		out.dst = *dstptr;
+		out.size = (size_t)(dst_end - *dstptr);
+		out.pos = 0;
+
+		ret = ZSTD_decompressStream(state, &out, &in);
+
+		*srcptr += in.pos;
+		*dstptr += out.pos;
+
+		if (ZSTD_isError(ret)) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "failed decompressing zstd input: %s",
+				   ZSTD_getErrorName(ret));
+		} else if (ret == 0) {
+			*doneptr = 1;
+		}
+		break;
+	}
+#endif
+	default:
+		(void)state;
+		(void)srcptr;
+		(void)src_end;
+		(void)dstptr;
+		(void)dst_end;
+		err = CORPUS_ERROR_INTERNAL;
+		corpus_log(err, "unsupported compression format");
+		break;
+	}
+
+	return err;
+}
+
+
+/*
+ * Block framing
+ */
+
+/*
+ * Get the size of the BGZF block at the start of the data, or 0 if the
+ * data does not start with a BGZF block. BGZF blocks are gzip members
+ * with an extra field ('B', 'C') that records the block size.
+ */
+size_t bgzf_block_size(const uint8_t *ptr, size_t size)
+{
+	size_t xlen, off, slen, bsize;
+
+	// ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2)
+	if (size < 12 || ptr[0] != 0x1F || ptr[1] != 0x8B || ptr[2] != 8
+			|| !(ptr[3] & 0x04)) {
+		return 0;
+	}
+
+	xlen = (size_t)ptr[10] | ((size_t)ptr[11] << 8);
+	if (size < 12 + xlen) {
+		return 0;
+	}
+
+	for (off = 12; off + 4 <= 12 + xlen; off += 4 + slen) {
+		slen = (size_t)ptr[off + 2] | ((size_t)ptr[off + 3] << 8);
+		if (ptr[off] == 'B' && ptr[off + 1] == 'C' && slen == 2
+				&& off + 6 <= 12 + xlen) {
+			bsize = ((size_t)ptr[off + 4]
+				 | ((size_t)ptr[off + 5] << 8)) + 1;
+			return (bsize <= size && bsize > 12 + xlen) ? bsize
+								    : 0;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Get the size of the zstd frame at the start of the data, or 0 if the
+ * data does not start with a complete frame.
+ */
+size_t zstd_frame_size(const uint8_t *ptr, size_t size)
+{
+#if defined(CORPUS_HAVE_ZSTD)
+	size_t ret = ZSTD_findFrameCompressedSize(ptr, size);
+	return ZSTD_isError(ret) ? 0 : ret;
+#else
+	(void)ptr;
+	(void)size;
+	return 0;
+#endif
+}
+
+
+#if defined(DECODER_THREADS)
+
+/*
+ * Parallel decoding
+ *
+ * The workers claim units of consecutive blocks in order, and decode
+ * each one into a slot in a ring buffer; the reader consumes the slots
+ * in the same order. A worker only claims unit `i` once the reader has
+ * finished with unit `i - nslot`, which bounds the memory use.
+ */
+
+int pool_init(struct corpus_decoder_pool **poolptr, int type,
+	      const uint8_t *ptr, size_t size, int nthread)
+{
+	struct corpus_decoder_pool *pool;
+	int i, err;
+
+	if (!(pool = corpus_calloc(1, sizeof(*pool)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto alloc_fail;
+	}
+
+	pool->type = type;
+	pool->next = ptr;
+	pool->end = ptr + size;
+	pool->nslot = DECODER_SLOT_PER_THREAD * nthread;
+
+	if (!(pool->slots = corpus_calloc((size_t)pool->nslot,
+					  sizeof(*pool->slots)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto slots_fail;
+	}
+
+	if (pthread_mutex_init(&pool->mutex, NULL)) {
+		err = CORPUS_ERROR_OS;
+		goto mutex_fail;
+	}
+	if (pthread_cond_init(&pool->work, NULL)) {
+		err = CORPUS_ERROR_OS;
+		goto work_fail;
+	}
+	if (pthread_cond_init(&pool->done, NULL)) {
+		err = CORPUS_ERROR_OS;
+		goto done_fail;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if (pthread_create(&pool->threads[i], NULL, pool_worker,
+				   pool)) {
+			break;
+		}
+		pool->nthread++;
+	}
+	if (pool->nthread == 0) {
+		err = CORPUS_ERROR_OS;
+		goto thread_fail;
+	}
+
+	*poolptr = pool;
+	return 0;
+
+thread_fail:
+	pthread_cond_destroy(&pool->done);
+done_fail:
+	pthread_cond_destroy(&pool->work);
+work_fail:
+	pthread_mutex_destroy(&pool->mutex);
+mutex_fail:
+	corpus_free(pool->slots);
+slots_fail:
+	corpus_free(pool);
+alloc_fail:
+	corpus_log(err, "failed initializing decoder threads");
+	return err;
+}
+
+
+void pool_destroy(struct corpus_decoder_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nthread; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	for (i = 0; i < pool->nslot; i++) {
+		corpus_free(pool->slots[i].buf);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	corpus_free(pool->slots);
+	corpus_free(pool);
+}
+
+
+int pool_read(struct corpus_decoder_pool *pool, uint8_t *buf, size_t size,
+	      size_t *nreadptr)
+{
+	struct decoder_slot *slot;
+	size_t n, nread = 0;
+	int err = 0;
+
+	while (nread < size) {
+		slot = &pool->slots[pool->read_unit % (uint64_t)pool->nslot];
+
+		pthread_mutex_lock(&pool->mutex);
+		while (!(slot->state == SLOT_READY
+				&& slot->unit == pool->read_unit)) {
+			if (pool->read_unit == pool->next_unit
+					&& pool->next == pool->end) {
+				err = pool->error;
+				break;
+			}
+			pthread_cond_wait(&pool->done, &pool->mutex);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (slot->state != SLOT_READY
+				|| slot->unit != pool->read_unit) {
+			break; // end of input
+		}
+
+		if ((err = slot->error)) {
+			break;
+		}
+
+		n = slot->size - slot->pos;
+		if (n > size - nread) {
+			n = size - nread;
+		}
+		memcpy(buf + nread, slot->buf + slot->pos, n);
+		slot->pos += n;
+		nread += n;
+
+		if (slot->pos == slot->size) {
+			pthread_mutex_lock(&pool->mutex);
+			slot->state = SLOT_FREE;
+			pool->read_unit++;
+			pthread_cond_broadcast(&pool->work);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+	}
+
+	*nreadptr = nread;
+	return err;
+}
+
+
+/*
+ * Find the end of the next unit of whole blocks, starting at `ptr`.
+ */
+static int pool_scan_unit(const struct corpus_decoder_pool *pool,
+			  const uint8_t *ptr, const uint8_t **stopptr)
+{
+	const uint8_t *start = ptr;
+	size_t size;
+	int err;
+
+	while (ptr != pool->end && (size_t)(ptr - start) < DECODER_UNIT_SIZE) {
+		if (pool->type == CORPUS_COMPRESS_GZIP) {
+			size = bgzf_block_size(ptr, (size_t)(pool->end - ptr));
+		} else {
+			size = zstd_frame_size(ptr, (size_t)(pool->end - ptr));
+		}
+
+		if (size == 0) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "%s input has an invalid or"
+				   " truncated block",
+				   corpus_compress_name(pool->type));
+			return err;
+		}
+		ptr += size;
+	}
+
+	*stopptr = ptr;
+	return 0;
+}
+
+
+/*
+ * Decode a unit into a slot, growing the slot's buffer as necessary.
+ */
+static int pool_decode_unit(int type, void *state, const uint8_t *ptr,
+			    const uint8_t *end, struct decoder_slot *slot)
+{
+	void *base;
+	uint8_t *dst, *start;
+	int done = 1, err;
+
+	slot->size = 0;
+	slot->pos = 0;
+
+	while (ptr != end) {
+		if (slot->size == slot->size_max) {
+			base = slot->buf;
+			if ((err = corpus_bigarray_grow(&base, &slot->size_max,
+							1, slot->size,
+							(size_t)(end - ptr)))) {
+				return err;
+			}
+			slot->buf = base;
+		}
+
+		dst = slot->buf + slot->size;
+		if ((err = decoder_state_read(type, state, &ptr, end, &dst,
+					      slot->buf + slot->size_max,
+					      &done))) {
+			return err;
+		}
+		slot->size = (size_t)(dst - slot->buf);
+	}
+
+	// flush any output still buffered in the decompression state
+	while (!done) {
+		start = slot->buf + slot->size;
+		if (slot->size == slot->size_max) {
+			base = slot->buf;
+			if ((err = corpus_bigarray_grow(&base, &slot->size_max,
+							1, slot->size, 1))) {
+				return err;
+			}
+			slot->buf = base;
+		}
+
+		dst = slot->buf + slot->size;
+		if ((err = decoder_state_read(type, state, &ptr, end, &dst,
+					      slot->buf + slot->size_max,
+					      &done))) {
+			return err;
+		}
+		if (dst == start && !done) {
+			err = CORPUS_ERROR_INVAL;
+			corpus_log(err, "%s input is truncated",
+				   corpus_compress_name(type));
+			return err;
+		}
+		slot->size = (size_t)(dst - slot->buf);
+	}
+
+	return 0;
+}
+
+
+void *pool_worker(void *arg)
+{
+	struct corpus_decoder_pool *pool = arg;
+	struct decoder_slot *slot;
+	const uint8_t *start, *stop;
+	void *state = NULL;
+	int err;
+
+	err = decoder_state_init(pool->type, &state);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (err) {
+		pool->error = err;
+		pool->next = pool->end;
+		pthread_cond_broadcast(&pool->done);
+	}
+
+	for (;;) {
+		slot = &pool->slots[pool->next_unit % (uint64_t)pool->nslot];
+		while (!pool->stop && pool->next != pool->end
+				&& slot->state != SLOT_FREE) {
+			pthread_cond_wait(&pool->work, &pool->mutex);
+			slot = &pool->slots[pool->next_unit
+					    % (uint64_t)pool->nslot];
+		}
+		if (pool->stop || pool->next == pool->end) {
+			break;
+		}
+
+		start = pool->next;
+		if ((err = pool_scan_unit(pool, start, &stop))) {
+			pool->error = err;
+			pool->next = pool->end;
+			pthread_cond_broadcast(&pool->done);
+			break;
+		}
+
+		slot->state = SLOT_BUSY;
+		slot->unit = pool->next_unit;
+		pool->next = stop;
+		pool->next_unit++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		err = pool_decode_unit(pool->type, state, start, stop, slot);
+
+		pthread_mutex_lock(&pool->mutex);
+		slot->error = err;
+		slot->state = SLOT_READY;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (state) {
+		decoder_state_destroy(pool->type, state);
+	}
+	return NULL;
+}
+
+#endif /* DECODER_THREADS */
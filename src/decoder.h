@@ -0,0 +1,157 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CORPUS_DECODER_H
+#define CORPUS_DECODER_H
+
+/**
+ * \file decoder.h
+ *
+ * Decoder for compressed input.
+ *
+ * Support for each compression format is optional, and depends on the
+ * libraries available at build time: gzip requires zlib (define
+ * `CORPUS_HAVE_ZLIB`), and zstd requires libzstd (define
+ * `CORPUS_HAVE_ZSTD`).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Compression format.
+ */
+enum corpus_compress_type {
+	CORPUS_COMPRESS_NONE = 0,	/**< uncompressed */
+	CORPUS_COMPRESS_GZIP,		/**< gzip, possibly with multiple
+					  members (including BGZF) */
+	CORPUS_COMPRESS_ZSTD		/**< zstd, possibly with multiple
+					  frames */
+};
+
+/**
+ * Number of leading bytes needed to detect the compression format.
+ */
+#define CORPUS_COMPRESS_MAGIC_SIZE 4
+
+/**
+ * Maximum number of threads for parallel decoding.
+ */
+#define CORPUS_DECODER_NTHREAD_MAX 8
+
+struct corpus_decoder_pool;
+
+/**
+ * Decoder, reading decompressed data from a compressed source. The
+ * source is either an input stream, or an in-memory buffer (for example,
+ * a memory-mapped file). For in-memory gzip files made of independent
+ * BGZF blocks, and for in-memory zstd files with multiple frames, the
+ * decoder decompresses runs of blocks on several threads ahead of the
+ * reader.
+ */
+struct corpus_decoder {
+	int type;		/**< the compression format, a
+				  #corpus_compress_type value */
+
+	FILE *stream;		/**< the source stream, or `NULL` */
+	const uint8_t *src;	/**< the pending compressed input */
+	const uint8_t *src_end;	/**< the end of the pending input */
+
+	uint8_t *inbuf;		/**< the read buffer, for stream sources */
+	size_t inbuf_size;	/**< the read buffer capacity */
+
+	void *state;		/**< the decompression state, for sequential
+				  decoding */
+	struct corpus_decoder_pool *pool; /**< the worker pool, for
+					    parallel decoding */
+	int boundary;		/**< whether the decompression state is at a
+				  frame or member boundary */
+	int eof;		/**< whether the decoded data is exhausted */
+};
+
+/**
+ * Detect the compression format from the leading bytes of the data.
+ *
+ * \param ptr the data
+ * \param size the data size, in bytes
+ *
+ * \returns a #corpus_compress_type value
+ */
+int corpus_compress_detect(const uint8_t *ptr, size_t size);
+
+/**
+ * Get the name of a compression format.
+ *
+ * \param type a #corpus_compress_type value
+ *
+ * \returns the name
+ */
+const char *corpus_compress_name(int type);
+
+/**
+ * Initialize a decoder for an input stream. The decoder reads the
+ * leading bytes of the stream to detect the compression format; if the
+ * stream is not compressed, the decoder passes the data through
+ * unchanged.
+ *
+ * \param d the decoder
+ * \param stream the input stream
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the stream is compressed
+ * 	in a format that this build does not support
+ */
+int corpus_decoder_init_stream(struct corpus_decoder *d, FILE *stream);
+
+/**
+ * Initialize a decoder for compressed data held in memory.
+ *
+ * \param d the decoder
+ * \param type the compression format, a #corpus_compress_type value
+ * \param ptr the compressed data
+ * \param size the compressed data size, in bytes
+ * \param nthread the maximum number of decoding threads, or 0 to choose
+ * 	based on the number of processors
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if this build does not
+ * 	support the compression format
+ */
+int corpus_decoder_init_buffer(struct corpus_decoder *d, int type,
+			       const uint8_t *ptr, size_t size, int nthread);
+
+/**
+ * Release a decoder's resources, stopping any worker threads. This does
+ * not close the source stream.
+ *
+ * \param d the decoder
+ */
+void corpus_decoder_destroy(struct corpus_decoder *d);
+
+/**
+ * Read decoded data.
+ *
+ * \param d the decoder
+ * \param buf the destination buffer
+ * \param size the destination buffer size, in bytes
+ * \param nreadptr on exit, the number of bytes read; a value less than
+ * 	`size` indicates the end of the data
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL for corrupt input, or
+ * 	#CORPUS_ERROR_OS if reading from the stream fails
+ */
+int corpus_decoder_read(struct corpus_decoder *d, uint8_t *buf, size_t size,
+			size_t *nreadptr);
+
+#endif /* CORPUS_DECODER_H */
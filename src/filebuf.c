@@ -15,6 +15,8 @@
  */
 
 #define _FILE_OFFSET_BITS 64	// enable large file support
+#define _DEFAULT_SOURCE		// madvise, posix_fadvise (glibc)
+#define _DARWIN_C_SOURCE	// madvise (macOS)
 
 #include <assert.h>
 #include <errno.h>
@@ -23,11 +25,24 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#include "array.h"
 #include "error.h"
 #include "memory.h"
 #include "filebuf.h"
 
+static int filebuf_index_load(struct corpus_filebuf *buf);
+static void filebuf_index_destroy(struct corpus_filebuf_index *index);
+static uint64_t filebuf_line_offset(const struct corpus_filebuf *buf,
+				    uint64_t i);
+
 
 #if (defined(_WIN32) || defined(_WIN64))
 
@@ -100,9 +115,22 @@ int corpus_filebuf_init(struct corpus_filebuf *buf, const char *file_name)
 		buf->map_addr = NULL;
 	}
 
+	buf->access = CORPUS_FILEBUF_NORMAL;
+	buf->window = CORPUS_FILEBUF_WINDOW;
+
+	if ((err = filebuf_index_load(buf))) {
+		goto index_fail;
+	}
+
 	err = 0;
 	goto out;
 
+index_fail:
+	if (buf->map_addr) {
+		UnmapViewOfFile(buf->map_addr);
+	}
+	CloseHandle(handle);
+	goto open_fail;
 view_fail:
 	CloseHandle(mapping);
 mapping_fail:
@@ -118,6 +146,9 @@ out:
 
 void corpus_filebuf_destroy(struct corpus_filebuf *buf)
 {
+	if (buf->has_index) {
+		filebuf_index_destroy(&buf->index);
+	}
 	if (buf->map_addr) {
 		UnmapViewOfFile(buf->map_addr);
 	}
@@ -126,6 +157,35 @@ void corpus_filebuf_destroy(struct corpus_filebuf *buf)
 }
 
 
+static void filebuf_advise_sequential(struct corpus_filebuf *buf, int on)
+{
+	(void)buf;
+	(void)on;
+}
+
+
+static void filebuf_iter_advise(struct corpus_filebuf_iter *it,
+				const uint8_t *keep)
+{
+	(void)keep;
+	it->advise_ptr = it->end;
+}
+
+
+int corpus_filebuf_replace(const char *temp_name, const char *file_name)
+{
+	int err;
+
+	if (!MoveFileExA(temp_name, file_name, MOVEFILE_REPLACE_EXISTING)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed replacing file (%s)", file_name);
+		DeleteFileA(temp_name);
+		return err;
+	}
+	return 0;
+}
+
+
 #else /* POSIX */
 
 
@@ -190,9 +250,20 @@ int corpus_filebuf_init(struct corpus_filebuf *buf, const char *file_name)
 		buf->map_addr = NULL;
 	}
 
+	buf->access = CORPUS_FILEBUF_NORMAL;
+	buf->window = CORPUS_FILEBUF_WINDOW;
+
+	if ((err = filebuf_index_load(buf))) {
+		goto index_fail;
+	}
+
 	err = 0;
 	goto out;
 
+index_fail:
+	if (buf->map_addr) {
+		munmap(buf->map_addr, buf->map_size);
+	}
 mmap_fail:
 fstat_fail:
 	close((int)buf->handle);
@@ -207,6 +278,9 @@ out:
 
 void corpus_filebuf_destroy(struct corpus_filebuf *buf)
 {
+	if (buf->has_index) {
+		filebuf_index_destroy(&buf->index);
+	}
 	if (buf->map_addr) {
 		//fprintf(stderr, "unmaping %"PRIu64" bytes from address %p\n",
 		//        (uint64_t)buf->map_size, buf->map_addr);
@@ -219,31 +293,275 @@ void corpus_filebuf_destroy(struct corpus_filebuf *buf)
 }
 
 
+static void filebuf_advise_sequential(struct corpus_filebuf *buf, int on)
+{
+	if (!buf->map_addr) {
+		return;
+	}
+
+	// failures here are harmless; the hints are only advisory
+#if defined(MADV_SEQUENTIAL) && defined(MADV_NORMAL)
+	(void)madvise(buf->map_addr, buf->map_size,
+		      on ? MADV_SEQUENTIAL : MADV_NORMAL);
+#endif
+#if defined(POSIX_FADV_SEQUENTIAL) && defined(POSIX_FADV_NORMAL)
+	(void)posix_fadvise((int)buf->handle, 0, 0,
+			    on ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+}
+
+
+/*
+ * Issue the prefetch and drop-behind hints for an iterator's current
+ * position, then schedule the next hint for half a window later. The
+ * drop-behind hint stops short of `keep`, the start of the lines that
+ * the iterator just returned.
+ */
+static void filebuf_iter_advise(struct corpus_filebuf_iter *it,
+				const uint8_t *keep)
+{
+	const struct corpus_filebuf *buf = it->buf;
+	const uint8_t *base = (const uint8_t *)buf->map_addr;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t window = buf->window;
+	size_t lo, hi;
+
+	if (buf->access & CORPUS_FILEBUF_PREFETCH) {
+		lo = (size_t)(it->ptr - base) & ~(page - 1);
+		hi = (size_t)(it->end - base);
+		if (hi - lo > window) {
+			hi = lo + window;
+		}
+#if defined(MADV_WILLNEED)
+		if (hi > lo) {
+			(void)madvise((void *)(base + lo), hi - lo,
+				      MADV_WILLNEED);
+		}
+#endif
+	}
+
+	if (buf->access & CORPUS_FILEBUF_DROPBEHIND) {
+		// only release pages that lie entirely before the lines
+		// that the iterator just returned
+		lo = ((size_t)(it->drop_ptr - base) + page - 1) & ~(page - 1);
+		hi = (size_t)(keep - base) & ~(page - 1);
+		if (hi > lo) {
+#if defined(MADV_DONTNEED)
+			(void)madvise((void *)(base + lo), hi - lo,
+				      MADV_DONTNEED);
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+			(void)posix_fadvise((int)buf->handle, (off_t)lo,
+					    (off_t)(hi - lo),
+					    POSIX_FADV_DONTNEED);
+#endif
+			it->drop_ptr = base + hi;
+		}
+	}
+
+	if ((size_t)(it->end - it->ptr) > window / 2) {
+		it->advise_ptr = it->ptr + window / 2;
+	} else {
+		it->advise_ptr = it->end;
+	}
+}
+
+
+int corpus_filebuf_replace(const char *temp_name, const char *file_name)
+{
+	int err;
+
+	if (rename(temp_name, file_name) < 0) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed replacing file (%s): %s", file_name,
+			   strerror(errno));
+		remove(temp_name);
+		return err;
+	}
+	return 0;
+}
+
 #endif /* end of platform-specific code */ 
 
 
+void corpus_filebuf_set_access(struct corpus_filebuf *buf, int access,
+			       size_t window)
+{
+	int sequential = (access & CORPUS_FILEBUF_SEQUENTIAL) ? 1 : 0;
+
+	if (sequential != ((buf->access & CORPUS_FILEBUF_SEQUENTIAL) ? 1 : 0)) {
+		filebuf_advise_sequential(buf, sequential);
+	}
+
+	buf->access = access;
+	buf->window = window ? window : CORPUS_FILEBUF_WINDOW;
+}
+
+
 void corpus_filebuf_iter_make(struct corpus_filebuf_iter *it,
 			      const struct corpus_filebuf *buf)
 {
+	it->buf = buf;
 	it->begin = (uint8_t *)buf->map_addr;
 	it->end = it->begin + (size_t)buf->file_size;
 	corpus_filebuf_iter_reset(it);
 }
 
 
+/*
+ * Find the start of the first line beginning at or after the given
+ * offset. A line begins at offset 0 or immediately after a newline.
+ */
+static const uint8_t *filebuf_line_start(const struct corpus_filebuf *buf,
+					 uint64_t offset)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	const uint8_t *end = begin + (size_t)buf->file_size;
+	const uint8_t *ptr;
+
+	if (offset == 0) {
+		return begin;
+	}
+	if (offset >= buf->file_size) {
+		return end;
+	}
+
+	// start the search at the byte before the offset; if that byte is
+	// a newline, then the line starts exactly at the offset
+	ptr = begin + (size_t)(offset - 1);
+	ptr = memchr(ptr, '\n', (size_t)(end - ptr));
+
+	return ptr ? ptr + 1 : end;
+}
+
+
+void corpus_filebuf_iter_make_range(struct corpus_filebuf_iter *it,
+				    const struct corpus_filebuf *buf,
+				    uint64_t start, uint64_t stop)
+{
+	assert(start <= stop);
+
+	it->buf = buf;
+	it->begin = filebuf_line_start(buf, start);
+	it->end = filebuf_line_start(buf, stop);
+	corpus_filebuf_iter_reset(it);
+}
+
+
+/*
+ * Compute floor(size * i / n) without overflowing on large files.
+ */
+static uint64_t filebuf_split_offset(uint64_t size, int i, int n)
+{
+	uint64_t q = size / (uint64_t)n;
+	uint64_t r = size % (uint64_t)n;
+
+	return q * (uint64_t)i + (r * (uint64_t)i) / (uint64_t)n;
+}
+
+
+void corpus_filebuf_split(const struct corpus_filebuf *buf,
+			  struct corpus_filebuf_iter *its, int n)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	uint64_t line, offset;
+	int i;
+
+	assert(n > 0);
+
+	for (i = 0; i < n; i++) {
+		// each range starts where the previous one ends
+		its[i].buf = buf;
+		its[i].begin = (i == 0) ? begin : its[i - 1].end;
+
+		if (buf->has_index) {
+			line = filebuf_split_offset(buf->index.nline, i + 1, n);
+			offset = filebuf_line_offset(buf, line);
+			its[i].end = begin + (size_t)offset;
+		} else {
+			offset = filebuf_split_offset(buf->file_size, i + 1, n);
+			its[i].end = filebuf_line_start(buf, offset);
+		}
+
+		corpus_filebuf_iter_reset(&its[i]);
+	}
+}
+
+
 void corpus_filebuf_iter_reset(struct corpus_filebuf_iter *it)
 {
 	it->ptr = it->begin;
+	it->advise_ptr = it->begin;
+	it->drop_ptr = it->begin;
 	it->current.ptr = NULL;
 	it->current.size = 0;
 }
 
 
+/*
+ * Find the first newline in [ptr, end), returning `end` if none exists.
+ *
+ * When SSE2 or AVX2 is available at compile time, we compare a full
+ * vector of bytes at a time and use the movemask to locate the first
+ * match. Otherwise, we defer to the C library's memchr, which is usually
+ * vectorized already.
+ */
+static const uint8_t *filebuf_find_newline(const uint8_t *ptr,
+					   const uint8_t *end)
+{
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+	unsigned mask;
+
+#  if defined(__AVX2__)
+	const __m256i nl32 = _mm256_set1_epi8('\n');
+	__m256i chunk32;
+
+	while (end - ptr >= 32) {
+		chunk32 = _mm256_loadu_si256((const __m256i *)ptr);
+		mask = (unsigned)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(chunk32, nl32));
+		if (mask) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 32;
+	}
+#  endif
+	const __m128i nl16 = _mm_set1_epi8('\n');
+	__m128i chunk16;
+
+	while (end - ptr >= 16) {
+		chunk16 = _mm_loadu_si128((const __m128i *)ptr);
+		mask = (unsigned)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(chunk16, nl16));
+		if (mask) {
+			return ptr + __builtin_ctz(mask);
+		}
+		ptr += 16;
+	}
+
+	while (ptr != end) {
+		if (*ptr == '\n') {
+			return ptr;
+		}
+		ptr++;
+	}
+	return end;
+#else
+	const uint8_t *nl;
+
+	if (ptr == end) {
+		return end;
+	}
+	nl = memchr(ptr, '\n', (size_t)(end - ptr));
+	return nl ? nl : end;
+#endif
+}
+
+
 int corpus_filebuf_iter_advance(struct corpus_filebuf_iter *it)
 {
 	const uint8_t *ptr = it->ptr;
 	const uint8_t *end = it->end;
-	uint_fast8_t ch;
 
 	if (ptr == end) {
 		it->current.ptr = NULL;
@@ -253,12 +571,696 @@ int corpus_filebuf_iter_advance(struct corpus_filebuf_iter *it)
 
 	it->current.ptr = ptr;
 
-	do {
-	       ch = *ptr++;
-	} while (ch != '\n' && ptr != end);
+	ptr = filebuf_find_newline(ptr, end);
+	if (ptr != end) {
+		ptr++; // include the trailing newline
+	}
 
 	it->current.size = (size_t)(ptr - it->current.ptr);
 	it->ptr = ptr;
 
+	if (it->buf->access && ptr >= it->advise_ptr) {
+		filebuf_iter_advise(it, it->current.ptr);
+	}
+
+	return 1;
+}
+
+
+int corpus_filebuf_iter_advance_lines(struct corpus_filebuf_iter *it,
+				      struct corpus_filebuf_line *lines,
+				      int nmax)
+{
+	const uint8_t *ptr = it->ptr;
+	const uint8_t *end = it->end;
+	const uint8_t *start;
+	int n = 0;
+
+	while (n < nmax && ptr != end) {
+		start = ptr;
+		ptr = filebuf_find_newline(ptr, end);
+		if (ptr != end) {
+			ptr++;
+		}
+		lines[n].ptr = start;
+		lines[n].size = (size_t)(ptr - start);
+		n++;
+	}
+
+	it->ptr = ptr;
+	if (it->buf->access && ptr >= it->advise_ptr) {
+		filebuf_iter_advise(it, n > 0 ? lines[0].ptr : ptr);
+	}
+
+	if (n > 0) {
+		it->current = lines[n - 1];
+	} else {
+		it->current.ptr = NULL;
+		it->current.size = 0;
+	}
+
+	return n;
+}
+
+
+/*
+ * Skip over the next `n` lines, returning the start of the line after
+ * them, or `end` if there are fewer than `n` lines.
+ */
+static const uint8_t *filebuf_skip_lines(const uint8_t *ptr,
+					 const uint8_t *end, uint64_t n)
+{
+	while (n > 0 && ptr != end) {
+		ptr = filebuf_find_newline(ptr, end);
+		if (ptr != end) {
+			ptr++;
+		}
+		n--;
+	}
+	return ptr;
+}
+
+
+static int filebuf_index_get(const struct corpus_filebuf *buf, uint64_t i,
+			     uint64_t *offsetptr, uint64_t *sizeptr);
+
+
+/*
+ * Get the byte offset of the start of line `i`, or the file size if
+ * the file has `i` or fewer lines.
+ */
+uint64_t filebuf_line_offset(const struct corpus_filebuf *buf, uint64_t i)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	const uint8_t *end = begin + (size_t)buf->file_size;
+	uint64_t offset, size;
+
+	if (buf->has_index) {
+		if (i >= buf->index.nline) {
+			return buf->file_size;
+		}
+		if (filebuf_index_get(buf, i, &offset, &size)) {
+			return offset;
+		}
+	}
+
+	return (uint64_t)(filebuf_skip_lines(begin, end, i) - begin);
+}
+
+
+int corpus_filebuf_line(const struct corpus_filebuf *buf, uint64_t i,
+			struct corpus_filebuf_line *lineptr)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	const uint8_t *end = begin + (size_t)buf->file_size;
+	const uint8_t *ptr, *next;
+	uint64_t offset, size;
+
+	if (buf->has_index) {
+		if (i >= buf->index.nline) {
+			goto none;
+		}
+		if (filebuf_index_get(buf, i, &offset, &size)) {
+			lineptr->ptr = begin + (size_t)offset;
+			lineptr->size = (size_t)size;
+			return 1;
+		}
+	}
+
+	ptr = filebuf_skip_lines(begin, end, i);
+	if (ptr == end) {
+		goto none;
+	}
+
+	next = filebuf_find_newline(ptr, end);
+	if (next != end) {
+		next++;
+	}
+	lineptr->ptr = ptr;
+	lineptr->size = (size_t)(next - ptr);
+	return 1;
+
+none:
+	lineptr->ptr = NULL;
+	lineptr->size = 0;
+	return 0;
+}
+
+
+void corpus_filebuf_iter_make_lines(struct corpus_filebuf_iter *it,
+				    const struct corpus_filebuf *buf,
+				    uint64_t start, uint64_t stop)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	const uint8_t *end = begin + (size_t)buf->file_size;
+
+	assert(start <= stop);
+
+	it->buf = buf;
+	if (buf->has_index) {
+		it->begin = begin + (size_t)filebuf_line_offset(buf, start);
+		it->end = begin + (size_t)filebuf_line_offset(buf, stop);
+	} else {
+		it->begin = filebuf_skip_lines(begin, end, start);
+		it->end = filebuf_skip_lines(it->begin, end, stop - start);
+	}
+	corpus_filebuf_iter_reset(it);
+}
+
+
+/*
+ * Line index files have a fixed-size header, followed by the
+ * checkpoints, followed by the encoded line lengths. All integers get
+ * stored in little-endian byte order:
+ *
+ *   magic          8 bytes, "CORPUSIX"
+ *   version        4 bytes
+ *   stride         4 bytes
+ *   file size      8 bytes
+ *   file mtime     8 bytes, in nanoseconds
+ *   nline          8 bytes
+ *   lengths size   8 bytes
+ *   checkpoints    16 bytes each (offset, position)
+ *   lengths        one unsigned LEB128 integer per line
+ */
+
+#define FILEBUF_INDEX_MAGIC "CORPUSIX"
+#define FILEBUF_INDEX_VERSION 2
+#define FILEBUF_INDEX_HEADER_SIZE 48
+#define FILEBUF_VARINT_MAX 10
+
+static void filebuf_put_u32(uint8_t *ptr, uint32_t val)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		ptr[i] = (uint8_t)(val >> (8 * i));
+	}
+}
+
+
+static void filebuf_put_u64(uint8_t *ptr, uint64_t val)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		ptr[i] = (uint8_t)(val >> (8 * i));
+	}
+}
+
+
+static uint32_t filebuf_get_u32(const uint8_t *ptr)
+{
+	uint32_t val = 0;
+	int i;
+
+	for (i = 3; i >= 0; i--) {
+		val = (val << 8) | ptr[i];
+	}
+	return val;
+}
+
+
+static uint64_t filebuf_get_u64(const uint8_t *ptr)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		val = (val << 8) | ptr[i];
+	}
+	return val;
+}
+
+
+static size_t filebuf_varint_put(uint8_t *ptr, uint64_t val)
+{
+	size_t n = 0;
+
+	while (val >= 0x80) {
+		ptr[n++] = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+	ptr[n++] = (uint8_t)val;
+	return n;
+}
+
+
+/*
+ * Decode a variable-length integer starting at position `*posptr`,
+ * advancing the position. Returns zero if the integer is malformed
+ * or extends past the end of the data.
+ */
+static int filebuf_varint_get(const uint8_t *ptr, size_t size,
+			      size_t *posptr, uint64_t *valptr)
+{
+	size_t pos = *posptr;
+	uint64_t val = 0;
+	int shift = 0;
+	uint8_t ch;
+
+	do {
+		if (pos == size || shift >= 64) {
+			return 0;
+		}
+		ch = ptr[pos++];
+		val |= (uint64_t)(ch & 0x7F) << shift;
+		shift += 7;
+	} while (ch & 0x80);
+
+	*posptr = pos;
+	*valptr = val;
 	return 1;
 }
+
+
+/*
+ * Get the offset and size of line `i` from the line index. The index
+ * records the file size and modification time, but a file can get
+ * rewritten without changing either, so we check that the checkpoint
+ * and the line start after newlines, and that the line ends at one.
+ * Returns zero if the check fails, in which case the caller should scan
+ * the file instead.
+ */
+int filebuf_index_get(const struct corpus_filebuf *buf, uint64_t i,
+		      uint64_t *offsetptr, uint64_t *sizeptr)
+{
+	const struct corpus_filebuf_index *index = &buf->index;
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	uint64_t k = i / (uint64_t)index->stride;
+	uint64_t j = k * (uint64_t)index->stride;
+	uint64_t offset = index->checkpoint[2 * k];
+	size_t pos = (size_t)index->checkpoint[2 * k + 1];
+	uint64_t size = 0;
+
+	assert(i < index->nline);
+
+	if (offset > 0 && begin[offset - 1] != '\n') {
+		return 0;
+	}
+
+	// the lengths were validated when the index was built or loaded
+	for (; j < i; j++) {
+		(void)filebuf_varint_get(index->lengths, index->lengths_size,
+					 &pos, &size);
+		offset += size;
+	}
+	(void)filebuf_varint_get(index->lengths, index->lengths_size, &pos,
+				 &size);
+
+	if ((offset > 0 && begin[offset - 1] != '\n')
+			|| (offset + size < buf->file_size
+				&& begin[offset + size - 1] != '\n')) {
+		return 0;
+	}
+
+	*offsetptr = offset;
+	*sizeptr = size;
+	return 1;
+}
+
+
+void filebuf_index_destroy(struct corpus_filebuf_index *index)
+{
+	corpus_free(index->lengths);
+	corpus_free(index->checkpoint);
+}
+
+
+static char *filebuf_index_name(const char *file_name)
+{
+	size_t len = strlen(file_name);
+	size_t ext_len = strlen(CORPUS_FILEBUF_INDEX_EXT);
+	char *name;
+
+	if (!(name = corpus_malloc(len + ext_len + 1))) {
+		corpus_log(CORPUS_ERROR_NOMEM,
+			   "failed allocating index file name");
+		return NULL;
+	}
+	memcpy(name, file_name, len);
+	memcpy(name + len, CORPUS_FILEBUF_INDEX_EXT, ext_len + 1);
+	return name;
+}
+
+
+char *corpus_filebuf_temp_name(const char *file_name)
+{
+	size_t len = strlen(file_name);
+	size_t ext_len = strlen(CORPUS_FILEBUF_TEMP_EXT);
+	char *name;
+
+	if (!(name = corpus_malloc(len + ext_len + 1))) {
+		corpus_log(CORPUS_ERROR_NOMEM,
+			   "failed allocating temporary file name");
+		return NULL;
+	}
+	memcpy(name, file_name, len);
+	memcpy(name + len, CORPUS_FILEBUF_TEMP_EXT, ext_len + 1);
+	return name;
+}
+
+
+static int filebuf_index_build(const struct corpus_filebuf *buf,
+			       struct corpus_filebuf_index *index)
+{
+	const uint8_t *begin = (const uint8_t *)buf->map_addr;
+	const uint8_t *end = begin + (size_t)buf->file_size;
+	const uint8_t *ptr, *next;
+	void *base;
+	size_t ncheck = 0, ncheck_max = 0, size_max = 0;
+	int err;
+
+	index->nline = 0;
+	index->stride = CORPUS_FILEBUF_INDEX_STRIDE;
+	index->checkpoint = NULL;
+	index->lengths = NULL;
+	index->lengths_size = 0;
+
+	ptr = begin;
+	while (ptr != end) {
+		next = filebuf_find_newline(ptr, end);
+		if (next != end) {
+			next++;
+		}
+
+		if (index->nline % (uint64_t)index->stride == 0) {
+			if (ncheck == ncheck_max) {
+				base = index->checkpoint;
+				if ((err = corpus_bigarray_grow(&base,
+						&ncheck_max,
+						2 * sizeof(*index->checkpoint),
+						ncheck, 1))) {
+					goto error;
+				}
+				index->checkpoint = base;
+			}
+			index->checkpoint[2 * ncheck] =
+				(uint64_t)(ptr - begin);
+			index->checkpoint[2 * ncheck + 1] =
+				(uint64_t)index->lengths_size;
+			ncheck++;
+		}
+
+		if (size_max - index->lengths_size < FILEBUF_VARINT_MAX) {
+			base = index->lengths;
+			if ((err = corpus_bigarray_grow(&base, &size_max, 1,
+							index->lengths_size,
+							FILEBUF_VARINT_MAX))) {
+				goto error;
+			}
+			index->lengths = base;
+		}
+		index->lengths_size += filebuf_varint_put(
+				index->lengths + index->lengths_size,
+				(uint64_t)(next - ptr));
+
+		index->nline++;
+		ptr = next;
+	}
+
+	return 0;
+
+error:
+	corpus_log(err, "failed building line index");
+	filebuf_index_destroy(index);
+	return err;
+}
+
+
+static int filebuf_index_write(const struct corpus_filebuf_index *index,
+			       uint64_t file_size, int64_t mtime,
+			       FILE *stream)
+{
+	uint8_t header[FILEBUF_INDEX_HEADER_SIZE];
+	uint8_t word[8];
+	uint64_t i, ncheck;
+
+	ncheck = (index->nline + (uint64_t)index->stride - 1)
+		/ (uint64_t)index->stride;
+
+	memcpy(header, FILEBUF_INDEX_MAGIC, 8);
+	filebuf_put_u32(header + 8, FILEBUF_INDEX_VERSION);
+	filebuf_put_u32(header + 12, (uint32_t)index->stride);
+	filebuf_put_u64(header + 16, file_size);
+	filebuf_put_u64(header + 24, (uint64_t)mtime);
+	filebuf_put_u64(header + 32, index->nline);
+	filebuf_put_u64(header + 40, (uint64_t)index->lengths_size);
+
+	if (fwrite(header, 1, sizeof(header), stream) != sizeof(header)) {
+		return CORPUS_ERROR_OS;
+	}
+
+	for (i = 0; i < 2 * ncheck; i++) {
+		filebuf_put_u64(word, index->checkpoint[i]);
+		if (fwrite(word, 1, sizeof(word), stream) != sizeof(word)) {
+			return CORPUS_ERROR_OS;
+		}
+	}
+
+	if (index->lengths_size > 0
+			&& fwrite(index->lengths, 1, index->lengths_size,
+				  stream) != index->lengths_size) {
+		return CORPUS_ERROR_OS;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Parse the contents of an index file, checking that it matches the
+ * data file and that the checkpoints agree with the line lengths.
+ * Returns CORPUS_ERROR_INVAL (without logging) if the index is stale
+ * or malformed.
+ */
+static int filebuf_index_parse(struct corpus_filebuf_index *index,
+			       const uint8_t *data, size_t size,
+			       uint64_t file_size, int64_t mtime)
+{
+	uint64_t i, k, ncheck, stride, nline, offset, len;
+	size_t rest, pos;
+	int err;
+
+	if (size < FILEBUF_INDEX_HEADER_SIZE
+			|| memcmp(data, FILEBUF_INDEX_MAGIC, 8) != 0
+			|| filebuf_get_u32(data + 8) != FILEBUF_INDEX_VERSION
+			|| filebuf_get_u64(data + 16) != file_size
+			|| filebuf_get_u64(data + 24) != (uint64_t)mtime) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	stride = filebuf_get_u32(data + 12);
+	nline = filebuf_get_u64(data + 32);
+
+	// every line has at least one byte
+	if (stride == 0 || stride > INT32_MAX || nline > file_size) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	ncheck = nline / stride + (nline % stride ? 1 : 0);
+	rest = size - FILEBUF_INDEX_HEADER_SIZE;
+	if (ncheck > rest / 16
+			|| filebuf_get_u64(data + 40) != rest - 16 * ncheck) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	index->nline = nline;
+	index->stride = (int)stride;
+	index->lengths_size = rest - (size_t)(16 * ncheck);
+	index->checkpoint = corpus_malloc((size_t)(2 * ncheck + 1)
+					  * sizeof(*index->checkpoint));
+	index->lengths = corpus_malloc(index->lengths_size + 1);
+	if (!index->checkpoint || !index->lengths) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating line index");
+		goto error;
+	}
+
+	data += FILEBUF_INDEX_HEADER_SIZE;
+	for (i = 0; i < 2 * ncheck; i++) {
+		index->checkpoint[i] = filebuf_get_u64(data + 8 * i);
+	}
+	memcpy(index->lengths, data + 16 * ncheck, index->lengths_size);
+
+	// validate the lengths so that lookups can skip the checks
+	err = CORPUS_ERROR_INVAL;
+	offset = 0;
+	pos = 0;
+	for (i = 0; i < nline; i++) {
+		if (i % stride == 0) {
+			k = i / stride;
+			if (index->checkpoint[2 * k] != offset
+				|| index->checkpoint[2 * k + 1] != pos) {
+				goto error;
+			}
+		}
+		if (!filebuf_varint_get(index->lengths, index->lengths_size,
+					&pos, &len)
+				|| len == 0 || len > file_size - offset) {
+			goto error;
+		}
+		offset += len;
+	}
+	if (offset != file_size || pos != index->lengths_size) {
+		goto error;
+	}
+
+	return 0;
+
+error:
+	filebuf_index_destroy(index);
+	return err;
+}
+
+
+/*
+ * Get a file's modification time in nanoseconds, so that rewriting a
+ * file within the same second still makes its index stale. Where the
+ * sub-second part is not available, we only compare seconds.
+ */
+static int filebuf_mtime(const char *file_name, int64_t *mtimeptr)
+{
+	struct stat st;
+	int64_t nsec;
+
+	if (stat(file_name, &st) < 0) {
+		return CORPUS_ERROR_OS;
+	}
+
+#if defined(__APPLE__)
+	nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#elif defined(st_mtime)	// st_mtime is an alias for st_mtim.tv_sec
+	nsec = (int64_t)st.st_mtim.tv_nsec;
+#else
+	nsec = 0;
+#endif
+
+	*mtimeptr = (int64_t)st.st_mtime * 1000000000 + nsec;
+	return 0;
+}
+
+
+/*
+ * Load the line index for a file buffer, if one exists and it is up
+ * to date. Failing to find or read the index is not an error; we only
+ * report running out of memory.
+ */
+int filebuf_index_load(struct corpus_filebuf *buf)
+{
+	struct stat st;
+	FILE *stream = NULL;
+	uint8_t *data = NULL;
+	char *name;
+	size_t size;
+	int64_t mtime;
+	int err = 0;
+
+	buf->has_index = 0;
+
+	if (!(name = filebuf_index_name(buf->file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto out;
+	}
+
+	if (stat(name, &st) < 0 || filebuf_mtime(buf->file_name, &mtime)) {
+		goto out;
+	}
+
+	if ((uint64_t)st.st_size < FILEBUF_INDEX_HEADER_SIZE
+			|| (uint64_t)st.st_size > SIZE_MAX) {
+		goto out;
+	}
+	size = (size_t)st.st_size;
+
+	if (!(data = corpus_malloc(size))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating space to read index file"
+			   " (%s)", name);
+		goto out;
+	}
+
+	if (!(stream = fopen(name, "rb"))
+			|| fread(data, 1, size, stream) != size) {
+		goto out;
+	}
+
+	err = filebuf_index_parse(&buf->index, data, size, buf->file_size,
+				  mtime);
+	if (err == 0) {
+		buf->has_index = 1;
+	} else if (err == CORPUS_ERROR_INVAL) {
+		err = 0;
+	}
+
+out:
+	if (stream) {
+		fclose(stream);
+	}
+	corpus_free(data);
+	corpus_free(name);
+	return err;
+}
+
+
+int corpus_filebuf_write_index(struct corpus_filebuf *buf)
+{
+	struct corpus_filebuf_index index;
+	FILE *stream;
+	char *name;
+	int64_t mtime;
+	int err;
+
+	if (!(name = filebuf_index_name(buf->file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto name_fail;
+	}
+
+	if ((err = filebuf_mtime(buf->file_name, &mtime))) {
+		corpus_log(err, "failed determining modification time of"
+			   " file (%s): %s", buf->file_name, strerror(errno));
+		goto mtime_fail;
+	}
+
+	if ((err = filebuf_index_build(buf, &index))) {
+		goto build_fail;
+	}
+
+	if (!(stream = fopen(name, "wb"))) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed opening index file (%s): %s",
+			   name, strerror(errno));
+		goto open_fail;
+	}
+
+	err = filebuf_index_write(&index, buf->file_size, mtime, stream);
+	if (fclose(stream) == EOF && !err) {
+		err = CORPUS_ERROR_OS;
+	}
+	if (err) {
+		corpus_log(err, "failed writing index file (%s): %s",
+			   name, strerror(errno));
+		remove(name);
+		goto write_fail;
+	}
+
+	if (buf->has_index) {
+		filebuf_index_destroy(&buf->index);
+	}
+	buf->index = index;
+	buf->has_index = 1;
+
+	corpus_free(name);
+	return 0;
+
+write_fail:
+open_fail:
+	filebuf_index_destroy(&index);
+build_fail:
+mtime_fail:
+	corpus_free(name);
+name_fail:
+	corpus_log(err, "failed writing line index for file (%s)",
+		   buf->file_name);
+	return err;
+}
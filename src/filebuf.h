@@ -22,8 +22,66 @@
  * File buffer, for holding a file in memory.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Access pattern hints for a file buffer. These are advisory: they do
+ * not change the data an iterator sees, only how the operating system
+ * manages the underlying pages. On platforms without support for the
+ * hints, they have no effect.
+ */
+enum corpus_filebuf_access_type {
+	CORPUS_FILEBUF_NORMAL = 0,	/**< no special treatment */
+	CORPUS_FILEBUF_SEQUENTIAL = (1 << 0), /**< aggressive readahead */
+	CORPUS_FILEBUF_PREFETCH = (1 << 1), /**< request the pages in a
+					      window ahead of each
+					      iterator */
+	CORPUS_FILEBUF_DROPBEHIND = (1 << 2) /**< release the pages before
+					       the lines an iterator
+					       last returned */
+};
+
+/**
+ * Default size (in bytes) of the prefetch and drop-behind window.
+ */
+#define CORPUS_FILEBUF_WINDOW ((size_t)16 * 1024 * 1024)
+
+/**
+ * File name extension for line index files. The index for a file gets
+ * stored next to the file, with this extension appended to its name.
+ */
+#define CORPUS_FILEBUF_INDEX_EXT ".idx"
+
+/**
+ * File name extension for temporary files, used while writing a new
+ * version of a file (see #corpus_filebuf_temp_name).
+ */
+#define CORPUS_FILEBUF_TEMP_EXT ".tmp"
+
+/**
+ * Number of lines between checkpoints in a line index.
+ */
+#define CORPUS_FILEBUF_INDEX_STRIDE 64
+
+/**
+ * Line index, for locating the lines in a file without scanning it.
+ * The index stores the length of each line as a variable-length
+ * integer, along with a checkpoint every `stride` lines giving the byte
+ * offset of that line and the position of its encoded length. Finding
+ * a line decodes at most `stride` lengths, no matter the file size.
+ */
+struct corpus_filebuf_index {
+	uint64_t nline;		/**< the number of lines in the file */
+	int stride;		/**< the number of lines between checkpoints */
+	uint64_t *checkpoint;	/**< for each checkpoint, the byte offset of
+				  the line followed by the position of its
+				  length in `lengths` */
+	uint8_t *lengths;	/**< the encoded line lengths */
+	size_t lengths_size;	/**< the size of the encoded lengths, in
+				  bytes */
+};
+
 /**
  * File buffer, holding a file in memory. Internally, we memory-map the
  * file, letting the operating system move the data from the hard disk
@@ -36,6 +94,14 @@ struct corpus_filebuf {
 
 	void *map_addr;		/**< the memory-mapped address */
 	size_t map_size;	/**< the memory map size */
+
+	int access;		/**< the access pattern hints, a bitmask of
+				  #corpus_filebuf_access_type values */
+	size_t window;		/**< the prefetch and drop-behind window
+				  size, in bytes */
+
+	struct corpus_filebuf_index index; /**< the line index, if loaded */
+	int has_index;		/**< whether the line index is loaded */
 };
 
 /**
@@ -52,15 +118,24 @@ struct corpus_filebuf_line {
  * may not end in a newline; all other lines do.)
  */
 struct corpus_filebuf_iter {
+	const struct corpus_filebuf *buf; /**< the file buffer */
 	const uint8_t *begin;	/**< the beginning of the file */
 	const uint8_t *ptr;	/**< the current position in the file */
 	const uint8_t *end;	/**< the end of the file */
 
+	const uint8_t *advise_ptr; /**< the position at which to issue the
+				     next access hint */
+	const uint8_t *drop_ptr; /**< the start of the pages not yet
+				   released by the drop-behind hint */
+
 	struct corpus_filebuf_line current; /**< the current line */
 };
 
 /**
- * Initialize a buffer for the specified file.
+ * Initialize a buffer for the specified file. If a line index for the
+ * file exists (see #corpus_filebuf_write_index) and it is up to date,
+ * the buffer loads it; a missing, stale, or malformed index gets
+ * ignored.
  *
  * \param buf the buffer
  * \param file_name the file name
@@ -76,6 +151,78 @@ int corpus_filebuf_init(struct corpus_filebuf *buf, const char *file_name);
  */
 void corpus_filebuf_destroy(struct corpus_filebuf *buf);
 
+/**
+ * Build a line index for a file buffer, write it next to the file,
+ * and attach it to the buffer. The index records the file size and
+ * modification time, so that later loads can detect when it is stale.
+ *
+ * \param buf the buffer
+ *
+ * \returns 0 on success
+ */
+int corpus_filebuf_write_index(struct corpus_filebuf *buf);
+
+/**
+ * Get the name of the temporary file for writing a new version of a
+ * file: the file name with #CORPUS_FILEBUF_TEMP_EXT appended. Writing
+ * the temporary file and then moving it into place with
+ * #corpus_filebuf_replace means that a process with the old file mapped
+ * never sees it truncated or half written, and that a failed write
+ * leaves the old file alone.
+ *
+ * \param file_name the file name
+ *
+ * 
+eturns the temporary file name, to be freed with `corpus_free`, or
+ * 	NULL on memory allocation failure
+ */
+char *corpus_filebuf_temp_name(const char *file_name);
+
+/**
+ * Move a temporary file into place, replacing the file with the given
+ * name if it exists. On failure, the temporary file gets removed.
+ *
+ * \param temp_name the temporary file name
+ * \param file_name the file name
+ *
+ * 
+eturns 0 on success, #CORPUS_ERROR_OS on failure
+ */
+int corpus_filebuf_replace(const char *temp_name, const char *file_name);
+
+/**
+ * Get a line from a file by its position. This takes constant time if
+ * the buffer has a line index; otherwise, it scans the file from the
+ * beginning.
+ *
+ * \param buf the buffer
+ * \param i the line number, starting from 0
+ * \param lineptr on exit, the line, if it exists
+ *
+ * \returns nonzero if the line exists, zero if the file has `i` or
+ * 	fewer lines
+ */
+int corpus_filebuf_line(const struct corpus_filebuf *buf, uint64_t i,
+			struct corpus_filebuf_line *lineptr);
+
+/**
+ * Set the access pattern hints for a file buffer. The hints apply to
+ * the whole buffer, not to particular iterators: turning
+ * #CORPUS_FILEBUF_SEQUENTIAL on or off re-advises the entire mapping
+ * right away, and every iterator over the buffer, including ones that
+ * already exist, reads the #CORPUS_FILEBUF_PREFETCH and
+ * #CORPUS_FILEBUF_DROPBEHIND hints and the window size when it reaches
+ * its next hint point. Together, the latter two keep the resident memory
+ * for a one-pass scan bounded by a few windows, no matter the file size.
+ *
+ * \param buf the buffer
+ * \param access a bitmask of #corpus_filebuf_access_type values
+ * \param window the prefetch and drop-behind window size, in bytes,
+ * 	or 0 to use the default (#CORPUS_FILEBUF_WINDOW)
+ */
+void corpus_filebuf_set_access(struct corpus_filebuf *buf, int access,
+			       size_t window);
+
 /**
  * Get an iterator over the lines in a file.
  *
@@ -85,6 +232,52 @@ void corpus_filebuf_destroy(struct corpus_filebuf *buf);
 void corpus_filebuf_iter_make(struct corpus_filebuf_iter *it,
 			      const struct corpus_filebuf *buf);
 
+/**
+ * Get an iterator over the lines starting in a byte range of a file.
+ * A line belongs to the range if its first byte is at an offset in
+ * `[start, stop)`. Ranges that tile the file therefore yield each line
+ * exactly once, even when the range boundaries fall in the middle of
+ * a line.
+ *
+ * \param it the iterator to initialize
+ * \param buf the file buffer
+ * \param start the starting byte offset
+ * \param stop the ending byte offset (exclusive)
+ */
+void corpus_filebuf_iter_make_range(struct corpus_filebuf_iter *it,
+				    const struct corpus_filebuf *buf,
+				    uint64_t start, uint64_t stop);
+
+/**
+ * Get an iterator over a range of lines in a file, by line number.
+ * Lines `start` through `stop - 1` (counting from 0) belong to the
+ * range; line numbers past the end of the file get truncated. With a
+ * line index, finding the range takes constant time.
+ *
+ * \param it the iterator to initialize
+ * \param buf the file buffer
+ * \param start the first line number
+ * \param stop the line number after the last line (exclusive)
+ */
+void corpus_filebuf_iter_make_lines(struct corpus_filebuf_iter *it,
+				    const struct corpus_filebuf *buf,
+				    uint64_t start, uint64_t stop);
+
+/**
+ * Split a file into disjoint line ranges of approximately equal size,
+ * suitable for processing in parallel. Every line in the file belongs
+ * to exactly one of the ranges; some ranges may be empty if the file
+ * has fewer than `n` lines. If the buffer has a line index, the ranges
+ * have equal numbers of lines; otherwise, they have equal numbers of
+ * bytes.
+ *
+ * \param buf the file buffer
+ * \param its an array of length `n` of iterators to initialize
+ * \param n the number of ranges; must be positive
+ */
+void corpus_filebuf_split(const struct corpus_filebuf *buf,
+			  struct corpus_filebuf_iter *its, int n);
+
 /**
  * Advance an iterator to the next line in the file.
  *
@@ -94,6 +287,22 @@ void corpus_filebuf_iter_make(struct corpus_filebuf_iter *it,
  */
 int corpus_filebuf_iter_advance(struct corpus_filebuf_iter *it);
 
+/**
+ * Advance an iterator over a batch of lines at once, storing the start
+ * and size of each line in the given array. After the call, the
+ * iterator's current line is the last line in the batch.
+ *
+ * \param it the iterator
+ * \param lines an array of length `nmax` to store the lines
+ * \param nmax the maximum number of lines to read
+ *
+ * \returns the number of lines read; a value less than `nmax` indicates
+ * 	that the iterator reached the end of the file
+ */
+int corpus_filebuf_iter_advance_lines(struct corpus_filebuf_iter *it,
+				      struct corpus_filebuf_line *lines,
+				      int nmax);
+
 /**
  * Reset an iterator to the beginning of the file.
  *
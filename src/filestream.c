@@ -0,0 +1,310 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64	// enable large file support
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "array.h"
+#include "error.h"
+#include "memory.h"
+#include "decoder.h"
+#include "filebuf.h"
+#include "filestream.h"
+
+#define CHECK_ERROR(value) \
+	do { \
+		if (fs->error) { \
+			corpus_log(CORPUS_ERROR_INVAL, "an error occurred" \
+				   " during a prior file stream operation"); \
+			return (value); \
+		} \
+	} while (0)
+
+static int filestream_is_stdin(const char *file_name);
+static int filestream_is_regular(const char *file_name);
+static int filestream_read_line(struct corpus_filestream *fs);
+static int filestream_refill(struct corpus_filestream *fs);
+
+
+int corpus_filestream_init(struct corpus_filestream *fs,
+			   const char *file_name)
+{
+	int err, type;
+
+	assert(file_name);
+
+	if (!(fs->file_name = corpus_strdup(file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed copying file name (%s)", file_name);
+		goto strdup_fail;
+	}
+
+	fs->stream = NULL;
+	fs->has_buf = 0;
+	fs->buffer = NULL;
+	fs->buffer_size = 0;
+	fs->ptr = NULL;
+	fs->end = NULL;
+	fs->eof = 0;
+	fs->skip = 0;
+	fs->remain = UINT64_MAX;
+	fs->current.ptr = NULL;
+	fs->current.size = 0;
+	fs->error = 0;
+
+	if (filestream_is_stdin(file_name)) {
+		fs->stream = stdin;
+	} else if (filestream_is_regular(file_name)) {
+		if ((err = corpus_filebuf_init(&fs->buf, file_name))) {
+			goto open_fail;
+		}
+		fs->has_buf = 1;
+		corpus_filebuf_set_access(&fs->buf, CORPUS_FILEBUF_SEQUENTIAL,
+					  0);
+	} else if (!(fs->stream = fopen(file_name, "rb"))) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed opening file (%s): %s",
+			   file_name, strerror(errno));
+		goto open_fail;
+	}
+
+	if (fs->has_buf) {
+		type = corpus_compress_detect(fs->buf.map_addr,
+					      fs->buf.map_size);
+		if (type == CORPUS_COMPRESS_NONE) {
+			fs->mapped = 1;
+			corpus_filebuf_iter_make(&fs->it, &fs->buf);
+			return 0;
+		}
+		err = corpus_decoder_init_buffer(&fs->decoder, type,
+						 fs->buf.map_addr,
+						 fs->buf.map_size, 0);
+	} else {
+		err = corpus_decoder_init_stream(&fs->decoder, fs->stream);
+	}
+	if (err) {
+		goto decoder_fail;
+	}
+
+	fs->mapped = 0;
+	fs->buffer_size = CORPUS_FILESTREAM_BUFFER_SIZE;
+	if (!(fs->buffer = corpus_malloc(fs->buffer_size))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating read buffer");
+		goto buffer_fail;
+	}
+	fs->ptr = fs->buffer;
+	fs->end = fs->buffer;
+
+	return 0;
+
+buffer_fail:
+	corpus_decoder_destroy(&fs->decoder);
+decoder_fail:
+	if (fs->has_buf) {
+		corpus_filebuf_destroy(&fs->buf);
+	} else if (fs->stream != stdin) {
+		fclose(fs->stream);
+	}
+open_fail:
+	corpus_free(fs->file_name);
+strdup_fail:
+	corpus_log(err, "failed initializing file stream");
+	return err;
+}
+
+
+void corpus_filestream_destroy(struct corpus_filestream *fs)
+{
+	if (!fs->mapped) {
+		corpus_free(fs->buffer);
+		corpus_decoder_destroy(&fs->decoder);
+	}
+
+	if (fs->has_buf) {
+		corpus_filebuf_destroy(&fs->buf);
+	} else if (fs->stream != stdin) {
+		fclose(fs->stream);
+	}
+
+	corpus_free(fs->file_name);
+}
+
+
+void corpus_filestream_set_lines(struct corpus_filestream *fs,
+				 uint64_t start, uint64_t stop)
+{
+	assert(start <= stop);
+
+	if (fs->mapped) {
+		corpus_filebuf_iter_make_lines(&fs->it, &fs->buf, start, stop);
+	} else {
+		fs->skip = start;
+		fs->remain = stop - start;
+	}
+}
+
+
+int corpus_filestream_advance(struct corpus_filestream *fs)
+{
+	CHECK_ERROR(0);
+
+	if (fs->mapped) {
+		if (!corpus_filebuf_iter_advance(&fs->it)) {
+			goto eof;
+		}
+		fs->current = fs->it.current;
+		return 1;
+	}
+
+	for (; fs->skip > 0; fs->skip--) {
+		if (!filestream_read_line(fs)) {
+			goto eof;
+		}
+	}
+
+	if (fs->remain == 0 || !filestream_read_line(fs)) {
+		goto eof;
+	}
+	fs->remain--;
+	return 1;
+
+eof:
+	fs->current.ptr = NULL;
+	fs->current.size = 0;
+	return 0;
+}
+
+
+/*
+ * Read the next line from the buffer into `fs->current`, refilling the
+ * buffer as necessary.
+ */
+int filestream_read_line(struct corpus_filestream *fs)
+{
+	const uint8_t *nl;
+	size_t off = 0;
+	int err;
+
+	// search for the end of the line, refilling as necessary; `off`
+	// tracks how far we have already searched, so that each byte only
+	// gets scanned once, even for lines that straddle refills
+	for (;;) {
+		if (fs->ptr + off != fs->end) {
+			nl = memchr(fs->ptr + off, '\n',
+				    (size_t)(fs->end - fs->ptr) - off);
+			if (nl) {
+				fs->current.ptr = fs->ptr;
+				fs->current.size = (size_t)(nl + 1 - fs->ptr);
+				fs->ptr = nl + 1;
+				return 1;
+			}
+			off = (size_t)(fs->end - fs->ptr);
+		}
+
+		if (fs->eof) {
+			break;
+		}
+
+		if ((err = filestream_refill(fs))) {
+			fs->error = err;
+			return 0;
+		}
+	}
+
+	// the last line does not end in a newline
+	if (fs->ptr != fs->end) {
+		fs->current.ptr = fs->ptr;
+		fs->current.size = (size_t)(fs->end - fs->ptr);
+		fs->ptr = fs->end;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Read more data into the buffer, keeping the unread data. We move the
+ * partial line at the end of the buffer to the front before reading,
+ * and only grow the buffer when that partial line fills it entirely.
+ */
+int filestream_refill(struct corpus_filestream *fs)
+{
+	void *base;
+	size_t size, nread, nkeep;
+	int err;
+
+	nkeep = (size_t)(fs->end - fs->ptr);
+
+	if (fs->ptr != fs->buffer) {
+		memmove(fs->buffer, fs->ptr, nkeep);
+		fs->ptr = fs->buffer;
+		fs->end = fs->buffer + nkeep;
+	}
+
+	if (nkeep == fs->buffer_size) {
+		base = fs->buffer;
+		size = fs->buffer_size;
+		if ((err = corpus_bigarray_grow(&base, &size, 1, nkeep, 1))) {
+			corpus_log(err, "failed growing read buffer");
+			return err;
+		}
+		fs->buffer = base;
+		fs->buffer_size = size;
+		fs->ptr = fs->buffer;
+		fs->end = fs->buffer + nkeep;
+	}
+
+	if ((err = corpus_decoder_read(&fs->decoder, fs->buffer + nkeep,
+				       fs->buffer_size - nkeep, &nread))) {
+		corpus_log(err, "failed reading from file (%s)",
+			   fs->file_name);
+		return err;
+	}
+	fs->end += nread;
+
+	if (nread < fs->buffer_size - nkeep) {
+		fs->eof = 1;
+	}
+
+	return 0;
+}
+
+
+int filestream_is_stdin(const char *file_name)
+{
+	return (strcmp(file_name, "-") == 0);
+}
+
+
+int filestream_is_regular(const char *file_name)
+{
+	struct stat st;
+
+	if (stat(file_name, &st) < 0) {
+		// let the open report the error
+		return 0;
+	}
+	return S_ISREG(st.st_mode) ? 1 : 0;
+}
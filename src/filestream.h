@@ -0,0 +1,118 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CORPUS_FILESTREAM_H
+#define CORPUS_FILESTREAM_H
+
+/**
+ * \file filestream.h
+ *
+ * File stream, for reading the lines in a file, pipe, or standard input
+ * in a single pass.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Default size (in bytes) of the read buffer for streaming input.
+ */
+#define CORPUS_FILESTREAM_BUFFER_SIZE ((size_t)1024 * 1024)
+
+/**
+ * File stream, a single-pass source of lines. Regular files get
+ * memory-mapped with a #corpus_filebuf; other inputs (pipes, terminals,
+ * and standard input) get read through a bounded buffer that is reused
+ * across refills. The buffer only grows when a single line does not fit.
+ *
+ * Compressed input (gzip or zstd, if supported by the build) gets
+ * detected from the leading bytes and decompressed with a
+ * #corpus_decoder as the lines are read.
+ */
+struct corpus_filestream {
+	char *file_name;	/**< the file name, or `-` for standard input */
+	int mapped;		/**< whether the lines come directly from the
+				  memory-mapped file */
+	int has_buf;		/**< whether the file is memory-mapped */
+
+	struct corpus_filebuf buf; /**< the file buffer, if memory-mapped */
+	struct corpus_filebuf_iter it; /**< the file buffer iterator, if
+					 mapped */
+
+	FILE *stream;		/**< the input stream, if not memory-mapped */
+	struct corpus_decoder decoder; /**< the decoder, if not mapped */
+	uint8_t *buffer;	/**< the read buffer, if not mapped */
+	size_t buffer_size;	/**< the read buffer capacity, in bytes */
+	const uint8_t *ptr;	/**< the start of the unread data */
+	const uint8_t *end;	/**< the end of the unread data */
+	int eof;		/**< whether the input stream is exhausted */
+	uint64_t skip;		/**< the number of lines left to discard
+				  before the range, if not mapped */
+	uint64_t remain;	/**< the number of lines left in the range,
+				  if not mapped */
+
+	struct corpus_filebuf_line current; /**< the current line */
+	int error;		/**< last error code */
+};
+
+/**
+ * Open a file stream. Standard input gets read if the file name is `-`.
+ *
+ * \param fs the file stream
+ * \param file_name the file name
+ *
+ * \returns 0 on success
+ */
+int corpus_filestream_init(struct corpus_filestream *fs,
+			   const char *file_name);
+
+/**
+ * Release a file stream's resources, closing the underlying file.
+ *
+ * \param fs the file stream
+ */
+void corpus_filestream_destroy(struct corpus_filestream *fs);
+
+/**
+ * Restrict a file stream to a range of lines, by line number. Lines
+ * `start` through `stop - 1` (counting from 0) get read. For
+ * memory-mapped files with a line index, the stream skips directly to
+ * the first line in the range; otherwise, it reads and discards the
+ * lines before the range. Call this before the first call to
+ * #corpus_filestream_advance.
+ *
+ * \param fs the file stream
+ * \param start the first line number
+ * \param stop the line number after the last line (exclusive)
+ */
+void corpus_filestream_set_lines(struct corpus_filestream *fs,
+				 uint64_t start, uint64_t stop);
+
+/**
+ * Advance to the next line in the stream. As with
+ * #corpus_filebuf_iter, lines include the trailing newline, if it
+ * exists. For streaming input, the current line is only valid until
+ * the next call to this function.
+ *
+ * \param fs the file stream
+ *
+ * \returns nonzero if a next line exists, zero if at the end of the
+ * 	input or an error occurs, in which case `fs->error` will be set
+ * 	to the error code
+ */
+int corpus_filestream_advance(struct corpus_filestream *fs);
+
+#endif /* CORPUS_FILESTREAM_H */
@@ -15,11 +15,16 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include "../lib/utf8lite/src/utf8lite.h"
 #include "array.h"
 #include "error.h"
+#include "filebuf.h"
 #include "memory.h"
 #include "table.h"
 #include "textset.h"
@@ -39,6 +44,44 @@
 	} while (0)
 
 
+/*
+ * Saved filters start with the saved symbol table, followed by a header:
+ *
+ *    0  magic ("CORPUSFT")
+ *    8  format version
+ *   12  filter flags
+ *   16  word connector
+ *   20  whether the filter has a stemmer
+ *   24  number of types
+ *   28  number of combination tree nodes
+ *   32  number of stemming exceptions
+ *   36  (reserved)
+ *   40  stemming exception blob size, in bytes
+ *
+ * and then the type properties (stem, unspaced type, FILTER_FILE_* flags),
+ * the combination tree nodes (parent, key, rule), the stemming exceptions
+ * (blob offset, size, non-ASCII flag), and the exception text blob. As
+ * with symbol tables, numbers are little-endian and each part gets padded
+ * to a multiple of 8 bytes.
+ */
+#define FILTER_FILE_MAGIC "CORPUSFT"
+#define FILTER_FILE_VERSION 1
+#define FILTER_FILE_HEADER_SIZE 48
+#define FILTER_FILE_PROP_SIZE 12
+#define FILTER_FILE_NODE_SIZE 12
+#define FILTER_FILE_EXCEPT_SIZE 16
+#define FILTER_FILE_PAD(size) (((size) + 7) & ~(uint64_t)7)
+
+enum filter_file_flag {
+	FILTER_FILE_HAS_STEM = (1 << 0),
+	FILTER_FILE_HAS_UNSPACE = (1 << 1),
+	FILTER_FILE_DROP = (1 << 2)
+};
+
+#define FILTER_FILE_FLAGS \
+	(FILTER_FILE_HAS_STEM | FILTER_FILE_HAS_UNSPACE | FILTER_FILE_DROP)
+
+
 struct corpus_filter_state {
 	int has_scan;
 	struct utf8lite_wordscan scan;
@@ -52,7 +95,11 @@ static void corpus_filter_state_push(struct corpus_filter *f,
 static void corpus_filter_state_pop(struct corpus_filter *f,
 				    struct corpus_filter_state *state);
 
+static int corpus_filter_next(struct corpus_filter *f);
 static int corpus_filter_advance_word(struct corpus_filter *f, int *idptr);
+static int corpus_filter_oov_type(struct corpus_filter *f,
+				  const struct utf8lite_text *token,
+				  int *idptr);
 static int corpus_filter_try_combine(struct corpus_filter *f, int *idptr);
 static int corpus_filter_stem(struct corpus_filter *f, int *idptr);
 static int corpus_filter_unspace(struct corpus_filter *f, int *idptr);
@@ -61,6 +108,14 @@ static int corpus_filter_grow_types(struct corpus_filter *f, int size);
 static int corpus_filter_get_drop(const struct corpus_filter *f, int kind);
 static int corpus_type_kind(const struct utf8lite_text *type);
 
+static void filter_put_u32(uint8_t *ptr, uint32_t val);
+static void filter_put_u64(uint8_t *ptr, uint64_t val);
+static uint32_t filter_get_u32(const uint8_t *ptr);
+static uint64_t filter_get_u64(const uint8_t *ptr);
+static int filter_write_pad(FILE *stream, uint64_t size);
+static int filter_parse(struct corpus_filter *f, const uint8_t *data,
+			uint64_t size);
+
 
 int corpus_filter_init(struct corpus_filter *f, int flags, int type_kind,
 		       int32_t connector, corpus_stem_func stemmer,
@@ -329,6 +384,205 @@ out:
 }
 
 
+int corpus_filter_save(const struct corpus_filter *f, const char *file_name)
+{
+	uint8_t header[FILTER_FILE_HEADER_SIZE];
+	uint8_t rec[FILTER_FILE_EXCEPT_SIZE];
+	const struct corpus_filter_prop *prop;
+	const struct corpus_tree_node *node;
+	const struct utf8lite_text *text;
+	const struct corpus_textset *excepts = NULL;
+	FILE *stream;
+	char *temp_name;
+	uint64_t off;
+	uint32_t flags;
+	size_t len;
+	int err, i, ntype, nexcept = 0;
+
+	CHECK_ERROR(CORPUS_ERROR_INVAL);
+
+	// write the symbol table and the filter to a temporary file, then
+	// move it into place, so that saving over the file the filter was
+	// loaded from does not truncate the text the filter points to
+	if (!(temp_name = corpus_filebuf_temp_name(file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto name_fail;
+	}
+
+	if ((err = corpus_symtab_save(&f->symtab, temp_name))) {
+		goto save_fail;
+	}
+
+	if (!(stream = fopen(temp_name, "ab"))) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed opening file (%s): %s", temp_name,
+			   strerror(errno));
+		goto open_fail;
+	}
+
+	if (f->has_stemmer) {
+		excepts = &f->stemmer.excepts;
+		nexcept = excepts->nitem;
+	}
+
+	off = 0;
+	for (i = 0; i < nexcept; i++) {
+		off += UTF8LITE_TEXT_SIZE(&excepts->items[i]);
+	}
+
+	ntype = f->symtab.ntype;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, FILTER_FILE_MAGIC, 8);
+	filter_put_u32(header + 8, FILTER_FILE_VERSION);
+	filter_put_u32(header + 12, (uint32_t)f->flags);
+	filter_put_u32(header + 16, (uint32_t)f->connector);
+	filter_put_u32(header + 20, (uint32_t)f->has_stemmer);
+	filter_put_u32(header + 24, (uint32_t)ntype);
+	filter_put_u32(header + 28, (uint32_t)f->combine.nnode);
+	filter_put_u32(header + 32, (uint32_t)nexcept);
+	filter_put_u64(header + 40, off);
+
+	if (fwrite(header, 1, sizeof(header), stream) != sizeof(header)) {
+		goto write_fail;
+	}
+
+	for (i = 0; i < ntype; i++) {
+		prop = &f->props[i];
+		flags = 0;
+		filter_put_u32(rec, (uint32_t)CORPUS_TYPE_NONE);
+		filter_put_u32(rec + 4, (uint32_t)CORPUS_TYPE_NONE);
+		if (prop->has_stem) {
+			flags |= FILTER_FILE_HAS_STEM;
+			filter_put_u32(rec, (uint32_t)prop->stem);
+		}
+		if (prop->has_unspace) {
+			flags |= FILTER_FILE_HAS_UNSPACE;
+			filter_put_u32(rec + 4, (uint32_t)prop->unspace);
+		}
+		if (prop->drop) {
+			flags |= FILTER_FILE_DROP;
+		}
+		filter_put_u32(rec + 8, flags);
+
+		if (fwrite(rec, 1, FILTER_FILE_PROP_SIZE, stream)
+				!= FILTER_FILE_PROP_SIZE) {
+			goto write_fail;
+		}
+	}
+	if (filter_write_pad(stream, (uint64_t)ntype * FILTER_FILE_PROP_SIZE)) {
+		goto write_fail;
+	}
+
+	for (i = 0; i < f->combine.nnode; i++) {
+		node = &f->combine.nodes[i];
+		filter_put_u32(rec, (uint32_t)node->parent_id);
+		filter_put_u32(rec + 4, (uint32_t)node->key);
+		filter_put_u32(rec + 8, (uint32_t)f->combine_rules[i]);
+
+		if (fwrite(rec, 1, FILTER_FILE_NODE_SIZE, stream)
+				!= FILTER_FILE_NODE_SIZE) {
+			goto write_fail;
+		}
+	}
+	if (filter_write_pad(stream, (uint64_t)f->combine.nnode
+				     * FILTER_FILE_NODE_SIZE)) {
+		goto write_fail;
+	}
+
+	off = 0;
+	for (i = 0; i < nexcept; i++) {
+		text = &excepts->items[i];
+		filter_put_u64(rec, off);
+		filter_put_u32(rec + 8, (uint32_t)UTF8LITE_TEXT_SIZE(text));
+		filter_put_u32(rec + 12, UTF8LITE_TEXT_IS_ASCII(text) ? 0 : 1);
+		off += UTF8LITE_TEXT_SIZE(text);
+
+		if (fwrite(rec, 1, FILTER_FILE_EXCEPT_SIZE, stream)
+				!= FILTER_FILE_EXCEPT_SIZE) {
+			goto write_fail;
+		}
+	}
+
+	for (i = 0; i < nexcept; i++) {
+		text = &excepts->items[i];
+		len = UTF8LITE_TEXT_SIZE(text);
+		if (len > 0 && fwrite(text->ptr, 1, len, stream) != len) {
+			goto write_fail;
+		}
+	}
+	if (filter_write_pad(stream, off)) {
+		goto write_fail;
+	}
+
+	if (fclose(stream) == EOF) {
+		stream = NULL;
+		goto write_fail;
+	}
+
+	if ((err = corpus_filebuf_replace(temp_name, file_name))) {
+		goto replace_fail;
+	}
+
+	corpus_free(temp_name);
+	return 0;
+
+write_fail:
+	err = CORPUS_ERROR_OS;
+	corpus_log(err, "failed writing to file (%s): %s", temp_name,
+		   strerror(errno));
+	if (stream) {
+		fclose(stream);
+	}
+open_fail:
+	remove(temp_name);
+replace_fail:
+save_fail:
+	corpus_free(temp_name);
+name_fail:
+	corpus_log(err, "failed saving filter");
+	return err;
+}
+
+
+int corpus_filter_load(struct corpus_filter *f, const char *file_name)
+{
+	const struct corpus_filebuf *file;
+	size_t off;
+	int err;
+
+	CHECK_ERROR(CORPUS_ERROR_INVAL);
+
+	if (f->symtab.ntype || f->symtab.ntoken || f->combine.nnode) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "filter is not empty");
+		goto out;
+	}
+
+	if ((err = corpus_symtab_load(&f->symtab, file_name, &off))) {
+		goto out;
+	}
+
+	file = f->symtab.file;
+	if ((err = filter_parse(f, (const uint8_t *)file->map_addr + off,
+				file->file_size - off))) {
+		if (err == CORPUS_ERROR_INVAL) {
+			corpus_log(err, "saved filter (%s) is malformed or"
+				   " has different settings", file_name);
+		}
+		goto out;
+	}
+
+out:
+	if (err) {
+		corpus_log(err, "failed loading filter");
+		f->error = err;
+	}
+
+	return err;
+}
+
+
 int corpus_filter_start(struct corpus_filter *f,
 			const struct utf8lite_text *text)
 {
@@ -344,6 +598,55 @@ int corpus_filter_start(struct corpus_filter *f,
 
 
 int corpus_filter_advance(struct corpus_filter *f)
+{
+	return corpus_filter_next(f);
+}
+
+
+int corpus_filter_tokenize(struct corpus_filter *f, int *type_ids,
+			   size_t *offsets, size_t *sizes, int nmax,
+			   int *nptr)
+{
+	const uint8_t *base;
+	int err, n = 0;
+
+	CHECK_ERROR(CORPUS_ERROR_INVAL);
+
+	base = f->has_scan ? f->scan.text.ptr : NULL;
+
+	while (n < nmax && corpus_filter_next(f)) {
+		if (f->type_id == CORPUS_TYPE_NONE) {
+			continue;
+		}
+		type_ids[n] = f->type_id;
+		if (offsets) {
+			offsets[n] = (size_t)(f->current.ptr - base);
+		}
+		if (sizes) {
+			sizes[n] = UTF8LITE_TEXT_SIZE(&f->current);
+		}
+		n++;
+	}
+
+	if ((err = f->error)) {
+		corpus_log(err, "failed tokenizing text");
+		n = 0;
+	}
+
+	if (nptr) {
+		*nptr = n;
+	}
+
+	return err;
+}
+
+
+/*
+ * Advance to the next type. This is the body of corpus_filter_advance,
+ * kept separate so that it can get inlined into the corpus_filter_tokenize
+ * loop.
+ */
+int corpus_filter_next(struct corpus_filter *f)
 {
 	int type_id = CORPUS_TYPE_NONE;
 	int err, ret;
@@ -644,6 +947,15 @@ int corpus_filter_advance_word(struct corpus_filter *f, int *idptr)
 	if ((err = corpus_symtab_add_token(&f->symtab, token, &token_id))) {
 		goto out;
 	}
+
+	// a bounded symbol table left the token out
+	if (token_id == CORPUS_TOKEN_OOV) {
+		if ((err = corpus_filter_oov_type(f, token, &type_id))) {
+			goto out;
+		}
+		ret = 1;
+		goto out;
+	}
 	type_id = f->symtab.tokens[token_id].type_id;
 
 	n = f->symtab.ntype;
@@ -685,6 +997,36 @@ out:
 }
 
 
+/*
+ * Get the type ID for a token that a bounded symbol table left out. If
+ * the token's type is known, this is the type's ID, like for any other
+ * token, so that the combine, stem, drop, and unspace rules still apply.
+ * Otherwise, it is CORPUS_TYPE_NONE if the type would get dropped by its
+ * word kind, and CORPUS_TYPE_OOV if not. This looks up the type without
+ * adding it.
+ */
+int corpus_filter_oov_type(struct corpus_filter *f,
+			   const struct utf8lite_text *token, int *idptr)
+{
+	const struct utf8lite_text *type;
+	int drop, err, id;
+
+	if ((err = utf8lite_textmap_set(&f->symtab.typemap, token))) {
+		return err;
+	}
+	type = &f->symtab.typemap.text;
+
+	if (corpus_symtab_has_type(&f->symtab, type, &id)) {
+		*idptr = id;
+		return 0;
+	}
+
+	drop = corpus_filter_get_drop(f, corpus_type_kind(type));
+	*idptr = drop ? CORPUS_TYPE_NONE : CORPUS_TYPE_OOV;
+	return 0;
+}
+
+
 int corpus_filter_add_type(struct corpus_filter *f,
 			   const struct utf8lite_text *type, int *idptr)
 {
@@ -828,3 +1170,195 @@ void corpus_filter_state_pop(struct corpus_filter *f,
 		f->has_scan = 0;
 	}
 }
+
+
+void filter_put_u32(uint8_t *ptr, uint32_t val)
+{
+	ptr[0] = (uint8_t)(val);
+	ptr[1] = (uint8_t)(val >> 8);
+	ptr[2] = (uint8_t)(val >> 16);
+	ptr[3] = (uint8_t)(val >> 24);
+}
+
+
+void filter_put_u64(uint8_t *ptr, uint64_t val)
+{
+	filter_put_u32(ptr, (uint32_t)val);
+	filter_put_u32(ptr + 4, (uint32_t)(val >> 32));
+}
+
+
+uint32_t filter_get_u32(const uint8_t *ptr)
+{
+	return ((uint32_t)ptr[0]
+		| ((uint32_t)ptr[1] << 8)
+		| ((uint32_t)ptr[2] << 16)
+		| ((uint32_t)ptr[3] << 24));
+}
+
+
+uint64_t filter_get_u64(const uint8_t *ptr)
+{
+	return ((uint64_t)filter_get_u32(ptr)
+		| ((uint64_t)filter_get_u32(ptr + 4) << 32));
+}
+
+
+int filter_write_pad(FILE *stream, uint64_t size)
+{
+	static const uint8_t zeros[8];
+	size_t pad = (size_t)(FILTER_FILE_PAD(size) - size);
+
+	if (pad > 0 && fwrite(zeros, 1, pad, stream) != pad) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+/*
+ * Parse the saved filter that follows the saved symbol table, checking
+ * that it is in bounds and matches the filter settings. Returns
+ * CORPUS_ERROR_INVAL (without logging) if it is malformed or does not
+ * match.
+ */
+int filter_parse(struct corpus_filter *f, const uint8_t *data, uint64_t size)
+{
+	struct corpus_filter_prop *prop;
+	struct utf8lite_text text;
+	const uint8_t *props, *nodes, *excepts, *blob, *rec;
+	uint64_t nprop, nnode, nexcept, blob_size, pos, off, len;
+	uint32_t flags;
+	int *rules;
+	int err, i, ntype, parent_id, key, rule, node_id;
+
+	ntype = f->symtab.ntype;
+
+	if (size < FILTER_FILE_HEADER_SIZE
+			|| memcmp(data, FILTER_FILE_MAGIC, 8) != 0
+			|| filter_get_u32(data + 8) != FILTER_FILE_VERSION
+			|| filter_get_u32(data + 12) != (uint32_t)f->flags
+			|| filter_get_u32(data + 16) != (uint32_t)f->connector
+			|| filter_get_u32(data + 20) != (uint32_t)f->has_stemmer
+			|| filter_get_u32(data + 24) != (uint32_t)ntype) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	nprop = (uint64_t)ntype;
+	nnode = filter_get_u32(data + 28);
+	nexcept = filter_get_u32(data + 32);
+	blob_size = filter_get_u64(data + 40);
+
+	if (nnode > INT_MAX || nexcept > INT_MAX) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	// the sizes are all less than 2^35, so none of the sums overflow
+	pos = FILTER_FILE_HEADER_SIZE;
+	props = data + pos;
+	pos += FILTER_FILE_PAD(nprop * FILTER_FILE_PROP_SIZE);
+	nodes = data + pos;
+	pos += FILTER_FILE_PAD(nnode * FILTER_FILE_NODE_SIZE);
+	excepts = data + pos;
+	pos += nexcept * FILTER_FILE_EXCEPT_SIZE;
+	blob = data + pos;
+	if (pos > size || blob_size > size - pos) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	// type properties
+	if (ntype > 0 && (err = corpus_filter_grow_types(f,
+						f->symtab.ntype_max))) {
+		return err;
+	}
+
+	for (i = 0; i < ntype; i++) {
+		rec = props + (size_t)i * FILTER_FILE_PROP_SIZE;
+		prop = &f->props[i];
+		prop->stem = (int)(int32_t)filter_get_u32(rec);
+		prop->unspace = (int)(int32_t)filter_get_u32(rec + 4);
+		flags = filter_get_u32(rec + 8);
+
+		if (prop->stem < CORPUS_TYPE_NONE || prop->stem >= ntype
+				|| prop->unspace < CORPUS_TYPE_NONE
+				|| prop->unspace >= ntype
+				|| (flags & ~(uint32_t)FILTER_FILE_FLAGS)) {
+			return CORPUS_ERROR_INVAL;
+		}
+		prop->has_stem = (flags & FILTER_FILE_HAS_STEM) ? 1 : 0;
+		prop->has_unspace = (flags & FILTER_FILE_HAS_UNSPACE) ? 1 : 0;
+		prop->drop = (flags & FILTER_FILE_DROP) ? 1 : 0;
+	}
+
+	// stemming exceptions, checked before adding the combination rules
+	// so that only a failed allocation can leave a partial tree
+	for (i = 0; i < (int)nexcept; i++) {
+		rec = excepts + (size_t)i * FILTER_FILE_EXCEPT_SIZE;
+		off = filter_get_u64(rec);
+		len = filter_get_u32(rec + 8);
+		if (off > blob_size || len > blob_size - off
+				|| filter_get_u32(rec + 12) > 1) {
+			return CORPUS_ERROR_INVAL;
+		}
+	}
+
+	// combination rules; adding the nodes in order reproduces the IDs
+	for (i = 0; i < (int)nnode; i++) {
+		rec = nodes + (size_t)i * FILTER_FILE_NODE_SIZE;
+		parent_id = (int)(int32_t)filter_get_u32(rec);
+		key = (int)(int32_t)filter_get_u32(rec + 4);
+		rule = (int)(int32_t)filter_get_u32(rec + 8);
+
+		if (parent_id < CORPUS_TREE_NONE || parent_id >= i
+				|| key < CORPUS_TYPE_NONE || key >= ntype
+				|| rule < CORPUS_TYPE_NONE || rule >= ntype) {
+			err = CORPUS_ERROR_INVAL;
+			goto error;
+		}
+
+		if ((err = corpus_tree_add(&f->combine, parent_id, key,
+					   &node_id))) {
+			goto error;
+		}
+		if (node_id != i) {
+			err = CORPUS_ERROR_INVAL;
+			goto error;
+		}
+	}
+
+	if (nnode > 0) {
+		rules = corpus_realloc(f->combine_rules,
+				       (size_t)f->combine.nnode_max
+				       * sizeof(*rules));
+		if (!rules) {
+			err = CORPUS_ERROR_NOMEM;
+			goto error;
+		}
+		f->combine_rules = rules;
+
+		for (i = 0; i < (int)nnode; i++) {
+			rec = nodes + (size_t)i * FILTER_FILE_NODE_SIZE;
+			rules[i] = (int)(int32_t)filter_get_u32(rec + 8);
+		}
+	}
+
+	for (i = 0; i < (int)nexcept; i++) {
+		rec = excepts + (size_t)i * FILTER_FILE_EXCEPT_SIZE;
+		off = filter_get_u64(rec);
+		len = filter_get_u32(rec + 8);
+		text.ptr = (uint8_t *)(blob + off);
+		text.attr = (size_t)len;
+		if (filter_get_u32(rec + 12)) {
+			text.attr |= UTF8LITE_TEXT_UTF8_BIT;
+		}
+		if ((err = corpus_stem_except(&f->stemmer, &text))) {
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	corpus_tree_clear(&f->combine);
+	return err;
+}
@@ -155,6 +155,38 @@ int corpus_filter_drop(struct corpus_filter *f,
 int corpus_filter_drop_except(struct corpus_filter *f,
 			      const struct utf8lite_text *type);
 
+/**
+ * Save a filter's symbol table, type properties, combination rules, and
+ * stemming exceptions to a file, replacing the file if it exists. The
+ * file starts with the symbol table, as saved by #corpus_symtab_save, so
+ * that the type IDs stay the same when the filter gets loaded. The
+ * cached stems and unspaced types get saved along with the drop flags,
+ * so that a loaded filter does not need to recompute them.
+ *
+ * \param f the filter
+ * \param file_name the file name
+ *
+ * \returns 0 on success
+ */
+int corpus_filter_save(const struct corpus_filter *f, const char *file_name);
+
+/**
+ * Load a saved filter into a newly-initialized one, with no types or
+ * combination rules. The filter must have the same flags, type kind,
+ * and connector as the saved one, and must have a stemmer if and only
+ * if the saved one did; the stemmer itself does not get saved, so it
+ * should be the same one, since the cached stems came from it. The
+ * symbol table text gets memory-mapped, as with #corpus_symtab_load.
+ *
+ * \param f the filter
+ * \param file_name the file name
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the filter is not empty,
+ * 	if the file is malformed, or if the saved filter has different
+ * 	settings
+ */
+int corpus_filter_load(struct corpus_filter *f, const char *file_name);
+
 /**
  * Start scanning a text.
  *
@@ -167,7 +199,11 @@ int corpus_filter_start(struct corpus_filter *f,
 			const struct utf8lite_text *text);
 
 /**
- * Advance a text to the next type.
+ * Advance a text to the next type. On success, `f->type_id` holds the
+ * type ID; #CORPUS_TYPE_NONE for a dropped token, or #CORPUS_TYPE_OOV
+ * for a kept token of an unknown type left out of a bounded symbol table
+ * (#corpus_symtab_set_limit). Left-out tokens of known types get the
+ * filtered type ID, as do any other tokens.
  *
  * \param f the filter
  *
@@ -176,4 +212,28 @@ int corpus_filter_start(struct corpus_filter *f,
  */
 int corpus_filter_advance(struct corpus_filter *f);
 
+/**
+ * Advance a text through the next `nmax` types in one call, storing
+ * their IDs and locations in the given arrays, for consumers that
+ * process tokens in bulk. As with #corpus_filter_advance, the IDs may
+ * be #CORPUS_TYPE_OOV or other negative codes, but dropped tokens
+ * (#CORPUS_TYPE_NONE) get skipped. Call this repeatedly until it stores
+ * fewer than `nmax` types, at which point the text is exhausted; it can
+ * be mixed with calls to #corpus_filter_advance.
+ *
+ * \param f the filter
+ * \param type_ids an array of length `nmax` to store the type IDs
+ * \param offsets if non-NULL, an array of length `nmax` to store the
+ * 	token start offsets, in bytes from the start of the text
+ * \param sizes if non-NULL, an array of length `nmax` to store the token
+ * 	sizes, in bytes
+ * \param nmax the maximum number of types to store
+ * \param nptr if non-NULL, a location to store the number of types
+ *
+ * \returns 0 on success
+ */
+int corpus_filter_tokenize(struct corpus_filter *f, int *type_ids,
+			   size_t *offsets, size_t *sizes, int nmax,
+			   int *nptr);
+
 #endif /* CORPUS_FILTER_H */
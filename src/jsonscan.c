@@ -0,0 +1,402 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#include "jsonscan.h"
+
+#define JSON_BLOCK_SIZE 64
+
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+#  define JSON_SIMD 1
+#endif
+
+
+/*
+ * Raw bitmasks for a block, before accounting for escapes and strings.
+ */
+struct json_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t open;
+	uint64_t close;
+};
+
+
+/*
+ * Compute the raw bitmasks for a full 64-byte block. The brackets come in
+ * pairs that differ only in bit 0x20 ('[' is 0x5B, '{' is 0x7B; ']' is
+ * 0x5D, '}' is 0x7D), so one comparison finds both.
+ */
+static void json_masks_make(struct json_masks *m, const uint8_t *ptr)
+{
+#if defined(JSON_SIMD) && defined(__AVX2__)
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i open = _mm256_set1_epi8('{');
+	const __m256i close = _mm256_set1_epi8('}');
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	__m256i chunk, folded;
+	uint64_t bits;
+	int i;
+
+	m->quote = m->backslash = m->open = m->close = 0;
+
+	for (i = 0; i < 2; i++) {
+		chunk = _mm256_loadu_si256((const __m256i *)(ptr + 32 * i));
+		folded = _mm256_or_si256(chunk, lower);
+
+		bits = (uint32_t)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(chunk, quote));
+		m->quote |= bits << (32 * i);
+		bits = (uint32_t)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(chunk, backslash));
+		m->backslash |= bits << (32 * i);
+		bits = (uint32_t)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(folded, open));
+		m->open |= bits << (32 * i);
+		bits = (uint32_t)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(folded, close));
+		m->close |= bits << (32 * i);
+	}
+#elif defined(JSON_SIMD)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i open = _mm_set1_epi8('{');
+	const __m128i close = _mm_set1_epi8('}');
+	const __m128i lower = _mm_set1_epi8(0x20);
+	__m128i chunk, folded;
+	uint64_t bits;
+	int i;
+
+	m->quote = m->backslash = m->open = m->close = 0;
+
+	for (i = 0; i < 4; i++) {
+		chunk = _mm_loadu_si128((const __m128i *)(ptr + 16 * i));
+		folded = _mm_or_si128(chunk, lower);
+
+		bits = (uint16_t)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(chunk, quote));
+		m->quote |= bits << (16 * i);
+		bits = (uint16_t)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(chunk, backslash));
+		m->backslash |= bits << (16 * i);
+		bits = (uint16_t)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(folded, open));
+		m->open |= bits << (16 * i);
+		bits = (uint16_t)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(folded, close));
+		m->close |= bits << (16 * i);
+	}
+#else
+	uint64_t bit;
+	uint_fast8_t ch;
+	int i;
+
+	m->quote = m->backslash = m->open = m->close = 0;
+
+	for (i = 0; i < JSON_BLOCK_SIZE; i++) {
+		bit = (uint64_t)1 << i;
+		ch = ptr[i];
+		switch (ch | 0x20) {
+		case '"' | 0x20:
+			if (ch == '"') {
+				m->quote |= bit;
+			}
+			break;
+		case '|':	// '\\' | 0x20
+			if (ch == '\\') {
+				m->backslash |= bit;
+			}
+			break;
+		case '{':
+			m->open |= bit;
+			break;
+		case '}':
+			m->close |= bit;
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+}
+
+
+/*
+ * Find the characters escaped by a backslash, given the backslash mask.
+ * A character is escaped if it follows an odd-length run of
+ * backslashes. Adding the starts of the runs that begin on odd bits to
+ * the backslash mask carries through each run, which flips the parity
+ * of the bits after the runs that need it (see simdjson).
+ */
+static uint64_t json_escaped(uint64_t backslash, uint64_t *prev_escapedptr)
+{
+	const uint64_t even_bits = 0x5555555555555555ULL;
+	uint64_t prev_escaped = *prev_escapedptr;
+	uint64_t follows_escape, odd_starts, sequences, invert;
+
+	// an escaped backslash does not start a run
+	backslash &= ~prev_escaped;
+	follows_escape = (backslash << 1) | prev_escaped;
+
+	odd_starts = backslash & ~even_bits & ~follows_escape;
+	sequences = odd_starts + backslash;
+	*prev_escapedptr = (sequences < backslash) ? 1 : 0; // overflow
+
+	invert = sequences << 1;
+	return (even_bits ^ invert) & follows_escape;
+}
+
+
+/*
+ * Compute the prefix XOR of the bits: bit `i` of the result is the
+ * parity of bits 0 through `i` of the input.
+ */
+static uint64_t json_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+
+static int json_ctz(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+void corpus_json_scanner_make(struct corpus_json_scanner *scan,
+			      const uint8_t *ptr, const uint8_t *end)
+{
+	scan->ptr = ptr;
+	scan->end = end;
+	scan->prev_escaped = 0;
+	scan->prev_in_string = 0;
+}
+
+
+const uint8_t *corpus_json_scanner_advance(struct corpus_json_scanner *scan,
+					   struct corpus_json_block *block)
+{
+	uint8_t buf[JSON_BLOCK_SIZE];
+	struct json_masks m;
+	const uint8_t *ptr = scan->ptr;
+	size_t n = (size_t)(scan->end - ptr);
+	uint64_t escaped, quote, in_string;
+
+	if (n == 0) {
+		return NULL;
+	}
+
+	if (n >= JSON_BLOCK_SIZE) {
+		json_masks_make(&m, ptr);
+		scan->ptr = ptr + JSON_BLOCK_SIZE;
+	} else {
+		// pad the last block with spaces, which are not structural
+		memset(buf, ' ', sizeof(buf));
+		memcpy(buf, ptr, n);
+		json_masks_make(&m, buf);
+		scan->ptr = scan->end;
+	}
+
+	escaped = json_escaped(m.backslash, &scan->prev_escaped);
+	quote = m.quote & ~escaped;
+	in_string = json_prefix_xor(quote) ^ scan->prev_in_string;
+	scan->prev_in_string = (uint64_t)0 - (in_string >> 63);
+
+	block->quote = quote;
+	block->in_string = in_string;
+	block->open = m.open & ~in_string;
+	block->close = m.close & ~in_string;
+
+	return ptr;
+}
+
+
+/*
+ * Find the first quote or backslash in [ptr, end), or `end` if none
+ * exists. If `utf8ptr` is non-NULL, set it to a nonzero value if any of
+ * the bytes before the result are non-ASCII.
+ */
+static const uint8_t *json_find_special(const uint8_t *ptr,
+					const uint8_t *end,
+					unsigned *utf8ptr)
+{
+	unsigned utf8 = 0;
+#if defined(JSON_SIMD)
+	unsigned high, mask;
+
+#  if defined(__AVX2__)
+	const __m256i quote32 = _mm256_set1_epi8('"');
+	const __m256i backslash32 = _mm256_set1_epi8('\\');
+	__m256i chunk32;
+
+	while (end - ptr >= 32) {
+		chunk32 = _mm256_loadu_si256((const __m256i *)ptr);
+		mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+				_mm256_cmpeq_epi8(chunk32, quote32),
+				_mm256_cmpeq_epi8(chunk32, backslash32)));
+		if (utf8ptr) {
+			high = (unsigned)_mm256_movemask_epi8(chunk32);
+			utf8 |= mask ? high & (mask ^ (mask - 1)) : high;
+		}
+		if (mask) {
+			ptr += __builtin_ctz(mask);
+			goto out;
+		}
+		ptr += 32;
+	}
+#  endif
+	const __m128i quote16 = _mm_set1_epi8('"');
+	const __m128i backslash16 = _mm_set1_epi8('\\');
+	__m128i chunk16;
+
+	while (end - ptr >= 16) {
+		chunk16 = _mm_loadu_si128((const __m128i *)ptr);
+		mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(chunk16, quote16),
+				_mm_cmpeq_epi8(chunk16, backslash16)));
+		if (utf8ptr) {
+			high = (unsigned)_mm_movemask_epi8(chunk16);
+			utf8 |= mask ? high & (mask ^ (mask - 1)) : high;
+		}
+		if (mask) {
+			ptr += __builtin_ctz(mask);
+			goto out;
+		}
+		ptr += 16;
+	}
+#endif
+	while (ptr != end) {
+		if (*ptr == '"' || *ptr == '\\') {
+			goto out;
+		}
+		utf8 |= (*ptr & 0x80);
+		ptr++;
+	}
+
+out:
+	if (utf8ptr) {
+		*utf8ptr |= utf8;
+	}
+	return ptr;
+}
+
+
+/*
+ * Find the end of a string, optionally noting whether it has any
+ * non-ASCII bytes.
+ */
+static const uint8_t *json_scan_text(const uint8_t *ptr, const uint8_t *end,
+				     int *has_escptr, unsigned *utf8ptr)
+{
+	int has_esc = 0;
+
+	while (1) {
+		ptr = json_find_special(ptr, end, utf8ptr);
+		if (ptr == end || *ptr == '"') {
+			break;
+		}
+
+		// backslash; skip over the escaped character, which is
+		// always ASCII in valid input
+		has_esc = 1;
+		ptr++;
+		if (ptr == end) {
+			break;
+		}
+		ptr++;
+	}
+
+	if (has_escptr) {
+		*has_escptr = has_esc;
+	}
+	return ptr;
+}
+
+
+const uint8_t *corpus_json_scan_text(const uint8_t *ptr, const uint8_t *end,
+				     int *has_escptr)
+{
+	return json_scan_text(ptr, end, has_escptr, NULL);
+}
+
+
+const uint8_t *corpus_json_scan_text_attr(const uint8_t *ptr,
+					  const uint8_t *end,
+					  int *has_escptr, int *has_utf8ptr)
+{
+	unsigned utf8 = 0;
+
+	ptr = json_scan_text(ptr, end, has_escptr, &utf8);
+	if (has_utf8ptr) {
+		*has_utf8ptr = utf8 ? 1 : 0;
+	}
+	return ptr;
+}
+
+
+const uint8_t *corpus_json_scan_close(const uint8_t *ptr,
+				      const uint8_t *end)
+{
+	struct corpus_json_scanner scan;
+	struct corpus_json_block block;
+	const uint8_t *base;
+	uint64_t structural, bit;
+	size_t depth = 0;
+	int i;
+
+	corpus_json_scanner_make(&scan, ptr, end);
+
+	while ((base = corpus_json_scanner_advance(&scan, &block))) {
+		structural = block.open | block.close;
+		while (structural) {
+			i = json_ctz(structural);
+			bit = (uint64_t)1 << i;
+			if (block.open & bit) {
+				depth++;
+			} else if (--depth == 0) {
+				return base + i + 1;
+			}
+			structural &= structural - 1;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CORPUS_JSONSCAN_H
+#define CORPUS_JSONSCAN_H
+
+/**
+ * \file jsonscan.h
+ *
+ * Vectorized structural scanning for JavaScript Object Notation (JSON)
+ * input.
+ *
+ * The scanners process the input in 64-byte blocks, in the style of the
+ * first stage of simdjson. For each block, they compute bitmasks of the
+ * quotes, backslashes, and brackets with vector comparisons, resolve
+ * which quotes are escaped and which bytes lie inside strings with
+ * carry-propagating bit arithmetic, and then only visit the structural
+ * characters, rather than every byte. On platforms without SSE2, the
+ * bitmasks get computed one byte at a time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Structural bitmasks for a 64-byte block of JSON input. Bit `i` of
+ * each mask corresponds to byte `i` of the block.
+ */
+struct corpus_json_block {
+	uint64_t quote;		/**< unescaped quotes (`"`) */
+	uint64_t in_string;	/**< bytes inside strings, including the
+				  opening quotes but not the closing ones */
+	uint64_t open;		/**< opening brackets (`[` and `{`) outside
+				  strings */
+	uint64_t close;		/**< closing brackets (`]` and `}`) outside
+				  strings */
+};
+
+/**
+ * Scanner state, carried from one block to the next.
+ */
+struct corpus_json_scanner {
+	const uint8_t *ptr;	/**< the start of the next block */
+	const uint8_t *end;	/**< the end of the input */
+	uint64_t prev_escaped;	/**< whether the first byte of the next block
+				  is escaped by a backslash */
+	uint64_t prev_in_string; /**< all ones if the next block starts inside
+				   a string, zero otherwise */
+};
+
+/**
+ * Initialize a scanner for input that starts outside of a string.
+ *
+ * \param scan the scanner
+ * \param ptr the input
+ * \param end the end of the input
+ */
+void corpus_json_scanner_make(struct corpus_json_scanner *scan,
+			      const uint8_t *ptr, const uint8_t *end);
+
+/**
+ * Compute the structural bitmasks for the next block of input. The last
+ * block may be shorter than 64 bytes; its masks have no bits set past
+ * the end of the input.
+ *
+ * \param scan the scanner
+ * \param block on exit, the block's bitmasks
+ *
+ * \returns a pointer to the start of the block, or `NULL` if the input
+ * 	is exhausted
+ */
+const uint8_t *corpus_json_scanner_advance(struct corpus_json_scanner *scan,
+					   struct corpus_json_block *block);
+
+/**
+ * Find the end of a string.
+ *
+ * \param ptr the string contents, immediately after the opening quote
+ * \param end the end of the input
+ * \param has_escptr if non-NULL, on exit, a flag indicating whether the
+ * 	string contains a backslash escape
+ *
+ * \returns a pointer to the closing quote, or `end` if the string is not
+ * 	terminated
+ */
+const uint8_t *corpus_json_scan_text(const uint8_t *ptr, const uint8_t *end,
+				     int *has_escptr);
+
+/**
+ * Find the end of a string, and note whether it has any non-ASCII
+ * bytes. This is the same as #corpus_json_scan_text, but checks the
+ * high bits of the string bytes along the way.
+ *
+ * \param ptr the string contents, immediately after the opening quote
+ * \param end the end of the input
+ * \param has_escptr if non-NULL, on exit, a flag indicating whether the
+ * 	string contains a backslash escape
+ * \param has_utf8ptr if non-NULL, on exit, a flag indicating whether the
+ * 	string contains a non-ASCII byte
+ *
+ * \returns a pointer to the closing quote, or `end` if the string is not
+ * 	terminated
+ */
+const uint8_t *corpus_json_scan_text_attr(const uint8_t *ptr,
+					  const uint8_t *end,
+					  int *has_escptr, int *has_utf8ptr);
+
+/**
+ * Find the end of an array or object. This only checks that the brackets
+ * and quotes balance; it does not distinguish between `[` and `{`, or
+ * validate the values inside.
+ *
+ * \param ptr the opening bracket (`[` or `{`)
+ * \param end the end of the input
+ *
+ * \returns a pointer immediately after the matching closing bracket, or
+ * 	`NULL` if none exists
+ */
+const uint8_t *corpus_json_scan_close(const uint8_t *ptr,
+				      const uint8_t *end);
+
+#endif /* CORPUS_JSONSCAN_H */
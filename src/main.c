@@ -37,7 +37,9 @@
 #define PROGRAM_VERSION	"0.6.0"
 
 void usage(void);
+void usage_compile(void);
 void usage_get(void);
+void usage_index(void);
 void usage_ngrams(void);
 void usage_scan(void);
 void usage_sentences(void);
@@ -45,7 +47,9 @@ void usage_tokens(void);
 
 void version(void);
 
+int main_compile(int argc, char * const argv[]);
 int main_get(int argc, char * const argv[]);
+int main_index(int argc, char * const argv[]);
 int main_ngrams(int argc, char * const argv[]);
 int main_scan(int argc, char * const argv[]);
 int main_sentences(int argc, char * const argv[]);
@@ -61,11 +65,15 @@ Options:\n\
 \t-v\tPrints the version number.\n\
 \n\
 Commands:\n\
+\tcompile\tCompile a data file into columns.\n\
 \tget\tExtract a field from a data file.\n\
+\tindex\tBuild a line index for a data file.\n\
 \tngrams\tCompute token n-gram frequencies.\n\
 \tscan\tDetermine the schema of a data file.\n\
 \tsentences\tSegment text into sentences.\n\
 \ttokens\tSegment text into tokens.\n\
+\n\
+Commands read from standard input when the input <path> is \"-\".\n\
 ", PROGRAM_NAME);
 }
 
@@ -116,12 +124,24 @@ int main(int argc, char * const argv[])
 	if (argc == 0) {
 		usage();
 		return EXIT_FAILURE;
+	} else if (!strcmp(argv[0], "compile")) {
+		if (help) {
+			usage_compile();
+			return EXIT_SUCCESS;
+		}
+		err = main_compile(argc, argv);
 	} else if (!strcmp(argv[0], "get")) {
 		if (help) {
 			usage_get();
 			return EXIT_SUCCESS;
 		}
 		err = main_get(argc, argv);
+	} else if (!strcmp(argv[0], "index")) {
+		if (help) {
+			usage_index();
+			return EXIT_SUCCESS;
+		}
+		err = main_index(argc, argv);
 	} else if (!strcmp(argv[0], "ngrams")) {
 		if (help) {
 			usage_ngrams();
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _POSIX_C_SOURCE 2 // for getopt
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../lib/utf8lite/src/utf8lite.h"
+
+#include "error.h"
+#include "filebuf.h"
+#include "colfile.h"
+
+#define PROGRAM_NAME	"corpus"
+
+int main_compile(int argc, char * const argv[]);
+void usage_compile(void);
+
+
+void usage_compile(void)
+{
+	printf("\
+Usage:\t%s compile [options] <path>\n\
+\n\
+Description:\n\
+\tCompile the records in a data file into columns, saving them at\n\
+\t<path>%s. Other commands read text fields from the columns\n\
+\twithout parsing the file; the columns get ignored if the file\n\
+\tchanges.\n\
+\n\
+Options:\n\
+\t-q\t\tDoes not print the number of rows and columns.\n\
+", PROGRAM_NAME, CORPUS_COLFILE_EXT);
+}
+
+
+int main_compile(int argc, char * const argv[])
+{
+	struct corpus_colfile cf;
+	const char *input;
+	int ch, err;
+	int quiet = 0;
+
+	while ((ch = getopt(argc, argv, "q")) != -1) {
+		switch (ch) {
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage_compile();
+			return EXIT_FAILURE;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0) {
+		fprintf(stderr, "No input file specified.\n\n");
+		usage_compile();
+		return EXIT_FAILURE;
+	} else if (argc > 1) {
+		fprintf(stderr, "Too many input files specified.\n\n");
+		usage_compile();
+		return EXIT_FAILURE;
+	}
+
+	input = argv[0];
+
+	if ((err = corpus_colfile_write(input))) {
+		goto error_write;
+	}
+
+	if (!quiet) {
+		if ((err = corpus_colfile_init(&cf, input))) {
+			corpus_log(err, "failed reading column file");
+			goto error_write;
+		}
+		printf("%"PRIu64" rows, %d columns\n", cf.nrow, cf.ncolumn);
+		corpus_colfile_destroy(&cf);
+	}
+
+error_write:
+	if (err) {
+		fprintf(stderr, "An error occurred.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
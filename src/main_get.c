@@ -16,6 +16,7 @@
 
 #define _POSIX_C_SOURCE 2 // for getopt
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -25,7 +26,9 @@
 #include "../lib/utf8lite/src/utf8lite.h"
 
 #include "error.h"
+#include "decoder.h"
 #include "filebuf.h"
+#include "filestream.h"
 #include "table.h"
 #include "textset.h"
 #include "stem.h"
@@ -37,37 +40,158 @@
 
 int main_get(int argc, char * const argv[]);
 void usage_get(void);
+static int parse_lines(const char *arg, uint64_t *startptr,
+		       uint64_t *stopptr);
+static void write_path(FILE *stream, const char *path);
+static void write_value(FILE *stream,
+			const struct corpus_data_projection *proj,
+			int path_id);
 
 
 void usage_get(void)
 {
 	printf("\
-Usage:\t%s get [options] <field> <path>\n\
+Usage:\t%s get [options] <field> [<field> ...] <path>\n\
 \n\
 Description:\n\
-\tExtract a field from a data file.\n\
+\tExtract one or more fields from a data file, in a single pass.\n\
+\tFields can be nested (\"user.lang\") and can select array items,\n\
+\teither by index (\"a[0]\") or all of them (\"entities.hashtags[*]\");\n\
+\tthe latter give an array of the matched values. With more than one\n\
+\tfield, each output line is a record keyed by the field paths.\n\
 \n\
 Options:\n\
+\t-l <m>:<n>\tExtracts from lines <m> through <n> only, counting\n\
+\t\t\tfrom 1; either bound may be omitted. With a line index\n\
+\t\t\t(see \"%s index\"), this does not scan the lines before <m>.\n\
 \t-o <path>\tSaves output at the given path.\n\
-", PROGRAM_NAME);
+", PROGRAM_NAME, PROGRAM_NAME);
+}
+
+
+/*
+ * Parse a line range of the form "m:n", "m:", ":n", or "m", with
+ * 1-based inclusive bounds, into a 0-based half-open range.
+ */
+int parse_lines(const char *arg, uint64_t *startptr, uint64_t *stopptr)
+{
+	const char *colon = strchr(arg, ':');
+	char *end;
+	uint64_t first = 1, last = UINT64_MAX;
+
+	// strtoull accepts a sign and leading space, so require a digit
+	if (colon != arg) {
+		if (!isdigit((unsigned char)arg[0])) {
+			return 0;
+		}
+		first = (uint64_t)strtoull(arg, &end, 10);
+		if (first == 0 || (*end && *end != ':')) {
+			return 0;
+		}
+	}
+
+	if (!colon) {
+		last = first;
+	} else if (colon[1]) {
+		if (!isdigit((unsigned char)colon[1])) {
+			return 0;
+		}
+		last = (uint64_t)strtoull(colon + 1, &end, 10);
+		if (*end) {
+			return 0;
+		}
+	}
+
+	if (last < first) {
+		last = first - 1;
+	}
+
+	*startptr = first - 1;
+	*stopptr = last;
+	return 1;
+}
+
+
+/*
+ * Write a field path as a JSON string.
+ */
+void write_path(FILE *stream, const char *path)
+{
+	const char *ptr;
+
+	fputc('"', stream);
+	for (ptr = path; *ptr; ptr++) {
+		if (*ptr == '"' || *ptr == '\\') {
+			fputc('\\', stream);
+		}
+		fputc(*ptr, stream);
+	}
+	fputc('"', stream);
+}
+
+
+/*
+ * Write the value for a path: an array of the matches for paths with an
+ * all-items step, or the first match (or null) for the others.
+ */
+void write_value(FILE *stream, const struct corpus_data_projection *proj,
+		 int path_id)
+{
+	const struct corpus_data *val;
+	int i, first = 1;
+
+	if (!proj->path_multi[path_id]) {
+		for (i = 0; i < proj->nmatch; i++) {
+			if (proj->matches[i].path_id == path_id) {
+				val = &proj->matches[i].value;
+				fprintf(stream, "%.*s", (int)val->size,
+					(const char *)val->ptr);
+				return;
+			}
+		}
+		fprintf(stream, "null");
+		return;
+	}
+
+	fputc('[', stream);
+	for (i = 0; i < proj->nmatch; i++) {
+		if (proj->matches[i].path_id != path_id) {
+			continue;
+		}
+		val = &proj->matches[i].value;
+		fprintf(stream, "%s%.*s", first ? "" : ",", (int)val->size,
+			(const char *)val->ptr);
+		first = 0;
+	}
+	fputc(']', stream);
 }
 
 
 int main_get(int argc, char * const argv[])
 {
-	struct corpus_data data, val;
-	struct utf8lite_text name;
+	struct corpus_data_projection proj;
+	struct utf8lite_text path;
 	struct corpus_schema schema;
-	struct corpus_filebuf buf;
-	struct corpus_filebuf_iter it;
+	struct corpus_filestream fs;
 	const char *output = NULL;
-	const char *field, *input;
+	const char *input;
 	FILE *stream;
-	int ch, err, name_id;
-	size_t field_len;
+	int *path_ids = NULL;
+	int ch, err, i, nfield;
+	int has_lines = 0;
+	uint64_t start = 0, stop = 0;
 
-	while ((ch = getopt(argc, argv, "o:")) != -1) {
+	while ((ch = getopt(argc, argv, "l:o:")) != -1) {
 		switch (ch) {
+		case 'l':
+			if (!parse_lines(optarg, &start, &stop)) {
+				fprintf(stderr, "Invalid line range (%s)\n\n",
+					optarg);
+				usage_get();
+				return EXIT_FAILURE;
+			}
+			has_lines = 1;
+			break;
 		case 'o':
 			output = optarg;
 			break;
@@ -88,33 +212,42 @@ int main_get(int argc, char * const argv[])
 		fprintf(stderr, "No input file specified.\n\n");
 		usage_get();
 		return EXIT_FAILURE;
-	} else if (argc > 2) {
-		fprintf(stderr, "Too many input files specified.\n\n");
-		usage_get();
-		return EXIT_FAILURE;
 	}
 
-	field = argv[0];
-	input = argv[1];
+	nfield = argc - 1;
+	input = argv[nfield];
+
+	if ((err = corpus_schema_init(&schema))) {
+		goto error_schema;
+	}
+
+	if ((err = corpus_data_projection_init(&proj))) {
+		goto error_projection;
+	}
 
-	field_len = strlen(field);
-	if (field_len > 0 && field[0] == '"') {
-		field++;
-		field_len -= 2;
+	if (!(path_ids = malloc((size_t)nfield * sizeof(*path_ids)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_fields;
 	}
 
-	if (utf8lite_text_assign(&name, (const uint8_t *)field, field_len, 0,
-				 NULL)) {
-		fprintf(stderr, "Invalid field name (%s)\n", field);
-		return EXIT_FAILURE;
+	for (i = 0; i < nfield; i++) {
+		if (utf8lite_text_assign(&path, (const uint8_t *)argv[i],
+					 strlen(argv[i]), 0, NULL)
+				|| corpus_data_projection_add(&proj, &schema,
+							      &path,
+							      &path_ids[i])) {
+			fprintf(stderr, "Invalid field (%s)\n", argv[i]);
+			err = CORPUS_ERROR_INVAL;
+			goto error_fields;
+		}
 	}
 
-	if ((err = corpus_schema_init(&schema))) {
-		goto error_schema;
+	if ((err = corpus_filestream_init(&fs, input))) {
+		goto error_fields;
 	}
 
-	if ((err = corpus_filebuf_init(&buf, input))) {
-		goto error_filebuf;
+	if (has_lines) {
+		corpus_filestream_set_lines(&fs, start, stop);
 	}
 
 	if (output) {
@@ -127,25 +260,31 @@ int main_get(int argc, char * const argv[])
 		stream = stdout;
 	}
 
-	if ((err = corpus_schema_name(&schema, &name, &name_id))) {
-		goto error_get;
-	}
-
-	corpus_filebuf_iter_make(&it, &buf);
-	while (corpus_filebuf_iter_advance(&it)) {
-		if ((err = corpus_data_assign(&data, &schema, it.current.ptr,
-					      it.current.size))) {
+	while (corpus_filestream_advance(&fs)) {
+		if ((err = corpus_data_project(&proj, &schema, fs.current.ptr,
+					       fs.current.size))) {
 			goto error_get;
 		}
 
-		if (corpus_data_field(&data, &schema, name_id, &val) == 0) {
-			// field exists
-			fprintf(stream, "%.*s\n", (int)val.size,
-				(const char *)val.ptr);
+		if (nfield == 1) {
+			write_value(stream, &proj, path_ids[0]);
 		} else {
-			// field is null
-			fprintf(stream, "null\n");
+			fputc('{', stream);
+			for (i = 0; i < nfield; i++) {
+				if (i > 0) {
+					fputc(',', stream);
+				}
+				write_path(stream, argv[i]);
+				fputc(':', stream);
+				write_value(stream, &proj, path_ids[i]);
+			}
+			fputc('}', stream);
 		}
+		fputc('\n', stream);
+	}
+	if (fs.error) {
+		err = fs.error;
+		goto error_get;
 	}
 
 	err = 0;
@@ -156,8 +295,11 @@ error_get:
 		err = CORPUS_ERROR_OS;
 	}
 error_output:
-	corpus_filebuf_destroy(&buf);
-error_filebuf:
+	corpus_filestream_destroy(&fs);
+error_fields:
+	free(path_ids);
+	corpus_data_projection_destroy(&proj);
+error_projection:
 	corpus_schema_destroy(&schema);
 error_schema:
 	if (err) {
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _POSIX_C_SOURCE 2 // for getopt
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "filebuf.h"
+
+#define PROGRAM_NAME	"corpus"
+
+int main_index(int argc, char * const argv[]);
+void usage_index(void);
+
+
+void usage_index(void)
+{
+	printf("\
+Usage:\t%s index [options] <path>\n\
+\n\
+Description:\n\
+\tBuild a line index for a data file, saving it at <path>%s.\n\
+\tOther commands use the index to locate lines without scanning\n\
+\tthe file; the index gets ignored if the file changes.\n\
+\n\
+Options:\n\
+\t-q\t\tDoes not print the number of lines.\n\
+", PROGRAM_NAME, CORPUS_FILEBUF_INDEX_EXT);
+}
+
+
+int main_index(int argc, char * const argv[])
+{
+	struct corpus_filebuf buf;
+	const char *input;
+	int ch, err;
+	int quiet = 0;
+
+	while ((ch = getopt(argc, argv, "q")) != -1) {
+		switch (ch) {
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage_index();
+			return EXIT_FAILURE;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0) {
+		fprintf(stderr, "No input file specified.\n\n");
+		usage_index();
+		return EXIT_FAILURE;
+	} else if (argc > 1) {
+		fprintf(stderr, "Too many input files specified.\n\n");
+		usage_index();
+		return EXIT_FAILURE;
+	}
+
+	input = argv[0];
+
+	if ((err = corpus_filebuf_init(&buf, input))) {
+		goto error_filebuf;
+	}
+
+	if ((err = corpus_filebuf_write_index(&buf))) {
+		goto error_index;
+	}
+
+	if (!quiet) {
+		printf("%"PRIu64" lines\n", buf.index.nline);
+	}
+
+error_index:
+	corpus_filebuf_destroy(&buf);
+error_filebuf:
+	if (err) {
+		fprintf(stderr, "An error occurred.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
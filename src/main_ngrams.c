@@ -14,9 +14,11 @@
  * limitations under the License.
  */
 
-#define _POSIX_C_SOURCE 2 // for getopt
+#define _POSIX_C_SOURCE 200809L // for getopt, sysconf
 
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,7 +27,10 @@
 #include "../lib/utf8lite/src/utf8lite.h"
 
 #include "error.h"
+#include "decoder.h"
 #include "filebuf.h"
+#include "filestream.h"
+#include "colfile.h"
 #include "stopword.h"
 #include "table.h"
 #include "textset.h"
@@ -41,11 +46,82 @@
 
 #define COMBINE_MAX 256
 
+/* Maximum number of threads for parallel counting. */
+#define NGRAMS_NTHREAD_MAX 64
+
+/*
+ * Parallel counting splits the input into batches of about this many
+ * bytes (for data files) or rows (for column files).
+ */
+#define NGRAMS_BATCH_SIZE ((size_t)256 * 1024)
+#define NGRAMS_BATCH_NROW 1024
+
 static const char *combine_rules[COMBINE_MAX];
 
+/*
+ * Filter and counter settings, for setting up each thread.
+ */
+struct ngrams_config {
+	const struct utf8lite_text *name;
+	int filter_flags;
+	int type_flags;
+	const char *stemmer;
+	const uint8_t **stopwords;
+	int ncomb;
+	int length;
+};
+
+/*
+ * Counting state, with a filter, a schema for parsing the lines, and
+ * the n-gram counts. Each thread has its own.
+ */
+struct ngrams_state {
+	struct corpus_filter filter;
+	struct corpus_stem_snowball snowball;
+	struct corpus_schema schema;
+	struct corpus_data_accessor accessor;
+	struct corpus_ngram ngram;
+	int has_snowball;
+};
+
+/*
+ * Parallel counting work. Threads claim batches of lines as they finish
+ * their previous ones, so that a slow batch does not hold up the others.
+ */
+struct ngrams_pool {
+	pthread_mutex_t lock;
+	const struct corpus_colfile *cf;
+	int col;
+	struct corpus_filebuf_iter *its;
+	int nbatch;
+	int next;
+	int error;
+};
+
+struct ngrams_worker {
+	pthread_t thread;
+	struct ngrams_pool *pool;
+	struct ngrams_state state;
+};
+
 
 int main_ngrams(int argc, char * const argv[]);
 void usage_ngrams(void);
+static int ngrams_state_init(struct ngrams_state *st,
+			     const struct ngrams_config *cfg,
+			     struct corpus_symtab_shared *sh);
+static void ngrams_state_destroy(struct ngrams_state *st);
+static int ngrams_line_text(struct ngrams_state *st,
+			    const struct corpus_filebuf_line *line,
+			    struct utf8lite_text *text, int *has_textptr);
+static int ngrams_count(struct ngrams_state *st,
+			const struct utf8lite_text *text);
+static int ngrams_batch_run(struct ngrams_worker *w, int i);
+static void *ngrams_worker_run(void *arg);
+static int ngrams_parallel(const struct ngrams_config *cfg,
+			   const struct corpus_colfile *cf, int col,
+			   const struct corpus_filebuf *buf, int nthread,
+			   struct corpus_ngram *ngram);
 
 
 struct string_arg {
@@ -106,6 +182,8 @@ Options:\n\
 \t-c <combine>\tAdds a combination rule.\n\
 \t-d <class>\tReplace words from the given class with 'null'.\n\
 \t-f <field>\tGets text from the given field (defaults to \"text\").\n\
+\t-j <n>\t\tCounts with <n> threads, or one per processor if <n>\n\
+\t\t\tis 0; only for uncompressed or compiled files.\n\
 \t-k <map>\tDoes not perform the given character map.\n\
 \t-n <length>\tSets the n-gram length.\n\
 \t-o <path>\tSaves output at the given path.\n\
@@ -161,45 +239,424 @@ Options:\n\
 	}
 }
 
-int main_ngrams(int argc, char * const argv[])
+/*
+ * Set up the filter, schema, and counter for one thread, attaching the
+ * filter's symbol table to the shared table `sh`, if it is non-NULL.
+ */
+int ngrams_state_init(struct ngrams_state *st,
+		      const struct ngrams_config *cfg,
+		      struct corpus_symtab_shared *sh)
+{
+	const uint8_t **stopwords;
+	struct utf8lite_text word;
+	int err, i;
+
+	st->has_snowball = 0;
+
+	if ((err = corpus_ngram_init(&st->ngram, cfg->length))) {
+		goto error_ngram;
+	}
+
+	if ((err = corpus_schema_init(&st->schema))) {
+		goto error_schema;
+	}
+
+	if ((err = corpus_data_accessor_init(&st->accessor, &st->schema,
+					     cfg->name))) {
+		goto error_accessor;
+	}
+
+	if (cfg->stemmer) {
+		if ((err = corpus_stem_snowball_init(&st->snowball,
+						     cfg->stemmer))) {
+			goto error_snowball;
+		}
+		st->has_snowball = 1;
+		if ((err = corpus_filter_init(&st->filter, cfg->filter_flags,
+					      cfg->type_flags, '_',
+					      corpus_stem_snowball,
+					      &st->snowball))) {
+			goto error_filter;
+		}
+	} else {
+		if ((err = corpus_filter_init(&st->filter, cfg->filter_flags,
+					      cfg->type_flags, '_', NULL,
+					      NULL))) {
+			goto error_filter;
+		}
+	}
+
+	stopwords = cfg->stopwords;
+	if (stopwords) {
+		while (*stopwords) {
+			err = utf8lite_text_assign(&word, *stopwords,
+						   strlen((const char *)
+							  *stopwords),
+						   UTF8LITE_TEXT_UNKNOWN,
+						   NULL);
+			if (err) {
+				fprintf(stderr, "Internal error:"
+					" stop word list is not valid UTF-8.");
+				goto error_stopwords;
+			}
+
+			err = corpus_filter_stem_except(&st->filter, &word);
+			if (err) {
+				goto error_stopwords;
+			}
+
+			err = corpus_filter_drop(&st->filter, &word);
+			if (err) {
+				goto error_stopwords;
+			}
+
+			stopwords++;
+		}
+	}
+
+	for (i = 0; i < cfg->ncomb; i++) {
+		err = utf8lite_text_assign(&word,
+					   (const uint8_t *)combine_rules[i],
+					   strlen(combine_rules[i]),
+					   UTF8LITE_TEXT_UNKNOWN, NULL);
+		if (err) {
+			fprintf(stderr,
+				"Combination rule ('%s') is not valid UTF-8.",
+				combine_rules[i]);
+			goto error_combine;
+		}
+
+		if ((err = corpus_filter_combine(&st->filter, &word))) {
+			goto error_combine;
+		}
+	}
+
+	if (sh && (err = corpus_symtab_set_shared(&st->filter.symtab, sh))) {
+		goto error_shared;
+	}
+
+	return 0;
+
+error_shared:
+error_combine:
+error_stopwords:
+	corpus_filter_destroy(&st->filter);
+error_filter:
+	if (st->has_snowball) {
+		corpus_stem_snowball_destroy(&st->snowball);
+	}
+error_snowball:
+error_accessor:
+	corpus_schema_destroy(&st->schema);
+error_schema:
+	corpus_ngram_destroy(&st->ngram);
+error_ngram:
+	return err;
+}
+
+
+void ngrams_state_destroy(struct ngrams_state *st)
+{
+	corpus_filter_destroy(&st->filter);
+	if (st->has_snowball) {
+		corpus_stem_snowball_destroy(&st->snowball);
+	}
+	corpus_schema_destroy(&st->schema);
+	corpus_ngram_destroy(&st->ngram);
+}
+
+
+/*
+ * Get the text from a line of a data file, using the entire line if the
+ * field is missing. Sets `*has_textptr` to zero if the value is not
+ * text.
+ */
+int ngrams_line_text(struct ngrams_state *st,
+		     const struct corpus_filebuf_line *line,
+		     struct utf8lite_text *text, int *has_textptr)
 {
-	struct corpus_filter filter;
-	struct corpus_stem_snowball snowball;
 	struct corpus_data data, val;
-	struct utf8lite_text name, text, word;
-	struct corpus_schema schema;
-	struct corpus_filebuf buf;
+	int err;
+
+	if ((err = corpus_data_access(&st->accessor, &st->schema, line->ptr,
+				      line->size, &val))) {
+		return err;
+	}
+
+	// if the field is missing, use the entire line
+	if (val.type_id == CORPUS_DATATYPE_NULL) {
+		if ((err = corpus_data_assign(&data, &st->schema, line->ptr,
+					      line->size))) {
+			return err;
+		}
+		val = data;
+	}
+
+	*has_textptr = corpus_data_text(&val, text) ? 0 : 1;
+	return 0;
+}
+
+
+/*
+ * Count the n-grams in a text, by their types' shared IDs, so that the
+ * counts from different threads agree.
+ */
+int ngrams_count(struct ngrams_state *st, const struct utf8lite_text *text)
+{
+	struct corpus_filter *filter = &st->filter;
+	int err, type_id;
+
+	if ((err = corpus_filter_start(filter, text))) {
+		return err;
+	}
+
+	if ((err = corpus_ngram_break(&st->ngram))) {
+		return err;
+	}
+
+	while (corpus_filter_advance(filter)) {
+		type_id = filter->type_id;
+		if (type_id == CORPUS_TYPE_NONE) {
+			continue;
+		} else if (type_id < 0) {
+			if ((err = corpus_ngram_break(&st->ngram))) {
+				return err;
+			}
+		} else {
+			type_id = filter->symtab.types[type_id].shared_id;
+			if ((err = corpus_ngram_add(&st->ngram, type_id, 1))) {
+				return err;
+			}
+		}
+	}
+
+	return filter->error;
+}
+
+
+/*
+ * Count the n-grams in a batch of lines.
+ */
+int ngrams_batch_run(struct ngrams_worker *w, int i)
+{
+	struct ngrams_pool *p = w->pool;
 	struct corpus_filebuf_iter it;
+	struct utf8lite_text text;
+	uint64_t row, end;
+	int err, has_text;
+
+	if (p->col >= 0) {
+		row = (uint64_t)i * NGRAMS_BATCH_NROW;
+		end = row + NGRAMS_BATCH_NROW;
+		if (end > p->cf->nrow) {
+			end = p->cf->nrow;
+		}
+		for (; row < end; row++) {
+			if (corpus_colfile_text(p->cf, p->col, row, &text)) {
+				continue;
+			}
+			if ((err = ngrams_count(&w->state, &text))) {
+				return err;
+			}
+		}
+	} else {
+		it = p->its[i];
+		while (corpus_filebuf_iter_advance(&it)) {
+			if ((err = ngrams_line_text(&w->state, &it.current,
+						    &text, &has_text))) {
+				return err;
+			}
+			if (!has_text) {
+				continue;
+			}
+			if ((err = ngrams_count(&w->state, &text))) {
+				return err;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+void *ngrams_worker_run(void *arg)
+{
+	struct ngrams_worker *w = arg;
+	struct ngrams_pool *p = w->pool;
+	int err, i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		if (p->error || p->next == p->nbatch) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		i = p->next++;
+		pthread_mutex_unlock(&p->lock);
+
+		if ((err = ngrams_batch_run(w, i))) {
+			pthread_mutex_lock(&p->lock);
+			if (!p->error) {
+				p->error = err;
+			}
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Count the n-grams in the lines of a memory-mapped file or the rows of a
+ * column file on several threads, each with its own filter and counter,
+ * and add the counts to `ngram`. The filters share a symbol table, so
+ * that the type IDs agree across threads.
+ */
+int ngrams_parallel(const struct ngrams_config *cfg,
+		    const struct corpus_colfile *cf, int col,
+		    const struct corpus_filebuf *buf, int nthread,
+		    struct corpus_ngram *ngram)
+{
+	struct corpus_symtab_shared shared;
+	struct ngrams_pool pool;
+	struct ngrams_worker *workers = NULL;
+	uint64_t nbatch;
+	int err = 0, i, ninit = 0, nstart = 0;
+
+	if (col >= 0) {
+		nbatch = (cf->nrow + NGRAMS_BATCH_NROW - 1) / NGRAMS_BATCH_NROW;
+	} else {
+		nbatch = buf->file_size / NGRAMS_BATCH_SIZE + 1;
+	}
+	if (nbatch > INT_MAX) {
+		nbatch = INT_MAX;
+	}
+	if (nbatch == 0) {
+		return 0;
+	}
+
+	pool.cf = cf;
+	pool.col = col;
+	pool.its = NULL;
+	pool.nbatch = (int)nbatch;
+	pool.next = 0;
+	pool.error = 0;
+
+	if ((err = corpus_symtab_shared_init(&shared))) {
+		goto error_shared;
+	}
+
+	if (col < 0) {
+		if (!(pool.its = malloc((size_t)nbatch * sizeof(*pool.its)))) {
+			err = CORPUS_ERROR_NOMEM;
+			goto error_its;
+		}
+		corpus_filebuf_split(buf, pool.its, (int)nbatch);
+	}
+
+	if (!(workers = calloc((size_t)nthread, sizeof(*workers)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_workers;
+	}
+
+	if (pthread_mutex_init(&pool.lock, NULL)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed initializing counting pool lock");
+		goto error_lock;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if ((err = ngrams_state_init(&workers[i].state, cfg,
+					     &shared))) {
+			goto out;
+		}
+		workers[i].pool = &pool;
+		ninit++;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if (pthread_create(&workers[i].thread, NULL, ngrams_worker_run,
+				   &workers[i])) {
+			err = CORPUS_ERROR_OS;
+			corpus_log(err, "failed creating counting thread");
+
+			pthread_mutex_lock(&pool.lock);
+			pool.error = err;
+			pthread_mutex_unlock(&pool.lock);
+			break;
+		}
+		nstart++;
+	}
+
+	for (i = 0; i < nstart; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	if (!err) {
+		err = pool.error;
+	}
+
+	for (i = 0; i < nthread && !err; i++) {
+		err = corpus_ngram_merge(ngram, &workers[i].state.ngram);
+	}
+
+out:
+	for (i = 0; i < ninit; i++) {
+		ngrams_state_destroy(&workers[i].state);
+	}
+	pthread_mutex_destroy(&pool.lock);
+error_lock:
+	free(workers);
+error_workers:
+	free(pool.its);
+error_its:
+	corpus_symtab_shared_destroy(&shared);
+error_shared:
+	return err;
+}
+
+
+int main_ngrams(int argc, char * const argv[])
+{
+	struct ngrams_config cfg;
+	struct ngrams_state st;
 	struct corpus_ngram ngram;
+	struct utf8lite_text name, text;
+	struct corpus_filestream fs;
+	struct corpus_colfile cf;
 	const char *output = NULL;
-	const char *stemmer = NULL;
-	const uint8_t **stopwords = NULL;
 	const char *field, *input;
 	FILE *stream;
+	char *end;
 	size_t field_len;
-	int filter_flags, type_flags, length;
-	int ch, err, i, name_id, type_id, ncomb;
+	int ch, err, i, has_text;
+	int col = -1, nthread = 1;
+	uint64_t row;
 	int count;
 
-	filter_flags = CORPUS_FILTER_KEEP_ALL;
-	type_flags = (UTF8LITE_TEXTMAP_CASE | UTF8LITE_TEXTMAP_COMPAT
-			| UTF8LITE_TEXTMAP_QUOTE | UTF8LITE_TEXTMAP_RMDI);
+	cfg.name = &name;
+	cfg.filter_flags = CORPUS_FILTER_KEEP_ALL;
+	cfg.type_flags = (UTF8LITE_TEXTMAP_CASE | UTF8LITE_TEXTMAP_COMPAT
+			  | UTF8LITE_TEXTMAP_QUOTE | UTF8LITE_TEXTMAP_RMDI);
+	cfg.stemmer = NULL;
+	cfg.stopwords = NULL;
+	cfg.ncomb = 0;
+	cfg.length = 1;
 
 	field = "text";
-	length = 1;
-	ncomb = 0;
 
-	while ((ch = getopt(argc, argv, "c:d:f:k:n:o:s:t:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:d:f:j:k:n:o:s:t:")) != -1) {
 		switch (ch) {
 		case 'c':
-			if (ncomb == COMBINE_MAX) {
+			if (cfg.ncomb == COMBINE_MAX) {
 				fprintf(stderr, "Too many combination rules"
 					" (maximum is %d)\n", COMBINE_MAX);
 				return EXIT_FAILURE;
 			}
 
-			combine_rules[ncomb] = optarg;
-			ncomb++;
+			combine_rules[cfg.ncomb] = optarg;
+			cfg.ncomb++;
 			break;
 
 		case 'd':
@@ -211,11 +668,28 @@ int main_ngrams(int argc, char * const argv[])
 				usage_ngrams();
 				return EXIT_FAILURE;
 			}
-			filter_flags |= word_classes[i].value;
+			cfg.filter_flags |= word_classes[i].value;
 			break;
 		case 'f':
 			field = optarg;
 			break;
+		case 'j':
+			nthread = (int)strtol(optarg, &end, 10);
+			if (end == optarg || *end || nthread < 0) {
+				fprintf(stderr, "Invalid thread count (%s)\n\n",
+					optarg);
+				usage_ngrams();
+				return EXIT_FAILURE;
+			}
+			if (nthread == 0) {
+				nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+			}
+			if (nthread < 1) {
+				nthread = 1;
+			} else if (nthread > NGRAMS_NTHREAD_MAX) {
+				nthread = NGRAMS_NTHREAD_MAX;
+			}
+			break;
 		case 'k':
 			i = get_arg(char_maps, optarg);
 			if (i < 0) {
@@ -225,19 +699,20 @@ int main_ngrams(int argc, char * const argv[])
 				usage_ngrams();
 				return EXIT_FAILURE;
 			}
-			type_flags &= ~(char_maps[i].value);
+			cfg.type_flags &= ~(char_maps[i].value);
 			break;
 		case 'n':
-			length = atoi(optarg);
+			cfg.length = atoi(optarg);
 			break;
 		case 'o':
 			output = optarg;
 			break;
 		case 's':
-			stemmer = optarg;
+			cfg.stemmer = optarg;
 			break;
 		case 't':
-			if (!(stopwords = corpus_stopword_list(optarg, NULL))) {
+			cfg.stopwords = corpus_stopword_list(optarg, NULL);
+			if (!cfg.stopwords) {
 				fprintf(stderr,
 					"Unrecognized stop word list: '%s'."
 					"\n\n", optarg);
@@ -273,81 +748,27 @@ int main_ngrams(int argc, char * const argv[])
 	input = argv[0];
 
 	if (utf8lite_text_assign(&name, (const uint8_t *)field, field_len, 0,
-				NULL)) {
+				 NULL)) {
 		fprintf(stderr, "Invalid field name (%s)\n", field);
 		return EXIT_FAILURE;
 	}
 
-	if ((err = corpus_ngram_init(&ngram, length))) {
-		goto error_ngram;
-	}
-
-	if ((err = corpus_schema_init(&schema))) {
-		goto error_schema;
-	}
-
-	if (stemmer) {
-		if ((err = corpus_stem_snowball_init(&snowball, stemmer))) {
-			goto error_snowball;
-		}
-		if ((err = corpus_filter_init(&filter, filter_flags,
-					      type_flags, '_',
-					      corpus_stem_snowball,
-					      &snowball))) {
-			goto error_filter;
-		}
-	} else {
-		if ((err = corpus_filter_init(&filter, filter_flags,
-					      type_flags, '_', NULL, NULL))) {
-			goto error_filter;
-		}
-	}
-
-	if (stopwords) {
-		while (*stopwords) {
-			err = utf8lite_text_assign(&word, *stopwords,
-						 strlen((const char *)
-							*stopwords),
-						 UTF8LITE_TEXT_UNKNOWN, NULL);
-			if (err) {
-				fprintf(stderr, "Internal error:"
-					" stop word list is not valid UTF-8.");
-				goto error_stopwords;
-			}
-
-			err = corpus_filter_stem_except(&filter, &word);
-			if (err) {
-				goto error_stopwords;
-			}
-
-			err = corpus_filter_drop(&filter, &word);
-			if (err) {
-				goto error_stopwords;
-			}
-
-			stopwords++;
+	// read the text from the column file, if one exists and it has
+	// the field as a text column
+	if ((err = corpus_colfile_init(&cf, input)) == 0) {
+		col = corpus_colfile_column(&cf, &name);
+		if (col >= 0 && cf.columns[col].type != CORPUS_DATATYPE_TEXT) {
+			col = -1;
 		}
-	}
-
-	for (i = 0; i < ncomb; i++) {
-		err = utf8lite_text_assign(&word,
-					 (const uint8_t *)combine_rules[i],
-					 strlen(combine_rules[i]),
-					 UTF8LITE_TEXT_UNKNOWN, NULL);
-		if (err) {
-			fprintf(stderr,
-				"Combination rule ('%s') is not valid UTF-8.",
-				combine_rules[i]);
-			goto error_combine;
-		}
-
-		if ((err = corpus_filter_combine(&filter, &word))) {
-			goto error_combine;
+		if (col < 0) {
+			corpus_colfile_destroy(&cf);
 		}
+	} else if (err != CORPUS_ERROR_INVAL) {
+		goto error_filestream;
 	}
 
-	if ((err = corpus_filebuf_init(&buf, input))) {
-		goto error_filebuf;
+	if (col < 0 && (err = corpus_filestream_init(&fs, input))) {
+		goto error_filestream;
 	}
 
 	if (output) {
@@ -360,56 +781,66 @@ int main_ngrams(int argc, char * const argv[])
 		stream = stdout;
 	}
 
-	if ((err = corpus_schema_name(&schema, &name, &name_id))) {
-		goto error;
+	// streaming input has to be read sequentially
+	if (nthread > 1 && (col >= 0 || fs.mapped)) {
+		if ((err = corpus_ngram_init(&ngram, cfg.length))) {
+			goto error;
+		}
+		err = ngrams_parallel(&cfg, col >= 0 ? &cf : NULL, col,
+				      col >= 0 ? NULL : &fs.buf, nthread,
+				      &ngram);
+		count = ngram.terms.nnode;
+		corpus_ngram_destroy(&ngram);
+		if (err) {
+			goto error;
+		}
+		goto out;
 	}
 
-	corpus_filebuf_iter_make(&it, &buf);
-	while (corpus_filebuf_iter_advance(&it)) {
-		if ((err = corpus_data_assign(&data, &schema, it.current.ptr,
-					      it.current.size))) {
-				goto error;
-		}
+	if ((err = ngrams_state_init(&st, &cfg, NULL))) {
+		goto error;
+	}
 
-		if ((err = corpus_data_field(&data, &schema, name_id, &val))) {
-			err = corpus_data_text(&data, &text);
+	row = 0;
+	for (;;) {
+		if (col >= 0) {
+			if (row == cf.nrow) {
+				break;
+			}
+			has_text = !corpus_colfile_text(&cf, col, row, &text);
+			row++;
 		} else {
-			err = corpus_data_text(&val, &text);
+			if (!corpus_filestream_advance(&fs)) {
+				break;
+			}
+			if ((err = ngrams_line_text(&st, &fs.current, &text,
+						    &has_text))) {
+				goto error_count;
+			}
 		}
 
-		if (err) {
+		if (!has_text) {
 			continue;
 		}
 
-		if ((err = corpus_filter_start(&filter, &text))) {
-			goto error;
-		}
-
-		if ((err = corpus_ngram_break(&ngram))) {
-			goto error;
+		if ((err = ngrams_count(&st, &text))) {
+			goto error_count;
 		}
+	}
+	if (col < 0 && fs.error) {
+		err = fs.error;
+		goto error_count;
+	}
 
-		while (corpus_filter_advance(&filter)) {
-			type_id = filter.type_id;
-			if (type_id == CORPUS_TYPE_NONE) {
-				continue;
-			} else if (type_id < 0) {
-				if ((err = corpus_ngram_break(&ngram))) {
-					goto error;
-				}
-			} else {
-				if ((err = corpus_ngram_add(&ngram, type_id, 1))) {
-					goto error;
-				}
-			}
-		}
-		if (filter.error) {
-			goto error;
-		}
+	count = st.ngram.terms.nnode;
+error_count:
+	ngrams_state_destroy(&st);
+	if (err) {
+		goto error;
 	}
 
-	count = ngram.terms.nnode;
-	fprintf(stream, "Found %d %d-grams.\n", count, length);
+out:
+	fprintf(stream, "Found %d %d-grams.\n", count, cfg.length);
 
 	err = 0;
 error:
@@ -418,20 +849,12 @@ error:
 		err = CORPUS_ERROR_OS;
 	}
 error_output:
-	corpus_filebuf_destroy(&buf);
-error_filebuf:
-error_combine:
-error_stopwords:
-	corpus_filter_destroy(&filter);
-error_filter:
-	if (stemmer) {
-		corpus_stem_snowball_destroy(&snowball);
+	if (col >= 0) {
+		corpus_colfile_destroy(&cf);
+	} else {
+		corpus_filestream_destroy(&fs);
 	}
-error_snowball:
-	corpus_schema_destroy(&schema);
-error_schema:
-	corpus_ngram_destroy(&ngram);
-error_ngram:
+error_filestream:
 	if (err) {
 		fprintf(stderr, "An error occurred.\n");
 		return EXIT_FAILURE;
@@ -14,9 +14,10 @@
  * limitations under the License.
  */
 
-#define _POSIX_C_SOURCE 2 // for getopt
+#define _POSIX_C_SOURCE 200112L // for getopt, sysconf
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,7 +26,9 @@
 #include "../lib/utf8lite/src/utf8lite.h"
 
 #include "error.h"
+#include "decoder.h"
 #include "filebuf.h"
+#include "filestream.h"
 #include "table.h"
 #include "textset.h"
 #include "stem.h"
@@ -35,8 +38,27 @@
 
 #define PROGRAM_NAME	"corpus"
 
+/* Maximum number of threads for parallel scanning. */
+#define SCAN_NTHREAD_MAX 64
+
+/*
+ * A scanning thread, with its own schema for the lines in its range.
+ */
+struct scan_worker {
+	pthread_t thread;
+	struct corpus_filebuf_iter it;
+	struct corpus_schema schema;
+	int type_id;
+	uint64_t nline;
+	int error;
+};
+
 int main_scan(int argc, char * const argv[]);
 void usage_scan(void);
+static void *scan_worker_run(void *arg);
+static int scan_parallel(struct corpus_schema *schema,
+			 const struct corpus_filebuf *buf, int nthread,
+			 int *type_idptr, uint64_t *nlineptr);
 
 
 void usage_scan(void)
@@ -48,26 +70,142 @@ Description:\n\
 \tDetermine the types of the data values in a newline-delimited JSON file.\n\
 \n\
 Options:\n\
+\t-j <n>\t\tScans with <n> threads, or one per processor if <n>\n\
+\t\t\tis 0; only for uncompressed files, without -l.\n\
 \t-l\t\tPrints type information for each line.\n\
 \t-o <path>\tSaves output at the given path.\n\
 ", PROGRAM_NAME);
 }
 
 
+void *scan_worker_run(void *arg)
+{
+	struct scan_worker *w = arg;
+	int err, id;
+
+	while (corpus_filebuf_iter_advance(&w->it)) {
+		w->nline++;
+
+		if ((err = corpus_schema_scan(&w->schema, w->it.current.ptr,
+					      w->it.current.size, &id))) {
+			goto error;
+		}
+		if ((err = corpus_schema_union(&w->schema, w->type_id, id,
+					       &w->type_id))) {
+			goto error;
+		}
+	}
+	return NULL;
+
+error:
+	w->error = err;
+	return NULL;
+}
+
+
+/*
+ * Scan the lines of a file on several threads, each with its own
+ * schema, and merge the results into the given schema.
+ */
+int scan_parallel(struct corpus_schema *schema,
+		  const struct corpus_filebuf *buf, int nthread,
+		  int *type_idptr, uint64_t *nlineptr)
+{
+	struct corpus_filebuf_iter its[SCAN_NTHREAD_MAX];
+	struct scan_worker *workers;
+	int err = 0, i, id, ninit = 0, nstart = 0;
+	int type_id = CORPUS_DATATYPE_NULL;
+	uint64_t nline = 0;
+
+	if (!(workers = calloc((size_t)nthread, sizeof(*workers)))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+
+	corpus_filebuf_split(buf, its, nthread);
+
+	for (i = 0; i < nthread; i++) {
+		if ((err = corpus_schema_init(&workers[i].schema))) {
+			goto out;
+		}
+		ninit++;
+		workers[i].it = its[i];
+		workers[i].type_id = CORPUS_DATATYPE_NULL;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if (pthread_create(&workers[i].thread, NULL, scan_worker_run,
+				   &workers[i])) {
+			err = CORPUS_ERROR_OS;
+			corpus_log(err, "failed creating scanning thread");
+			break;
+		}
+		nstart++;
+	}
+
+	// merge in file order, so that the field names get numbered in
+	// about the order they first appear, as in a sequential scan
+	for (i = 0; i < nstart; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (err) {
+			continue;
+		}
+		if ((err = workers[i].error)) {
+			continue;
+		}
+		if ((err = corpus_schema_import(schema, &workers[i].schema,
+						workers[i].type_id, &id))) {
+			continue;
+		}
+		if ((err = corpus_schema_union(schema, type_id, id,
+					       &type_id))) {
+			continue;
+		}
+		nline += workers[i].nline;
+	}
+
+out:
+	for (i = 0; i < ninit; i++) {
+		corpus_schema_destroy(&workers[i].schema);
+	}
+	free(workers);
+
+	*type_idptr = type_id;
+	*nlineptr = nline;
+	return err;
+}
+
+
 int main_scan(int argc, char * const argv[])
 {
 	struct corpus_schema schema;
-	struct corpus_filebuf buf;
-	struct corpus_filebuf_iter it;
+	struct corpus_filestream fs;
 	const char *output = NULL;
 	const char *input = NULL;
 	FILE *stream;
+	char *end;
 	int ch, err, id, type_id;
-	int lines = 0;
+	int lines = 0, nthread = 1;
 	uint64_t lineno;
 
-	while ((ch = getopt(argc, argv, "lo:")) != -1) {
+	while ((ch = getopt(argc, argv, "j:lo:")) != -1) {
 		switch (ch) {
+		case 'j':
+			nthread = (int)strtol(optarg, &end, 10);
+			if (end == optarg || *end || nthread < 0) {
+				fprintf(stderr, "Invalid thread count (%s)\n\n",
+					optarg);
+				usage_scan();
+				return EXIT_FAILURE;
+			}
+			if (nthread == 0) {
+				nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+			}
+			if (nthread < 1) {
+				nthread = 1;
+			} else if (nthread > SCAN_NTHREAD_MAX) {
+				nthread = SCAN_NTHREAD_MAX;
+			}
+			break;
 		case 'l':
 			lines = 1;
 			break;
@@ -99,8 +237,8 @@ int main_scan(int argc, char * const argv[])
 		goto error_schema;
 	}
 
-	if ((err = corpus_filebuf_init(&buf, input))) {
-		goto error_filebuf;
+	if ((err = corpus_filestream_init(&fs, input))) {
+		goto error_filestream;
 	}
 
 	if (output) {
@@ -119,13 +257,22 @@ int main_scan(int argc, char * const argv[])
 
 	type_id = CORPUS_DATATYPE_NULL;
 
-	corpus_filebuf_iter_make(&it, &buf);
+	// per-line output needs the lines in order; streaming input has
+	// to be read sequentially
+	if (nthread > 1 && !lines && fs.mapped) {
+		if ((err = scan_parallel(&schema, &fs.buf, nthread, &type_id,
+					 &lineno))) {
+			goto error_scan;
+		}
+		goto done;
+	}
+
 	lineno = 0;
-	while (corpus_filebuf_iter_advance(&it)) {
+	while (corpus_filestream_advance(&fs)) {
 		lineno++;
 
-		if ((err = corpus_schema_scan(&schema, it.current.ptr,
-					it.current.size, &id))) {
+		if ((err = corpus_schema_scan(&schema, fs.current.ptr,
+					fs.current.size, &id))) {
 			goto error_scan;
 		}
 
@@ -140,10 +287,15 @@ int main_scan(int argc, char * const argv[])
 			goto error_scan;
 		}
 	}
+	if (fs.error) {
+		err = fs.error;
+		goto error_scan;
+	}
 
 	if (lines) {
 		fprintf(stream, "--\n");
 	}
+done:
 	corpus_write_datatype(stream, &schema, type_id);
 	fprintf(stream, "\n");
 	fprintf(stream, "%"PRId64" rows\n", lineno);
@@ -155,8 +307,8 @@ error_scan:
 		err = CORPUS_ERROR_OS;
 	}
 error_output:
-	corpus_filebuf_destroy(&buf);
-error_filebuf:
+	corpus_filestream_destroy(&fs);
+error_filestream:
 	corpus_schema_destroy(&schema);
 error_schema:
 	if (err) {
@@ -25,7 +25,9 @@
 #include "../lib/utf8lite/src/utf8lite.h"
 
 #include "error.h"
+#include "decoder.h"
 #include "filebuf.h"
+#include "filestream.h"
 #include "table.h"
 #include "textset.h"
 #include "stem.h"
@@ -60,15 +62,15 @@ int main_sentences(int argc, char * const argv[])
 {
 	struct corpus_sentscan scan;
 	struct corpus_data data, val;
+	struct corpus_data_accessor accessor;
 	struct utf8lite_text name, text;
 	struct corpus_schema schema;
-	struct corpus_filebuf buf;
-	struct corpus_filebuf_iter it;
+	struct corpus_filestream fs;
 	const char *output = NULL;
 	const char *field, *input;
 	FILE *stream;
 	size_t field_len;
-	int ch, err, name_id, start;
+	int ch, err, start;
 	int flags = CORPUS_SENTSCAN_SPCRLF;
 
 	field = "text";
@@ -121,8 +123,8 @@ int main_sentences(int argc, char * const argv[])
 		goto error_schema;
 	}
 
-	if ((err = corpus_filebuf_init(&buf, input))) {
-		goto error_filebuf;
+	if ((err = corpus_filestream_init(&fs, input))) {
+		goto error_filestream;
 	}
 
 	if (output) {
@@ -135,22 +137,27 @@ int main_sentences(int argc, char * const argv[])
 		stream = stdout;
 	}
 
-	if ((err = corpus_schema_name(&schema, &name, &name_id))) {
+	if ((err = corpus_data_accessor_init(&accessor, &schema, &name))) {
 		goto error;
 	}
 
-	corpus_filebuf_iter_make(&it, &buf);
-	while (corpus_filebuf_iter_advance(&it)) {
-		if ((err = corpus_data_assign(&data, &schema, it.current.ptr,
-					      it.current.size))) {
+	while (corpus_filestream_advance(&fs)) {
+		if ((err = corpus_data_access(&accessor, &schema,
+					      fs.current.ptr, fs.current.size,
+					      &val))) {
 				goto error;
 		}
 
-		if ((err = corpus_data_field(&data, &schema, name_id, &val))) {
-			err = corpus_data_text(&data, &text);
-		} else {
-			err = corpus_data_text(&val, &text);
+		// if the field is missing, use the entire line
+		if (val.type_id == CORPUS_DATATYPE_NULL) {
+			if ((err = corpus_data_assign(&data, &schema,
+						      fs.current.ptr,
+						      fs.current.size))) {
+				goto error;
+			}
+			val = data;
 		}
+		err = corpus_data_text(&val, &text);
 
 		if (err) {
 			fprintf(stream, "null\n");
@@ -173,6 +180,10 @@ int main_sentences(int argc, char * const argv[])
 		}
 		fprintf(stream, "]\n");
 	}
+	if (fs.error) {
+		err = fs.error;
+		goto error;
+	}
 
 	err = 0;
 
@@ -182,8 +193,8 @@ error:
 		err = CORPUS_ERROR_OS;
 	}
 error_output:
-	corpus_filebuf_destroy(&buf);
-error_filebuf:
+	corpus_filestream_destroy(&fs);
+error_filestream:
 	corpus_schema_destroy(&schema);
 error_schema:
 	if (err) {
@@ -14,9 +14,11 @@
  * limitations under the License.
  */
 
-#define _POSIX_C_SOURCE 2 // for getopt
+#define _POSIX_C_SOURCE 200809L // for getopt, sysconf, open_memstream
 
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,7 +27,10 @@
 #include "../lib/utf8lite/src/utf8lite.h"
 
 #include "error.h"
+#include "decoder.h"
 #include "filebuf.h"
+#include "filestream.h"
+#include "colfile.h"
 #include "stopword.h"
 #include "table.h"
 #include "textset.h"
@@ -40,11 +45,102 @@
 
 #define COMBINE_MAX 256
 
+/* Maximum number of threads for parallel tokenizing. */
+#define TOKENS_NTHREAD_MAX 64
+
+/*
+ * Parallel tokenizing splits the input into batches of about this many
+ * bytes (for data files) or rows (for column files).
+ */
+#define TOKENS_BATCH_SIZE ((size_t)256 * 1024)
+#define TOKENS_BATCH_NROW 1024
+
+/*
+ * Number of batches per thread that can be in progress or waiting to get
+ * written at once; this bounds the output held in memory when one batch
+ * is slow.
+ */
+#define TOKENS_WINDOW 4
+
 static const char *combine_rules[COMBINE_MAX];
 
+/*
+ * Filter settings, for setting up a filter on each thread.
+ */
+struct tokens_config {
+	const struct utf8lite_text *name;
+	int filter_flags;
+	int type_flags;
+	const char *stemmer;
+	const uint8_t **stopwords;
+	int ncomb;
+};
+
+/*
+ * Tokenizing state, with a filter and a schema for parsing the lines.
+ * Each thread has its own.
+ */
+struct tokens_state {
+	struct corpus_filter filter;
+	struct corpus_stem_snowball snowball;
+	struct corpus_schema schema;
+	struct corpus_data_accessor accessor;
+	struct utf8lite_render render;
+	int has_snowball;
+};
+
+/*
+ * A batch of lines for parallel tokenizing, with its output.
+ */
+struct tokens_batch {
+	char *buf;
+	size_t size;
+	int done;
+};
+
+/*
+ * Parallel tokenizing work. Threads claim batches in order, and the
+ * thread that finishes the oldest unwritten batch writes it, along with
+ * any finished batches after it, so that the output stays in line order.
+ */
+struct tokens_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const struct corpus_colfile *cf;
+	int col;
+	struct corpus_filebuf_iter *its;
+	uint64_t nbatch;
+	uint64_t next;
+	uint64_t nwrite;
+	struct tokens_batch *window;
+	int nwindow;
+	FILE *stream;
+	int error;
+};
+
+struct tokens_worker {
+	pthread_t thread;
+	struct tokens_pool *pool;
+	struct tokens_state state;
+};
 
 int main_tokens(int argc, char * const argv[]);
 void usage_tokens(void);
+static int tokens_state_init(struct tokens_state *st,
+			     const struct tokens_config *cfg);
+static void tokens_state_destroy(struct tokens_state *st);
+static int tokens_line_text(struct tokens_state *st,
+			    const struct corpus_filebuf_line *line,
+			    struct utf8lite_text *text, int *has_textptr);
+static int tokens_write(FILE *stream, struct tokens_state *st,
+			const struct utf8lite_text *text);
+static int tokens_batch_run(struct tokens_worker *w, uint64_t i,
+			    struct tokens_batch *b);
+static void *tokens_worker_run(void *arg);
+static int tokens_parallel(const struct tokens_config *cfg,
+			   const struct corpus_colfile *cf, int col,
+			   const struct corpus_filebuf *buf, FILE *stream,
+			   int nthread);
 
 
 struct string_arg {
@@ -105,6 +201,8 @@ Options:\n\
 \t-c <combine>\tAdds a combination rule.\n\
 \t-d <class>\tReplace words from the given class with 'null'.\n\
 \t-f <field>\tGets text from the given field (defaults to \"text\").\n\
+\t-j <n>\t\tTokenizes with <n> threads, or one per processor if <n>\n\
+\t\t\tis 0; only for uncompressed or compiled files.\n\
 \t-k <map>\tDoes not perform the given character map.\n\
 \t-o <path>\tSaves output at the given path.\n\
 \t-s <stemmer>\tStems tokens with the given algorithm.\n\
@@ -159,44 +257,489 @@ Options:\n\
 	}
 }
 
-int main_tokens(int argc, char * const argv[])
+/*
+ * Set up the filter and schema for tokenizing on one thread.
+ */
+int tokens_state_init(struct tokens_state *st, const struct tokens_config *cfg)
+{
+	const uint8_t **stopwords;
+	struct utf8lite_text word;
+	int err, i;
+
+	st->has_snowball = 0;
+
+	if ((err = utf8lite_render_init(&st->render,
+					(UTF8LITE_ESCAPE_CONTROL
+					 | UTF8LITE_ESCAPE_UTF8)))) {
+		goto error_render;
+	}
+
+	if ((err = corpus_schema_init(&st->schema))) {
+		goto error_schema;
+	}
+
+	if ((err = corpus_data_accessor_init(&st->accessor, &st->schema,
+					     cfg->name))) {
+		goto error_accessor;
+	}
+
+	if (cfg->stemmer) {
+		if ((err = corpus_stem_snowball_init(&st->snowball,
+						     cfg->stemmer))) {
+			goto error_snowball;
+		}
+		st->has_snowball = 1;
+		if ((err = corpus_filter_init(&st->filter, cfg->filter_flags,
+					      cfg->type_flags, '_',
+					      corpus_stem_snowball,
+					      &st->snowball))) {
+			goto error_filter;
+		}
+	} else {
+		if ((err = corpus_filter_init(&st->filter, cfg->filter_flags,
+					      cfg->type_flags, '_', NULL,
+					      NULL))) {
+			goto error_filter;
+		}
+	}
+
+	stopwords = cfg->stopwords;
+	if (stopwords) {
+		while (*stopwords) {
+			err = utf8lite_text_assign(&word, *stopwords,
+					           strlen((const char *)
+							   *stopwords),
+						   UTF8LITE_TEXT_UNKNOWN,
+						   NULL);
+			if (err) {
+				fprintf(stderr, "Internal error:"
+					" stop word list is not valid UTF-8.");
+				goto error_stopwords;
+			}
+
+			err = corpus_filter_stem_except(&st->filter, &word);
+			if (err) {
+				goto error_stopwords;
+			}
+
+			err = corpus_filter_drop(&st->filter, &word);
+			if (err) {
+				goto error_stopwords;
+			}
+
+			stopwords++;
+		}
+	}
+
+	for (i = 0; i < cfg->ncomb; i++) {
+		err = utf8lite_text_assign(&word,
+				           (const uint8_t *)combine_rules[i],
+					   strlen(combine_rules[i]),
+					   UTF8LITE_TEXT_UNKNOWN, NULL);
+		if (err) {
+			fprintf(stderr,
+				"Combination rule ('%s') is not valid UTF-8.",
+				combine_rules[i]);
+			goto error_combine;
+		}
+
+		if ((err = corpus_filter_combine(&st->filter, &word))) {
+			goto error_combine;
+		}
+	}
+
+	return 0;
+
+error_combine:
+error_stopwords:
+	corpus_filter_destroy(&st->filter);
+error_filter:
+	if (st->has_snowball) {
+		corpus_stem_snowball_destroy(&st->snowball);
+	}
+error_snowball:
+error_accessor:
+	corpus_schema_destroy(&st->schema);
+error_schema:
+	utf8lite_render_destroy(&st->render);
+error_render:
+	return err;
+}
+
+
+void tokens_state_destroy(struct tokens_state *st)
+{
+	corpus_filter_destroy(&st->filter);
+	if (st->has_snowball) {
+		corpus_stem_snowball_destroy(&st->snowball);
+	}
+	corpus_schema_destroy(&st->schema);
+	utf8lite_render_destroy(&st->render);
+}
+
+
+/*
+ * Get the text from a line of a data file, using the entire line if the
+ * field is missing. Sets `*has_textptr` to zero if the value is not
+ * text.
+ */
+int tokens_line_text(struct tokens_state *st,
+		     const struct corpus_filebuf_line *line,
+		     struct utf8lite_text *text, int *has_textptr)
 {
-	struct corpus_filter filter;
-	struct corpus_stem_snowball snowball;
 	struct corpus_data data, val;
-	struct utf8lite_text name, text, word;
+	int err;
+
+	if ((err = corpus_data_access(&st->accessor, &st->schema, line->ptr,
+				      line->size, &val))) {
+		return err;
+	}
+
+	// if the field is missing, use the entire line
+	if (val.type_id == CORPUS_DATATYPE_NULL) {
+		if ((err = corpus_data_assign(&data, &st->schema, line->ptr,
+					      line->size))) {
+			return err;
+		}
+		val = data;
+	}
+
+	*has_textptr = corpus_data_text(&val, text) ? 0 : 1;
+	return 0;
+}
+
+
+/*
+ * Write the types in a text as a JSON array, with `null` for dropped
+ * words, or write `null` if the text is missing.
+ */
+int tokens_write(FILE *stream, struct tokens_state *st,
+		 const struct utf8lite_text *text)
+{
+	struct corpus_filter *filter = &st->filter;
+	struct utf8lite_render *render = &st->render;
 	const struct utf8lite_text *type;
-	struct corpus_schema schema;
-	struct corpus_filebuf buf;
+	int err, start, type_id;
+
+	if (!text) {
+		fprintf(stream, "null\n");
+		return 0;
+	}
+
+	fprintf(stream, "[");
+	start = 1;
+
+	if ((err = corpus_filter_start(filter, text))) {
+		return err;
+	}
+
+	while (corpus_filter_advance(filter)) {
+		type_id = filter->type_id;
+		if (type_id == CORPUS_TYPE_NONE) {
+			continue;
+		}
+
+		if (!start) {
+			fprintf(stream, ", ");
+		} else {
+			start = 0;
+		}
+
+		if (type_id < 0) {
+			fprintf(stream, "null");
+		} else {
+			type = &filter->symtab.types[type_id].text;
+
+			utf8lite_render_clear(render);
+			utf8lite_render_text(render, type);
+			if ((err = render->error)) {
+				return err;
+			}
+
+			fprintf(stream, "\"%.*s\"",
+				render->length, render->string);
+		}
+	}
+	if ((err = filter->error)) {
+		return err;
+	}
+	fprintf(stream, "]\n");
+	return 0;
+}
+
+
+/*
+ * Tokenize a batch of lines, writing the output to memory.
+ */
+int tokens_batch_run(struct tokens_worker *w, uint64_t i,
+		     struct tokens_batch *b)
+{
+	struct tokens_pool *p = w->pool;
 	struct corpus_filebuf_iter it;
-	struct utf8lite_render render;
+	struct utf8lite_text text;
+	FILE *stream;
+	uint64_t row, end;
+	int err = 0, has_text;
+
+	if (!(stream = open_memstream(&b->buf, &b->size))) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating output buffer");
+		return err;
+	}
+
+	if (p->col >= 0) {
+		row = i * TOKENS_BATCH_NROW;
+		end = row + TOKENS_BATCH_NROW;
+		if (end > p->cf->nrow) {
+			end = p->cf->nrow;
+		}
+		for (; row < end; row++) {
+			has_text = !corpus_colfile_text(p->cf, p->col, row,
+							&text);
+			if ((err = tokens_write(stream, &w->state,
+						has_text ? &text : NULL))) {
+				break;
+			}
+		}
+	} else {
+		it = p->its[i];
+		while (corpus_filebuf_iter_advance(&it)) {
+			if ((err = tokens_line_text(&w->state, &it.current,
+						    &text, &has_text))) {
+				break;
+			}
+			if ((err = tokens_write(stream, &w->state,
+						has_text ? &text : NULL))) {
+				break;
+			}
+		}
+	}
+
+	if (fclose(stream) == EOF && !err) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed writing output buffer");
+	}
+	if (err) {
+		free(b->buf);
+		b->buf = NULL;
+	}
+	return err;
+}
+
+
+void *tokens_worker_run(void *arg)
+{
+	struct tokens_worker *w = arg;
+	struct tokens_pool *p = w->pool;
+	struct tokens_batch *b;
+	uint64_t i;
+	int err;
+
+	for (;;) {
+		// claim the next batch, waiting while the window is full
+		pthread_mutex_lock(&p->lock);
+		while (!p->error && p->next < p->nbatch
+				&& (p->next - p->nwrite
+				    >= (uint64_t)p->nwindow)) {
+			pthread_cond_wait(&p->cond, &p->lock);
+		}
+		if (p->error || p->next == p->nbatch) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		i = p->next++;
+		pthread_mutex_unlock(&p->lock);
+
+		b = &p->window[i % (uint64_t)p->nwindow];
+		err = tokens_batch_run(w, i, b);
+
+		// write the finished batches that are next in line
+		pthread_mutex_lock(&p->lock);
+		if (err) {
+			if (!p->error) {
+				p->error = err;
+			}
+		} else {
+			b->done = 1;
+		}
+		while (!p->error && p->nwrite < p->nbatch) {
+			b = &p->window[p->nwrite % (uint64_t)p->nwindow];
+			if (!b->done) {
+				break;
+			}
+			if (fwrite(b->buf, 1, b->size, p->stream) != b->size) {
+				p->error = CORPUS_ERROR_OS;
+				corpus_log(p->error, "failed writing output");
+			}
+			free(b->buf);
+			b->buf = NULL;
+			b->done = 0;
+			p->nwrite++;
+		}
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Tokenize the lines of a memory-mapped file or the rows of a column file
+ * on several threads, each with its own filter, and write the output in
+ * line order.
+ */
+int tokens_parallel(const struct tokens_config *cfg,
+		    const struct corpus_colfile *cf, int col,
+		    const struct corpus_filebuf *buf, FILE *stream,
+		    int nthread)
+{
+	struct tokens_pool pool;
+	struct tokens_worker *workers = NULL;
+	uint64_t nbatch;
+	int err = 0, i, ninit = 0, nstart = 0;
+
+	if (col >= 0) {
+		nbatch = (cf->nrow + TOKENS_BATCH_NROW - 1) / TOKENS_BATCH_NROW;
+	} else {
+		nbatch = buf->file_size / TOKENS_BATCH_SIZE + 1;
+		if (nbatch > INT_MAX) {
+			nbatch = INT_MAX;
+		}
+	}
+	if (nbatch == 0) {
+		return 0;
+	}
+
+	pool.cf = cf;
+	pool.col = col;
+	pool.its = NULL;
+	pool.nbatch = nbatch;
+	pool.next = 0;
+	pool.nwrite = 0;
+	pool.nwindow = TOKENS_WINDOW * nthread;
+	pool.stream = stream;
+	pool.error = 0;
+
+	if (!(pool.window = calloc((size_t)pool.nwindow,
+				   sizeof(*pool.window)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_window;
+	}
+
+	if (col < 0) {
+		if (!(pool.its = malloc((size_t)nbatch * sizeof(*pool.its)))) {
+			err = CORPUS_ERROR_NOMEM;
+			goto error_its;
+		}
+		corpus_filebuf_split(buf, pool.its, (int)nbatch);
+	}
+
+	if (!(workers = calloc((size_t)nthread, sizeof(*workers)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_workers;
+	}
+
+	if (pthread_mutex_init(&pool.lock, NULL)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed initializing tokenizing pool lock");
+		goto error_lock;
+	}
+	if (pthread_cond_init(&pool.cond, NULL)) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed initializing tokenizing pool"
+			   " condition variable");
+		goto error_cond;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if ((err = tokens_state_init(&workers[i].state, cfg))) {
+			goto out;
+		}
+		workers[i].pool = &pool;
+		ninit++;
+	}
+
+	for (i = 0; i < nthread; i++) {
+		if (pthread_create(&workers[i].thread, NULL, tokens_worker_run,
+				   &workers[i])) {
+			err = CORPUS_ERROR_OS;
+			corpus_log(err, "failed creating tokenizing thread");
+
+			pthread_mutex_lock(&pool.lock);
+			pool.error = err;
+			pthread_cond_broadcast(&pool.cond);
+			pthread_mutex_unlock(&pool.lock);
+			break;
+		}
+		nstart++;
+	}
+
+	for (i = 0; i < nstart; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	if (!err) {
+		err = pool.error;
+	}
+
+out:
+	for (i = 0; i < ninit; i++) {
+		tokens_state_destroy(&workers[i].state);
+	}
+	pthread_cond_destroy(&pool.cond);
+error_cond:
+	pthread_mutex_destroy(&pool.lock);
+error_lock:
+	free(workers);
+error_workers:
+	free(pool.its);
+error_its:
+	for (i = 0; i < pool.nwindow; i++) {
+		free(pool.window[i].buf);
+	}
+	free(pool.window);
+error_window:
+	return err;
+}
+
+
+int main_tokens(int argc, char * const argv[])
+{
+	struct tokens_config cfg;
+	struct tokens_state st;
+	struct utf8lite_text name, text;
+	struct corpus_filestream fs;
+	struct corpus_colfile cf;
 	const char *output = NULL;
-	const char *stemmer = NULL;
-	const uint8_t **stopwords = NULL;
 	const char *field, *input;
 	FILE *stream;
+	char *end;
 	size_t field_len;
-	int filter_flags, type_flags;
-	int ch, err, i, name_id, start, type_id, ncomb;
-
-	filter_flags = CORPUS_FILTER_KEEP_ALL;
-	type_flags = (UTF8LITE_TEXTMAP_CASE | UTF8LITE_TEXTMAP_COMPAT
-			| UTF8LITE_TEXTMAP_QUOTE | UTF8LITE_TEXTMAP_RMDI);
+	int ch, err, i, has_text;
+	int col = -1, nthread = 1;
+	uint64_t row;
+
+	cfg.name = &name;
+	cfg.filter_flags = CORPUS_FILTER_KEEP_ALL;
+	cfg.type_flags = (UTF8LITE_TEXTMAP_CASE | UTF8LITE_TEXTMAP_COMPAT
+			  | UTF8LITE_TEXTMAP_QUOTE | UTF8LITE_TEXTMAP_RMDI);
+	cfg.stemmer = NULL;
+	cfg.stopwords = NULL;
+	cfg.ncomb = 0;
 
 	field = "text";
-	ncomb = 0;
 
-	while ((ch = getopt(argc, argv, "c:d:f:k:o:s:t:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:d:f:j:k:o:s:t:")) != -1) {
 		switch (ch) {
 		case 'c':
-			if (ncomb == COMBINE_MAX) {
+			if (cfg.ncomb == COMBINE_MAX) {
 				fprintf(stderr, "Too many combination rules"
 					" (maximum is %d)\n", COMBINE_MAX);
 				return EXIT_FAILURE;
 			}
 
-			combine_rules[ncomb] = optarg;
-			ncomb++;
+			combine_rules[cfg.ncomb] = optarg;
+			cfg.ncomb++;
 			break;
 
 		case 'd':
@@ -208,11 +751,28 @@ int main_tokens(int argc, char * const argv[])
 				usage_tokens();
 				return EXIT_FAILURE;
 			}
-			filter_flags |= word_classes[i].value;
+			cfg.filter_flags |= word_classes[i].value;
 			break;
 		case 'f':
 			field = optarg;
 			break;
+		case 'j':
+			nthread = (int)strtol(optarg, &end, 10);
+			if (end == optarg || *end || nthread < 0) {
+				fprintf(stderr, "Invalid thread count (%s)\n\n",
+					optarg);
+				usage_tokens();
+				return EXIT_FAILURE;
+			}
+			if (nthread == 0) {
+				nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+			}
+			if (nthread < 1) {
+				nthread = 1;
+			} else if (nthread > TOKENS_NTHREAD_MAX) {
+				nthread = TOKENS_NTHREAD_MAX;
+			}
+			break;
 		case 'k':
 			i = get_arg(char_maps, optarg);
 			if (i < 0) {
@@ -222,16 +782,17 @@ int main_tokens(int argc, char * const argv[])
 				usage_tokens();
 				return EXIT_FAILURE;
 			}
-			type_flags &= ~(char_maps[i].value);
+			cfg.type_flags &= ~(char_maps[i].value);
 			break;
 		case 'o':
 			output = optarg;
 			break;
 		case 's':
-			stemmer = optarg;
+			cfg.stemmer = optarg;
 			break;
 		case 't':
-			if (!(stopwords = corpus_stopword_list(optarg, NULL))) {
+			cfg.stopwords = corpus_stopword_list(optarg, NULL);
+			if (!cfg.stopwords) {
 				fprintf(stderr,
 					"Unrecognized stop word list: '%s'."
 					"\n\n", optarg);
@@ -272,78 +833,22 @@ int main_tokens(int argc, char * const argv[])
 		return EXIT_FAILURE;
 	}
 
-	if ((err = utf8lite_render_init(&render, (UTF8LITE_ESCAPE_CONTROL
-						  | UTF8LITE_ESCAPE_UTF8)))) {
-		goto error_render;
-	}
-
-	if ((err = corpus_schema_init(&schema))) {
-		goto error_schema;
-	}
-
-	if (stemmer) {
-		if ((err = corpus_stem_snowball_init(&snowball, stemmer))) {
-			goto error_snowball;
+	// read the text from the column file, if one exists and it has
+	// the field as a text column
+	if ((err = corpus_colfile_init(&cf, input)) == 0) {
+		col = corpus_colfile_column(&cf, &name);
+		if (col >= 0 && cf.columns[col].type != CORPUS_DATATYPE_TEXT) {
+			col = -1;
 		}
-		if ((err = corpus_filter_init(&filter, filter_flags,
-					      type_flags, '_',
-					      corpus_stem_snowball,
-					      &snowball))) {
-			goto error_filter;
-		}
-	} else {
-		if ((err = corpus_filter_init(&filter, filter_flags,
-					      type_flags, '_', NULL, NULL))) {
-			goto error_filter;
+		if (col < 0) {
+			corpus_colfile_destroy(&cf);
 		}
+	} else if (err != CORPUS_ERROR_INVAL) {
+		goto error_filestream;
 	}
 
-	if (stopwords) {
-		while (*stopwords) {
-			err = utf8lite_text_assign(&word, *stopwords,
-					           strlen((const char *)
-							   *stopwords),
-						   UTF8LITE_TEXT_UNKNOWN,
-						   NULL);
-			if (err) {
-				fprintf(stderr, "Internal error:"
-					" stop word list is not valid UTF-8.");
-				goto error_stopwords;
-			}
-
-			err = corpus_filter_stem_except(&filter, &word);
-			if (err) {
-				goto error_stopwords;
-			}
-
-			err = corpus_filter_drop(&filter, &word);
-			if (err) {
-				goto error_stopwords;
-			}
-
-			stopwords++;
-		}
-	}
-
-	for (i = 0; i < ncomb; i++) {
-		err = utf8lite_text_assign(&word,
-				           (const uint8_t *)combine_rules[i],
-					   strlen(combine_rules[i]),
-					   UTF8LITE_TEXT_UNKNOWN, NULL);
-		if (err) {
-			fprintf(stderr,
-				"Combination rule ('%s') is not valid UTF-8.",
-				combine_rules[i]);
-			goto error_combine;
-		}
-
-		if ((err = corpus_filter_combine(&filter, &word))) {
-			goto error_combine;
-		}
-	}
-
-	if ((err = corpus_filebuf_init(&buf, input))) {
-		goto error_filebuf;
+	if (col < 0 && (err = corpus_filestream_init(&fs, input))) {
+		goto error_filestream;
 	}
 
 	if (output) {
@@ -356,89 +861,61 @@ int main_tokens(int argc, char * const argv[])
 		stream = stdout;
 	}
 
-	if ((err = corpus_schema_name(&schema, &name, &name_id))) {
+	// streaming input has to be read sequentially
+	if (nthread > 1 && (col >= 0 || fs.mapped)) {
+		err = tokens_parallel(&cfg, col >= 0 ? &cf : NULL, col,
+				      col >= 0 ? NULL : &fs.buf, stream,
+				      nthread);
 		goto error;
 	}
 
-	corpus_filebuf_iter_make(&it, &buf);
-	while (corpus_filebuf_iter_advance(&it)) {
-		if ((err = corpus_data_assign(&data, &schema, it.current.ptr,
-					      it.current.size))) {
-				goto error;
-		}
-
-		if ((err = corpus_data_field(&data, &schema, name_id, &val))) {
-			err = corpus_data_text(&data, &text);
-		} else {
-			err = corpus_data_text(&val, &text);
-		}
-
-		if (err) {
-			fprintf(stream, "null\n");
-			continue;
-		}
-
-		fprintf(stream, "[");
-		start = 1;
-
-		if ((err = corpus_filter_start(&filter, &text))) {
-			goto error;
-		}
+	if ((err = tokens_state_init(&st, &cfg))) {
+		goto error;
+	}
 
-		while (corpus_filter_advance(&filter)) {
-			type_id = filter.type_id;
-			if (type_id == CORPUS_TYPE_NONE) {
-				continue;
+	row = 0;
+	for (;;) {
+		if (col >= 0) {
+			if (row == cf.nrow) {
+				break;
 			}
-
-			if (!start) {
-				fprintf(stream, ", ");
-			} else {
-				start = 0;
+			has_text = !corpus_colfile_text(&cf, col, row, &text);
+			row++;
+		} else {
+			if (!corpus_filestream_advance(&fs)) {
+				break;
 			}
-
-			if (type_id < 0) {
-				fprintf(stream, "null");
-			} else {
-				type = &filter.symtab.types[type_id].text;
-
-				utf8lite_render_clear(&render);
-				utf8lite_render_text(&render, type);
-				if ((err = render.error)) {
-					goto error;
-				}
-
-				fprintf(stream, "\"%.*s\"",
-					render.length, render.string);
+			if ((err = tokens_line_text(&st, &fs.current, &text,
+						    &has_text))) {
+				goto out;
 			}
 		}
-		if (filter.error) {
-			goto error;
+
+		if ((err = tokens_write(stream, &st,
+					has_text ? &text : NULL))) {
+			goto out;
 		}
-		fprintf(stream, "]\n");
+	}
+	if (col < 0 && fs.error) {
+		err = fs.error;
+		goto out;
 	}
 
 	err = 0;
+out:
+	tokens_state_destroy(&st);
 error:
 	if (output && fclose(stream) == EOF) {
 		perror("Failed closing output file");
 		err = CORPUS_ERROR_OS;
 	}
 error_output:
-	corpus_filebuf_destroy(&buf);
-error_filebuf:
-error_combine:
-error_stopwords:
-	corpus_filter_destroy(&filter);
-error_filter:
-	if (stemmer) {
-		corpus_stem_snowball_destroy(&snowball);
+	if (col >= 0) {
+		corpus_colfile_destroy(&cf);
+	} else {
+		corpus_filestream_destroy(&fs);
 	}
-error_snowball:
-	corpus_schema_destroy(&schema);
-error_schema:
-	utf8lite_render_destroy(&render);
-error_render:
+error_filestream:
 	if (err) {
 		fprintf(stderr, "An error occurred.\n");
 		return EXIT_FAILURE;
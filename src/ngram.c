@@ -26,6 +26,10 @@
 #include "ngram.h"
 
 
+static int ngram_add_term(struct corpus_ngram *ng, int parent_id, int key,
+			  double weight, int *idptr);
+
+
 static int ngram_nbuffer(int length)
 {
 	if (length <= 0) {
@@ -88,9 +92,8 @@ void corpus_ngram_clear(struct corpus_ngram *ng)
 
 int corpus_ngram_add(struct corpus_ngram *ng, int type_id, double weight)
 {
-	double *weights;
 	const int *type_ids;
-	int key, length, id, parent_id, n, nmax, nnode, nnode0, size, size0;
+	int length, id, n, nmax;
 	int err;
 
 	length = ng->length;
@@ -115,48 +118,110 @@ int corpus_ngram_add(struct corpus_ngram *ng, int type_id, double weight)
 	type_ids = ng->buffer + ng->nbuffer - length;
 
 	while (length-- > 0) {
-		key = type_ids[length];
-		parent_id = id;
-		nnode0 = ng->terms.nnode;
-		size0 = ng->terms.nnode_max;
-		if ((err = corpus_tree_add(&ng->terms, parent_id, key, &id))) {
+		if ((err = ngram_add_term(ng, id, type_ids[length], weight,
+					  &id))) {
 			goto out;
 		}
-		nnode = ng->terms.nnode;
-
-		// check whether a new node got added
-		if (nnode0 < nnode) {
-			// expand the weights array if necessary
-			size = ng->terms.nnode_max;
-			if (size0 < size) {
-				weights = ng->weights;
-				weights = corpus_realloc(weights,
-						(size_t)size
-						* sizeof(*weights));
-				if (!weights) {
-					err = CORPUS_ERROR_NOMEM;
-					goto out;
-				}
-				ng->weights = weights;
-			}
+	}
+	err = 0;
+
+out:
+	if (err) {
+		corpus_log(err, "failed adding to n-gram counts");
+	}
+	return err;
+}
 
-			// set the new weight to 0
-			ng->weights[id] = 0;
-		}
 
-		// update the weight
-		ng->weights[id] += weight;
+int corpus_ngram_merge(struct corpus_ngram *ng,
+		       const struct corpus_ngram *other)
+{
+	const struct corpus_tree_node *node;
+	int *ids;
+	int err, i, n, parent_id;
+
+	if (other->length > ng->length) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "n-gram length (%d) exceeds counter length"
+			   " (%d)", other->length, ng->length);
+		return err;
+	}
+
+	n = other->terms.nnode;
+	if (n == 0) {
+		return 0;
+	}
+
+	if (!(ids = corpus_malloc((size_t)n * sizeof(*ids)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto out;
+	}
+
+	// parents come before their children in the node array, so
+	// each parent already has its ID in this counter
+	for (i = 0; i < n; i++) {
+		node = &other->terms.nodes[i];
+		assert(node->parent_id < i);
+		parent_id = (node->parent_id < 0) ? CORPUS_TREE_NONE
+			: ids[node->parent_id];
+		if ((err = ngram_add_term(ng, parent_id, node->key,
+					  other->weights[i], &ids[i]))) {
+			goto out;
+		}
 	}
 	err = 0;
 
 out:
+	corpus_free(ids);
 	if (err) {
-		corpus_log(err, "failed adding to n-gram counts");
+		corpus_log(err, "failed merging n-gram counts");
 	}
 	return err;
 }
 
 
+/*
+ * Add a weight to an n-gram term, given by its parent (a suffix) and the
+ * key for its first type, adding the term if it does not exist.
+ */
+int ngram_add_term(struct corpus_ngram *ng, int parent_id, int key,
+		   double weight, int *idptr)
+{
+	double *weights;
+	int err, id, nnode, nnode0, size, size0;
+
+	nnode0 = ng->terms.nnode;
+	size0 = ng->terms.nnode_max;
+	if ((err = corpus_tree_add(&ng->terms, parent_id, key, &id))) {
+		return err;
+	}
+	nnode = ng->terms.nnode;
+
+	// check whether a new node got added
+	if (nnode0 < nnode) {
+		// expand the weights array if necessary
+		size = ng->terms.nnode_max;
+		if (size0 < size) {
+			weights = ng->weights;
+			weights = corpus_realloc(weights,
+						 (size_t)size * sizeof(*weights));
+			if (!weights) {
+				return CORPUS_ERROR_NOMEM;
+			}
+			ng->weights = weights;
+		}
+
+		// set the new weight to 0
+		ng->weights[id] = 0;
+	}
+
+	// update the weight
+	ng->weights[id] += weight;
+	*idptr = id;
+	return 0;
+}
+
+
 int corpus_ngram_break(struct corpus_ngram *ng)
 {
 	ng->nbuffer = 0;
@@ -90,6 +90,21 @@ int corpus_ngram_add(struct corpus_ngram *ng, int type_id, double weight);
  */
 int corpus_ngram_break(struct corpus_ngram *ng);
 
+/**
+ * Add the n-gram weights from another counter, for example one that
+ * counted a different part of a corpus in another thread. The counters
+ * must use the same type IDs. The input buffer is unaffected.
+ *
+ * \param ng the counter
+ * \param other the counter with the weights to add; its length must not
+ * 	exceed that of `ng`
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the other counter has a
+ * 	greater length
+ */
+int corpus_ngram_merge(struct corpus_ngram *ng,
+		       const struct corpus_ngram *other);
+
 /**
  * Check whether an n-gram exists in the counter, and get its weight.
  *
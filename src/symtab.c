@@ -15,23 +15,196 @@
  */
 
 #include <assert.h>
-#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+
+#if !(defined(_WIN32) || defined(_WIN64))
+#  define SYMTAB_THREADS
+#  include <pthread.h>
+#endif
+
 #include "../lib/utf8lite/src/utf8lite.h"
 #include "array.h"
 #include "error.h"
+#include "filebuf.h"
 #include "memory.h"
 #include "table.h"
 #include "textset.h"
 #include "symtab.h"
 
+/*
+ * Storage blocks start small, so that small tables stay small, and double
+ * in size up to a maximum; a request larger than the next block size gets
+ * a block of its own size.
+ */
+#define SYMTAB_BLOCK_MIN ((size_t)4 * 1024)
+#define SYMTAB_BLOCK_MAX ((size_t)1024 * 1024)
+
+struct corpus_symtab_block {
+	struct corpus_symtab_block *next; // the next (older) block
+	size_t size;			  // the storage size, in bytes
+};
+
+/*
+ * Shared tables find the text for an ID through a directory of
+ * fixed-size segments, which never move once allocated, so that readers
+ * need no locks.
+ */
+#define SYMTAB_SEGMENT_BITS 16
+#define SYMTAB_SEGMENT_SIZE ((int)1 << SYMTAB_SEGMENT_BITS)
+#define SYMTAB_NSEGMENT ((INT_MAX >> SYMTAB_SEGMENT_BITS) + 1)
+
+// the shard for a hash code, using different bits than the table groups
+// and tags
+#define SYMTAB_SHARD(hash) \
+	(((hash) >> 19) & (CORPUS_SYMTAB_NSHARD - 1))
+
+#if defined(SYMTAB_THREADS)
+#  define SYMTAB_LOCK(m) pthread_mutex_lock(m)
+#  define SYMTAB_UNLOCK(m) pthread_mutex_unlock(m)
+#else
+#  define SYMTAB_LOCK(m) ((void)0)
+#  define SYMTAB_UNLOCK(m) ((void)0)
+#endif
+
+/*
+ * Saved symbol tables start with a header:
+ *
+ *    0  magic ("CORPUSST")
+ *    8  format version
+ *   12  type kind
+ *   16  number of types
+ *   20  number of tokens
+ *   24  hash code for SYMTAB_FILE_HASH_CHECK, to detect when the hash
+ *       function differs from the one that saved the table
+ *   28  (reserved)
+ *   32  total size of the saved table, in bytes
+ *   40  text blob size, in bytes
+ *
+ * followed by a record for each type, and then for each token:
+ *
+ *    0  text offset in the blob
+ *    8  text size
+ *   12  text hash code
+ *   16  text flags (SYMTAB_FILE_ESC, SYMTAB_FILE_UTF8)
+ *   20  type ID (for tokens; zero for types)
+ *
+ * and then the text blob, with a NUL byte after each text. Numbers are
+ * in little-endian byte order; the blob gets padded to a multiple of 8
+ * bytes.
+ */
+#define SYMTAB_FILE_MAGIC "CORPUSST"
+#define SYMTAB_FILE_VERSION 1
+#define SYMTAB_FILE_HEADER_SIZE 48
+#define SYMTAB_FILE_RECORD_SIZE 24
+#define SYMTAB_FILE_PAD(size) (((size) + 7) & ~(uint64_t)7)
+#define SYMTAB_FILE_HASH_CHECK "corpus \xC3\xA9t\xC3\xA9"
+
+enum symtab_file_flag {
+	SYMTAB_FILE_ESC = (1 << 0),
+	SYMTAB_FILE_UTF8 = (1 << 1)
+};
+
+/*
+ * Most tokens are plain ASCII, and for these, the type map usually either
+ * leaves the text unchanged or lowercases it. We detect this when the
+ * table gets initialized, and then compute the types for short ASCII
+ * tokens directly, 8 bytes at a time, without decoding and re-encoding
+ * them character by character.
+ */
+#define SYMTAB_ASCII_MAX 128
+#define SYMTAB_ONES ((uint64_t)0x0101010101010101)
+#define SYMTAB_HIGH (SYMTAB_ONES * 0x80)
+
+/*
+ * Bounded tables count the tokens they have not yet added in a count-min
+ * sketch, with SYMTAB_SKETCH_DEPTH rows of counters. The rows get sized
+ * to the token limit, within these bounds.
+ */
+#define SYMTAB_SKETCH_DEPTH 4
+#define SYMTAB_SKETCH_SEED 0x9E3779B97F4A7C15ULL
+#define SYMTAB_SKETCH_WIDTH_MIN ((unsigned)1 << 10)
+#define SYMTAB_SKETCH_WIDTH_MAX ((unsigned)1 << 22)
+
+enum symtab_ascii_kind {
+	SYMTAB_ASCII_NONE = 0,	// no fast path; use the type map
+	SYMTAB_ASCII_SAME,	// ASCII tokens are their own types
+	SYMTAB_ASCII_LOWER	// ASCII types are the lowercased tokens
+};
+
+struct symtab_shard {
+#if defined(SYMTAB_THREADS)
+	pthread_mutex_t lock;
+#endif
+	struct corpus_tagtable table;	      // shared IDs, by hash code
+	struct corpus_symtab_storage storage; // text storage
+};
+
+struct corpus_symtab_shared_state {
+	struct symtab_shard token_shards[CORPUS_SYMTAB_NSHARD];
+	struct symtab_shard type_shards[CORPUS_SYMTAB_NSHARD];
+#if defined(SYMTAB_THREADS)
+	pthread_mutex_t lock;	// guards the counts and directories
+#endif
+	struct corpus_symtab_token *tokens[SYMTAB_NSEGMENT];
+	struct utf8lite_text *types[SYMTAB_NSEGMENT];
+	int ntoken;
+	int ntype;
+};
+
+static void symtab_storage_init(struct corpus_symtab_storage *st);
+static void *symtab_storage_alloc(struct corpus_symtab_storage *st,
+				  size_t size, size_t align);
+static int symtab_storage_copy(struct corpus_symtab_storage *st,
+			       struct utf8lite_text *text,
+			       const struct utf8lite_text *other);
+static void symtab_storage_free(struct corpus_symtab_storage *st, int keep);
+static int corpus_symtab_find_token(const struct corpus_symtab *tab,
+				    const struct utf8lite_text *tok,
+				    unsigned hash);
+static int corpus_symtab_find_type(const struct corpus_symtab *tab,
+				   const struct utf8lite_text *typ,
+				   unsigned hash);
+static int corpus_symtab_find_frozen_token(const struct corpus_symtab *tab,
+					   const struct utf8lite_text *tok);
+static int corpus_symtab_find_frozen_type(const struct corpus_symtab *tab,
+					  const struct utf8lite_text *typ);
+static uint64_t symtab_token_hash(void *context, int id, uint64_t seed);
+static uint64_t symtab_type_hash(void *context, int id, uint64_t seed);
+static uint64_t symtab_hash_seed(const struct utf8lite_text *text,
+				 uint64_t seed);
+static int symtab_ascii_kind(const struct utf8lite_textmap *map);
+static int symtab_ascii_type(const struct corpus_symtab *tab,
+			     const struct utf8lite_text *tok, uint8_t *buf,
+			     struct utf8lite_text *typ);
+static int symtab_admit(struct corpus_symtab *tab, unsigned hash);
 static int corpus_symtab_grow_tokens(struct corpus_symtab *tab, int nadd);
 static int corpus_symtab_grow_types(struct corpus_symtab *tab, int nadd);
-static void corpus_symtab_rehash_tokens(struct corpus_symtab *tab);
-static void corpus_symtab_rehash_types(struct corpus_symtab *tab);
 
-static int type_add_token(struct corpus_symtab_type *type, int token_id);
+static int symtab_shard_init(struct symtab_shard *shard);
+static void symtab_shard_destroy(struct symtab_shard *shard);
+static void *symtab_shared_new_id(struct corpus_symtab_shared_state *st,
+				  void **segments, size_t width, int *countptr,
+				  int *idptr);
+
+static int type_add_token(struct corpus_symtab *tab,
+			  struct corpus_symtab_type *type, int token_id);
+
+static void symtab_put_u32(uint8_t *ptr, uint32_t val);
+static void symtab_put_u64(uint8_t *ptr, uint64_t val);
+static uint32_t symtab_get_u32(const uint8_t *ptr);
+static uint64_t symtab_get_u64(const uint8_t *ptr);
+static unsigned symtab_hash_check(void);
+static int symtab_write_record(FILE *stream, const struct utf8lite_text *text,
+			       uint64_t off, int type_id);
+static int symtab_write_text(FILE *stream, const struct utf8lite_text *text);
+static int symtab_read_record(const uint8_t *rec, const uint8_t *blob,
+			      uint64_t blob_size, struct utf8lite_text *text,
+			      unsigned *hashptr, int rehash);
 
 
 int corpus_symtab_init(struct corpus_symtab *tab, int type_kind)
@@ -42,13 +215,14 @@ int corpus_symtab_init(struct corpus_symtab *tab, int type_kind)
 		corpus_log(err, "failed initializing type buffer");
 		goto error_typemap;
 	}
+	tab->ascii_kind = symtab_ascii_kind(&tab->typemap);
 
-	if ((err = corpus_table_init(&tab->type_table))) {
+	if ((err = corpus_tagtable_init(&tab->type_table))) {
 		corpus_log(err, "failed allocating type table");
 		goto error_type_table;
 	}
 
-	if ((err = corpus_table_init(&tab->token_table))) {
+	if ((err = corpus_tagtable_init(&tab->token_table))) {
 		corpus_log(err, "failed allocating token table");
 		goto error_token_table;
 	}
@@ -61,10 +235,21 @@ int corpus_symtab_init(struct corpus_symtab *tab, int type_kind)
 	tab->ntoken_max = 0;
 	tab->ntoken = 0;
 
+	symtab_storage_init(&tab->storage);
+	tab->shared = NULL;
+	tab->file = NULL;
+	corpus_perfhash_init(&tab->type_index);
+	corpus_perfhash_init(&tab->token_index);
+	tab->frozen = 0;
+	tab->ntoken_limit = -1;
+	tab->min_count = 1;
+	tab->sketch = NULL;
+	tab->sketch_mask = 0;
+
 	return 0;
 
 error_token_table:
-	corpus_table_destroy(&tab->type_table);
+	corpus_tagtable_destroy(&tab->type_table);
 error_type_table:
 	utf8lite_textmap_destroy(&tab->typemap);
 error_typemap:
@@ -76,109 +261,206 @@ error_typemap:
 void corpus_symtab_destroy(struct corpus_symtab *tab)
 {
 	corpus_symtab_clear(tab);
+	symtab_storage_free(&tab->storage, 0);
 	corpus_free(tab->tokens);
 	corpus_free(tab->types);
-	corpus_table_destroy(&tab->token_table);
-	corpus_table_destroy(&tab->type_table);
+	corpus_free(tab->sketch);
+	corpus_tagtable_destroy(&tab->token_table);
+	corpus_tagtable_destroy(&tab->type_table);
 	utf8lite_textmap_destroy(&tab->typemap);
 }
 
 
 void corpus_symtab_clear(struct corpus_symtab *tab)
 {
-	int ntoken = tab->ntoken;
-	int ntype = tab->ntype;
+	// keep the most recent (largest) block for re-use
+	symtab_storage_free(&tab->storage, 1);
+	tab->ntoken = 0;
+	tab->ntype = 0;
 
-	while (ntoken-- > 0) {
-		utf8lite_text_destroy(&tab->tokens[ntoken].text);
+	corpus_tagtable_clear(&tab->token_table);
+	corpus_tagtable_clear(&tab->type_table);
+
+	// un-freeze the table
+	if (tab->frozen) {
+		corpus_perfhash_destroy(&tab->token_index);
+		corpus_perfhash_destroy(&tab->type_index);
+		corpus_perfhash_init(&tab->token_index);
+		corpus_perfhash_init(&tab->type_index);
+		tab->frozen = 0;
 	}
-	tab->ntoken = 0;
 
-	while (ntype-- > 0) {
-		utf8lite_text_destroy(&tab->types[ntype].text);
-		corpus_free(tab->types[ntype].token_ids);
+	// release the loaded text, if any
+	if (tab->file) {
+		corpus_filebuf_destroy(tab->file);
+		corpus_free(tab->file);
+		tab->file = NULL;
 	}
-	tab->ntype = 0;
 
-	corpus_table_clear(&tab->token_table);
-	corpus_table_clear(&tab->type_table);
+	// reset the counts for tokens not yet added
+	if (tab->sketch) {
+		memset(tab->sketch, 0, SYMTAB_SKETCH_DEPTH
+		       * ((size_t)tab->sketch_mask + 1) * sizeof(*tab->sketch));
+	}
 }
 
 
 int corpus_symtab_has_token(const struct corpus_symtab *tab,
 			    const struct utf8lite_text *tok, int *idptr)
 {
-	struct corpus_table_probe probe;
-	unsigned hash = (unsigned)utf8lite_text_hash(tok);
-	int token_id = CORPUS_TOKEN_NONE;
-	bool found = false;
+	int token_id;
+
+	if (tab->frozen) {
+		token_id = corpus_symtab_find_frozen_token(tab, tok);
+	} else {
+		token_id = corpus_symtab_find_token(
+				tab, tok, (unsigned)utf8lite_text_hash(tok));
+	}
+
+	if (idptr) {
+		*idptr = token_id;
+	}
+
+	return (token_id != CORPUS_TOKEN_NONE);
+}
 
-	corpus_table_probe_make(&probe, &tab->token_table, hash);
-	while (corpus_table_probe_advance(&probe)) {
+
+int corpus_symtab_find_token(const struct corpus_symtab *tab,
+			     const struct utf8lite_text *tok, unsigned hash)
+{
+	struct corpus_tagtable_probe probe;
+	int token_id;
+
+	corpus_tagtable_probe_make(&probe, &tab->token_table, hash);
+	while (corpus_tagtable_probe_advance(&probe)) {
 		token_id = probe.current;
 		if (utf8lite_text_equals(tok, &tab->tokens[token_id].text)) {
-			found = true;
-			goto out;
+			return token_id;
 		}
 	}
 
-out:
+	return CORPUS_TOKEN_NONE;
+}
+
+
+int corpus_symtab_has_type(const struct corpus_symtab *tab,
+			   const struct utf8lite_text *typ, int *idptr)
+{
+	int type_id;
+
+	if (tab->frozen) {
+		type_id = corpus_symtab_find_frozen_type(tab, typ);
+	} else {
+		type_id = corpus_symtab_find_type(
+				tab, typ, (unsigned)utf8lite_text_hash(typ));
+	}
+
 	if (idptr) {
-		*idptr = found ? token_id : probe.index;
+		*idptr = type_id;
 	}
 
-	return found;
+	return (type_id != CORPUS_TYPE_NONE);
 }
 
 
-int corpus_symtab_has_type(const struct corpus_symtab *tab,
-			   const struct utf8lite_text *typ, int *idptr)
+int corpus_symtab_find_type(const struct corpus_symtab *tab,
+			    const struct utf8lite_text *typ, unsigned hash)
 {
-	struct corpus_table_probe probe;
-	unsigned hash = (unsigned)utf8lite_text_hash(typ);
-	int type_id = CORPUS_TYPE_NONE;
-	bool found = false;
+	struct corpus_tagtable_probe probe;
+	int type_id;
 
-	corpus_table_probe_make(&probe, &tab->type_table, hash);
-	while (corpus_table_probe_advance(&probe)) {
+	corpus_tagtable_probe_make(&probe, &tab->type_table, hash);
+	while (corpus_tagtable_probe_advance(&probe)) {
 		type_id = probe.current;
 		if (utf8lite_text_equals(typ, &tab->types[type_id].text)) {
-			found = true;
-			goto out;
+			return type_id;
 		}
 	}
 
-out:
-	if (idptr) {
-		*idptr = found ? type_id : probe.index;
+	return CORPUS_TYPE_NONE;
+}
+
+
+int corpus_symtab_find_frozen_token(const struct corpus_symtab *tab,
+				    const struct utf8lite_text *tok)
+{
+	const struct corpus_perfhash *index = &tab->token_index;
+	int token_id;
+
+	token_id = corpus_perfhash_get(index,
+				       symtab_hash_seed(tok, index->seed));
+	if (token_id >= 0
+			&& utf8lite_text_equals(tok,
+						&tab->tokens[token_id].text)) {
+		return token_id;
+	}
+
+	return CORPUS_TOKEN_NONE;
+}
+
+
+int corpus_symtab_find_frozen_type(const struct corpus_symtab *tab,
+				   const struct utf8lite_text *typ)
+{
+	const struct corpus_perfhash *index = &tab->type_index;
+	int type_id;
+
+	type_id = corpus_perfhash_get(index,
+				      symtab_hash_seed(typ, index->seed));
+	if (type_id >= 0
+			&& utf8lite_text_equals(typ,
+						&tab->types[type_id].text)) {
+		return type_id;
 	}
 
-	return found;
+	return CORPUS_TYPE_NONE;
 }
 
 
 int corpus_symtab_add_token(struct corpus_symtab *tab,
 			    const struct utf8lite_text *tok, int *idptr)
 {
-	int pos, token_id, type_id;
-	bool rehash = false;
+	uint8_t buf[SYMTAB_ASCII_MAX];
+	struct utf8lite_text typ;
+	unsigned hash;
+	int token_id, type_id, shared_type_id;
 	int err;
 
-	if (corpus_symtab_has_token(tab, tok, &pos)) {
-		token_id = pos;
+	if (tab->frozen) {
+		token_id = corpus_symtab_find_frozen_token(tab, tok);
+		if (token_id != CORPUS_TOKEN_NONE) {
+			goto out;
+		}
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "failed adding token to symbol table"
+			   " (table is frozen)");
+		return err;
+	}
+
+	hash = (unsigned)utf8lite_text_hash(tok);
+	token_id = corpus_symtab_find_token(tab, tok, hash);
+	if (token_id != CORPUS_TOKEN_NONE) {
+		goto out;
+	}
+
+	// leave the token out if the table is full, or if the token is rare
+	if (tab->ntoken_limit >= 0 && !symtab_admit(tab, hash)) {
+		token_id = CORPUS_TOKEN_OOV;
 		goto out;
 	}
 
 	token_id = tab->ntoken;
 
 	// compute the type
-	if ((err = utf8lite_textmap_set(&tab->typemap, tok))) {
-		goto error;
+	if (!symtab_ascii_type(tab, tok, buf, &typ)) {
+		if ((err = utf8lite_textmap_set(&tab->typemap, tok))) {
+			goto error;
+		}
+		typ = tab->typemap.text;
 	}
 
 	// add the type
-	if ((err = corpus_symtab_add_type(tab, &tab->typemap.text,
-					  &type_id))) {
+	if ((err = corpus_symtab_add_type(tab, &typ, &type_id))) {
 		goto error;
 	}
 
@@ -190,26 +472,37 @@ int corpus_symtab_add_token(struct corpus_symtab *tab,
 	}
 
 	// grow the token table if necessary
-	if (token_id == tab->token_table.capacity) {
-		if ((err = corpus_table_reinit(&tab->token_table,
-					       token_id + 1))) {
-			goto error;
-		}
-		rehash = true;
+	if ((err = corpus_tagtable_grow(&tab->token_table, 1))) {
+		goto error;
 	}
 
 	// allocate storage for the token
-	if ((err = utf8lite_text_init_copy(&tab->tokens[token_id].text, tok))) {
+	if ((err = symtab_storage_copy(&tab->storage,
+				       &tab->tokens[token_id].text, tok))) {
 		goto error;
 	}
 
 	// set the type
 	tab->tokens[token_id].type_id = type_id;
 
+	// set the shared ID
+	if (tab->shared) {
+		shared_type_id = (type_id >= 0 ? tab->types[type_id].shared_id
+				  : CORPUS_TYPE_NONE);
+		if ((err = corpus_symtab_shared_add_token(
+					tab->shared, tok, shared_type_id,
+					&tab->tokens[token_id].shared_id))) {
+			goto error;
+		}
+	} else {
+		tab->tokens[token_id].shared_id = token_id;
+	}
+
 	if (type_id >= 0) {
-		// add the token to the type
-		if ((err = type_add_token(&tab->types[type_id], token_id))) {
-			utf8lite_text_destroy(&tab->tokens[token_id].text);
+		// add the token to the type; on failure, the token text
+		// stays in the block storage until the table gets cleared
+		if ((err = type_add_token(tab, &tab->types[type_id],
+					  token_id))) {
 			goto error;
 		}
 	}
@@ -218,11 +511,7 @@ int corpus_symtab_add_token(struct corpus_symtab *tab,
 	tab->ntoken++;
 
 	// set the bucket
-	if (rehash) {
-		corpus_symtab_rehash_tokens(tab);
-	} else {
-		tab->token_table.items[pos] = token_id;
-	}
+	corpus_tagtable_add(&tab->token_table, hash, token_id);
 
 out:
 	if (idptr) {
@@ -232,9 +521,6 @@ out:
 	return 0;
 
 error:
-	if (rehash) {
-		corpus_symtab_rehash_tokens(tab);
-	}
 	corpus_log(err, "failed adding token to symbol table");
 	return err;
 }
@@ -243,13 +529,25 @@ error:
 int corpus_symtab_add_type(struct corpus_symtab *tab,
 			   const struct utf8lite_text *typ, int *idptr)
 {
-	int pos, type_id;
-	bool rehash = false;
+	struct corpus_symtab_type *type;
+	unsigned hash;
+	int type_id;
 	int err;
 
-	if (corpus_symtab_has_type(tab, typ, &pos)) {
-		type_id = pos;
-	} else {
+	if (tab->frozen) {
+		type_id = corpus_symtab_find_frozen_type(tab, typ);
+		if (type_id != CORPUS_TYPE_NONE) {
+			goto out;
+		}
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "failed adding type to symbol table"
+			   " (table is frozen)");
+		return err;
+	}
+
+	hash = (unsigned)utf8lite_text_hash(typ);
+	type_id = corpus_symtab_find_type(tab, typ, hash);
+	if (type_id == CORPUS_TYPE_NONE) {
 		type_id = tab->ntype;
 
 		// grow the type array if necessary
@@ -260,17 +558,14 @@ int corpus_symtab_add_type(struct corpus_symtab *tab,
 		}
 
 		// grow the type table if necessary
-		if (type_id == tab->type_table.capacity) {
-			if ((err = corpus_table_reinit(&tab->type_table,
-						       type_id + 1))) {
-				goto error;
-			}
-			rehash = true;
+		if ((err = corpus_tagtable_grow(&tab->type_table, 1))) {
+			goto error;
 		}
 
 		// allocate storage for the type's text
-		if ((err = utf8lite_text_init_copy(&tab->types[type_id].text,
-						 typ))) {
+		if ((err = symtab_storage_copy(&tab->storage,
+					       &tab->types[type_id].text,
+					       typ))) {
 			goto error;
 		}
 
@@ -278,17 +573,26 @@ int corpus_symtab_add_type(struct corpus_symtab *tab,
 		tab->types[type_id].token_ids = NULL;
 		tab->types[type_id].ntoken = 0;
 
+		// set the shared ID
+		type = &tab->types[type_id];
+		if (tab->shared) {
+			if ((err = corpus_symtab_shared_add_type(
+						tab->shared, typ,
+						&type->shared_id))) {
+				goto error;
+			}
+		} else {
+			type->shared_id = type_id;
+		}
+
 		// update the count
 		tab->ntype++;
 
 		// set the bucket
-		if (rehash) {
-			corpus_symtab_rehash_types(tab);
-		} else {
-			tab->type_table.items[pos] = type_id;
-		}
+		corpus_tagtable_add(&tab->type_table, hash, type_id);
 	}
 
+out:
 	if (idptr) {
 		*idptr = type_id;
 	}
@@ -296,96 +600,1171 @@ int corpus_symtab_add_type(struct corpus_symtab *tab,
 	return 0;
 
 error:
-	if (rehash) {
-		corpus_symtab_rehash_types(tab);
-	}
 	corpus_log(err, "failed adding type to symbol table");
 	return err;
 }
 
-
-int corpus_symtab_grow_tokens(struct corpus_symtab *tab, int nadd)
+int corpus_symtab_set_limit(struct corpus_symtab *tab, int ntoken_limit,
+			    int min_count)
 {
-	void *base = tab->tokens;
-	int size = tab->ntoken_max;
+	uint32_t *sketch = NULL;
+	unsigned width = 0;
 	int err;
 
-	if ((err = corpus_array_grow(&base, &size, sizeof(*tab->tokens),
-				     tab->ntoken, nadd))) {
-		corpus_log(err, "failed allocating token array");
-		return err;
+	if (min_count <= 0) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "invalid minimum count (%d)", min_count);
+		goto error;
 	}
 
-	tab->tokens = base;
-	tab->ntoken_max = size;
+	if (ntoken_limit >= 0 && min_count > 1) {
+		width = SYMTAB_SKETCH_WIDTH_MIN;
+		while (width < (unsigned)ntoken_limit
+				&& width < SYMTAB_SKETCH_WIDTH_MAX) {
+			width *= 2;
+		}
+		sketch = corpus_calloc(SYMTAB_SKETCH_DEPTH * (size_t)width,
+				       sizeof(*sketch));
+		if (!sketch) {
+			err = CORPUS_ERROR_NOMEM;
+			goto error;
+		}
+	}
+
+	corpus_free(tab->sketch);
+	tab->sketch = sketch;
+	tab->sketch_mask = width ? width - 1 : 0;
+	tab->ntoken_limit = (ntoken_limit >= 0) ? ntoken_limit : -1;
+	tab->min_count = min_count;
 	return 0;
+
+error:
+	corpus_log(err, "failed setting symbol table limit");
+	return err;
 }
 
 
-int corpus_symtab_grow_types(struct corpus_symtab *tab, int nadd)
+int corpus_symtab_freeze(struct corpus_symtab *tab)
 {
-	void *base = tab->types;
-	int size = tab->ntype_max;
+	struct corpus_tagtable type_table, token_table;
 	int err;
 
-	if ((err = corpus_array_grow(&base, &size, sizeof(*tab->types),
-				     tab->ntype, nadd))) {
-		corpus_log(err, "failed allocating type array");
-		return err;
+	if (tab->frozen) {
+		return 0;
 	}
 
-	tab->types = base;
-	tab->ntype_max = size;
+	if ((err = corpus_perfhash_build(&tab->type_index, tab->ntype,
+					 symtab_type_hash, tab))) {
+		goto error_type_index;
+	}
+
+	if ((err = corpus_perfhash_build(&tab->token_index, tab->ntoken,
+					 symtab_token_hash, tab))) {
+		goto error_token_index;
+	}
+
+	// replace the hash tables with empty ones, to release their memory
+	if ((err = corpus_tagtable_init(&type_table))) {
+		goto error_type_table;
+	}
+	if ((err = corpus_tagtable_init(&token_table))) {
+		goto error_token_table;
+	}
+
+	corpus_tagtable_destroy(&tab->type_table);
+	corpus_tagtable_destroy(&tab->token_table);
+	tab->type_table = type_table;
+	tab->token_table = token_table;
+	tab->frozen = 1;
 	return 0;
+
+error_token_table:
+	corpus_tagtable_destroy(&type_table);
+error_type_table:
+	corpus_perfhash_destroy(&tab->token_index);
+	corpus_perfhash_init(&tab->token_index);
+error_token_index:
+	corpus_perfhash_destroy(&tab->type_index);
+	corpus_perfhash_init(&tab->type_index);
+error_type_index:
+	corpus_log(err, "failed freezing symbol table");
+	return err;
 }
 
 
-void corpus_symtab_rehash_tokens(struct corpus_symtab *tab)
+int corpus_symtab_save(const struct corpus_symtab *tab,
+		       const char *file_name)
 {
-	const struct corpus_symtab_token *tokens = tab->tokens;
-	struct corpus_table *token_table = &tab->token_table;
-	int i, n = tab->ntoken;
-	unsigned hash;
+	uint8_t header[SYMTAB_FILE_HEADER_SIZE];
+	static const uint8_t zeros[8];
+	FILE *stream;
+	char *temp_name;
+	uint64_t off;
+	size_t pad;
+	int err, i;
+
+	// write to a temporary file, so that we do not truncate the file
+	// if it is the one that the table was loaded from
+	if (!(temp_name = corpus_filebuf_temp_name(file_name))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto name_fail;
+	}
 
-	corpus_table_clear(token_table);
+	if (!(stream = fopen(temp_name, "wb"))) {
+		err = CORPUS_ERROR_OS;
+		corpus_log(err, "failed opening file (%s): %s", temp_name,
+			   strerror(errno));
+		goto open_fail;
+	}
+
+	off = 0;
+	for (i = 0; i < tab->ntype; i++) {
+		off += UTF8LITE_TEXT_SIZE(&tab->types[i].text) + 1;
+	}
+	for (i = 0; i < tab->ntoken; i++) {
+		off += UTF8LITE_TEXT_SIZE(&tab->tokens[i].text) + 1;
+	}
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, SYMTAB_FILE_MAGIC, 8);
+	symtab_put_u32(header + 8, SYMTAB_FILE_VERSION);
+	symtab_put_u32(header + 12, (uint32_t)tab->typemap.type);
+	symtab_put_u32(header + 16, (uint32_t)tab->ntype);
+	symtab_put_u32(header + 20, (uint32_t)tab->ntoken);
+	symtab_put_u32(header + 24, symtab_hash_check());
+	symtab_put_u64(header + 32, SYMTAB_FILE_HEADER_SIZE
+		       + ((uint64_t)tab->ntype + (uint64_t)tab->ntoken)
+		         * SYMTAB_FILE_RECORD_SIZE
+		       + SYMTAB_FILE_PAD(off));
+	symtab_put_u64(header + 40, off);
+
+	if (fwrite(header, 1, sizeof(header), stream) != sizeof(header)) {
+		goto write_fail;
+	}
+
+	off = 0;
+	for (i = 0; i < tab->ntype; i++) {
+		if ((err = symtab_write_record(stream, &tab->types[i].text,
+					       off, 0))) {
+			goto error;
+		}
+		off += UTF8LITE_TEXT_SIZE(&tab->types[i].text) + 1;
+	}
+	for (i = 0; i < tab->ntoken; i++) {
+		if ((err = symtab_write_record(stream, &tab->tokens[i].text,
+					       off, tab->tokens[i].type_id))) {
+			goto error;
+		}
+		off += UTF8LITE_TEXT_SIZE(&tab->tokens[i].text) + 1;
+	}
+
+	for (i = 0; i < tab->ntype; i++) {
+		if (symtab_write_text(stream, &tab->types[i].text)) {
+			goto write_fail;
+		}
+	}
+	for (i = 0; i < tab->ntoken; i++) {
+		if (symtab_write_text(stream, &tab->tokens[i].text)) {
+			goto write_fail;
+		}
+	}
+
+	pad = (size_t)(SYMTAB_FILE_PAD(off) - off);
+	if (pad > 0 && fwrite(zeros, 1, pad, stream) != pad) {
+		goto write_fail;
+	}
+
+	if (fclose(stream) == EOF) {
+		stream = NULL;
+		goto write_fail;
+	}
+
+	if ((err = corpus_filebuf_replace(temp_name, file_name))) {
+		goto replace_fail;
+	}
 
-	for (i = 0; i < n; i++) {
-		hash = (unsigned)utf8lite_text_hash(&tokens[i].text);
-		corpus_table_add(token_table, hash, i);
+	corpus_free(temp_name);
+	return 0;
+
+write_fail:
+	err = CORPUS_ERROR_OS;
+	corpus_log(err, "failed writing to file (%s): %s", temp_name,
+		   strerror(errno));
+error:
+	if (stream) {
+		fclose(stream);
 	}
+	remove(temp_name);
+replace_fail:
+open_fail:
+	corpus_free(temp_name);
+name_fail:
+	corpus_log(err, "failed saving symbol table");
+	return err;
 }
 
 
-void corpus_symtab_rehash_types(struct corpus_symtab *tab)
+int corpus_symtab_load(struct corpus_symtab *tab, const char *file_name,
+		       size_t *sizeptr)
 {
-	const struct corpus_symtab_type *types = tab->types;
-	struct corpus_table *type_table = &tab->type_table;
-	int i, n = tab->ntype;
+	struct corpus_symtab_type *type;
+	struct corpus_symtab_token *token;
+	const uint8_t *data, *rec, *blob;
+	uint64_t size, nrec, off, blob_size, total;
 	unsigned hash;
+	int err, i, ntype, ntoken, rehash, type_id;
+
+	if (tab->ntype || tab->ntoken || tab->shared || tab->file
+			|| tab->frozen) {
+		err = CORPUS_ERROR_INVAL;
+		corpus_log(err, "symbol table is not empty");
+		goto error_empty;
+	}
+
+	if (!(tab->file = corpus_malloc(sizeof(*tab->file)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_empty;
+	}
 
-	corpus_table_clear(type_table);
+	if ((err = corpus_filebuf_init(tab->file, file_name))) {
+		corpus_free(tab->file);
+		tab->file = NULL;
+		goto error_empty;
+	}
+
+	data = tab->file->map_addr;
+	size = tab->file->file_size;
+
+	err = CORPUS_ERROR_INVAL;
+
+	if (size < SYMTAB_FILE_HEADER_SIZE
+			|| memcmp(data, SYMTAB_FILE_MAGIC, 8) != 0
+			|| symtab_get_u32(data + 8) != SYMTAB_FILE_VERSION) {
+		corpus_log(err, "file (%s) is not a saved symbol table",
+			   file_name);
+		goto error;
+	}
+
+	if (symtab_get_u32(data + 12) != (uint32_t)tab->typemap.type) {
+		corpus_log(err, "saved symbol table (%s) has a different"
+			   " type kind", file_name);
+		goto error;
+	}
+
+	nrec = (uint64_t)symtab_get_u32(data + 16)
+		+ (uint64_t)symtab_get_u32(data + 20);
+	total = symtab_get_u64(data + 32);
+	blob_size = symtab_get_u64(data + 40);
+
+	if (symtab_get_u32(data + 16) > INT_MAX
+			|| symtab_get_u32(data + 20) > INT_MAX
+			|| nrec > (size - SYMTAB_FILE_HEADER_SIZE)
+				  / SYMTAB_FILE_RECORD_SIZE) {
+		goto malformed;
+	}
+	ntype = (int)symtab_get_u32(data + 16);
+	ntoken = (int)symtab_get_u32(data + 20);
+
+	off = SYMTAB_FILE_HEADER_SIZE + nrec * SYMTAB_FILE_RECORD_SIZE;
+	if (blob_size > size - off || total > size
+			|| total != off + SYMTAB_FILE_PAD(blob_size)) {
+		goto malformed;
+	}
+	blob = data + off;
+
+	// the saved hash codes are only valid if the hash function has not
+	// changed since the table got saved
+	rehash = (symtab_get_u32(data + 24) != symtab_hash_check());
+
+	if ((ntype > tab->ntype_max
+			&& (err = corpus_symtab_grow_types(tab, ntype)))
+			|| (ntoken > tab->ntoken_max
+			    && (err = corpus_symtab_grow_tokens(tab, ntoken)))
+			|| (err = corpus_tagtable_grow(&tab->type_table, ntype))
+			|| (err = corpus_tagtable_grow(&tab->token_table,
+						       ntoken))) {
+		goto error;
+	}
+
+	rec = data + SYMTAB_FILE_HEADER_SIZE;
+
+	for (i = 0; i < ntype; i++) {
+		type = &tab->types[i];
+		if ((err = symtab_read_record(rec, blob, blob_size,
+					      &type->text, &hash, rehash))) {
+			goto malformed;
+		}
+		type->token_ids = NULL;
+		type->ntoken = 0;
+		type->shared_id = i;
+		tab->ntype++;
+		corpus_tagtable_add(&tab->type_table, hash, i);
+		rec += SYMTAB_FILE_RECORD_SIZE;
+	}
+
+	for (i = 0; i < ntoken; i++) {
+		token = &tab->tokens[i];
+		if ((err = symtab_read_record(rec, blob, blob_size,
+					      &token->text, &hash, rehash))) {
+			goto malformed;
+		}
+
+		type_id = (int)(int32_t)symtab_get_u32(rec + 20);
+		if (type_id < CORPUS_TYPE_NONE || type_id >= ntype) {
+			err = CORPUS_ERROR_INVAL;
+			goto malformed;
+		}
+		token->type_id = type_id;
+		token->shared_id = i;
+
+		if (type_id >= 0 && (err = type_add_token(tab,
+							  &tab->types[type_id],
+							  i))) {
+			goto error;
+		}
+		tab->ntoken++;
+		corpus_tagtable_add(&tab->token_table, hash, i);
+		rec += SYMTAB_FILE_RECORD_SIZE;
+	}
+
+	if (sizeptr) {
+		*sizeptr = (size_t)total;
+	}
+	return 0;
 
-	for (i = 0; i < n; i++) {
-		hash = (unsigned)utf8lite_text_hash(&types[i].text);
-		corpus_table_add(type_table, hash, i);
+malformed:
+	corpus_log(err, "saved symbol table (%s) is malformed", file_name);
+error:
+	corpus_symtab_clear(tab);
+error_empty:
+	corpus_log(err, "failed loading symbol table");
+	return err;
+}
+
+
+int corpus_symtab_set_shared(struct corpus_symtab *tab,
+			     struct corpus_symtab_shared *sh)
+{
+	struct corpus_symtab_token *token;
+	struct corpus_symtab_type *type;
+	int err, i, type_id;
+
+	tab->shared = sh;
+
+	for (i = 0; i < tab->ntype; i++) {
+		type = &tab->types[i];
+		if ((err = corpus_symtab_shared_add_type(sh, &type->text,
+							 &type->shared_id))) {
+			goto error;
+		}
+	}
+
+	for (i = 0; i < tab->ntoken; i++) {
+		token = &tab->tokens[i];
+		type_id = token->type_id;
+		if (type_id >= 0) {
+			type_id = tab->types[type_id].shared_id;
+		}
+		if ((err = corpus_symtab_shared_add_token(sh, &token->text,
+							  type_id,
+							  &token->shared_id))) {
+			goto error;
+		}
 	}
+
+	return 0;
+
+error:
+	corpus_log(err, "failed attaching symbol table to shared table");
+	return err;
 }
 
 
-int type_add_token(struct corpus_symtab_type *typ, int tok_id)
+int corpus_symtab_shared_init(struct corpus_symtab_shared *sh)
 {
-	int *tok_ids = typ->token_ids;
-	int ntok = typ->ntoken;
+	struct corpus_symtab_shared_state *st;
+	int err, i, ntok = 0, ntyp = 0;
 
-	tok_ids = corpus_realloc(tok_ids,
-				 (size_t)(ntok + 1) * sizeof(*tok_ids));
-	if (!tok_ids) {
-		return CORPUS_ERROR_NOMEM;
+	if (!(st = corpus_calloc(1, sizeof(*st)))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto error_state;
 	}
 
-	tok_ids[ntok] = tok_id;
-	typ->token_ids = tok_ids;
-	typ->ntoken = ntok + 1;
+	for (; ntok < CORPUS_SYMTAB_NSHARD; ntok++) {
+		if ((err = symtab_shard_init(&st->token_shards[ntok]))) {
+			goto error_shard;
+		}
+	}
+
+	for (; ntyp < CORPUS_SYMTAB_NSHARD; ntyp++) {
+		if ((err = symtab_shard_init(&st->type_shards[ntyp]))) {
+			goto error_shard;
+		}
+	}
 
+#if defined(SYMTAB_THREADS)
+	if (pthread_mutex_init(&st->lock, NULL)) {
+		err = CORPUS_ERROR_OS;
+		goto error_shard;
+	}
+#endif
+
+	sh->state = st;
+	return 0;
+
+error_shard:
+	for (i = 0; i < ntyp; i++) {
+		symtab_shard_destroy(&st->type_shards[i]);
+	}
+	for (i = 0; i < ntok; i++) {
+		symtab_shard_destroy(&st->token_shards[i]);
+	}
+	corpus_free(st);
+error_state:
+	corpus_log(err, "failed initializing shared symbol table");
+	return err;
+}
+
+
+void corpus_symtab_shared_destroy(struct corpus_symtab_shared *sh)
+{
+	struct corpus_symtab_shared_state *st = sh->state;
+	int i;
+
+#if defined(SYMTAB_THREADS)
+	pthread_mutex_destroy(&st->lock);
+#endif
+
+	for (i = 0; i < SYMTAB_NSEGMENT; i++) {
+		corpus_free(st->tokens[i]);
+		corpus_free(st->types[i]);
+	}
+
+	for (i = 0; i < CORPUS_SYMTAB_NSHARD; i++) {
+		symtab_shard_destroy(&st->type_shards[i]);
+		symtab_shard_destroy(&st->token_shards[i]);
+	}
+
+	corpus_free(st);
+}
+
+
+int corpus_symtab_shared_add_token(struct corpus_symtab_shared *sh,
+				   const struct utf8lite_text *tok,
+				   int type_id, int *idptr)
+{
+	struct corpus_symtab_shared_state *st = sh->state;
+	struct corpus_tagtable_probe probe;
+	struct corpus_symtab_token *token;
+	struct symtab_shard *shard;
+	unsigned hash = (unsigned)utf8lite_text_hash(tok);
+	int err = 0, id;
+
+	shard = &st->token_shards[SYMTAB_SHARD(hash)];
+	SYMTAB_LOCK(&shard->lock);
+
+	corpus_tagtable_probe_make(&probe, &shard->table, hash);
+	while (corpus_tagtable_probe_advance(&probe)) {
+		id = probe.current;
+		token = &st->tokens[id >> SYMTAB_SEGMENT_BITS]
+				   [id & (SYMTAB_SEGMENT_SIZE - 1)];
+		if (utf8lite_text_equals(tok, &token->text)) {
+			goto out;
+		}
+	}
+
+	if ((err = corpus_tagtable_grow(&shard->table, 1))) {
+		goto out;
+	}
+
+	if (!(token = symtab_shared_new_id(st, (void **)st->tokens,
+					   sizeof(*token), &st->ntoken,
+					   &id))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto out;
+	}
+
+	// on failure, the ID stays in use, with empty text
+	if ((err = symtab_storage_copy(&shard->storage, &token->text, tok))) {
+		goto out;
+	}
+	token->type_id = type_id;
+	token->shared_id = id;
+
+	corpus_tagtable_add(&shard->table, hash, id);
+
+out:
+	SYMTAB_UNLOCK(&shard->lock);
+
+	if (err) {
+		corpus_log(err, "failed adding token to shared symbol table");
+		id = CORPUS_TOKEN_NONE;
+	}
+	if (idptr) {
+		*idptr = id;
+	}
+	return err;
+}
+
+
+int corpus_symtab_shared_add_type(struct corpus_symtab_shared *sh,
+				  const struct utf8lite_text *typ, int *idptr)
+{
+	struct corpus_symtab_shared_state *st = sh->state;
+	struct corpus_tagtable_probe probe;
+	struct utf8lite_text *type;
+	struct symtab_shard *shard;
+	unsigned hash = (unsigned)utf8lite_text_hash(typ);
+	int err = 0, id;
+
+	shard = &st->type_shards[SYMTAB_SHARD(hash)];
+	SYMTAB_LOCK(&shard->lock);
+
+	corpus_tagtable_probe_make(&probe, &shard->table, hash);
+	while (corpus_tagtable_probe_advance(&probe)) {
+		id = probe.current;
+		type = &st->types[id >> SYMTAB_SEGMENT_BITS]
+				 [id & (SYMTAB_SEGMENT_SIZE - 1)];
+		if (utf8lite_text_equals(typ, type)) {
+			goto out;
+		}
+	}
+
+	if ((err = corpus_tagtable_grow(&shard->table, 1))) {
+		goto out;
+	}
+
+	if (!(type = symtab_shared_new_id(st, (void **)st->types,
+					  sizeof(*type), &st->ntype, &id))) {
+		err = CORPUS_ERROR_NOMEM;
+		goto out;
+	}
+
+	// on failure, the ID stays in use, with empty text
+	if ((err = symtab_storage_copy(&shard->storage, type, typ))) {
+		goto out;
+	}
+
+	corpus_tagtable_add(&shard->table, hash, id);
+
+out:
+	SYMTAB_UNLOCK(&shard->lock);
+
+	if (err) {
+		corpus_log(err, "failed adding type to shared symbol table");
+		id = CORPUS_TYPE_NONE;
+	}
+	if (idptr) {
+		*idptr = id;
+	}
+	return err;
+}
+
+
+const struct corpus_symtab_token *corpus_symtab_shared_token(
+		const struct corpus_symtab_shared *sh, int id)
+{
+	const struct corpus_symtab_shared_state *st = sh->state;
+
+	assert(id >= 0);
+	return &st->tokens[id >> SYMTAB_SEGMENT_BITS]
+			  [id & (SYMTAB_SEGMENT_SIZE - 1)];
+}
+
+
+const struct utf8lite_text *corpus_symtab_shared_type(
+		const struct corpus_symtab_shared *sh, int id)
+{
+	const struct corpus_symtab_shared_state *st = sh->state;
+
+	assert(id >= 0);
+	return &st->types[id >> SYMTAB_SEGMENT_BITS]
+			 [id & (SYMTAB_SEGMENT_SIZE - 1)];
+}
+
+
+int corpus_symtab_shared_ntoken(const struct corpus_symtab_shared *sh)
+{
+	struct corpus_symtab_shared_state *st = sh->state;
+	int ntoken;
+
+	SYMTAB_LOCK(&st->lock);
+	ntoken = st->ntoken;
+	SYMTAB_UNLOCK(&st->lock);
+
+	return ntoken;
+}
+
+
+int corpus_symtab_shared_ntype(const struct corpus_symtab_shared *sh)
+{
+	struct corpus_symtab_shared_state *st = sh->state;
+	int ntype;
+
+	SYMTAB_LOCK(&st->lock);
+	ntype = st->ntype;
+	SYMTAB_UNLOCK(&st->lock);
+
+	return ntype;
+}
+
+
+int symtab_shard_init(struct symtab_shard *shard)
+{
+	int err;
+
+	if ((err = corpus_tagtable_init(&shard->table))) {
+		return err;
+	}
+
+#if defined(SYMTAB_THREADS)
+	if (pthread_mutex_init(&shard->lock, NULL)) {
+		corpus_tagtable_destroy(&shard->table);
+		return CORPUS_ERROR_OS;
+	}
+#endif
+
+	symtab_storage_init(&shard->storage);
+	return 0;
+}
+
+
+void symtab_shard_destroy(struct symtab_shard *shard)
+{
+#if defined(SYMTAB_THREADS)
+	pthread_mutex_destroy(&shard->lock);
+#endif
+	symtab_storage_free(&shard->storage, 0);
+	corpus_tagtable_destroy(&shard->table);
+}
+
+
+/*
+ * Reserve the next ID in a shared table directory, allocating a new
+ * segment if necessary, and get the (zeroed) entry for the ID.
+ */
+void *symtab_shared_new_id(struct corpus_symtab_shared_state *st,
+			   void **segments, size_t width, int *countptr,
+			   int *idptr)
+{
+	void *entry = NULL;
+	int id, seg;
+
+	SYMTAB_LOCK(&st->lock);
+
+	id = *countptr;
+	if (id == INT_MAX) {
+		corpus_log(CORPUS_ERROR_OVERFLOW, "number of symbols"
+			   " exceeds maximum (%d)", INT_MAX);
+		goto out;
+	}
+
+	seg = id >> SYMTAB_SEGMENT_BITS;
+	if (!segments[seg]) {
+		segments[seg] = corpus_calloc((size_t)SYMTAB_SEGMENT_SIZE,
+					      width);
+		if (!segments[seg]) {
+			goto out;
+		}
+	}
+
+	entry = (char *)segments[seg]
+		+ (size_t)(id & (SYMTAB_SEGMENT_SIZE - 1)) * width;
+	*countptr = id + 1;
+	*idptr = id;
+
+out:
+	SYMTAB_UNLOCK(&st->lock);
+	return entry;
+}
+
+
+void symtab_storage_init(struct corpus_symtab_storage *st)
+{
+	st->blocks = NULL;
+	st->ptr = NULL;
+	st->end = NULL;
+}
+
+
+void *symtab_storage_alloc(struct corpus_symtab_storage *st, size_t size,
+			   size_t align)
+{
+	struct corpus_symtab_block *block;
+	uint8_t *ptr;
+	size_t pad, block_size;
+
+	if (st->blocks) {
+		pad = (align - (uintptr_t)st->ptr % align) % align;
+		if (pad + size <= (size_t)(st->end - st->ptr)) {
+			ptr = st->ptr + pad;
+			st->ptr = ptr + size;
+			return ptr;
+		}
+		block_size = 2 * st->blocks->size;
+		if (block_size > SYMTAB_BLOCK_MAX) {
+			block_size = SYMTAB_BLOCK_MAX;
+		}
+	} else {
+		block_size = SYMTAB_BLOCK_MIN;
+	}
+
+	if (block_size < size) {
+		if (size > SIZE_MAX - sizeof(*block)) {
+			corpus_log(CORPUS_ERROR_OVERFLOW,
+				   "symbol table storage size is too large");
+			return NULL;
+		}
+		block_size = size;
+	}
+
+	// the block header size is a multiple of the alignment for
+	// all of the objects we store, so the storage needs no padding
+	if (!(block = corpus_malloc(sizeof(*block) + block_size))) {
+		corpus_log(CORPUS_ERROR_NOMEM, "failed allocating symbol"
+			   " table storage block");
+		return NULL;
+	}
+	block->next = st->blocks;
+	block->size = block_size;
+	st->blocks = block;
+
+	ptr = (uint8_t *)(block + 1);
+	st->ptr = ptr + size;
+	st->end = ptr + block_size;
+	return ptr;
+}
+
+
+int symtab_storage_copy(struct corpus_symtab_storage *st,
+			struct utf8lite_text *text,
+			const struct utf8lite_text *other)
+{
+	size_t size = UTF8LITE_TEXT_SIZE(other);
+	uint8_t *ptr;
+
+	if (!(ptr = symtab_storage_alloc(st, size + 1, 1))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+
+	if (size) {
+		memcpy(ptr, other->ptr, size);
+	}
+	ptr[size] = '\0';
+
+	text->ptr = ptr;
+	text->attr = other->attr;
+	return 0;
+}
+
+
+void symtab_storage_free(struct corpus_symtab_storage *st, int keep)
+{
+	struct corpus_symtab_block *block = st->blocks;
+	struct corpus_symtab_block *next;
+
+	if (keep && block) {
+		next = block->next;
+		block->next = NULL;
+		st->ptr = (uint8_t *)(block + 1);
+		block = next;
+	} else {
+		symtab_storage_init(st);
+	}
+
+	while (block) {
+		next = block->next;
+		corpus_free(block);
+		block = next;
+	}
+}
+
+
+uint64_t symtab_token_hash(void *context, int id, uint64_t seed)
+{
+	const struct corpus_symtab *tab = context;
+	return symtab_hash_seed(&tab->tokens[id].text, seed);
+}
+
+
+uint64_t symtab_type_hash(void *context, int id, uint64_t seed)
+{
+	const struct corpus_symtab *tab = context;
+	return symtab_hash_seed(&tab->types[id].text, seed);
+}
+
+
+/*
+ * Seeded hash for the frozen tables: 64-bit FNV-1a over the UTF-8 bytes
+ * of the decoded text, followed by a final mix. Texts without escapes
+ * get hashed in place; escaped ones get decoded and re-encoded one
+ * character at a time, so that texts that compare equal hash the same.
+ */
+uint64_t symtab_hash_seed(const struct utf8lite_text *text, uint64_t seed)
+{
+	struct utf8lite_text_iter it;
+	uint8_t buf[4];
+	const uint8_t *ptr, *end;
+	uint8_t *bufptr;
+	uint64_t hash = 0xCBF29CE484222325ULL ^ seed;
+
+	if (!UTF8LITE_TEXT_HAS_ESC(text)) {
+		ptr = text->ptr;
+		end = ptr + UTF8LITE_TEXT_SIZE(text);
+		while (ptr != end) {
+			hash ^= *ptr++;
+			hash *= 0x100000001B3ULL;
+		}
+	} else {
+		utf8lite_text_iter_make(&it, text);
+		while (utf8lite_text_iter_advance(&it)) {
+			bufptr = buf;
+			utf8lite_encode_utf8(it.current, &bufptr);
+			for (ptr = buf; ptr != bufptr; ptr++) {
+				hash ^= *ptr;
+				hash *= 0x100000001B3ULL;
+			}
+		}
+	}
+
+	return corpus_perfhash_mix(hash);
+}
+
+
+int corpus_symtab_grow_tokens(struct corpus_symtab *tab, int nadd)
+{
+	void *base = tab->tokens;
+	int size = tab->ntoken_max;
+	int err;
+
+	if ((err = corpus_array_grow(&base, &size, sizeof(*tab->tokens),
+				     tab->ntoken, nadd))) {
+		corpus_log(err, "failed allocating token array");
+		return err;
+	}
+
+	tab->tokens = base;
+	tab->ntoken_max = size;
+	return 0;
+}
+
+
+int corpus_symtab_grow_types(struct corpus_symtab *tab, int nadd)
+{
+	void *base = tab->types;
+	int size = tab->ntype_max;
+	int err;
+
+	if ((err = corpus_array_grow(&base, &size, sizeof(*tab->types),
+				     tab->ntype, nadd))) {
+		corpus_log(err, "failed allocating type array");
+		return err;
+	}
+
+	tab->types = base;
+	tab->ntype_max = size;
+	return 0;
+}
+
+
+/*
+ * Decide whether to add a new token to a bounded table, counting it in
+ * the sketch. We use a conservative update, only incrementing the
+ * counters that equal the current estimate (the minimum), which keeps
+ * the over-estimates for rare tokens small.
+ */
+int symtab_admit(struct corpus_symtab *tab, unsigned hash)
+{
+	uint32_t *cell[SYMTAB_SKETCH_DEPTH];
+	uint32_t count = UINT32_MAX;
+	uint64_t h;
+	size_t width;
+	int d;
+
+	if (tab->ntoken >= tab->ntoken_limit) {
+		return 0;
+	}
+
+	if (!tab->sketch) {
+		return 1;
+	}
+
+	width = (size_t)tab->sketch_mask + 1;
+	for (d = 0; d < SYMTAB_SKETCH_DEPTH; d++) {
+		h = corpus_perfhash_mix((uint64_t)hash
+					+ (uint64_t)(d + 1) * SYMTAB_SKETCH_SEED);
+		cell[d] = &tab->sketch[(size_t)d * width
+				       + (h & tab->sketch_mask)];
+		if (*cell[d] < count) {
+			count = *cell[d];
+		}
+	}
+
+	if (count < UINT32_MAX) {
+		count++;
+		for (d = 0; d < SYMTAB_SKETCH_DEPTH; d++) {
+			if (*cell[d] < count) {
+				*cell[d] = count;
+			}
+		}
+	}
+
+	return (count >= (uint32_t)tab->min_count);
+}
+
+
+/*
+ * Determine how a type map acts on ASCII text: whether it leaves every
+ * ASCII character unchanged, or lowercases A-Z and leaves the others
+ * unchanged. Other maps (for example, ones that drop characters) do not
+ * get the fast path.
+ */
+int symtab_ascii_kind(const struct utf8lite_textmap *map)
+{
+	int same = 1, lower = 1;
+	int c, l;
+
+	for (c = 0; c < 128; c++) {
+		l = ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+		if (map->ascii_map[c] != c) {
+			same = 0;
+		}
+		if (map->ascii_map[c] != l) {
+			lower = 0;
+		}
+	}
+
+	if (same) {
+		return SYMTAB_ASCII_SAME;
+	} else if (lower) {
+		return SYMTAB_ASCII_LOWER;
+	}
+	return SYMTAB_ASCII_NONE;
+}
+
+
+/*
+ * Compute the type for a token without going through the type map, if
+ * the token is plain ASCII (no escapes, nothing above 0x7F). Lowercased
+ * types get written to `buf`, which must have room for SYMTAB_ASCII_MAX
+ * bytes. Returns nonzero on success, or zero if the token needs the
+ * type map.
+ */
+int symtab_ascii_type(const struct corpus_symtab *tab,
+		      const struct utf8lite_text *tok, uint8_t *buf,
+		      struct utf8lite_text *typ)
+{
+	const uint8_t *ptr = tok->ptr;
+	size_t size = UTF8LITE_TEXT_SIZE(tok);
+	size_t i, n;
+	uint64_t word, upper, any = 0;
+
+	if (tab->ascii_kind == SYMTAB_ASCII_NONE
+			|| UTF8LITE_TEXT_BITS(tok)) {
+		return 0;
+	}
+
+	if (tab->ascii_kind == SYMTAB_ASCII_SAME) {
+		*typ = *tok;
+		return 1;
+	}
+
+	if (size > SYMTAB_ASCII_MAX) {
+		return 0;
+	}
+
+	// every byte is below 0x80, so adding 0x3F (resp. 0x25) sets the
+	// high bit of a byte exactly when it is at least 'A' (resp. above
+	// 'Z'), without carrying into the next byte; an uppercase byte
+	// gets its 0x20 bit from its shifted high bit
+	for (i = 0; i < size; i += 8) {
+		n = (size - i < 8) ? size - i : 8;
+		word = 0;
+		memcpy(&word, ptr + i, n);
+		upper = (word + SYMTAB_ONES * (0x80 - 'A'))
+			& ~(word + SYMTAB_ONES * (0x80 - 'Z' - 1))
+			& SYMTAB_HIGH;
+		word |= upper >> 2;
+		memcpy(buf + i, &word, n);
+		any |= upper;
+	}
+
+	if (any) {
+		typ->ptr = buf;
+		typ->attr = size;
+	} else {
+		*typ = *tok;
+	}
+	return 1;
+}
+
+
+/*
+ * Add a token to a type's token list. The lists live in the block
+ * storage, with power-of-two capacities; when a list fills up, we copy it
+ * to a new location with twice the capacity, abandoning the old one.
+ * The abandoned space is at most the size of the live lists.
+ */
+int type_add_token(struct corpus_symtab *tab, struct corpus_symtab_type *typ,
+		   int tok_id)
+{
+	int *tok_ids = typ->token_ids;
+	int ntok = typ->ntoken;
+	int cap;
+
+	if ((ntok & (ntok - 1)) == 0) {
+		// the list is full (or empty)
+		if (ntok > INT_MAX / 2) {
+			return CORPUS_ERROR_OVERFLOW;
+		}
+		cap = ntok ? 2 * ntok : 1;
+
+		tok_ids = symtab_storage_alloc(&tab->storage, (size_t)cap
+					       * sizeof(*tok_ids),
+					       sizeof(*tok_ids));
+		if (!tok_ids) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		if (ntok) {
+			memcpy(tok_ids, typ->token_ids,
+			       (size_t)ntok * sizeof(*tok_ids));
+		}
+	}
+
+	tok_ids[ntok] = tok_id;
+	typ->token_ids = tok_ids;
+	typ->ntoken = ntok + 1;
+
+	return 0;
+}
+
+
+void symtab_put_u32(uint8_t *ptr, uint32_t val)
+{
+	ptr[0] = (uint8_t)(val);
+	ptr[1] = (uint8_t)(val >> 8);
+	ptr[2] = (uint8_t)(val >> 16);
+	ptr[3] = (uint8_t)(val >> 24);
+}
+
+
+void symtab_put_u64(uint8_t *ptr, uint64_t val)
+{
+	symtab_put_u32(ptr, (uint32_t)val);
+	symtab_put_u32(ptr + 4, (uint32_t)(val >> 32));
+}
+
+
+uint32_t symtab_get_u32(const uint8_t *ptr)
+{
+	return ((uint32_t)ptr[0]
+		| ((uint32_t)ptr[1] << 8)
+		| ((uint32_t)ptr[2] << 16)
+		| ((uint32_t)ptr[3] << 24));
+}
+
+
+uint64_t symtab_get_u64(const uint8_t *ptr)
+{
+	return ((uint64_t)symtab_get_u32(ptr)
+		| ((uint64_t)symtab_get_u32(ptr + 4) << 32));
+}
+
+
+/*
+ * Hash a fixed text with non-ASCII characters, so that loading can tell
+ * whether the hash function has changed since a table got saved.
+ */
+unsigned symtab_hash_check(void)
+{
+	struct utf8lite_text text;
+
+	text.ptr = (uint8_t *)SYMTAB_FILE_HASH_CHECK;
+	text.attr = strlen(SYMTAB_FILE_HASH_CHECK) | UTF8LITE_TEXT_UTF8_BIT;
+
+	return (unsigned)utf8lite_text_hash(&text);
+}
+
+
+int symtab_write_record(FILE *stream, const struct utf8lite_text *text,
+			uint64_t off, int type_id)
+{
+	uint8_t rec[SYMTAB_FILE_RECORD_SIZE];
+	size_t size = UTF8LITE_TEXT_SIZE(text);
+	uint32_t flags = 0;
+
+	if (size > UINT32_MAX - 1) {
+		corpus_log(CORPUS_ERROR_OVERFLOW,
+			   "symbol is too long to save");
+		return CORPUS_ERROR_OVERFLOW;
+	}
+
+	if (text->attr & UTF8LITE_TEXT_ESC_BIT) {
+		flags |= SYMTAB_FILE_ESC;
+	}
+	if (text->attr & UTF8LITE_TEXT_UTF8_BIT) {
+		flags |= SYMTAB_FILE_UTF8;
+	}
+
+	symtab_put_u64(rec, off);
+	symtab_put_u32(rec + 8, (uint32_t)size);
+	symtab_put_u32(rec + 12, (uint32_t)utf8lite_text_hash(text));
+	symtab_put_u32(rec + 16, flags);
+	symtab_put_u32(rec + 20, (uint32_t)type_id);
+
+	if (fwrite(rec, 1, sizeof(rec), stream) != sizeof(rec)) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+int symtab_write_text(FILE *stream, const struct utf8lite_text *text)
+{
+	size_t size = UTF8LITE_TEXT_SIZE(text);
+
+	if (size > 0 && fwrite(text->ptr, 1, size, stream) != size) {
+		return CORPUS_ERROR_OS;
+	}
+	if (fputc('\0', stream) == EOF) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+/*
+ * Read a saved token or type, checking that its text is in bounds and
+ * followed by a NUL byte.
+ */
+int symtab_read_record(const uint8_t *rec, const uint8_t *blob,
+		       uint64_t blob_size, struct utf8lite_text *text,
+		       unsigned *hashptr, int rehash)
+{
+	uint64_t off = symtab_get_u64(rec);
+	uint64_t size = symtab_get_u32(rec + 8);
+	uint32_t flags = symtab_get_u32(rec + 16);
+
+	if (off > blob_size || size >= blob_size - off
+			|| blob[off + size] != '\0'
+			|| (flags & ~(uint32_t)(SYMTAB_FILE_ESC
+						| SYMTAB_FILE_UTF8))) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	text->ptr = (uint8_t *)(blob + off);
+	text->attr = (size_t)size;
+	if (flags & SYMTAB_FILE_ESC) {
+		text->attr |= UTF8LITE_TEXT_ESC_BIT;
+	}
+	if (flags & SYMTAB_FILE_UTF8) {
+		text->attr |= UTF8LITE_TEXT_UTF8_BIT;
+	}
+
+	if (rehash) {
+		*hashptr = (unsigned)utf8lite_text_hash(text);
+	} else {
+		*hashptr = symtab_get_u32(rec + 12);
+	}
 	return 0;
 }
@@ -23,18 +23,30 @@
  * Symbol table, assigning integer IDs to tokens and types.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
 /** Code for a missing or non-existent token */
 #define CORPUS_TOKEN_NONE (-1)
 
 /** Code for a missing or non-existent type */
 #define CORPUS_TYPE_NONE (-1)
 
+/** Code for a token left out of a bounded symbol table */
+#define CORPUS_TOKEN_OOV (-2)
+
+/** Code for the type of a token left out of a bounded symbol table */
+#define CORPUS_TYPE_OOV (-2)
+
 /**
  * Symbol table token.
  */
 struct corpus_symtab_token {
 	struct utf8lite_text text;/**< the token text */
 	int type_id;		/**< the ID of the token's type */
+	int shared_id;		/**< the token ID in the shared table, if
+				  the symbol table has one; otherwise, the
+				  same as the local ID */
 };
 
 /**
@@ -42,24 +54,92 @@ struct corpus_symtab_token {
  */
 struct corpus_symtab_type {
 	struct utf8lite_text text;/**< the type text */
-	int *token_ids;		/**< the IDs of the tokens in the type */
+	int *token_ids;		/**< the IDs of the tokens in the type; the
+				  capacity is the smallest power of two
+				  at least as large as `ntoken` */
 	int ntoken;		/**< the number of tokens in the type */
+	int shared_id;		/**< the type ID in the shared table, if
+				  the symbol table has one; otherwise, the
+				  same as the local ID */
 };
 
+struct corpus_filebuf;
+
+/**
+ * Storage block for symbol table text and type token lists.
+ */
+struct corpus_symtab_block;
+
 /**
- * Symbol table.
+ * Block storage, for allocating symbol table text and type token lists
+ * from large append-only blocks that get freed together.
+ */
+struct corpus_symtab_storage {
+	struct corpus_symtab_block *blocks; /**< storage blocks, most
+					      recent first */
+	uint8_t *ptr;		/**< the free space in the most recent
+				  block */
+	uint8_t *end;		/**< the end of the most recent block */
+};
+
+/**
+ * Symbol table. The token and type text, along with the type token
+ * lists, get stored in large append-only blocks owned by the table,
+ * rather than in individual allocations; these blocks get freed
+ * together when the table gets cleared or destroyed.
  */
 struct corpus_symtab {
 	struct utf8lite_textmap typemap;/**< type map, for normalizing
 					  tokens to types */
-	struct corpus_table type_table;	/**< type hash table */
-	struct corpus_table token_table;/**< token hash table */
+	int ascii_kind;			/**< how the type map acts on ASCII
+					  text, for the token fast path */
+	struct corpus_tagtable type_table; /**< type hash table */
+	struct corpus_tagtable token_table; /**< token hash table */
 	struct corpus_symtab_type *types;	/**< type array */
 	struct corpus_symtab_token *tokens;	/**< token array */
 	int ntype;			/**< type array length */
 	int ntype_max;			/**< type array capacity */
 	int ntoken;			/**< token array length */
 	int ntoken_max;			/**< token array capacity */
+	struct corpus_symtab_storage storage; /**< text and token list
+						storage */
+	struct corpus_symtab_shared *shared; /**< the shared table, or NULL */
+	struct corpus_filebuf *file;	/**< the memory-mapped file holding
+					  the loaded text, or NULL */
+	struct corpus_perfhash type_index; /**< frozen type lookup table */
+	struct corpus_perfhash token_index; /**< frozen token lookup table */
+	int frozen;			/**< whether the table is frozen */
+	int ntoken_limit;		/**< the maximum number of tokens, or
+					  -1 if unbounded */
+	int min_count;			/**< the number of times a new token
+					  must be seen before it gets added,
+					  if bounded */
+	uint32_t *sketch;		/**< count-min sketch of the counts
+					  for tokens not yet added, or NULL */
+	unsigned sketch_mask;		/**< sketch row width, minus one */
+};
+
+/** Number of shards in a shared symbol table; must be a power of 2. */
+#define CORPUS_SYMTAB_NSHARD 64
+
+/**
+ * Shared symbol table internals.
+ */
+struct corpus_symtab_shared_state;
+
+/**
+ * Shared symbol table, for giving globally consistent token and type IDs
+ * to symbol tables in different threads. Each thread keeps its own
+ * #corpus_symtab, attached to the shared table with
+ * #corpus_symtab_set_shared. The local table acts as a cache, so that
+ * looking up a token that the thread has seen before takes no locks.
+ * Only new tokens and types go to the shared table, which gets split into
+ * #CORPUS_SYMTAB_NSHARD shards by hash code, each with its own lock, so
+ * that concurrent insertions rarely wait on each other. The shared IDs
+ * are consecutive, starting at 0.
+ */
+struct corpus_symtab_shared {
+	struct corpus_symtab_shared_state *state; /**< the internal state */
 };
 
 
@@ -96,7 +176,9 @@ void corpus_symtab_clear(struct corpus_symtab *tab);
  * \param tok the token
  * \param idptr a pointer to store the token id, or NULL
  *
- * \returns 0 on success
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the token is new and the
+ * 	table is frozen; for a bounded table (#corpus_symtab_set_limit),
+ * 	the ID is #CORPUS_TOKEN_OOV if the token did not get added
  */
 int corpus_symtab_add_token(struct corpus_symtab *tab,
 			    const struct utf8lite_text *tok, int *idptr);
@@ -109,7 +191,8 @@ int corpus_symtab_add_token(struct corpus_symtab *tab,
  * \param typ the type
  * \param idptr a pointer to store the type id, or NULL
  *
- * \returns 0 on success
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the type is new and the
+ * 	table is frozen
  */
 int corpus_symtab_add_type(struct corpus_symtab *tab,
 			   const struct utf8lite_text *typ, int *idptr);
@@ -138,4 +221,193 @@ int corpus_symtab_has_token(const struct corpus_symtab *tab,
 int corpus_symtab_has_type(const struct corpus_symtab *tab,
 			   const struct utf8lite_text *typ, int *idptr);
 
+/**
+ * Freeze a symbol table, so that no more tokens or types can get added,
+ * and replace its hash tables with minimal perfect hash tables
+ * (#corpus_perfhash). Looking up a token or type in a frozen table
+ * takes a single probe and one comparison; the frozen tables take a
+ * quarter to a half as much memory as the hash tables they replace.
+ * Lookups do not modify a frozen table, so any number of threads can use
+ * it at once without locks, including through #corpus_symtab_add_token
+ * and #corpus_symtab_add_type for existing tokens and types. Clearing
+ * the table un-freezes it.
+ *
+ * \param tab the symbol table
+ *
+ * \returns 0 on success
+ */
+int corpus_symtab_freeze(struct corpus_symtab *tab);
+
+/**
+ * Bound the number of tokens in a symbol table, so that the table stays
+ * within a fixed memory budget on open-ended input. Once the table holds
+ * `ntoken_limit` tokens, #corpus_symtab_add_token reports new tokens as
+ * #CORPUS_TOKEN_OOV instead of adding them. Tokens already in the table
+ * keep their IDs; nothing gets evicted.
+ *
+ * So that rare tokens do not use up the budget, a new token only gets
+ * added after it has been seen `min_count` times; until then, it gets
+ * reported as #CORPUS_TOKEN_OOV. The counts for these tokens are
+ * approximate, tracked by a count-min sketch with a size proportional to
+ * `ntoken_limit`, so a rare token may occasionally get added early, but
+ * never late.
+ *
+ * The limit does not apply to types added with #corpus_symtab_add_type.
+ * Clearing the table resets the counts but keeps the limit.
+ *
+ * \param tab the symbol table
+ * \param ntoken_limit the maximum number of tokens, or -1 for no limit
+ * \param min_count the number of times a new token must be seen before
+ * 	it gets added; 1 to add new tokens right away
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if `min_count` is not
+ * 	positive, #CORPUS_ERROR_NOMEM if allocating the sketch fails
+ */
+int corpus_symtab_set_limit(struct corpus_symtab *tab, int ntoken_limit,
+			    int min_count);
+
+/**
+ * Save a symbol table to a file, replacing the file if it exists. The
+ * file holds the token and type text, the token types, and the hash
+ * codes, in an architecture-independent format (with numbers stored in
+ * little-endian byte order) that #corpus_symtab_load can use in place,
+ * without parsing or copying the text.
+ *
+ * \param tab the symbol table
+ * \param file_name the file name
+ *
+ * \returns 0 on success, #CORPUS_ERROR_OVERFLOW if a token or type is too
+ * 	long to save
+ */
+int corpus_symtab_save(const struct corpus_symtab *tab,
+		       const char *file_name);
+
+/**
+ * Load a saved symbol table into an empty one, giving the tokens and
+ * types the same IDs that they had when saved. The file gets
+ * memory-mapped, read-only, and the token and type text point into the
+ * map; only the token and type arrays and the hash tables get built in
+ * memory. The hash tables get rebuilt from the saved hash codes, unless
+ * the current hash function differs from the one that saved the file.
+ * Tokens and types added after loading get stored as usual.
+ *
+ * The table must have the same type kind as the saved table, and must
+ * not be frozen or attached to a shared table; call
+ * #corpus_symtab_freeze or #corpus_symtab_set_shared after loading
+ * instead.
+ *
+ * \param tab the symbol table
+ * \param file_name the file name
+ * \param sizeptr if non-NULL, a location to store the size (in bytes)
+ * 	of the saved table; the remainder of the file, if any, is
+ * 	available to the caller at this offset in `tab->file`
+ *
+ * \returns 0 on success, #CORPUS_ERROR_INVAL if the table is not empty,
+ * 	or if the file is malformed or has a different type kind
+ */
+int corpus_symtab_load(struct corpus_symtab *tab, const char *file_name,
+		       size_t *sizeptr);
+
+/**
+ * Attach a symbol table to a shared table. Tokens and types already in
+ * the symbol table get added to the shared table; new ones get added as
+ * they appear.
+ *
+ * \param tab the symbol table
+ * \param sh the shared table
+ *
+ * \returns 0 on success
+ */
+int corpus_symtab_set_shared(struct corpus_symtab *tab,
+			     struct corpus_symtab_shared *sh);
+
+/**
+ * Initialize an empty shared symbol table.
+ *
+ * \param sh the shared table
+ *
+ * \returns 0 on success
+ */
+int corpus_symtab_shared_init(struct corpus_symtab_shared *sh);
+
+/**
+ * Release a shared symbol table's resources. The symbol tables attached
+ * to it must not get used afterward.
+ *
+ * \param sh the shared table
+ */
+void corpus_symtab_shared_destroy(struct corpus_symtab_shared *sh);
+
+/**
+ * Add a token to a shared table if it does not already exist there, and
+ * get its shared ID. This function is safe to call from multiple threads.
+ *
+ * \param sh the shared table
+ * \param tok the token
+ * \param type_id the shared ID of the token's type
+ * \param idptr a pointer to store the token id, or NULL
+ *
+ * \returns 0 on success
+ */
+int corpus_symtab_shared_add_token(struct corpus_symtab_shared *sh,
+				   const struct utf8lite_text *tok,
+				   int type_id, int *idptr);
+
+/**
+ * Add a type to a shared table if it does not already exist there, and
+ * get its shared ID. This function is safe to call from multiple threads.
+ *
+ * \param sh the shared table
+ * \param typ the type
+ * \param idptr a pointer to store the type id, or NULL
+ *
+ * \returns 0 on success
+ */
+int corpus_symtab_shared_add_type(struct corpus_symtab_shared *sh,
+				  const struct utf8lite_text *typ,
+				  int *idptr);
+
+/**
+ * Get a token from a shared table, by its shared ID. This takes no locks;
+ * the ID must have come from a call in the same thread, or from a call
+ * that finished before the threads synchronized.
+ *
+ * \param sh the shared table
+ * \param id the shared token ID
+ *
+ * \returns the token, with the shared ID of its type
+ */
+const struct corpus_symtab_token *corpus_symtab_shared_token(
+		const struct corpus_symtab_shared *sh, int id);
+
+/**
+ * Get the text of a type from a shared table, by its shared ID. As with
+ * #corpus_symtab_shared_token, this takes no locks.
+ *
+ * \param sh the shared table
+ * \param id the shared type ID
+ *
+ * \returns the type text
+ */
+const struct utf8lite_text *corpus_symtab_shared_type(
+		const struct corpus_symtab_shared *sh, int id);
+
+/**
+ * Get the number of tokens in a shared table.
+ *
+ * \param sh the shared table
+ *
+ * \returns the number of tokens
+ */
+int corpus_symtab_shared_ntoken(const struct corpus_symtab_shared *sh);
+
+/**
+ * Get the number of types in a shared table.
+ *
+ * \param sh the shared table
+ *
+ * \returns the number of types
+ */
+int corpus_symtab_shared_ntype(const struct corpus_symtab_shared *sh);
+
 #endif /* CORPUS_SYMTAB_H */
@@ -18,6 +18,13 @@
 #include <limits.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#  include <emmintrin.h>
+#  define TAGTABLE_SIMD 1
+#endif
+
 #include "error.h"
 #include "memory.h"
 #include "table.h"
@@ -182,3 +189,636 @@ int corpus_table_next_empty(const struct corpus_table *tab, unsigned hash)
 
 	return probe.index;
 }
+
+
+/*
+ * The tagged table design follows the "Swiss table" from the Abseil
+ * library (Apache License 2.0):
+ *
+ *       https://abseil.io/about/design/swisstables
+ *
+ * Full cells have tags in [0, 127], the top 7 bits of the hash code.
+ * Probes visit groups in a quadratic sequence, stopping after the first
+ * group with an empty cell. Cells that have been moved to the new
+ * generation during a resize get a tag that is neither full nor empty,
+ * so that they do not break the probe sequences for the remaining items.
+ */
+
+#define TAGTABLE_EMPTY	0x80
+#define TAGTABLE_MOVED	0xFE
+
+/* Maximum number of items per group before we resize (7/8 full). */
+#define TAGTABLE_GROUP_LOAD	(CORPUS_TAGTABLE_GROUP * 7 / 8)
+
+/* Maximum number of groups; must be a power of 2. */
+#define TAGTABLE_NGROUP_MAX \
+	((unsigned)INT_MAX / CORPUS_TAGTABLE_GROUP + 1)
+
+static int tagtable_cells_init(struct corpus_tagtable_cells *cells,
+			       unsigned ngroup);
+static void tagtable_cells_destroy(struct corpus_tagtable_cells *cells);
+static void tagtable_cells_add(struct corpus_tagtable_cells *cells,
+			       unsigned hash, int item);
+static void tagtable_move(struct corpus_tagtable *tab, unsigned ngroup);
+static void tagtable_probe_start(struct corpus_tagtable_probe *probe,
+				 const struct corpus_tagtable_cells *cells);
+static void tagtable_probe_load(struct corpus_tagtable_probe *probe);
+
+
+static uint8_t tagtable_tag(unsigned hash)
+{
+	return (uint8_t)((hash >> 25) & 0x7F);
+}
+
+
+// bit mask of the cells in a group with the given tag
+static unsigned tagtable_match(const uint8_t *tags, uint8_t tag)
+{
+#if defined(TAGTABLE_SIMD)
+	__m128i group = _mm_loadu_si128((const __m128i *)tags);
+	__m128i eq = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag));
+	return (unsigned)_mm_movemask_epi8(eq);
+#else
+	unsigned bits = 0;
+	int i;
+
+	for (i = 0; i < CORPUS_TAGTABLE_GROUP; i++) {
+		if (tags[i] == tag) {
+			bits |= 1U << i;
+		}
+	}
+	return bits;
+#endif
+}
+
+
+static unsigned tagtable_ctz(unsigned bits)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctz(bits);
+#else
+	unsigned n = 0;
+	while (!(bits & 1)) {
+		bits >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+int corpus_tagtable_init(struct corpus_tagtable *tab)
+{
+	int err;
+
+	if ((err = tagtable_cells_init(&tab->cells, 1))) {
+		corpus_log(err, "failed allocating table");
+		return err;
+	}
+
+	tab->old.tags = NULL;
+	tab->old.hashes = NULL;
+	tab->old.items = NULL;
+	tab->old.mask = 0;
+	tab->old_next = 0;
+	tab->resizing = 0;
+	tab->count = 0;
+	tab->capacity = TAGTABLE_GROUP_LOAD;
+	return 0;
+}
+
+
+void corpus_tagtable_destroy(struct corpus_tagtable *tab)
+{
+	if (tab->resizing) {
+		tagtable_cells_destroy(&tab->old);
+	}
+	tagtable_cells_destroy(&tab->cells);
+}
+
+
+void corpus_tagtable_clear(struct corpus_tagtable *tab)
+{
+	size_t ncell = ((size_t)tab->cells.mask + 1) * CORPUS_TAGTABLE_GROUP;
+
+	if (tab->resizing) {
+		tagtable_cells_destroy(&tab->old);
+		tab->resizing = 0;
+		tab->old_next = 0;
+	}
+
+	memset(tab->cells.tags, TAGTABLE_EMPTY, ncell);
+	tab->count = 0;
+}
+
+
+int corpus_tagtable_grow(struct corpus_tagtable *tab, int nadd)
+{
+	struct corpus_tagtable_cells cells;
+	unsigned ngroup;
+	int err;
+
+	assert(nadd >= 0);
+
+	if (nadd <= tab->capacity - tab->count) {
+		return 0;
+	}
+
+	ngroup = tab->cells.mask + 1;
+	do {
+		if (ngroup >= TAGTABLE_NGROUP_MAX) {
+			err = CORPUS_ERROR_OVERFLOW;
+			corpus_log(err, "table size exceeds maximum (%d)",
+				   INT_MAX);
+			return err;
+		}
+		ngroup *= 2;
+	} while ((unsigned)nadd > ngroup * TAGTABLE_GROUP_LOAD
+				  - (unsigned)tab->count);
+
+	if ((err = tagtable_cells_init(&cells, ngroup))) {
+		corpus_log(err, "failed allocating table");
+		return err;
+	}
+
+	// finish the previous resize, if there is one; this only happens
+	// if the new items do not fit in the space from the previous
+	// resize
+	if (tab->resizing) {
+		tagtable_move(tab, tab->old.mask + 1);
+	}
+
+	tab->old = tab->cells;
+	tab->cells = cells;
+	tab->old_next = 0;
+	tab->resizing = 1;
+	tab->capacity = (int)(ngroup * TAGTABLE_GROUP_LOAD);
+
+	return 0;
+}
+
+
+void corpus_tagtable_add(struct corpus_tagtable *tab, unsigned hash,
+			 int item)
+{
+	assert(tab->count < tab->capacity);
+	assert(item >= 0);
+
+	tagtable_cells_add(&tab->cells, hash, item);
+	tab->count++;
+
+	// move one old group with each insertion; the new cells have
+	// room for more items than the number of old groups, so the move
+	// finishes before the next resize
+	if (tab->resizing) {
+		tagtable_move(tab, 1);
+	}
+}
+
+
+void corpus_tagtable_probe_make(struct corpus_tagtable_probe *probe,
+				const struct corpus_tagtable *tab,
+				unsigned hash)
+{
+	probe->table = tab;
+	probe->hash = hash;
+	probe->current = CORPUS_TABLE_ITEM_EMPTY;
+	tagtable_probe_start(probe, &tab->cells);
+}
+
+
+int corpus_tagtable_probe_advance(struct corpus_tagtable_probe *probe)
+{
+	const struct corpus_tagtable *tab = probe->table;
+	const struct corpus_tagtable_cells *cells;
+	unsigned i;
+
+	for (;;) {
+		cells = probe->cells;
+
+		while (probe->match) {
+			i = tagtable_ctz(probe->match);
+			probe->match &= probe->match - 1;
+			i += probe->group * CORPUS_TAGTABLE_GROUP;
+
+			if (cells->hashes[i] == probe->hash) {
+				probe->current = cells->items[i];
+				return 1;
+			}
+		}
+
+		if (probe->last) {
+			if (cells == &tab->cells && tab->resizing) {
+				// search the items that have not moved yet
+				tagtable_probe_start(probe, &tab->old);
+				continue;
+			}
+			probe->current = CORPUS_TABLE_ITEM_EMPTY;
+			return 0;
+		}
+
+		probe->nprobe++;
+		probe->group = (probe->group + probe->nprobe) & cells->mask;
+		tagtable_probe_load(probe);
+	}
+}
+
+
+void tagtable_probe_start(struct corpus_tagtable_probe *probe,
+			  const struct corpus_tagtable_cells *cells)
+{
+	probe->cells = cells;
+	probe->group = probe->hash & cells->mask;
+	probe->nprobe = 0;
+	tagtable_probe_load(probe);
+}
+
+
+void tagtable_probe_load(struct corpus_tagtable_probe *probe)
+{
+	const struct corpus_tagtable_cells *cells = probe->cells;
+	const uint8_t *tags = cells->tags
+		+ (size_t)probe->group * CORPUS_TAGTABLE_GROUP;
+
+	probe->match = tagtable_match(tags, tagtable_tag(probe->hash));
+
+	// stop after a group with an empty cell, or after visiting all
+	// groups (possible in the old cells, which have no empty cells
+	// when full and partially moved)
+	probe->last = (tagtable_match(tags, TAGTABLE_EMPTY) != 0
+		       || probe->nprobe == cells->mask);
+}
+
+
+int tagtable_cells_init(struct corpus_tagtable_cells *cells,
+			unsigned ngroup)
+{
+	size_t ncell = (size_t)ngroup * CORPUS_TAGTABLE_GROUP;
+
+	cells->tags = corpus_malloc(ncell);
+	cells->hashes = corpus_malloc(ncell * sizeof(*cells->hashes));
+	cells->items = corpus_malloc(ncell * sizeof(*cells->items));
+
+	if (!cells->tags || !cells->hashes || !cells->items) {
+		tagtable_cells_destroy(cells);
+		return CORPUS_ERROR_NOMEM;
+	}
+
+	memset(cells->tags, TAGTABLE_EMPTY, ncell);
+	cells->mask = ngroup - 1;
+	return 0;
+}
+
+
+void tagtable_cells_destroy(struct corpus_tagtable_cells *cells)
+{
+	corpus_free(cells->items);
+	corpus_free(cells->hashes);
+	corpus_free(cells->tags);
+}
+
+
+void tagtable_cells_add(struct corpus_tagtable_cells *cells, unsigned hash,
+			int item)
+{
+	unsigned empty, group = hash & cells->mask, nprobe = 0;
+	size_t i;
+
+	for (;;) {
+		i = (size_t)group * CORPUS_TAGTABLE_GROUP;
+		empty = tagtable_match(cells->tags + i, TAGTABLE_EMPTY);
+		if (empty) {
+			break;
+		}
+		nprobe++;
+		group = (group + nprobe) & cells->mask;
+	}
+
+	i += tagtable_ctz(empty);
+	cells->tags[i] = tagtable_tag(hash);
+	cells->hashes[i] = hash;
+	cells->items[i] = item;
+}
+
+
+// move the items in the next old groups to the current cells
+void tagtable_move(struct corpus_tagtable *tab, unsigned ngroup)
+{
+	struct corpus_tagtable_cells *old = &tab->old;
+	size_t i, end;
+
+	while (ngroup-- > 0 && tab->old_next <= old->mask) {
+		i = (size_t)tab->old_next * CORPUS_TAGTABLE_GROUP;
+		end = i + CORPUS_TAGTABLE_GROUP;
+
+		for (; i < end; i++) {
+			if (!(old->tags[i] & TAGTABLE_EMPTY)) {
+				tagtable_cells_add(&tab->cells,
+						   old->hashes[i],
+						   old->items[i]);
+				old->tags[i] = TAGTABLE_MOVED;
+			}
+		}
+		tab->old_next++;
+	}
+
+	if (tab->old_next > old->mask) {
+		tagtable_cells_destroy(old);
+		old->tags = NULL;
+		old->hashes = NULL;
+		old->items = NULL;
+		old->mask = 0;
+		tab->old_next = 0;
+		tab->resizing = 0;
+	}
+}
+
+
+/*
+ * Perfect hash tables. With 3 items per bucket on average and 2% more
+ * positions than items, most buckets find a pilot in a few tries; the
+ * buckets get placed largest first, while most positions are still free.
+ * If a bucket does not find a pilot, or has two items with the same hash
+ * code, we start over with a new seed. The seeds come from a fixed
+ * sequence, so that building a table for the same items gives the same
+ * result every time.
+ */
+
+#define PERFHASH_BUCKET_LOAD 3
+#define PERFHASH_SLACK 50
+#define PERFHASH_PILOT_MAX ((uint32_t)1 << 20)
+#define PERFHASH_NSEED 16
+#define PERFHASH_SEED 0x9E3779B97F4A7C15ULL
+
+struct perfhash_work {
+	uint64_t *hashes;	// the hash code for each item
+	int *order;		// the items, sorted by bucket
+	uint32_t *starts;	// the start of each bucket in 'order'
+	uint32_t *buckets;	// the buckets, largest first
+	uint64_t *taken;	// bitmap of taken positions
+	uint32_t *pos;		// the positions for the current bucket
+	uint32_t *counts;	// the number of buckets of each size
+	uint32_t size_max;	// the capacity of 'pos' and 'counts'
+};
+
+static int perfhash_try(struct corpus_perfhash *ph, struct perfhash_work *w,
+			corpus_perfhash_func hash, void *context);
+
+
+static uint32_t perfhash_bucket(uint64_t hash, uint32_t nbucket)
+{
+	return (uint32_t)(((hash >> 32) * nbucket) >> 32);
+}
+
+
+static int perfhash_taken(const uint64_t *bits, uint32_t i)
+{
+	return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+
+void corpus_perfhash_init(struct corpus_perfhash *ph)
+{
+	ph->seed = 0;
+	ph->pilots = NULL;
+	ph->remap = NULL;
+	ph->items = NULL;
+	ph->nbucket = 0;
+	ph->nposition = 0;
+	ph->nitem = 0;
+}
+
+
+void corpus_perfhash_destroy(struct corpus_perfhash *ph)
+{
+	corpus_free(ph->items);
+	corpus_free(ph->remap);
+	corpus_free(ph->pilots);
+}
+
+
+int corpus_perfhash_build(struct corpus_perfhash *ph, int nitem,
+			  corpus_perfhash_func hash, void *context)
+{
+	struct corpus_perfhash next;
+	struct perfhash_work w;
+	uint32_t nbucket, nposition;
+	size_t nword;
+	int err, i;
+
+	assert(nitem >= 0);
+
+	corpus_perfhash_init(&next);
+	memset(&w, 0, sizeof(w));
+
+	if (nitem == 0) {
+		err = 0;
+		goto out;
+	}
+
+	nbucket = (uint32_t)nitem / PERFHASH_BUCKET_LOAD + 1;
+	nposition = (uint32_t)nitem + (uint32_t)nitem / PERFHASH_SLACK + 1;
+	nword = ((size_t)nposition + 63) / 64;
+
+	next.pilots = corpus_malloc((size_t)nbucket * sizeof(*next.pilots));
+	next.remap = corpus_malloc(((size_t)nposition - (size_t)nitem)
+				   * sizeof(*next.remap));
+	next.items = corpus_malloc((size_t)nitem * sizeof(*next.items));
+	w.hashes = corpus_malloc((size_t)nitem * sizeof(*w.hashes));
+	w.order = corpus_malloc((size_t)nitem * sizeof(*w.order));
+	w.starts = corpus_malloc(((size_t)nbucket + 1) * sizeof(*w.starts));
+	w.buckets = corpus_malloc((size_t)nbucket * sizeof(*w.buckets));
+	w.taken = corpus_malloc(nword * sizeof(*w.taken));
+
+	if (!next.pilots || !next.remap || !next.items || !w.hashes
+			|| !w.order || !w.starts || !w.buckets || !w.taken) {
+		err = CORPUS_ERROR_NOMEM;
+		corpus_log(err, "failed allocating perfect hash table");
+		goto out;
+	}
+
+	next.nbucket = nbucket;
+	next.nposition = nposition;
+	next.nitem = nitem;
+
+	err = CORPUS_ERROR_INVAL;
+	for (i = 0; i < PERFHASH_NSEED && err == CORPUS_ERROR_INVAL; i++) {
+		next.seed = corpus_perfhash_mix(PERFHASH_SEED + (uint64_t)i);
+		err = perfhash_try(&next, &w, hash, context);
+	}
+
+	if (err == CORPUS_ERROR_INVAL) {
+		corpus_log(err, "failed building perfect hash table"
+			   " (item keys might not be distinct)");
+	} else if (err) {
+		corpus_log(err, "failed allocating perfect hash table");
+	}
+
+out:
+	corpus_free(w.counts);
+	corpus_free(w.pos);
+	corpus_free(w.taken);
+	corpus_free(w.buckets);
+	corpus_free(w.starts);
+	corpus_free(w.order);
+	corpus_free(w.hashes);
+
+	if (err) {
+		corpus_perfhash_destroy(&next);
+		return err;
+	}
+
+	corpus_perfhash_destroy(ph);
+	*ph = next;
+	return 0;
+}
+
+
+/*
+ * Try building a perfect hash table with the seed in `ph->seed`. Returns
+ * CORPUS_ERROR_INVAL (without logging) if a different seed is needed.
+ */
+int perfhash_try(struct corpus_perfhash *ph, struct perfhash_work *w,
+		 corpus_perfhash_func hash, void *context)
+{
+	const uint32_t n = (uint32_t)ph->nitem;
+	const uint32_t nbucket = ph->nbucket;
+	const uint32_t nposition = ph->nposition;
+	uint64_t h;
+	uint32_t b, i, j, k, p, q, start, size, size_max, next;
+	void *base;
+
+	// hash the items, and count the bucket sizes
+	memset(w->starts, 0, ((size_t)nbucket + 1) * sizeof(*w->starts));
+	for (i = 0; i < n; i++) {
+		h = hash(context, (int)i, ph->seed);
+		w->hashes[i] = h;
+		w->starts[perfhash_bucket(h, nbucket) + 1]++;
+	}
+
+	size_max = 0;
+	for (b = 0; b < nbucket; b++) {
+		if (w->starts[b + 1] > size_max) {
+			size_max = w->starts[b + 1];
+		}
+		w->starts[b + 1] += w->starts[b];
+	}
+
+	if (size_max + 1 > w->size_max) {
+		if (!(base = corpus_realloc(w->pos, ((size_t)size_max + 1)
+					    * sizeof(*w->pos)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		w->pos = base;
+		if (!(base = corpus_realloc(w->counts, ((size_t)size_max + 1)
+					    * sizeof(*w->counts)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		w->counts = base;
+		w->size_max = size_max + 1;
+	}
+
+	// sort the items by bucket, using 'buckets' for the insertion points
+	for (b = 0; b < nbucket; b++) {
+		w->buckets[b] = w->starts[b];
+	}
+	for (i = 0; i < n; i++) {
+		b = perfhash_bucket(w->hashes[i], nbucket);
+		w->order[w->buckets[b]++] = (int)i;
+	}
+
+	// sort the buckets by decreasing size, with a counting sort
+	memset(w->counts, 0, ((size_t)size_max + 1) * sizeof(*w->counts));
+	for (b = 0; b < nbucket; b++) {
+		w->counts[w->starts[b + 1] - w->starts[b]]++;
+	}
+	next = 0;
+	for (size = size_max + 1; size-- > 0; ) {
+		k = w->counts[size];
+		w->counts[size] = next;
+		next += k;
+	}
+	for (b = 0; b < nbucket; b++) {
+		size = w->starts[b + 1] - w->starts[b];
+		w->buckets[w->counts[size]++] = b;
+	}
+
+	// place the buckets, largest first
+	memset(w->taken, 0, (((size_t)nposition + 63) / 64)
+			    * sizeof(*w->taken));
+	memset(ph->pilots, 0, (size_t)nbucket * sizeof(*ph->pilots));
+
+	for (i = 0; i < nbucket; i++) {
+		b = w->buckets[i];
+		start = w->starts[b];
+		size = w->starts[b + 1] - start;
+		if (size == 0) {
+			break;
+		}
+
+		// items with the same hash code cannot get separated
+		for (j = 1; j < size; j++) {
+			h = w->hashes[w->order[start + j]];
+			for (k = 0; k < j; k++) {
+				if (w->hashes[w->order[start + k]] == h) {
+					return CORPUS_ERROR_INVAL;
+				}
+			}
+		}
+
+		for (p = 0; p < PERFHASH_PILOT_MAX; p++) {
+			for (j = 0; j < size; j++) {
+				h = w->hashes[w->order[start + j]];
+				q = corpus_perfhash_position(h, p, nposition);
+				if (perfhash_taken(w->taken, q)) {
+					break;
+				}
+				for (k = 0; k < j && w->pos[k] != q; k++) {
+					// check for a collision in the bucket
+				}
+				if (k < j) {
+					break;
+				}
+				w->pos[j] = q;
+			}
+			if (j == size) {
+				break;
+			}
+		}
+
+		if (p == PERFHASH_PILOT_MAX) {
+			return CORPUS_ERROR_INVAL;
+		}
+
+		ph->pilots[b] = p;
+		for (j = 0; j < size; j++) {
+			q = w->pos[j];
+			w->taken[q / 64] |= (uint64_t)1 << (q % 64);
+		}
+	}
+
+	// send the taken positions past the last slot to the free slots
+	next = 0;
+	for (q = n; q < nposition; q++) {
+		if (perfhash_taken(w->taken, q)) {
+			while (perfhash_taken(w->taken, next)) {
+				next++;
+			}
+			ph->remap[q - n] = next++;
+		} else {
+			ph->remap[q - n] = 0;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		h = w->hashes[i];
+		b = perfhash_bucket(h, nbucket);
+		q = corpus_perfhash_position(h, ph->pilots[b], nposition);
+		if (q >= n) {
+			q = ph->remap[q - n];
+		}
+		ph->items[q] = (int)i;
+	}
+
+	return 0;
+}
@@ -23,6 +23,8 @@
  * Hash table, providing O(1) element access and insertion.
  */
 
+#include <stdint.h>
+
 /** Code for empty table cells. */
 #define CORPUS_TABLE_ITEM_EMPTY (-1)
 
@@ -149,4 +151,261 @@ static inline int corpus_table_probe_advance(struct corpus_table_probe *probe)
 	return (probe->current != CORPUS_TABLE_ITEM_EMPTY);
 }
 
+/** Number of cells in a tagged hash table group. */
+#define CORPUS_TAGTABLE_GROUP 16
+
+/**
+ * Cells for one generation of a tagged hash table. The cells are
+ * arranged in groups of #CORPUS_TAGTABLE_GROUP, and each cell has a
+ * one-byte tag, derived from the hash code of its item; cells also store
+ * the full hash codes, next to the items.
+ */
+struct corpus_tagtable_cells {
+	uint8_t *tags;		/**< the cell tags */
+	unsigned *hashes;	/**< the hash codes of the items in the cells */
+	int *items;		/**< the items in the cells */
+	unsigned mask;		/**< bitwise mask for indexing into the
+				  groups */
+};
+
+/**
+ * Tagged hash table, a variant of #corpus_table that stores the hash
+ * code of each item, along with a one-byte tag for each cell. Probes
+ * check a whole group of tags at once, with SIMD instructions when they
+ * are available, and only report the items with matching hash codes,
+ * so that callers rarely compare keys that are not equal.
+ *
+ * The table resizes incrementally: when it fills up, it allocates new
+ * cells with twice the size, and then moves one group of the old cells
+ * to the new ones with each subsequent insertion. Moving an item uses
+ * its stored hash code, without re-hashing its key. Until the move
+ * finishes, probes search both generations.
+ */
+struct corpus_tagtable {
+	struct corpus_tagtable_cells cells; /**< the current cells */
+	struct corpus_tagtable_cells old;   /**< the old cells, if resizing */
+	unsigned old_next;	/**< the next old group to move */
+	int resizing;		/**< whether the old cells have items */
+	int count;		/**< the number of items */
+	int capacity;		/**< the maximum number of items before the
+				  table needs to grow */
+};
+
+/**
+ * Tagged hash table probe, for looking up items by their hash value.
+ */
+struct corpus_tagtable_probe {
+	const struct corpus_tagtable *table; /**< the underlying table */
+	const struct corpus_tagtable_cells *cells; /**< the current
+						     generation */
+	unsigned hash;		/**< the hash value */
+	unsigned group;		/**< the current group */
+	unsigned nprobe;	/**< number of groups searched in the
+				  current generation */
+	unsigned match;		/**< bit mask of the unchecked matching
+				  cells in the current group */
+	int last;		/**< whether the current group is the last one
+				  in the probe sequence for the generation */
+	int current;		/**< current item in the probe sequence */
+};
+
+/**
+ * Initialize a new tagged hash table.
+ *
+ * \param tab the table
+ *
+ * \returns 0 on success
+ */
+int corpus_tagtable_init(struct corpus_tagtable *tab);
+
+/**
+ * Release a tagged hash table's resources.
+ *
+ * \param tab the table
+ */
+void corpus_tagtable_destroy(struct corpus_tagtable *tab);
+
+/**
+ * Remove all items from a tagged hash table.
+ *
+ * \param tab the table
+ */
+void corpus_tagtable_clear(struct corpus_tagtable *tab);
+
+/**
+ * Ensure that a tagged hash table has room for more items, starting an
+ * incremental resize if necessary.
+ *
+ * \param tab the table
+ * \param nadd the number of items to make room for
+ *
+ * \returns 0 on success; nonzero on failure, in which case the table is
+ * 	left unchanged
+ */
+int corpus_tagtable_grow(struct corpus_tagtable *tab, int nadd);
+
+/**
+ * Associate an item with the given hash code.
+ *
+ * \param tab a table with room for at least one more item
+ * \param hash the hash code
+ * \param item a non-negative item
+ */
+void corpus_tagtable_add(struct corpus_tagtable *tab, unsigned hash,
+			 int item);
+
+/**
+ * Start a new tagged hash table probe at the given hash code.
+ *
+ * \param probe the new probe
+ * \param tab the hash table
+ * \param hash the hash code
+ */
+void corpus_tagtable_probe_make(struct corpus_tagtable_probe *probe,
+				const struct corpus_tagtable *tab,
+				unsigned hash);
+
+/**
+ * Advance a probe to the next item with a matching hash code.
+ *
+ * \param probe the probe
+ *
+ * \returns zero if no more items match, in which case `probe->current`
+ * 	is invalid; nonzero otherwise
+ */
+int corpus_tagtable_probe_advance(struct corpus_tagtable_probe *probe);
+
+/**
+ * Hash function for building a perfect hash table.
+ *
+ * \param context the function context
+ * \param item the item
+ * \param seed the seed
+ *
+ * \returns the hash code for the item's key, computed with the seed;
+ * 	different seeds should give independent hash codes
+ */
+typedef uint64_t (*corpus_perfhash_func)(void *context, int item,
+					 uint64_t seed);
+
+/**
+ * Minimal perfect hash table, mapping each item in a fixed set to its
+ * own slot. A lookup computes the slot for a hash code directly, with a
+ * single probe and no comparisons; callers must check that the key for
+ * the item in the slot matches, since keys outside the set map to
+ * arbitrary slots. The table is immutable once built, so any number of
+ * threads can use it without locks.
+ *
+ * The construction follows PTHash (Pibiri and Trani, 2021): items get
+ * split into buckets by hash code, and each bucket gets a "pilot" value,
+ * found by trial, that sends its items to free positions. There are a
+ * few more positions than items; the ones past the last slot get
+ * remapped to the slots left free. The table takes about 5.5 bytes per
+ * item.
+ */
+struct corpus_perfhash {
+	uint64_t seed;		/**< the seed for the item hash codes */
+	uint32_t *pilots;	/**< the pilot for each bucket */
+	uint32_t *remap;	/**< the slot for each position past the last
+				  slot */
+	int *items;		/**< the item in each slot */
+	uint32_t nbucket;	/**< the number of buckets */
+	uint32_t nposition;	/**< the number of positions */
+	int nitem;		/**< the number of items and slots */
+};
+
+/**
+ * Initialize an empty perfect hash table.
+ *
+ * \param ph the table
+ */
+void corpus_perfhash_init(struct corpus_perfhash *ph);
+
+/**
+ * Release a perfect hash table's resources.
+ *
+ * \param ph the table
+ */
+void corpus_perfhash_destroy(struct corpus_perfhash *ph);
+
+/**
+ * Build a perfect hash table for a set of items, replacing the table's
+ * current contents. The items' keys must be distinct. The hash function
+ * gets called a few times for each item, with the same seed each time
+ * unless the construction needs to start over; the seed that works gets
+ * stored in the table, for computing the hash codes of lookup keys.
+ *
+ * \param ph the table
+ * \param nitem the number of items, numbered from 0 to `nitem - 1`
+ * \param hash the hash function
+ * \param context the hash function context
+ *
+ * \returns 0 on success; nonzero on failure, in which case the table is
+ * 	left unchanged
+ */
+int corpus_perfhash_build(struct corpus_perfhash *ph, int nitem,
+			  corpus_perfhash_func hash, void *context);
+
+/**
+ * Mix the bits of a 64-bit value, so that each input bit affects each
+ * output bit. This is the finalizer from MurmurHash3.
+ *
+ * \param x the value
+ *
+ * \returns the mixed value
+ */
+static inline uint64_t corpus_perfhash_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * Get the position for a hash code, given the pilot for its bucket.
+ *
+ * \param hash the hash code
+ * \param pilot the pilot
+ * \param nposition the number of positions
+ *
+ * \returns the position, in `[0, nposition)`
+ */
+static inline uint32_t corpus_perfhash_position(uint64_t hash,
+						uint32_t pilot,
+						uint32_t nposition)
+{
+	uint64_t x = corpus_perfhash_mix(hash ^ corpus_perfhash_mix(pilot));
+	return (uint32_t)(((x >> 32) * nposition) >> 32);
+}
+
+/**
+ * Get the item in the slot for a hash code.
+ *
+ * \param ph the table
+ * \param hash the hash code of the key, computed with `ph->seed`
+ *
+ * \returns the item in the slot for the hash code, or
+ * 	#CORPUS_TABLE_ITEM_EMPTY if the table is empty
+ */
+static inline int corpus_perfhash_get(const struct corpus_perfhash *ph,
+				      uint64_t hash)
+{
+	uint32_t bucket, pos;
+
+	if (ph->nitem == 0) {
+		return CORPUS_TABLE_ITEM_EMPTY;
+	}
+
+	bucket = (uint32_t)(((hash >> 32) * ph->nbucket) >> 32);
+	pos = corpus_perfhash_position(hash, ph->pilots[bucket],
+				       ph->nposition);
+	if (pos >= (uint32_t)ph->nitem) {
+		pos = ph->remap[pos - (uint32_t)ph->nitem];
+	}
+	return ph->items[pos];
+}
+
 #endif /* CORPUS_TABLE_H */
@@ -0,0 +1,444 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for utimensat
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "../lib/utf8lite/src/utf8lite.h"
+#include "../src/error.h"
+#include "../src/table.h"
+#include "../src/textset.h"
+#include "../src/stem.h"
+#include "../src/symtab.h"
+#include "../src/datatype.h"
+#include "../src/data.h"
+#include "../src/filebuf.h"
+#include "../src/colfile.h"
+#include "testutil.h"
+
+#define FILE_NAME "check_colfile.tmp"
+#define COLFILE_NAME FILE_NAME CORPUS_COLFILE_EXT
+
+struct corpus_colfile cf;
+int has_cf;
+
+
+void ignore_message(int code, const char *message)
+{
+	(void)code;
+	(void)message;
+}
+
+
+void setup_colfile(void)
+{
+	setup();
+	has_cf = 0;
+}
+
+
+void teardown_colfile(void)
+{
+	if (has_cf) {
+		corpus_colfile_destroy(&cf);
+		has_cf = 0;
+	}
+	remove(FILE_NAME);
+	remove(COLFILE_NAME);
+	teardown();
+	corpus_log_func = NULL;
+}
+
+
+void write_file(const char *contents)
+{
+	FILE *file;
+	size_t size = strlen(contents);
+
+	file = fopen(FILE_NAME, "wb");
+	ck_assert(file != NULL);
+	ck_assert(fwrite(contents, 1, size, file) == size);
+	ck_assert(!fclose(file));
+}
+
+
+void compile(const char *contents)
+{
+	ck_assert(!has_cf);
+
+	write_file(contents);
+	ck_assert(!corpus_colfile_write(FILE_NAME));
+	ck_assert(!corpus_colfile_init(&cf, FILE_NAME));
+	has_cf = 1;
+}
+
+
+int column(const char *name)
+{
+	int col = corpus_colfile_column(&cf, S(name));
+	ck_assert(col >= 0);
+	return col;
+}
+
+
+// check a text value against the result of parsing the raw string
+void check_text(int col, uint64_t row, const char *raw)
+{
+	struct utf8lite_text text, expect;
+
+	ck_assert(!corpus_colfile_text(&cf, col, row, &text));
+	ck_assert(!utf8lite_text_assign(&expect, (const uint8_t *)raw,
+					strlen(raw),
+					UTF8LITE_TEXT_UNESCAPE, NULL));
+	ck_assert_uint_eq(UTF8LITE_TEXT_SIZE(&text),
+			  UTF8LITE_TEXT_SIZE(&expect));
+	ck_assert(memcmp(text.ptr, raw, strlen(raw)) == 0);
+	ck_assert_uint_eq(text.attr, expect.attr);
+}
+
+
+START_TEST(test_types)
+{
+	int a, b, c, d, e, val;
+	double dval;
+
+	compile("{\"a\": 1, \"b\": \"x\", \"c\": true, \"d\": 1.5,"
+		" \"e\": [1]}\n"
+		"{\"e\": null, \"d\": 2, \"c\": false, \"b\": \"y\","
+		" \"a\": -7}\n"
+		"{\"a\": null}\n"
+		"null\n");
+
+	ck_assert_uint_eq(cf.nrow, 4);
+	ck_assert_int_eq(cf.ncolumn, 5);
+
+	a = column("a");
+	b = column("b");
+	c = column("c");
+	d = column("d");
+	e = column("e");
+	ck_assert(corpus_colfile_column(&cf, S("f")) < 0);
+
+	ck_assert_int_eq(cf.columns[a].type, CORPUS_DATATYPE_INTEGER);
+	ck_assert_int_eq(cf.columns[b].type, CORPUS_DATATYPE_TEXT);
+	ck_assert_int_eq(cf.columns[c].type, CORPUS_DATATYPE_BOOLEAN);
+	ck_assert_int_eq(cf.columns[d].type, CORPUS_DATATYPE_REAL);
+	ck_assert_int_eq(cf.columns[e].type, CORPUS_DATATYPE_ANY);
+
+	ck_assert(!corpus_colfile_int(&cf, a, 0, &val));
+	ck_assert_int_eq(val, 1);
+	ck_assert(!corpus_colfile_int(&cf, a, 1, &val));
+	ck_assert_int_eq(val, -7);
+	ck_assert(!corpus_colfile_double(&cf, a, 1, &dval));
+	ck_assert(dval == -7.0);
+	ck_assert(corpus_colfile_int(&cf, a, 2, &val)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert(corpus_colfile_is_null(&cf, a, 2));
+	ck_assert(corpus_colfile_is_null(&cf, a, 3));
+
+	check_text(b, 0, "x");
+	check_text(b, 1, "y");
+	ck_assert(corpus_colfile_text(&cf, b, 2, NULL) == CORPUS_ERROR_INVAL);
+
+	ck_assert(!corpus_colfile_bool(&cf, c, 0, &val));
+	ck_assert_int_eq(val, 1);
+	ck_assert(!corpus_colfile_bool(&cf, c, 1, &val));
+	ck_assert_int_eq(val, 0);
+
+	ck_assert(!corpus_colfile_double(&cf, d, 0, &dval));
+	ck_assert(dval == 1.5);
+	ck_assert(!corpus_colfile_double(&cf, d, 1, &dval));
+	ck_assert(dval == 2.0);
+	ck_assert(corpus_colfile_int(&cf, d, 0, NULL) == CORPUS_ERROR_INVAL);
+
+	ck_assert(!corpus_colfile_is_null(&cf, e, 0));
+	ck_assert(corpus_colfile_is_null(&cf, e, 1));
+}
+END_TEST
+
+
+START_TEST(test_text)
+{
+	int col;
+
+	compile("{\"t\": \"plain\"}\n"
+		"{\"t\": \"caf\xC3\xA9\"}\n"
+		"{\"t\": \"a \\\"quote\\\"\"}\n"
+		"{\"t\": \"caf\\u00e9\"}\n"
+		"{\"t\": \"\"}\n"
+		"{}\n");
+
+	col = column("t");
+	check_text(col, 0, "plain");
+	check_text(col, 1, "caf\xC3\xA9");
+	check_text(col, 2, "a \\\"quote\\\"");
+	check_text(col, 3, "caf\\u00e9");
+	check_text(col, 4, "");
+	ck_assert(corpus_colfile_is_null(&cf, col, 5));
+}
+END_TEST
+
+
+START_TEST(test_data)
+{
+	struct corpus_schema schema;
+	struct corpus_data val;
+	struct utf8lite_text text;
+	int b, t, e, n, ival;
+
+	compile("{\"t\": \"caf\\u00e9\", \"b\": false, \"e\": [1, 2],"
+		" \"n\": 3}\n"
+		"{\"t\": null, \"e\": {\"x\": 1}}\n");
+	ck_assert(!corpus_schema_init(&schema));
+
+	t = column("t");
+	ck_assert(!corpus_colfile_data(&cf, &schema, t, 0, &val));
+	ck_assert_int_eq(val.type_id, CORPUS_DATATYPE_TEXT);
+	ck_assert(!corpus_data_text(&val, &text));
+	assert_text_eq(&text, T("caf\xC3\xA9"));
+	ck_assert(!corpus_colfile_data(&cf, &schema, t, 1, &val));
+	ck_assert_int_eq(val.type_id, CORPUS_DATATYPE_NULL);
+
+	b = column("b");
+	ck_assert(!corpus_colfile_data(&cf, &schema, b, 0, &val));
+	ck_assert(!corpus_data_bool(&val, &ival));
+	ck_assert_int_eq(ival, 0);
+
+	e = column("e");
+	ck_assert(!corpus_colfile_data(&cf, &schema, e, 0, &val));
+	ck_assert(!corpus_data_nitem(&val, &schema, &ival));
+	ck_assert_int_eq(ival, 2);
+	ck_assert(!corpus_colfile_data(&cf, &schema, e, 1, &val));
+	ck_assert(!corpus_data_nfield(&val, &schema, &ival));
+	ck_assert_int_eq(ival, 1);
+
+	n = column("n");
+	ck_assert(corpus_colfile_data(&cf, &schema, n, 0, &val)
+		  == CORPUS_ERROR_INVAL);
+
+	corpus_schema_destroy(&schema);
+}
+END_TEST
+
+
+START_TEST(test_big_integer)
+{
+	int col, val;
+	double dval;
+
+	compile("{\"a\": 3000000000}\n"
+		"{\"a\": 100000000000000000000}\n"
+		"{\"a\": -2}\n");
+
+	// values that overflow 64 bits make the column real
+	col = column("a");
+	ck_assert_int_eq(cf.columns[col].type, CORPUS_DATATYPE_REAL);
+	ck_assert(!corpus_colfile_double(&cf, col, 0, &dval));
+	ck_assert(dval == 3e9);
+	ck_assert(!corpus_colfile_double(&cf, col, 1, &dval));
+	ck_assert(dval == 1e20);
+	ck_assert(!corpus_colfile_double(&cf, col, 2, &dval));
+	ck_assert(dval == -2.0);
+	ck_assert(corpus_colfile_int(&cf, col, 0, &val) == CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+START_TEST(test_int_range)
+{
+	int col, val;
+
+	compile("{\"a\": 3000000000}\n{\"a\": -3000000000}\n");
+
+	col = column("a");
+	ck_assert_int_eq(cf.columns[col].type, CORPUS_DATATYPE_INTEGER);
+	ck_assert(corpus_colfile_int(&cf, col, 0, &val) == CORPUS_ERROR_RANGE);
+	ck_assert_int_eq(val, INT_MAX);
+	ck_assert(corpus_colfile_int(&cf, col, 1, &val) == CORPUS_ERROR_RANGE);
+	ck_assert_int_eq(val, INT_MIN);
+}
+END_TEST
+
+
+START_TEST(test_empty)
+{
+	compile("");
+	ck_assert_uint_eq(cf.nrow, 0);
+	ck_assert_int_eq(cf.ncolumn, 0);
+}
+END_TEST
+
+
+START_TEST(test_stale)
+{
+	compile("{\"a\": 1}\n");
+	corpus_colfile_destroy(&cf);
+	has_cf = 0;
+
+	// changing the file invalidates the columns
+	write_file("{\"a\": 1}\n{\"a\": 2}\n");
+	ck_assert(corpus_colfile_init(&cf, FILE_NAME) == CORPUS_ERROR_INVAL);
+
+	// so does a missing file
+	remove(COLFILE_NAME);
+	ck_assert(corpus_colfile_init(&cf, FILE_NAME) == CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+// set the data file's access and modification times
+void set_times(long nsec)
+{
+	struct timespec times[2];
+
+	times[0].tv_sec = 1000000000;
+	times[0].tv_nsec = nsec;
+	times[1] = times[0];
+	ck_assert(!utimensat(AT_FDCWD, FILE_NAME, times, 0));
+}
+
+
+START_TEST(test_stale_same_second)
+{
+	write_file("{\"a\": \"x\"}\n");
+	set_times(100000000);
+	ck_assert(!corpus_colfile_write(FILE_NAME));
+
+	// rewriting the file with the same size in the same second
+	// invalidates the columns
+	write_file("{\"a\": \"y\"}\n");
+	set_times(200000000);
+	ck_assert(corpus_colfile_init(&cf, FILE_NAME) == CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+START_TEST(test_recompile_open)
+{
+	compile("{\"a\": \"x\"}\n");
+
+	// recompiling leaves the open columns readable
+	write_file("{\"a\": \"yz\"}\n{\"a\": \"w\"}\n");
+	ck_assert(!corpus_colfile_write(FILE_NAME));
+	ck_assert_uint_eq(cf.nrow, 1);
+	check_text(column("a"), 0, "x");
+	corpus_colfile_destroy(&cf);
+	has_cf = 0;
+
+	ck_assert(!corpus_colfile_init(&cf, FILE_NAME));
+	has_cf = 1;
+	ck_assert_uint_eq(cf.nrow, 2);
+	check_text(column("a"), 0, "yz");
+	check_text(column("a"), 1, "w");
+}
+END_TEST
+
+
+START_TEST(test_corrupt)
+{
+	FILE *file;
+	char *data;
+	long size;
+
+	compile("{\"a\": \"x\"}\n{\"a\": \"yz\"}\n");
+	corpus_colfile_destroy(&cf);
+	has_cf = 0;
+
+	file = fopen(COLFILE_NAME, "rb");
+	ck_assert(file != NULL);
+	ck_assert(!fseek(file, 0, SEEK_END));
+	size = ftell(file);
+	ck_assert(size > 0);
+	ck_assert(!fseek(file, 0, SEEK_SET));
+	data = alloc((size_t)size);
+	ck_assert(fread(data, 1, (size_t)size, file) == (size_t)size);
+	ck_assert(!fclose(file));
+
+	// a truncated column file gets ignored
+	file = fopen(COLFILE_NAME, "wb");
+	ck_assert(file != NULL);
+	ck_assert(fwrite(data, 1, (size_t)size - 8, file)
+		  == (size_t)size - 8);
+	ck_assert(!fclose(file));
+	ck_assert(corpus_colfile_init(&cf, FILE_NAME) == CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+START_TEST(test_not_records)
+{
+	corpus_log_func = ignore_message;
+
+	write_file("{\"a\": 1}\n\"text\"\n");
+	ck_assert(corpus_colfile_write(FILE_NAME) == CORPUS_ERROR_INVAL);
+	ck_assert(corpus_colfile_write("-") == CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+Suite *colfile_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("colfile");
+
+	tc = tcase_create("read");
+	tcase_add_checked_fixture(tc, setup_colfile, teardown_colfile);
+	tcase_add_test(tc, test_types);
+	tcase_add_test(tc, test_text);
+	tcase_add_test(tc, test_data);
+	tcase_add_test(tc, test_big_integer);
+	tcase_add_test(tc, test_int_range);
+	tcase_add_test(tc, test_empty);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("validate");
+	tcase_add_checked_fixture(tc, setup_colfile, teardown_colfile);
+	tcase_add_test(tc, test_stale);
+	tcase_add_test(tc, test_stale_same_second);
+	tcase_add_test(tc, test_recompile_open);
+	tcase_add_test(tc, test_corrupt);
+	tcase_add_test(tc, test_not_records);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = colfile_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -34,6 +34,7 @@
 
 
 struct corpus_schema schema;
+struct corpus_data_projection proj;
 
 const int Null = CORPUS_DATATYPE_NULL;
 const int Boolean = CORPUS_DATATYPE_BOOLEAN;
@@ -497,6 +498,46 @@ START_TEST(test_decode_subnormal)
 END_TEST
 
 
+START_TEST(test_decode_short)
+{
+	char buf[64];
+	double x;
+	int i, j, k;
+
+	ck_assert(decode_int("12345678") == 12345678);
+	ck_assert(decode_int("-1234567890") == -1234567890);
+	ck_assert(decode_int("000000000000000000000000042") == 42);
+	ck_assert(decode_int("100000000") == 100000000);
+	ck_assert(decode_int("999999999999999999") == INT_MAX);
+	ck_assert(decode_int("-999999999999999999") == INT_MIN);
+
+	ck_assert(decode_double("0.1") == 0.1);
+	ck_assert(decode_double("-2.5e-3") == -2.5e-3);
+	ck_assert(decode_double("1.") == 1);
+	ck_assert(decode_double(".5") == 0.5);
+	ck_assert(decode_double("9007199254740993") == 9007199254740993.0);
+	ck_assert(decode_double("1e22") == 1e22);
+	ck_assert(decode_double("1e23") == 1e23);
+	ck_assert(decode_double("12345678.12345678") == 12345678.12345678);
+
+	// short decimals agree with strtod
+	for (i = 0; i < 2000; i++) {
+		x = (double)(i * 7919 % 100003) / (double)(i + 1);
+		for (j = 0; j < 18; j++) {
+			for (k = -1; k <= 1; k += 2) {
+				snprintf(buf, sizeof(buf), "%.*g", j + 1, k * x);
+				ck_assert(decode_double(buf)
+					  == strtod(buf, NULL));
+				snprintf(buf, sizeof(buf), "%.*e", j, k * x);
+				ck_assert(decode_double(buf)
+					  == strtod(buf, NULL));
+			}
+		}
+	}
+}
+END_TEST
+
+
 START_TEST(test_decode_nonfinite)
 {
 	ck_assert(decode_double("Infinity") == INFINITY);
@@ -515,6 +556,71 @@ START_TEST(test_valid_text)
 END_TEST
 
 
+/*
+ * Check that the text from a data value matches what a second pass over
+ * the raw bytes gives, attributes included.
+ */
+void assert_text_same(const struct corpus_data *d)
+{
+	struct utf8lite_text text, expect;
+
+	ck_assert(!corpus_data_text(d, &text));
+	ck_assert(!utf8lite_text_assign(&expect, d->ptr + 1, d->size - 2,
+					UTF8LITE_TEXT_VALID
+					| UTF8LITE_TEXT_UNESCAPE, NULL));
+	ck_assert(text.ptr == expect.ptr);
+	ck_assert_uint_eq(text.attr, expect.attr);
+}
+
+
+START_TEST(test_decode_text)
+{
+	const char *strs[] = {
+		"\"hello\"",
+		"\"\"",
+		"\"caf\xC3\xA9\"",
+		"\"a \\\"quote\\\"\"",
+		"\"caf\\u00e9\"",
+		"\"long enough to span a whole vector \xE2\x98\x83\""
+	};
+	struct corpus_data val, item, field;
+	struct corpus_data_items items;
+	struct corpus_data_fields fields;
+	char buf[256];
+	size_t i, n = sizeof(strs) / sizeof(strs[0]);
+
+	for (i = 0; i < n; i++) {
+		ck_assert(!corpus_data_assign(&val, &schema,
+					      (const uint8_t *)strs[i],
+					      strlen(strs[i])));
+		assert_text_same(&val);
+
+		sprintf(buf, "[%s]", strs[i]);
+		ck_assert(!corpus_data_assign(&val, &schema,
+					      (const uint8_t *)buf,
+					      strlen(buf)));
+		ck_assert(!corpus_data_items(&val, &schema, &items));
+		ck_assert(corpus_data_items_advance(&items));
+		item = items.current;
+		assert_text_same(&item);
+
+		sprintf(buf, "{\"x\": 1, \"t\": %s}", strs[i]);
+		ck_assert(!corpus_data_assign(&val, &schema,
+					      (const uint8_t *)buf,
+					      strlen(buf)));
+		ck_assert(!corpus_data_field(&val, &schema, get_name("t"),
+					     &field));
+		assert_text_same(&field);
+
+		ck_assert(!corpus_data_fields(&val, &schema, &fields));
+		ck_assert(corpus_data_fields_advance(&fields));
+		ck_assert(corpus_data_fields_advance(&fields));
+		assert_text_same(&fields.current);
+	}
+}
+END_TEST
+
+
 START_TEST(test_invalid_text)
 {
 	corpus_log_func = ignore_message;
@@ -591,6 +697,60 @@ START_TEST(test_decode_record_array)
 END_TEST
 
 
+START_TEST(test_array_view)
+{
+	const char *json[] = { "[1, \"a\", [2], null, {\"x\": true}]",
+			       "[ ]", "[3.5,4.5]", "null", "\"text\"" };
+	struct corpus_data val, item;
+	struct corpus_data_items items;
+	struct corpus_data_array arr;
+	int i, k, nitem;
+
+	corpus_data_array_init(&arr);
+
+	for (k = 0; k < 3; k++) {
+		ck_assert(!corpus_data_assign(&val, &schema,
+					      (const uint8_t *)json[k],
+					      strlen(json[k])));
+		ck_assert(!corpus_data_array_assign(&arr, &val, &schema));
+		ck_assert(!corpus_data_nitem(&val, &schema, &nitem));
+		ck_assert_int_eq(arr.length, nitem);
+
+		// the items should match the ones from iterating
+		ck_assert(!corpus_data_items(&val, &schema, &items));
+		i = 0;
+		while (corpus_data_items_advance(&items)) {
+			ck_assert(!corpus_data_array_item(&arr, i, &item));
+			ck_assert(item.ptr == items.current.ptr);
+			ck_assert_int_eq(item.size, items.current.size);
+			ck_assert_int_eq(item.type_id, items.current.type_id);
+			i++;
+		}
+		ck_assert_int_eq(i, nitem);
+	}
+
+	// out of range
+	ck_assert(corpus_data_array_item(&arr, -1, &item)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert(corpus_data_array_item(&arr, 2, &item)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert(item.type_id == CORPUS_DATATYPE_NULL);
+
+	// not arrays
+	for (k = 3; k < 5; k++) {
+		ck_assert(!corpus_data_assign(&val, &schema,
+					      (const uint8_t *)json[k],
+					      strlen(json[k])));
+		ck_assert(corpus_data_array_assign(&arr, &val, &schema)
+			  == CORPUS_ERROR_INVAL);
+		ck_assert_int_eq(arr.length, 0);
+	}
+
+	corpus_data_array_destroy(&arr);
+}
+END_TEST
+
+
 START_TEST(test_valid_record)
 {
 	ck_assert(get_type("{}") == Record(0));
@@ -627,6 +787,115 @@ START_TEST(test_nested_record)
 END_TEST
 
 
+START_TEST(test_repeated_record)
+{
+	int i;
+
+	// the second time through, the records match cached shapes
+	for (i = 0; i < 2; i++) {
+		ck_assert(get_type("{\"y\":false, \"x\":1}")
+			  == Record(2, "x", Integer, "y", Boolean));
+		ck_assert(get_type("{\"y\":false, \"x\":1.5}")
+			  == Record(2, "x", Real, "y", Boolean));
+		ck_assert(get_type("{\"y\":false}")
+			  == Record(1, "y", Boolean));
+		ck_assert(get_type("{\"y\":false, \"xx\":1}")
+			  == Record(2, "xx", Integer, "y", Boolean));
+		ck_assert(get_type("{\"\\u0079\":false, \"x\":1}")
+			  == Record(2, "x", Integer, "y", Boolean));
+		ck_assert(get_type("{\"y\":{\"y\":{}, \"x\":2}, \"x\":1}")
+			  == Record(2, "x", Integer, "y",
+				    Record(2, "x", Integer, "y", Record(0))));
+	}
+}
+END_TEST
+
+
+// get a record field, treating the input as having the given type
+const char *get_field(const char *name, const char *str, int type_id)
+{
+	struct corpus_data data, val;
+	char *res;
+
+	ck_assert(!corpus_data_assign(&data, &schema, (const uint8_t *)str,
+				      strlen(str)));
+	data.type_id = type_id;
+	if (corpus_data_field(&data, &schema, get_name(name), &val)) {
+		return NULL;
+	}
+
+	res = alloc(val.size + 1);
+	memcpy(res, val.ptr, val.size);
+	res[val.size] = '\0';
+	return res;
+}
+
+
+// list the names of the fields in a record, in input order
+const char *list_fields(const char *str)
+{
+	struct corpus_data data;
+	struct corpus_data_fields it;
+	const struct utf8lite_text *name;
+	char *res = alloc(strlen(str) + 1);
+	size_t n = 0;
+
+	ck_assert(!corpus_data_assign(&data, &schema, (const uint8_t *)str,
+				      strlen(str)));
+	ck_assert(!corpus_data_fields(&data, &schema, &it));
+	while (corpus_data_fields_advance(&it)) {
+		name = &schema.names.types[it.name_id].text;
+		memcpy(res + n, name->ptr, UTF8LITE_TEXT_SIZE(name));
+		n += UTF8LITE_TEXT_SIZE(name);
+		res[n++] = ',';
+	}
+	res[n] = '\0';
+	return res;
+}
+
+
+START_TEST(test_field_order)
+{
+	const char *str1 = "{\"a\":1, \"b\":2, \"c\":3}";
+	const char *str2 = "{\"c\":4, \"a\":5, \"b\":6}";
+	const char *str3 = "{\"b\":7, \"\\u0063\":8, \"a\":9}";
+	int id = get_type(str1);
+	int i;
+
+	// the predicted positions change as the field order changes
+	for (i = 0; i < 2; i++) {
+		ck_assert_str_eq(get_field("c", str1, id), "3");
+		ck_assert_str_eq(get_field("a", str1, id), "1");
+		ck_assert_str_eq(get_field("c", str2, id), "4");
+		ck_assert_str_eq(get_field("b", str2, id), "6");
+		ck_assert_str_eq(get_field("c", str3, id), "8");
+		ck_assert_str_eq(get_field("a", str3, id), "9");
+
+		ck_assert_str_eq(list_fields(str1), "a,b,c,");
+		ck_assert_str_eq(list_fields(str2), "c,a,b,");
+		ck_assert_str_eq(list_fields(str3), "b,c,a,");
+	}
+}
+END_TEST
+
+
+START_TEST(test_field_subset)
+{
+	const char *str1 = "{\"a\":1, \"b\":2}";
+	const char *str2 = "{\"b\":3, \"c\":4}";
+	int id = Union(get_type(str1), get_type(str2));
+
+	// records of a supertype can be missing fields
+	ck_assert_str_eq(get_field("b", str1, id), "2");
+	ck_assert_str_eq(get_field("b", str2, id), "3");
+	ck_assert_str_eq(get_field("c", str2, id), "4");
+	ck_assert(get_field("c", str1, id) == NULL);
+	ck_assert(get_field("a", str2, id) == NULL);
+	ck_assert_str_eq(get_field("a", str1, id), "1");
+}
+END_TEST
+
+
 START_TEST(test_invalid_record)
 {
 	corpus_log_func = ignore_message;
@@ -635,6 +904,294 @@ START_TEST(test_invalid_record)
 	ck_assert(is_error("{ \"a\":1, }"));
 	ck_assert(is_error("{ \"x\":,\"y\":null }"));
 	ck_assert(is_error("{ \"1\":\"duplicate\", \"1\":\"duplicate\" }"));
+	ck_assert(is_error("{ \"1\":\"duplicate\", \"1\":\"duplicate\" }"));
+	ck_assert(is_error("{ \"1\":\"duplicate\", \"2\": }"));
+}
+END_TEST
+
+
+// get a field with an accessor, checking that the result agrees with
+// corpus_data_assign followed by corpus_data_field
+const char *access_field(const char *name, const char *str)
+{
+	struct corpus_data_accessor a;
+	struct corpus_data data, val, val2;
+	size_t n = strlen(str);
+	char *res;
+
+	ck_assert(!corpus_data_accessor_init(&a, &schema, S(name)));
+	ck_assert(!corpus_data_access(&a, &schema, (const uint8_t *)str, n,
+				      &val));
+
+	ck_assert(!corpus_data_assign(&data, &schema, (const uint8_t *)str,
+				      n));
+	if (corpus_data_field(&data, &schema, a.name_id, &val2)) {
+		ck_assert_int_eq(val.type_id, Null);
+		ck_assert(val.ptr == NULL);
+		return NULL;
+	}
+	ck_assert_int_eq(val.type_id, val2.type_id);
+	ck_assert(val.ptr == val2.ptr);
+	ck_assert_uint_eq(val.size, val2.size);
+
+	res = alloc(val.size + 1);
+	memcpy(res, val.ptr, val.size);
+	res[val.size] = '\0';
+	return res;
+}
+
+
+int access_error(const char *name, const char *str)
+{
+	struct corpus_data_accessor a;
+	struct corpus_data val;
+	int err;
+
+	ck_assert(!corpus_data_accessor_init(&a, &schema, S(name)));
+	err = corpus_data_access(&a, &schema, (const uint8_t *)str,
+				 strlen(str), &val);
+	ck_assert(err == CORPUS_ERROR_INVAL || err == 0);
+	return (err != 0);
+}
+
+
+START_TEST(test_access_field)
+{
+	ck_assert_str_eq(access_field("a", "{\"a\": 1}"), "1");
+	ck_assert_str_eq(access_field("b", "{\"a\": [1, {\"b\": 2}],"
+				      " \"b\" : \"x\\\"y\" }"),
+			 "\"x\\\"y\"");
+	ck_assert_str_eq(access_field("c", " {\"a\":{}, \"b\":[],"
+				      "\"c\":{\"d\":[true]}}\n"),
+			 "{\"d\":[true]}");
+	ck_assert_str_eq(access_field("x", "{\"x\":-1.5e3}"), "-1.5e3");
+	ck_assert_str_eq(access_field("x", "{\"x\":null}"), "null");
+	ck_assert(access_field("x", "{\"xx\":1, \"y\":2}") == NULL);
+	ck_assert(access_field("x", "{}") == NULL);
+	ck_assert(access_field("x", "\"x\"") == NULL);
+	ck_assert(access_field("x", "[{\"x\":1}]") == NULL);
+	ck_assert(access_field("x", "null") == NULL);
+	ck_assert(access_field("x", "") == NULL);
+}
+END_TEST
+
+
+START_TEST(test_access_escaped)
+{
+	ck_assert_str_eq(access_field("text", "{\"te\\u0078t\":true}"),
+			 "true");
+	ck_assert_str_eq(access_field("\xC3\xA9", "{\"\\u00e9\":1}"), "1");
+	ck_assert_str_eq(access_field("\xC3\xA9", "{\"\xC3\xA9\":2}"), "2");
+	ck_assert(access_field("\xC3\xA9", "{\"e\":3}") == NULL);
+}
+END_TEST
+
+
+START_TEST(test_access_invalid)
+{
+	corpus_log_func = ignore_message;
+
+	ck_assert(access_error("a", "{"));
+	ck_assert(access_error("a", "{\"a\""));
+	ck_assert(access_error("a", "{\"a\" 1}"));
+	ck_assert(access_error("a", "{\"a\": }"));
+	ck_assert(access_error("a", "{\"a\": tru}"));
+	ck_assert(access_error("a", "{\"b\": [1, 2}"));
+	ck_assert(access_error("a", "{\"b\": \"x}"));
+	ck_assert(access_error("a", "{\"b\": 1 \"a\": 2}"));
+	ck_assert(access_error("a", "{1: 2}"));
+
+	// fields after the requested one do not get checked
+	ck_assert(!access_error("a", "{\"a\": 1, \"b\": ]"));
+}
+END_TEST
+
+
+void setup_project(void)
+{
+	setup_data();
+	corpus_data_projection_init(&proj);
+}
+
+
+void teardown_project(void)
+{
+	corpus_data_projection_destroy(&proj);
+	teardown_data();
+}
+
+
+int add_path(const char *path)
+{
+	int id;
+	ck_assert(!corpus_data_projection_add(&proj, &schema, S(path), &id));
+	ck_assert(0 <= id && id < proj.npath);
+	return id;
+}
+
+
+int path_error(const char *path)
+{
+	int err = corpus_data_projection_add(&proj, &schema, S(path), NULL);
+	ck_assert(err == CORPUS_ERROR_INVAL || err == 0);
+	return (err != 0);
+}
+
+
+// project the input, and render the matches as "id:value" pairs,
+// separated by spaces
+const char *project(const char *str)
+{
+	const struct corpus_data_match *match;
+	char *res, *dst;
+	size_t len = 0;
+	int i;
+
+	ck_assert(!corpus_data_project(&proj, &schema, (const uint8_t *)str,
+				       strlen(str)));
+
+	for (i = 0; i < proj.nmatch; i++) {
+		len += proj.matches[i].value.size + 16;
+	}
+	res = alloc(len + 1);
+	dst = res;
+	*dst = '\0';
+
+	for (i = 0; i < proj.nmatch; i++) {
+		match = &proj.matches[i];
+		ck_assert(match->value.type_id != Null
+			  || match->value.size == 4);
+		dst += sprintf(dst, "%s%d:%.*s", i ? " " : "", match->path_id,
+			       (int)match->value.size,
+			       (const char *)match->value.ptr);
+	}
+	return res;
+}
+
+
+START_TEST(test_project_field)
+{
+	add_path("text");
+	add_path("user.lang");
+
+	ck_assert_str_eq(project("{\"text\": \"hi\", \"user\": {\"id\": 1,"
+				 " \"lang\": \"en\"}}"),
+			 "0:\"hi\" 1:\"en\"");
+	ck_assert_str_eq(project("{\"user\": {\"lang\": null}, \"text\": 2}"),
+			 "1:null 0:2");
+	ck_assert_str_eq(project("{\"user\": [1], \"x\": {\"text\": 3}}"), "");
+	ck_assert_str_eq(project("{\"user\": {}}"), "");
+	ck_assert_str_eq(project("[{\"text\": 1}]"), "");
+	ck_assert_str_eq(project("null"), "");
+	ck_assert_str_eq(project(""), "");
+}
+END_TEST
+
+
+START_TEST(test_project_shared)
+{
+	ck_assert_int_eq(add_path("a.b"), 0);
+	ck_assert_int_eq(add_path("a"), 1);
+	ck_assert_int_eq(add_path("a.c"), 2);
+	ck_assert_int_eq(add_path("a.b"), 0);
+	ck_assert_int_eq(proj.npath, 3);
+
+	ck_assert_str_eq(project("{\"a\": {\"c\": 1, \"b\": [2]}}"),
+			 "1:{\"c\": 1, \"b\": [2]} 2:1 0:[2]");
+}
+END_TEST
+
+
+START_TEST(test_project_items)
+{
+	add_path("entities.hashtags[*].text");
+	add_path("a[1]");
+	add_path("[0]");
+
+	ck_assert_int_eq(proj.path_multi[0], 1);
+	ck_assert_int_eq(proj.path_multi[1], 0);
+
+	ck_assert_str_eq(project("{\"entities\": {\"hashtags\": ["
+				 "{\"text\": \"x\"}, {\"y\": 1},"
+				 " {\"text\": \"z\"}]}}"),
+			 "0:\"x\" 0:\"z\"");
+	ck_assert_str_eq(project("{\"a\": [[1], {\"b\": \"]\"}, 3]}"),
+			 "1:{\"b\": \"]\"}");
+	ck_assert_str_eq(project("{\"a\": [1]}"), "");
+	ck_assert_str_eq(project("{\"a\": []}"), "");
+	ck_assert_str_eq(project("[true, false]"), "2:true");
+}
+END_TEST
+
+
+START_TEST(test_project_get)
+{
+	struct corpus_data val;
+	int id_a, id_b;
+
+	id_a = add_path("a");
+	id_b = add_path("b");
+	project("{\"a\": 1}");
+
+	ck_assert(corpus_data_projection_get(&proj, id_a, &val));
+	ck_assert_int_eq(val.type_id, Integer);
+	ck_assert_uint_eq(val.size, 1);
+
+	ck_assert(!corpus_data_projection_get(&proj, id_b, &val));
+	ck_assert_int_eq(val.type_id, Null);
+	ck_assert(val.ptr == NULL);
+}
+END_TEST
+
+
+START_TEST(test_project_quoted)
+{
+	add_path("\"a.b\"");
+	add_path("\"x[0]\".y");
+
+	ck_assert_str_eq(project("{\"a\": {\"b\": 1}, \"a.b\": 2}"), "0:2");
+	ck_assert_str_eq(project("{\"x[0]\": {\"y\": 3}}"), "1:3");
+}
+END_TEST
+
+
+START_TEST(test_project_path_invalid)
+{
+	corpus_log_func = ignore_message;
+
+	ck_assert(path_error(""));
+	ck_assert(path_error(".a"));
+	ck_assert(path_error("a."));
+	ck_assert(path_error("a..b"));
+	ck_assert(path_error("a["));
+	ck_assert(path_error("a[]"));
+	ck_assert(path_error("a[x]"));
+	ck_assert(path_error("a[1"));
+	ck_assert(path_error("a[99999999999]"));
+	ck_assert(path_error("a[0]b"));
+	ck_assert(path_error("\"a"));
+	ck_assert(path_error("\"a\"b"));
+	ck_assert_int_eq(proj.npath, 0);
+}
+END_TEST
+
+
+START_TEST(test_project_invalid)
+{
+	corpus_log_func = ignore_message;
+
+	add_path("a[*]");
+	add_path("c");
+
+	ck_assert(corpus_data_project(&proj, &schema,
+				      (const uint8_t *)"{\"a\": [1, }", 11));
+	ck_assert(corpus_data_project(&proj, &schema,
+				      (const uint8_t *)"{\"a\": [1 2]}", 12));
+	ck_assert(corpus_data_project(&proj, &schema,
+				      (const uint8_t *)"{\"b\" 1}", 7));
+	ck_assert(corpus_data_project(&proj, &schema,
+				      (const uint8_t *)"{\"a\": [tru]}", 12));
+	ck_assert_int_eq(proj.nmatch, 0);
 }
 END_TEST
 
@@ -697,6 +1254,68 @@ START_TEST(test_union_record)
 END_TEST 
 
 
+// scan a value in a separate schema, and import its type
+int import_type(struct corpus_schema *src, const char *str)
+{
+	int id, src_id;
+
+	ck_assert(!corpus_schema_scan(src, (const uint8_t *)str, strlen(str),
+				      &src_id));
+	ck_assert(!corpus_schema_import(&schema, src, src_id, &id));
+	return id;
+}
+
+
+START_TEST(test_import)
+{
+	struct corpus_schema src;
+	const char *inputs[] = {
+		"null", "true", "1", "1.5", "\"a\"", "[]", "[1, 2]",
+		"[1, \"a\"]", "{}", "{\"a\": [true], \"b\": {\"c\": \"x\"}}",
+		"[[{\"b\": null}], [{\"b\": 1}]]", "{\"\\u00e9\": 1}"
+	};
+	int i, n = (int)(sizeof(inputs) / sizeof(inputs[0]));
+
+	ck_assert(!corpus_schema_init(&src));
+
+	// give the destination some other types first, so that the
+	// IDs in the two schemas differ
+	get_name("z");
+	get_type("{\"y\": [1.5], \"b\": {}}");
+
+	for (i = 0; i < n; i++) {
+		ck_assert_int_eq(import_type(&src, inputs[i]),
+				 get_type(inputs[i]));
+	}
+
+	corpus_schema_destroy(&src);
+}
+END_TEST
+
+
+START_TEST(test_import_union)
+{
+	struct corpus_schema src1, src2;
+	const char *str1 = "{\"a\": 1, \"b\": [\"x\"]}";
+	const char *str2 = "{\"b\": [], \"c\": {\"d\": true}}";
+	int id, id1, id2;
+
+	ck_assert(!corpus_schema_init(&src1));
+	ck_assert(!corpus_schema_init(&src2));
+
+	// merging the imported types gives the same result as scanning
+	// both values in one schema
+	id1 = import_type(&src1, str1);
+	id2 = import_type(&src2, str2);
+	ck_assert(!corpus_schema_union(&schema, id1, id2, &id));
+	ck_assert_int_eq(id, Union(get_type(str1), get_type(str2)));
+
+	corpus_schema_destroy(&src2);
+	corpus_schema_destroy(&src1);
+}
+END_TEST
+
+
 Suite *data_suite(void)
 {
 	Suite *s;
@@ -730,6 +1349,7 @@ Suite *data_suite(void)
 	tcase_add_test(tc, test_decode_huge_mantissa);
 	tcase_add_test(tc, test_decode_leading_zeroes);
 	tcase_add_test(tc, test_decode_subnormal);
+	tcase_add_test(tc, test_decode_short);
 	tcase_add_test(tc, test_decode_nonfinite);
 	suite_add_tcase(s, tc);
 
@@ -737,6 +1357,7 @@ Suite *data_suite(void)
         tcase_add_checked_fixture(tc, setup_data, teardown_data);
 	tcase_add_test(tc, test_valid_text);
 	tcase_add_test(tc, test_invalid_text);
+	tcase_add_test(tc, test_decode_text);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("array");
@@ -744,6 +1365,7 @@ Suite *data_suite(void)
 	tcase_add_test(tc, test_valid_array);
 	tcase_add_test(tc, test_invalid_array);
 	tcase_add_test(tc, test_decode_record_array);
+	tcase_add_test(tc, test_array_view);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("record");
@@ -751,9 +1373,30 @@ Suite *data_suite(void)
 	tcase_add_test(tc, test_valid_record);
 	tcase_add_test(tc, test_equal_record);
 	tcase_add_test(tc, test_nested_record);
+	tcase_add_test(tc, test_repeated_record);
+	tcase_add_test(tc, test_field_order);
+	tcase_add_test(tc, test_field_subset);
 	tcase_add_test(tc, test_invalid_record);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("access");
+        tcase_add_checked_fixture(tc, setup_data, teardown_data);
+	tcase_add_test(tc, test_access_field);
+	tcase_add_test(tc, test_access_escaped);
+	tcase_add_test(tc, test_access_invalid);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("project");
+        tcase_add_checked_fixture(tc, setup_project, teardown_project);
+	tcase_add_test(tc, test_project_field);
+	tcase_add_test(tc, test_project_shared);
+	tcase_add_test(tc, test_project_items);
+	tcase_add_test(tc, test_project_get);
+	tcase_add_test(tc, test_project_quoted);
+	tcase_add_test(tc, test_project_path_invalid);
+	tcase_add_test(tc, test_project_invalid);
+	suite_add_tcase(s, tc);
+
 	tc = tcase_create("union");
         tcase_add_checked_fixture(tc, setup_data, teardown_data);
 	tcase_add_test(tc, test_union_null);
@@ -763,6 +1406,12 @@ Suite *data_suite(void)
 	tcase_add_test(tc, test_union_record);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("import");
+        tcase_add_checked_fixture(tc, setup_data, teardown_data);
+	tcase_add_test(tc, test_import);
+	tcase_add_test(tc, test_import_union);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
 
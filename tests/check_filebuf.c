@@ -0,0 +1,561 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for utimensat
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "../src/filebuf.h"
+#include "testutil.h"
+
+#define FILE_NAME "check_filebuf.tmp"
+#define INDEX_NAME FILE_NAME CORPUS_FILEBUF_INDEX_EXT
+
+#define NSPLIT_MAX 16
+
+struct corpus_filebuf buf;
+int has_buf;
+
+
+void setup_filebuf(void)
+{
+	setup();
+	has_buf = 0;
+}
+
+
+void teardown_filebuf(void)
+{
+	if (has_buf) {
+		corpus_filebuf_destroy(&buf);
+		has_buf = 0;
+	}
+	remove(FILE_NAME);
+	remove(INDEX_NAME);
+	teardown();
+}
+
+
+void init(const char *contents)
+{
+	FILE *file;
+	size_t size = strlen(contents);
+
+	ck_assert(!has_buf);
+
+	file = fopen(FILE_NAME, "wb");
+	ck_assert(file != NULL);
+	ck_assert(fwrite(contents, 1, size, file) == size);
+	ck_assert(!fclose(file));
+
+	ck_assert(!corpus_filebuf_init(&buf, FILE_NAME));
+	has_buf = 1;
+}
+
+
+// concatenate the lines from a set of iterators, checking that each
+// line ends in a newline (except possibly the last one in the file)
+char *collect(struct corpus_filebuf_iter *its, int n, int *nline_ptr)
+{
+	char *str = alloc((size_t)buf.file_size + 1);
+	size_t len = 0;
+	int i, nline = 0;
+
+	for (i = 0; i < n; i++) {
+		while (corpus_filebuf_iter_advance(&its[i])) {
+			ck_assert(its[i].current.size > 0);
+			memcpy(str + len, its[i].current.ptr,
+			       its[i].current.size);
+			len += its[i].current.size;
+			nline++;
+			ck_assert(str[len - 1] == '\n'
+				  || len == (size_t)buf.file_size);
+		}
+	}
+	str[len] = '\0';
+
+	if (nline_ptr) {
+		*nline_ptr = nline;
+	}
+	return str;
+}
+
+
+void check_split(const char *contents, int nline)
+{
+	struct corpus_filebuf_iter its[NSPLIT_MAX];
+	int n, count;
+
+	init(contents);
+
+	for (n = 1; n <= NSPLIT_MAX; n++) {
+		corpus_filebuf_split(&buf, its, n);
+		ck_assert_str_eq(collect(its, n, &count), contents);
+		ck_assert_int_eq(count, nline);
+	}
+}
+
+
+START_TEST(test_split_empty)
+{
+	check_split("", 0);
+}
+END_TEST
+
+
+START_TEST(test_split_one)
+{
+	check_split("{\"a\": 1}\n", 1);
+}
+END_TEST
+
+
+START_TEST(test_split_no_trailing_newline)
+{
+	check_split("1\n22\n333", 3);
+}
+END_TEST
+
+
+START_TEST(test_split_many)
+{
+	check_split("{}\n[1, 2, 3]\n\"hello world\"\n\nnull\n"
+		    "{\"x\": {\"y\": [true, false]}}\n3.14\n", 7);
+}
+END_TEST
+
+
+START_TEST(test_range_boundaries)
+{
+	struct corpus_filebuf_iter it;
+
+	init("aa\nbb\ncc\n");
+
+	// a range starting at the beginning of a line includes it
+	corpus_filebuf_iter_make_range(&it, &buf, 3, 6);
+	ck_assert(corpus_filebuf_iter_advance(&it));
+	ck_assert(it.current.ptr == (const uint8_t *)buf.map_addr + 3);
+	ck_assert_int_eq(it.current.size, 3);
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+
+	// a range starting mid-line skips to the next line
+	corpus_filebuf_iter_make_range(&it, &buf, 1, 4);
+	ck_assert(corpus_filebuf_iter_advance(&it));
+	ck_assert(it.current.ptr == (const uint8_t *)buf.map_addr + 3);
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+
+	// a range inside a line is empty
+	corpus_filebuf_iter_make_range(&it, &buf, 4, 5);
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+
+	// ranges past the end of the file are empty
+	corpus_filebuf_iter_make_range(&it, &buf, 9, 100);
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+
+	// reset returns to the start of the range
+	corpus_filebuf_iter_make_range(&it, &buf, 2, 9);
+	ck_assert(corpus_filebuf_iter_advance(&it));
+	ck_assert(corpus_filebuf_iter_advance(&it));
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+	corpus_filebuf_iter_reset(&it);
+	ck_assert(corpus_filebuf_iter_advance(&it));
+	ck_assert(it.current.ptr == (const uint8_t *)buf.map_addr + 3);
+}
+END_TEST
+
+
+START_TEST(test_advance_long_lines)
+{
+	struct corpus_filebuf_iter it;
+	char *contents = alloc(1024);
+	size_t len[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 200 };
+	size_t i, j, pos = 0;
+	int n = (int)(sizeof(len) / sizeof(len[0]));
+
+	for (i = 0; i < (size_t)n; i++) {
+		for (j = 0; j < len[i]; j++) {
+			contents[pos++] = (char)('a' + (j % 26));
+		}
+		contents[pos++] = '\n';
+	}
+	contents[pos] = '\0';
+
+	init(contents);
+	corpus_filebuf_iter_make(&it, &buf);
+
+	for (i = 0; i < (size_t)n; i++) {
+		ck_assert(corpus_filebuf_iter_advance(&it));
+		ck_assert_int_eq(it.current.size, len[i] + 1);
+		ck_assert(it.current.ptr[len[i]] == '\n');
+	}
+	ck_assert(!corpus_filebuf_iter_advance(&it));
+}
+END_TEST
+
+
+START_TEST(test_advance_lines)
+{
+	struct corpus_filebuf_iter it;
+	struct corpus_filebuf_line lines[2];
+	const uint8_t *base;
+
+	init("a\nbb\n\nccc");
+	base = (const uint8_t *)buf.map_addr;
+	corpus_filebuf_iter_make(&it, &buf);
+
+	ck_assert_int_eq(corpus_filebuf_iter_advance_lines(&it, lines, 2), 2);
+	ck_assert(lines[0].ptr == base && lines[0].size == 2);
+	ck_assert(lines[1].ptr == base + 2 && lines[1].size == 3);
+	ck_assert(it.current.ptr == lines[1].ptr);
+
+	ck_assert_int_eq(corpus_filebuf_iter_advance_lines(&it, lines, 2), 2);
+	ck_assert(lines[0].ptr == base + 5 && lines[0].size == 1);
+	ck_assert(lines[1].ptr == base + 6 && lines[1].size == 3);
+
+	ck_assert_int_eq(corpus_filebuf_iter_advance_lines(&it, lines, 2), 0);
+	ck_assert(it.current.ptr == NULL);
+}
+END_TEST
+
+
+START_TEST(test_access_hints)
+{
+	struct corpus_filebuf_iter its[4];
+	char *contents = alloc(64 * 1024 + 1);
+	size_t i, n = 64 * 1024;
+	int count;
+
+	for (i = 0; i < n; i++) {
+		contents[i] = (i % 100 == 99) ? '\n' : (char)('0' + (i % 10));
+	}
+	contents[n] = '\0';
+
+	init(contents);
+	corpus_filebuf_set_access(&buf, CORPUS_FILEBUF_SEQUENTIAL
+				  | CORPUS_FILEBUF_PREFETCH
+				  | CORPUS_FILEBUF_DROPBEHIND, 1000);
+
+	// the hints must not change the lines that the iterators see
+	corpus_filebuf_split(&buf, its, 1);
+	ck_assert_str_eq(collect(its, 1, &count), contents);
+	ck_assert_int_eq(count, (int)((n + 99) / 100));
+
+	corpus_filebuf_split(&buf, its, 4);
+	ck_assert_str_eq(collect(its, 4, &count), contents);
+	ck_assert_int_eq(count, (int)((n + 99) / 100));
+
+	corpus_filebuf_set_access(&buf, CORPUS_FILEBUF_NORMAL, 0);
+	ck_assert_int_eq(buf.window, CORPUS_FILEBUF_WINDOW);
+	corpus_filebuf_split(&buf, its, 1);
+	ck_assert_str_eq(collect(its, 1, NULL), contents);
+}
+END_TEST
+
+
+// reopen the file, picking up the line index, if it exists
+void reinit(void)
+{
+	ck_assert(has_buf);
+	corpus_filebuf_destroy(&buf);
+	has_buf = 0;
+
+	ck_assert(!corpus_filebuf_init(&buf, FILE_NAME));
+	has_buf = 1;
+}
+
+
+// a file with lines of varying lengths, spanning several checkpoints
+char *make_lines(int nline)
+{
+	char *contents = alloc((size_t)nline * 300 + 1);
+	size_t len = 0;
+	int i, j, width;
+
+	for (i = 0; i < nline; i++) {
+		width = (i * 37) % 300;
+		for (j = 0; j < width; j++) {
+			contents[len++] = (char)('a' + (i + j) % 26);
+		}
+		contents[len++] = '\n';
+	}
+	contents[len] = '\0';
+	return contents;
+}
+
+
+// check that random access by line number agrees with iteration
+void check_lines(void)
+{
+	struct corpus_filebuf_iter it;
+	struct corpus_filebuf_line line;
+	uint64_t i = 0;
+
+	corpus_filebuf_iter_make(&it, &buf);
+	while (corpus_filebuf_iter_advance(&it)) {
+		ck_assert(corpus_filebuf_line(&buf, i, &line));
+		ck_assert(line.ptr == it.current.ptr);
+		ck_assert_uint_eq(line.size, it.current.size);
+		i++;
+	}
+	ck_assert(!corpus_filebuf_line(&buf, i, &line));
+	ck_assert(line.ptr == NULL);
+}
+
+
+START_TEST(test_index_lines)
+{
+	char *contents = make_lines(1000);
+
+	init(contents);
+	ck_assert(!buf.has_index);
+	check_lines();
+
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	ck_assert(buf.has_index);
+	ck_assert_uint_eq(buf.index.nline, 1000);
+	check_lines();
+
+	reinit();
+	ck_assert(buf.has_index);
+	ck_assert_uint_eq(buf.index.nline, 1000);
+	check_lines();
+}
+END_TEST
+
+
+START_TEST(test_index_empty)
+{
+	struct corpus_filebuf_iter its[3];
+
+	init("");
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	reinit();
+	ck_assert(buf.has_index);
+	ck_assert_uint_eq(buf.index.nline, 0);
+
+	corpus_filebuf_split(&buf, its, 3);
+	ck_assert_str_eq(collect(its, 3, NULL), "");
+}
+END_TEST
+
+
+START_TEST(test_index_split)
+{
+	struct corpus_filebuf_iter its[NSPLIT_MAX];
+	char *contents = make_lines(250);
+	int i, n, count;
+
+	init(contents);
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	reinit();
+
+	// with an index, the ranges have equal numbers of lines
+	for (n = 1; n <= NSPLIT_MAX; n++) {
+		corpus_filebuf_split(&buf, its, n);
+		for (i = 0; i < n; i++) {
+			collect(&its[i], 1, &count);
+			ck_assert(count == 250 / n || count == 250 / n + 1);
+		}
+		corpus_filebuf_split(&buf, its, n);
+		ck_assert_str_eq(collect(its, n, &count), contents);
+		ck_assert_int_eq(count, 250);
+	}
+}
+END_TEST
+
+
+START_TEST(test_index_stale)
+{
+	init("1\n22\n333\n");
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	corpus_filebuf_destroy(&buf);
+	has_buf = 0;
+
+	// changing the file invalidates the index
+	init("1\n22\n333\n4444\n");
+	ck_assert(!buf.has_index);
+	check_lines();
+}
+END_TEST
+
+
+// set a file's access and modification times to a fixed value
+void set_times(void)
+{
+	struct timespec times[2];
+
+	times[0].tv_sec = 1000000000;
+	times[0].tv_nsec = 123456789;
+	times[1] = times[0];
+	ck_assert(!utimensat(AT_FDCWD, FILE_NAME, times, 0));
+}
+
+
+START_TEST(test_index_same_size)
+{
+	FILE *file;
+
+	init("1\n22\n333\n");
+	set_times();
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	corpus_filebuf_destroy(&buf);
+	has_buf = 0;
+
+	// rewrite the file with the same size and modification time, so
+	// that the index looks up to date
+	file = fopen(FILE_NAME, "wb");
+	ck_assert(file != NULL);
+	ck_assert(fputs("333\n22\n1\n", file) != EOF);
+	ck_assert(!fclose(file));
+	set_times();
+
+	// the lookups detect that the lines do not agree with the index
+	ck_assert(!corpus_filebuf_init(&buf, FILE_NAME));
+	has_buf = 1;
+	ck_assert(buf.has_index);
+	check_lines();
+}
+END_TEST
+
+
+START_TEST(test_index_corrupt)
+{
+	FILE *file;
+
+	init("1\n22\n333\n");
+	ck_assert(!corpus_filebuf_write_index(&buf));
+
+	// corrupting the last line length invalidates the index
+	file = fopen(INDEX_NAME, "r+b");
+	ck_assert(file != NULL);
+	ck_assert(!fseek(file, -1, SEEK_END));
+	ck_assert(fputc(0x80, file) != EOF);
+	ck_assert(!fclose(file));
+
+	reinit();
+	ck_assert(!buf.has_index);
+	check_lines();
+}
+END_TEST
+
+
+// concatenate the lines from an iterator over part of the file
+char *collect_lines(struct corpus_filebuf_iter *it)
+{
+	char *str = alloc((size_t)buf.file_size + 1);
+	size_t len = 0;
+
+	while (corpus_filebuf_iter_advance(it)) {
+		memcpy(str + len, it->current.ptr, it->current.size);
+		len += it->current.size;
+	}
+	str[len] = '\0';
+	return str;
+}
+
+
+void check_make_lines(void)
+{
+	struct corpus_filebuf_iter it;
+
+	corpus_filebuf_iter_make_lines(&it, &buf, 1, 3);
+	ck_assert_str_eq(collect_lines(&it), "22\n333\n");
+
+	corpus_filebuf_iter_make_lines(&it, &buf, 0, 1);
+	ck_assert_str_eq(collect_lines(&it), "1\n");
+
+	corpus_filebuf_iter_make_lines(&it, &buf, 2, 2);
+	ck_assert_str_eq(collect_lines(&it), "");
+
+	corpus_filebuf_iter_make_lines(&it, &buf, 3, 100);
+	ck_assert_str_eq(collect_lines(&it), "4444");
+
+	corpus_filebuf_iter_make_lines(&it, &buf, 4, 100);
+	ck_assert_str_eq(collect_lines(&it), "");
+}
+
+
+START_TEST(test_make_lines)
+{
+	init("1\n22\n333\n4444");
+	check_make_lines();
+
+	ck_assert(!corpus_filebuf_write_index(&buf));
+	reinit();
+	ck_assert(buf.has_index);
+	check_make_lines();
+}
+END_TEST
+
+
+Suite *filebuf_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("filebuf");
+
+	tc = tcase_create("split");
+	tcase_add_checked_fixture(tc, setup_filebuf, teardown_filebuf);
+	tcase_add_test(tc, test_split_empty);
+	tcase_add_test(tc, test_split_one);
+	tcase_add_test(tc, test_split_no_trailing_newline);
+	tcase_add_test(tc, test_split_many);
+	tcase_add_test(tc, test_range_boundaries);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("advance");
+	tcase_add_checked_fixture(tc, setup_filebuf, teardown_filebuf);
+	tcase_add_test(tc, test_advance_long_lines);
+	tcase_add_test(tc, test_advance_lines);
+	tcase_add_test(tc, test_access_hints);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("index");
+	tcase_add_checked_fixture(tc, setup_filebuf, teardown_filebuf);
+	tcase_add_test(tc, test_index_lines);
+	tcase_add_test(tc, test_index_empty);
+	tcase_add_test(tc, test_index_split);
+	tcase_add_test(tc, test_index_stale);
+	tcase_add_test(tc, test_index_same_size);
+	tcase_add_test(tc, test_index_corrupt);
+	tcase_add_test(tc, test_make_lines);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = filebuf_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
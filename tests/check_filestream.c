@@ -0,0 +1,497 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#if defined(CORPUS_HAVE_ZLIB)
+#  define ZLIB_CONST
+#  include <zlib.h>
+#endif
+#if defined(CORPUS_HAVE_ZSTD)
+#  include <zstd.h>
+#endif
+#include "../src/decoder.h"
+#include "../src/filebuf.h"
+#include "../src/filestream.h"
+#include "testutil.h"
+
+#define FILE_NAME "check_filestream.tmp"
+
+struct corpus_filestream fs;
+int has_fs;
+
+
+void setup_filestream(void)
+{
+	setup();
+	has_fs = 0;
+}
+
+
+void teardown_filestream(void)
+{
+	if (has_fs) {
+		corpus_filestream_destroy(&fs);
+		has_fs = 0;
+	}
+	remove(FILE_NAME);
+	teardown();
+}
+
+
+void write_file(const char *contents, size_t size)
+{
+	FILE *file;
+
+	file = fopen(FILE_NAME, "wb");
+	ck_assert(file != NULL);
+	ck_assert(fwrite(contents, 1, size, file) == size);
+	ck_assert(!fclose(file));
+}
+
+
+void init_mapped(void)
+{
+	ck_assert(!has_fs);
+	ck_assert(!corpus_filestream_init(&fs, FILE_NAME));
+	ck_assert(fs.mapped);
+	has_fs = 1;
+}
+
+
+// read the file through standard input, forcing the streaming code path
+void init_streamed(void)
+{
+	ck_assert(!has_fs);
+	ck_assert(freopen(FILE_NAME, "rb", stdin) != NULL);
+	ck_assert(!corpus_filestream_init(&fs, "-"));
+	ck_assert(!fs.mapped);
+	has_fs = 1;
+}
+
+
+// check that the stream yields the lines of the contents, in order
+void check_lines(const char *contents, size_t size)
+{
+	const char *ptr = contents, *end = contents + size;
+	const char *nl;
+	size_t len;
+
+	while (ptr != end) {
+		nl = memchr(ptr, '\n', (size_t)(end - ptr));
+		len = nl ? (size_t)(nl + 1 - ptr) : (size_t)(end - ptr);
+
+		ck_assert(corpus_filestream_advance(&fs));
+		ck_assert_int_eq(fs.current.size, len);
+		ck_assert(memcmp(fs.current.ptr, ptr, len) == 0);
+
+		ptr += len;
+	}
+
+	ck_assert(!corpus_filestream_advance(&fs));
+	ck_assert(!fs.error);
+	ck_assert(fs.current.ptr == NULL);
+}
+
+
+void check(const char *contents, size_t size)
+{
+	write_file(contents, size);
+
+	init_mapped();
+	check_lines(contents, size);
+	corpus_filestream_destroy(&fs);
+	has_fs = 0;
+
+	init_streamed();
+	check_lines(contents, size);
+}
+
+
+START_TEST(test_empty)
+{
+	check("", 0);
+}
+END_TEST
+
+
+START_TEST(test_short)
+{
+	const char *str = "{\"a\": 1}\n\n[1, 2]\nnull";
+	check(str, strlen(str));
+}
+END_TEST
+
+
+START_TEST(test_straddle)
+{
+	size_t i, size = 3 * CORPUS_FILESTREAM_BUFFER_SIZE + 17;
+	char *str = alloc(size);
+
+	// lines of varying lengths, many of which straddle a refill
+	for (i = 0; i < size; i++) {
+		str[i] = ((i * 7919) % 1013 == 0) ? '\n' : (char)('a' + i % 26);
+	}
+	check(str, size);
+}
+END_TEST
+
+
+START_TEST(test_long_line)
+{
+	size_t i, size = 2 * CORPUS_FILESTREAM_BUFFER_SIZE + 5;
+	char *str = alloc(size);
+
+	// a single line that is longer than the read buffer
+	for (i = 0; i < size; i++) {
+		str[i] = (char)('a' + i % 26);
+	}
+	str[10] = '\n';
+	str[size - 2] = '\n';
+	check(str, size);
+}
+END_TEST
+
+
+// generate `size` bytes of NDJSON-like text
+char *make_lines(size_t size)
+{
+	char *str = alloc(size + 1);
+	size_t i, len = 0;
+	int n = 0;
+
+	while (len < size) {
+		n++;
+		i = (size_t)snprintf(str + len, size + 1 - len,
+				     "{\"id\": %d, \"text\": \"line %d\"}\n",
+				     n, n * 7919 % 1000);
+		len += i;
+	}
+	str[size] = '\0';
+	return str;
+}
+
+
+// check that a compressed file decodes to the given lines, both when
+// memory-mapped and when read through standard input
+void check_compressed(const uint8_t *data, size_t data_size,
+		      const char *contents, size_t size)
+{
+	write_file((const char *)data, data_size);
+
+	ck_assert(!corpus_filestream_init(&fs, FILE_NAME));
+	ck_assert(!fs.mapped);
+	has_fs = 1;
+	check_lines(contents, size);
+	corpus_filestream_destroy(&fs);
+	has_fs = 0;
+
+	init_streamed();
+	check_lines(contents, size);
+}
+
+
+// decode from memory with the given number of threads, reading in
+// chunks of various sizes
+void check_decode(int type, const uint8_t *data, size_t data_size,
+		  const char *contents, size_t size, int nthread,
+		  int parallel)
+{
+	struct corpus_decoder d;
+	uint8_t *buf = alloc(size + 1);
+	size_t len = 0, chunk = 1, nread;
+
+	ck_assert(!corpus_decoder_init_buffer(&d, type, data, data_size,
+					      nthread));
+	ck_assert_int_eq(d.pool != NULL, parallel);
+
+	do {
+		chunk = (chunk * 31) % 100000 + 1;
+		if (chunk > size + 1 - len) {
+			chunk = size + 1 - len;
+		}
+		ck_assert(!corpus_decoder_read(&d, buf + len, chunk, &nread));
+		len += nread;
+	} while (nread == chunk && len <= size);
+
+	corpus_decoder_destroy(&d);
+
+	ck_assert_int_eq(len, size);
+	ck_assert(memcmp(buf, contents, size) == 0);
+}
+
+
+#if defined(CORPUS_HAVE_ZLIB)
+
+// compress data into a gzip member, optionally with a BGZF extra field
+size_t gzip_member(const char *src, size_t size, uint8_t *dst,
+		   size_t dst_size, int bgzf)
+{
+	uint8_t extra[6] = { 'B', 'C', 2, 0, 0, 0 };
+	gz_header head;
+	z_stream z;
+	size_t n;
+
+	memset(&z, 0, sizeof(z));
+	ck_assert(deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8,
+			       Z_DEFAULT_STRATEGY) == Z_OK);
+	if (bgzf) {
+		memset(&head, 0, sizeof(head));
+		head.extra = extra;
+		head.extra_len = sizeof(extra);
+		ck_assert(deflateSetHeader(&z, &head) == Z_OK);
+	}
+
+	z.next_in = (const Bytef *)src;
+	z.avail_in = (uInt)size;
+	z.next_out = dst;
+	z.avail_out = (uInt)dst_size;
+	ck_assert(deflate(&z, Z_FINISH) == Z_STREAM_END);
+	n = (size_t)z.total_out;
+	deflateEnd(&z);
+
+	if (bgzf) {
+		// BSIZE: the total block size, minus 1
+		dst[16] = (uint8_t)((n - 1) & 0xFF);
+		dst[17] = (uint8_t)((n - 1) >> 8);
+	}
+	return n;
+}
+
+
+// compress data into consecutive gzip members of `block` input bytes
+uint8_t *gzip_blocks(const char *src, size_t size, size_t block, int bgzf,
+		     size_t *nptr)
+{
+	uint8_t *dst = alloc(size + 1024 * (size / block + 1));
+	size_t off, len, n = 0;
+
+	for (off = 0; off < size; off += len) {
+		len = (size - off < block) ? size - off : block;
+		n += gzip_member(src + off, len, dst + n, 65536, bgzf);
+	}
+	*nptr = n;
+	return dst;
+}
+
+
+START_TEST(test_gzip)
+{
+	size_t size = 300000, n;
+	char *str = make_lines(size);
+	uint8_t *gz = gzip_blocks(str, size, size, 0, &n);
+
+	check_compressed(gz, n, str, size);
+}
+END_TEST
+
+
+START_TEST(test_gzip_members)
+{
+	size_t size = 300000, n;
+	char *str = make_lines(size);
+	uint8_t *gz = gzip_blocks(str, size, 12345, 0, &n);
+
+	check_compressed(gz, n, str, size);
+	check_decode(CORPUS_COMPRESS_GZIP, gz, n, str, size, 4, 0);
+}
+END_TEST
+
+
+START_TEST(test_bgzf)
+{
+	size_t size = 3 * 1024 * 1024, n;
+	char *str = make_lines(size);
+	uint8_t *gz = gzip_blocks(str, size, 60000, 1, &n);
+
+	check_compressed(gz, n, str, size);
+	check_decode(CORPUS_COMPRESS_GZIP, gz, n, str, size, 1, 0);
+	check_decode(CORPUS_COMPRESS_GZIP, gz, n, str, size, 3, 1);
+}
+END_TEST
+
+
+START_TEST(test_gzip_truncated)
+{
+	size_t size = 300000, n;
+	char *str = make_lines(size);
+	uint8_t *gz = gzip_blocks(str, size, size, 0, &n);
+
+	write_file((const char *)gz, n / 2);
+	ck_assert(!corpus_filestream_init(&fs, FILE_NAME));
+	has_fs = 1;
+
+	while (corpus_filestream_advance(&fs)) {
+	}
+	ck_assert(fs.error);
+}
+END_TEST
+
+#else
+
+START_TEST(test_gzip_unsupported)
+{
+	const uint8_t gz[] = { 0x1F, 0x8B, 0x08, 0x00 };
+
+	write_file((const char *)gz, sizeof(gz));
+	ck_assert(corpus_filestream_init(&fs, FILE_NAME));
+}
+END_TEST
+
+#endif /* CORPUS_HAVE_ZLIB */
+
+
+#if defined(CORPUS_HAVE_ZSTD)
+
+// compress data into consecutive zstd frames of `block` input bytes
+uint8_t *zstd_frames(const char *src, size_t size, size_t block,
+		     size_t *nptr)
+{
+	size_t cap = ZSTD_compressBound(block) * (size / block + 1);
+	uint8_t *dst = alloc(cap);
+	size_t off, len, ret, n = 0;
+
+	for (off = 0; off < size; off += len) {
+		len = (size - off < block) ? size - off : block;
+		ret = ZSTD_compress(dst + n, cap - n, src + off, len, 3);
+		ck_assert(!ZSTD_isError(ret));
+		n += ret;
+	}
+	*nptr = n;
+	return dst;
+}
+
+
+START_TEST(test_zstd)
+{
+	size_t size = 300000, n;
+	char *str = make_lines(size);
+	uint8_t *zst = zstd_frames(str, size, size, &n);
+
+	check_compressed(zst, n, str, size);
+	check_decode(CORPUS_COMPRESS_ZSTD, zst, n, str, size, 4, 0);
+}
+END_TEST
+
+
+START_TEST(test_zstd_frames)
+{
+	size_t size = 5 * 1024 * 1024, n;
+	char *str = make_lines(size);
+	uint8_t *zst = zstd_frames(str, size, 100000, &n);
+
+	check_compressed(zst, n, str, size);
+	check_decode(CORPUS_COMPRESS_ZSTD, zst, n, str, size, 1, 0);
+	check_decode(CORPUS_COMPRESS_ZSTD, zst, n, str, size, 4, 1);
+}
+END_TEST
+
+#endif /* CORPUS_HAVE_ZSTD */
+
+
+START_TEST(test_set_lines)
+{
+	const char *str = "1\n22\n333\n4444";
+
+	write_file(str, strlen(str));
+
+	init_mapped();
+	corpus_filestream_set_lines(&fs, 1, 3);
+	check_lines("22\n333\n", 7);
+	corpus_filestream_destroy(&fs);
+	has_fs = 0;
+
+	init_streamed();
+	corpus_filestream_set_lines(&fs, 1, 3);
+	check_lines("22\n333\n", 7);
+	corpus_filestream_destroy(&fs);
+	has_fs = 0;
+
+	init_streamed();
+	corpus_filestream_set_lines(&fs, 3, 10);
+	check_lines("4444", 4);
+	corpus_filestream_destroy(&fs);
+	has_fs = 0;
+
+	init_streamed();
+	corpus_filestream_set_lines(&fs, 5, 10);
+	check_lines("", 0);
+}
+END_TEST
+
+
+START_TEST(test_missing)
+{
+	ck_assert(corpus_filestream_init(&fs, "no/such/file.json"));
+}
+END_TEST
+
+
+Suite *filestream_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("filestream");
+
+	tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup_filestream, teardown_filestream);
+	tcase_add_test(tc, test_empty);
+	tcase_add_test(tc, test_short);
+	tcase_add_test(tc, test_straddle);
+	tcase_add_test(tc, test_long_line);
+	tcase_add_test(tc, test_set_lines);
+	tcase_add_test(tc, test_missing);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("compressed");
+	tcase_add_checked_fixture(tc, setup_filestream, teardown_filestream);
+#if defined(CORPUS_HAVE_ZLIB)
+	tcase_add_test(tc, test_gzip);
+	tcase_add_test(tc, test_gzip_members);
+	tcase_add_test(tc, test_bgzf);
+	tcase_add_test(tc, test_gzip_truncated);
+#else
+	tcase_add_test(tc, test_gzip_unsupported);
+#endif
+#if defined(CORPUS_HAVE_ZSTD)
+	tcase_add_test(tc, test_zstd);
+	tcase_add_test(tc, test_zstd_frames);
+#endif
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = filestream_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
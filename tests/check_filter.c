@@ -17,9 +17,11 @@
 #include <check.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../lib/utf8lite/src/utf8lite.h"
+#include "../src/error.h"
 #include "../src/table.h"
 #include "../src/textset.h"
 #include "../src/tree.h"
@@ -37,10 +39,12 @@
 
 #define ID_EOT	  (-1)
 #define ID_DROP	  (-2)
+#define ID_OOV	  (-3)
 #define TYPE_EOT    ((const struct utf8lite_text *)&type_eot)
 #define TYPE_DROP   ((const struct utf8lite_text *)&type_drop)
+#define TYPE_OOV    ((const struct utf8lite_text *)&type_oov)
 
-static struct utf8lite_text type_eot, type_drop;
+static struct utf8lite_text type_eot, type_drop, type_oov;
 static struct corpus_filter filter;
 static int has_filter;
 static struct corpus_stem_snowball snowball;
@@ -56,6 +60,8 @@ static void setup_filter(void)
 	type_eot.attr = strlen("<eot>");
 	type_drop.ptr = (uint8_t *)"<drop>";
 	type_drop.attr = strlen("<drop>");
+	type_oov.ptr = (uint8_t *)"<oov>";
+	type_oov.attr = strlen("<oov>");
 }
 
 
@@ -123,6 +129,8 @@ static int next_id(void)
 		type_id = filter.type_id;
 		if (type_id == CORPUS_TYPE_NONE) {
 			return ID_DROP;
+		} else if (type_id == CORPUS_TYPE_OOV) {
+			return ID_OOV;
 		}
 		ck_assert(type_id < filter.symtab.ntype);
 		return type_id;
@@ -141,6 +149,8 @@ static const struct utf8lite_text *next_type(void)
 		return TYPE_EOT;
 	case ID_DROP:
 		return TYPE_DROP;
+	case ID_OOV:
+		return TYPE_OOV;
 	default:
 		return &filter.symtab.types[type_id].text;
 	}
@@ -291,6 +301,201 @@ START_TEST(test_basic_census)
 END_TEST
 
 
+#define FILE_NAME "check_filter.tmp"
+
+START_TEST(test_save_load)
+{
+	const char *text = "New York City, new york. A rose is a ROSE!";
+	int ids[32];
+	int i, n, ntype, type_kind;
+
+	init(NULL, DROP_PUNCT);
+	combine(T("new york"));
+	combine(T("New York City"));
+	drop(T("a"));
+
+	start(T(text));
+	for (n = 0; (ids[n] = next_id()) != ID_EOT; n++) {
+		ck_assert(n < 31);
+	}
+	ntype = filter.symtab.ntype;
+
+	ck_assert(!corpus_filter_save(&filter, FILE_NAME));
+	type_kind = filter.symtab.typemap.type;
+	corpus_filter_destroy(&filter);
+	has_filter = 0;
+
+	// it should reject a filter with different settings
+	init(NULL, 0);
+	ck_assert(corpus_filter_load(&filter, FILE_NAME)
+		  == CORPUS_ERROR_INVAL);
+	corpus_filter_destroy(&filter);
+	has_filter = 0;
+
+	ck_assert(!corpus_filter_init(&filter, DROP_PUNCT, type_kind,
+				      CORPUS_FILTER_CONNECTOR, NULL, NULL));
+	has_filter = 1;
+	ck_assert(!corpus_filter_load(&filter, FILE_NAME));
+	ck_assert_int_eq(filter.symtab.ntype, ntype);
+
+	// it should give the same types, without adding new ones
+	start(T(text));
+	for (i = 0; i <= n; i++) {
+		ck_assert_int_eq(next_id(), ids[i]);
+	}
+	ck_assert_int_eq(filter.symtab.ntype, ntype);
+
+	// the combination rules and drop list should still work
+	start(T("NEW YORK a"));
+	assert_text_eq(next_type(), T("new_york"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_EOT);
+
+	// it should save over the file that it was loaded from
+	start(T("garden"));
+	assert_text_eq(next_type(), T("garden"));
+	ntype = filter.symtab.ntype;
+	ck_assert(!corpus_filter_save(&filter, FILE_NAME));
+	start(T(text));
+	for (i = 0; i <= n; i++) {
+		ck_assert_int_eq(next_id(), ids[i]);
+	}
+	corpus_filter_destroy(&filter);
+	has_filter = 0;
+
+	ck_assert(!corpus_filter_init(&filter, DROP_PUNCT, type_kind,
+				      CORPUS_FILTER_CONNECTOR, NULL, NULL));
+	has_filter = 1;
+	ck_assert(!corpus_filter_load(&filter, FILE_NAME));
+	ck_assert_int_eq(filter.symtab.ntype, ntype);
+	ck_assert(corpus_symtab_has_type(&filter.symtab, T("garden"), NULL));
+
+	remove(FILE_NAME);
+}
+END_TEST
+
+
+START_TEST(test_tokenize)
+{
+	const struct utf8lite_text *text = T("A rose is a Rose is a ROSE.");
+	int type_ids[4], expect[16];
+	size_t offsets[4], sizes[4];
+	int i, n, nexpect = 0, ntotal = 0;
+
+	init(NULL, 0);
+	combine(T("is a"));
+
+	// get the expected types one at a time
+	start(text);
+	while (corpus_filter_advance(&filter)) {
+		if (filter.type_id != CORPUS_TYPE_NONE) {
+			ck_assert(nexpect < 16);
+			expect[nexpect++] = filter.type_id;
+		}
+	}
+
+	// tokenize in batches
+	start(text);
+	do {
+		ck_assert(!corpus_filter_tokenize(&filter, type_ids, offsets,
+						  sizes, 4, &n));
+		for (i = 0; i < n; i++) {
+			ck_assert(ntotal < nexpect);
+			ck_assert_int_eq(type_ids[i], expect[ntotal]);
+			ntotal++;
+		}
+	} while (n == 4);
+	ck_assert_int_eq(ntotal, nexpect);
+
+	// it should report the token locations
+	start(text);
+	ck_assert(!corpus_filter_tokenize(&filter, type_ids, offsets,
+					  sizes, 4, &n));
+	ck_assert_int_eq(n, 4);
+	assert_text_eq(&filter.symtab.types[type_ids[0]].text, T("a"));
+	ck_assert_int_eq((int)offsets[0], 0);
+	ck_assert_int_eq((int)sizes[0], 1);
+	assert_text_eq(&filter.symtab.types[type_ids[1]].text, T("rose"));
+	ck_assert_int_eq((int)offsets[1], 2);
+	ck_assert_int_eq((int)sizes[1], 4);
+	assert_text_eq(&filter.symtab.types[type_ids[2]].text, T("is_a"));
+	ck_assert_int_eq((int)offsets[2], 7);
+	ck_assert_int_eq((int)sizes[2], 4);
+	assert_text_eq(&filter.symtab.types[type_ids[3]].text, T("rose"));
+	ck_assert_int_eq((int)offsets[3], 12);
+	ck_assert_int_eq((int)sizes[3], 4);
+}
+END_TEST
+
+
+START_TEST(test_limit)
+{
+	init(NULL, 0);
+	ck_assert(!corpus_symtab_set_limit(&filter.symtab, 2, 1));
+
+	start(T("a b c A"));
+
+	assert_text_eq(next_type(), T("a"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), T("b"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_OOV);
+	assert_text_eq(token(), T("c"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), T("a"));
+	assert_text_eq(token(), T("A"));
+	assert_text_eq(next_type(), TYPE_EOT);
+}
+END_TEST
+
+
+START_TEST(test_limit_known)
+{
+	init("english", 0);
+	ck_assert(!corpus_symtab_set_limit(&filter.symtab, 2, 1));
+
+	// case variants of a known type get stemmed after the cap
+	start(T("Running running RUNNING"));
+
+	assert_text_eq(next_type(), T("run"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), T("run"));
+	assert_text_eq(token(), T("running"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), T("run"));
+	assert_text_eq(token(), T("RUNNING"));
+	assert_text_eq(next_type(), TYPE_EOT);
+	ck_assert_int_eq(filter.symtab.ntoken, 2);
+}
+END_TEST
+
+
+START_TEST(test_limit_drop)
+{
+	init(NULL, DROP_PUNCT);
+	drop(T("the"));
+	ck_assert(!corpus_symtab_set_limit(&filter.symtab, 2, 1));
+
+	start(T("a b The , c"));
+
+	assert_text_eq(next_type(), T("a"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), T("b"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(token(), T("The"));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(token(), T(","));
+	assert_text_eq(next_type(), TYPE_DROP);
+	assert_text_eq(next_type(), TYPE_OOV);
+	assert_text_eq(token(), T("c"));
+	assert_text_eq(next_type(), TYPE_EOT);
+}
+END_TEST
+
+
 START_TEST(test_drop_ideo)
 {
 	init(NULL, DROP_LETTER);
@@ -348,6 +553,11 @@ Suite *filter_suite(void)
         tcase_add_test(tc, test_combine);
         tcase_add_test(tc, test_drop_combine);
         tcase_add_test(tc, test_basic_census);
+        tcase_add_test(tc, test_save_load);
+        tcase_add_test(tc, test_limit);
+        tcase_add_test(tc, test_limit_drop);
+        tcase_add_test(tc, test_limit_known);
+        tcase_add_test(tc, test_tokenize);
         tcase_add_test(tc, test_drop_ideo);
         tcase_add_test(tc, test_url);
         tcase_add_test(tc, test_hashtag);
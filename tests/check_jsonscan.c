@@ -0,0 +1,334 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "../src/jsonscan.h"
+#include "testutil.h"
+
+#define B(str) ((const uint8_t *)(str))
+
+
+/*
+ * Scalar reference for the structural masks: scan the input one byte at
+ * a time, and check the scanner's masks against the result.
+ */
+static void check_blocks(const char *str, size_t size)
+{
+	struct corpus_json_scanner scan;
+	struct corpus_json_block block;
+	const uint8_t *ptr = B(str);
+	const uint8_t *end = ptr + size;
+	const uint8_t *base;
+	uint64_t quote, in_string, open, close, bit;
+	size_t i, n;
+	uint8_t ch;
+	int in_str = 0, escaped = 0, is_quote;
+
+	corpus_json_scanner_make(&scan, ptr, end);
+
+	while ((base = corpus_json_scanner_advance(&scan, &block))) {
+		ck_assert(base < end);
+		n = (size_t)(end - base);
+		if (n > 64) {
+			n = 64;
+		}
+
+		quote = in_string = open = close = 0;
+		for (i = 0; i < n; i++) {
+			bit = (uint64_t)1 << i;
+			ch = base[i];
+
+			// an escape only hides a quote or another backslash;
+			// backslashes outside strings are invalid JSON, and
+			// don't affect the brackets
+			if (escaped) {
+				escaped = 0;
+				is_quote = 0;
+			} else {
+				escaped = (ch == '\\');
+				is_quote = (ch == '"');
+			}
+
+			if (is_quote) {
+				quote |= bit;
+				in_str = !in_str;
+			} else if (!in_str && (ch == '[' || ch == '{')) {
+				open |= bit;
+			} else if (!in_str && (ch == ']' || ch == '}')) {
+				close |= bit;
+			}
+			if (in_str) {
+				in_string |= bit;
+			}
+		}
+
+		ck_assert_uint_eq(block.quote, quote);
+		ck_assert_uint_eq(block.in_string & (n == 64 ? ~(uint64_t)0
+				: (((uint64_t)1 << n) - 1)), in_string);
+		ck_assert_uint_eq(block.open, open);
+		ck_assert_uint_eq(block.close, close);
+	}
+}
+
+
+static const char *scan_text(const char *str)
+{
+	const uint8_t *ptr = B(str);
+	const uint8_t *end = ptr + strlen(str);
+	const uint8_t *close;
+
+	close = corpus_json_scan_text(ptr, end, NULL);
+	if (close == end) {
+		return NULL;
+	}
+	return (const char *)close;
+}
+
+
+static int scan_close(const char *str)
+{
+	const uint8_t *ptr = B(str);
+	const uint8_t *end = ptr + strlen(str);
+	const uint8_t *close;
+
+	close = corpus_json_scan_close(ptr, end);
+	if (!close) {
+		return -1;
+	}
+	return (int)(close - ptr);
+}
+
+
+START_TEST(test_scan_text)
+{
+	int has_esc;
+	const char *str;
+
+	str = "hello\" world";
+	ck_assert_ptr_eq(scan_text(str), str + 5);
+
+	str = "\"";
+	ck_assert_ptr_eq(scan_text(str), str);
+
+	str = "a\\\"b\"";
+	ck_assert_ptr_eq(scan_text(str), str + 4);
+
+	str = "a\\\\\"b";
+	ck_assert_ptr_eq(scan_text(str), str + 3);
+
+	corpus_json_scan_text(B("abc\""), B("abc\"") + 4, &has_esc);
+	ck_assert(!has_esc);
+	corpus_json_scan_text(B("a\\nc\""), B("a\\nc\"") + 5, &has_esc);
+	ck_assert(has_esc);
+}
+END_TEST
+
+
+START_TEST(test_scan_text_long)
+{
+	char buf[256];
+	int i;
+
+	// the closing quote can fall in any position of a vector
+	for (i = 0; i < 200; i++) {
+		memset(buf, 'x', sizeof(buf));
+		buf[i] = '"';
+		buf[i + 1] = '\0';
+		ck_assert_ptr_eq(scan_text(buf), buf + i);
+	}
+
+	// an escaped quote that straddles a vector boundary
+	for (i = 1; i < 200; i++) {
+		memset(buf, 'x', sizeof(buf));
+		buf[i - 1] = '\\';
+		buf[i] = '"';
+		buf[i + 1] = '"';
+		buf[i + 2] = '\0';
+		ck_assert_ptr_eq(scan_text(buf), buf + i + 1);
+	}
+}
+END_TEST
+
+
+START_TEST(test_scan_text_utf8)
+{
+	uint8_t buf[256];
+	const uint8_t *close;
+	int i, j, has_esc, has_utf8;
+
+	// a non-ASCII byte before the closing quote gets noted in any
+	// position; one after the quote does not
+	for (i = 1; i < 200; i++) {
+		for (j = 0; j < 200; j++) {
+			if (j == i) {
+				continue;
+			}
+			memset(buf, 'x', sizeof(buf));
+			buf[i] = '"';
+			buf[j] = 0xC0;
+			close = corpus_json_scan_text_attr(buf, buf + 256,
+							   &has_esc, &has_utf8);
+			ck_assert_ptr_eq(close, buf + i);
+			ck_assert(!has_esc);
+			ck_assert_int_eq(has_utf8, j < i);
+		}
+	}
+}
+END_TEST
+
+
+START_TEST(test_scan_text_unterminated)
+{
+	ck_assert_ptr_eq(scan_text(""), NULL);
+	ck_assert_ptr_eq(scan_text("abc"), NULL);
+	ck_assert_ptr_eq(scan_text("abc\\\""), NULL);
+	ck_assert_ptr_eq(scan_text("abc\\"), NULL);
+}
+END_TEST
+
+
+START_TEST(test_scan_close)
+{
+	ck_assert_int_eq(scan_close("[]"), 2);
+	ck_assert_int_eq(scan_close("{} "), 2);
+	ck_assert_int_eq(scan_close("[1, [2, 3], {\"a\": 4}], 5"), 21);
+	ck_assert_int_eq(scan_close("{\"a]\": \"}\"}"), 11);
+	ck_assert_int_eq(scan_close("[\"\\\"]\"]"), 7);
+	ck_assert_int_eq(scan_close("[\"\\\\\"]"), 6);
+}
+END_TEST
+
+
+START_TEST(test_scan_close_unterminated)
+{
+	ck_assert_int_eq(scan_close("["), -1);
+	ck_assert_int_eq(scan_close("[[]"), -1);
+	ck_assert_int_eq(scan_close("[\"]\""), -1);
+	ck_assert_int_eq(scan_close("{\"a\": \"}"), -1);
+}
+END_TEST
+
+
+START_TEST(test_scan_close_long)
+{
+	char buf[512];
+	int i, n;
+
+	// nested brackets, with strings of varying length in between, so
+	// that the quotes and brackets fall on every block boundary
+	for (n = 0; n < 140; n++) {
+		i = 0;
+		buf[i++] = '[';
+		buf[i++] = '{';
+		buf[i++] = '"';
+		memset(buf + i, 'x', (size_t)n);
+		i += n;
+		buf[i++] = '"';
+		buf[i++] = ':';
+		buf[i++] = '"';
+		buf[i++] = ']';
+		buf[i++] = '"';
+		buf[i++] = '}';
+		buf[i++] = ']';
+		buf[i] = '\0';
+		ck_assert_int_eq(scan_close(buf), i);
+	}
+}
+END_TEST
+
+
+START_TEST(test_blocks)
+{
+	char buf[512];
+	int i, n, seed;
+	const char alphabet[] = "\"\\[]{}ab";
+
+	check_blocks("", 0);
+	check_blocks("{\"a\": [1, \"]\"]}", 15);
+
+	// runs of backslashes that cross block boundaries
+	for (n = 1; n < 10; n++) {
+		for (i = 50; i < 70; i++) {
+			memset(buf, 'a', sizeof(buf));
+			buf[0] = '"';
+			memset(buf + i - n, '\\', (size_t)n);
+			buf[i] = '"';
+			buf[i + 1] = '[';
+			check_blocks(buf, 200);
+		}
+	}
+
+	// random inputs
+	for (seed = 0; seed < 100; seed++) {
+		srand((unsigned)seed);
+		for (i = 0; i < (int)sizeof(buf); i++) {
+			buf[i] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+		}
+		check_blocks(buf, (size_t)(rand() % (int)sizeof(buf)));
+	}
+}
+END_TEST
+
+
+Suite *jsonscan_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("jsonscan");
+
+	tc = tcase_create("text");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_scan_text);
+	tcase_add_test(tc, test_scan_text_long);
+	tcase_add_test(tc, test_scan_text_utf8);
+	tcase_add_test(tc, test_scan_text_unterminated);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("close");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_scan_close);
+	tcase_add_test(tc, test_scan_close_unterminated);
+	tcase_add_test(tc, test_scan_close_long);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("blocks");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_blocks);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+
+int main(void)
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = jsonscan_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
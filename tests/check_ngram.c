@@ -327,6 +327,33 @@ START_TEST(test_bigram_clear)
 END_TEST
 
 
+START_TEST(test_bigram_merge)
+{
+	struct corpus_ngram other;
+
+	init(2);
+	add('a');
+	add('b');
+	add('a');
+
+	ck_assert(!corpus_ngram_init(&other, 2));
+	ck_assert(!corpus_ngram_add(&other, 'b', 1));
+	ck_assert(!corpus_ngram_add(&other, 'a', 2));
+	ck_assert(!corpus_ngram_add(&other, 'c', 1));
+	ck_assert(!corpus_ngram_merge(&ngram, &other));
+	corpus_ngram_destroy(&other);
+
+	ck_assert_int_eq(count(), 6);
+	ck_assert(weight("a") == 4);
+	ck_assert(weight("b") == 2);
+	ck_assert(weight("c") == 1);
+	ck_assert(weight("ab") == 1);
+	ck_assert(weight("ba") == 3);
+	ck_assert(weight("ac") == 1);
+}
+END_TEST
+
+
 START_TEST(test_trigram_random)
 {
 	double count3[10][10][10];
@@ -479,6 +506,7 @@ Suite *ngram_suite(void)
         tcase_add_test(tc, test_bigram_break);
         tcase_add_test(tc, test_bigram_iter);
         tcase_add_test(tc, test_bigram_clear);
+        tcase_add_test(tc, test_bigram_merge);
         suite_add_tcase(s, tc);
 
 	tc = tcase_create("trigram");
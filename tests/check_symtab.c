@@ -14,11 +14,14 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "../lib/utf8lite/src/utf8lite.h"
+#include "../src/error.h"
 #include "../src/table.h"
 #include "../src/textset.h"
 #include "../src/symtab.h"
@@ -360,6 +363,431 @@ START_TEST(test_casefold)
 END_TEST
 
 
+START_TEST(test_ascii_types)
+{
+	const char *toks[] = {
+		"", "a", "Z", "@[`{", "AZaz09", "The", "QUICK_brown",
+		"Fox,Jumps:Over", "\t\x01\x7F", "ABCDEFGH", "ABCDEFGHI",
+		"caf\\u00C9", "\\u0041B", "\\u2019S",
+		"It_Is_A_Long_Token_That_Is_More_Than_128_Bytes_Long_So"
+		"_It_Does_Not_Fit_In_The_Buffer_And_Takes_The_Slow_Path"
+		"_Through_The_Type_Map_Instead"
+	};
+	int kinds[] = {
+		UTF8LITE_TEXTMAP_NORMAL,
+		UTF8LITE_TEXTMAP_CASE,
+		(UTF8LITE_TEXTMAP_CASE | UTF8LITE_TEXTMAP_COMPAT
+		 | UTF8LITE_TEXTMAP_QUOTE | UTF8LITE_TEXTMAP_RMDI)
+	};
+	int ntok = (int)(sizeof(toks) / sizeof(toks[0]));
+	int nkind = (int)(sizeof(kinds) / sizeof(kinds[0]));
+	struct utf8lite_textmap map;
+	int i, k, tok_id;
+
+	for (k = 0; k < nkind; k++) {
+		corpus_symtab_destroy(&tab);
+		corpus_symtab_init(&tab, kinds[k]);
+		utf8lite_textmap_init(&map, kinds[k]);
+
+		for (i = 0; i < ntok; i++) {
+			tok_id = add_token(T(toks[i]));
+			utf8lite_textmap_set(&map, T(toks[i]));
+
+			// the type should match the one from the type map
+			assert_text_eq(&tab.types[tab.tokens[tok_id]
+					.type_id].text, &map.text);
+		}
+
+		utf8lite_textmap_destroy(&map);
+	}
+}
+END_TEST
+
+
+START_TEST(test_limit)
+{
+	int id;
+
+	ck_assert(!corpus_symtab_set_limit(&tab, 3, 1));
+
+	add_token(T("a"));
+	add_token(T("B"));
+	add_token(T("c"));
+
+	// when the table is full, it should leave new tokens out
+	ck_assert(!corpus_symtab_add_token(&tab, T("d"), &id));
+	ck_assert_int_eq(id, CORPUS_TOKEN_OOV);
+	ck_assert_int_eq(tab.ntoken, 3);
+	ck_assert(!has_token(T("d")));
+
+	// it should keep the existing tokens
+	ck_assert_int_eq(add_token(T("B")), 1);
+
+	// with a minimum count, it should leave out rare tokens
+	corpus_symtab_clear(&tab);
+	ck_assert(!corpus_symtab_set_limit(&tab, 3, 2));
+
+	ck_assert(!corpus_symtab_add_token(&tab, T("x"), &id));
+	ck_assert_int_eq(id, CORPUS_TOKEN_OOV);
+	ck_assert(!corpus_symtab_add_token(&tab, T("y"), &id));
+	ck_assert_int_eq(id, CORPUS_TOKEN_OOV);
+	ck_assert_int_eq(tab.ntoken, 0);
+
+	ck_assert(!corpus_symtab_add_token(&tab, T("x"), &id));
+	ck_assert_int_eq(id, 0);
+	ck_assert_int_eq(tab.ntoken, 1);
+
+	// without a limit, it should add new tokens
+	ck_assert(!corpus_symtab_set_limit(&tab, -1, 1));
+	ck_assert_int_eq(add_token(T("z")), 1);
+
+	ck_assert_int_eq(corpus_symtab_set_limit(&tab, 3, 0),
+			 CORPUS_ERROR_INVAL);
+}
+END_TEST
+
+
+START_TEST(test_many_blocks)
+{
+	static char big[10000];
+	char buf[256];
+	int i, k, n = 5000, type_id;
+	struct utf8lite_text *tok;
+
+	// repeat after clearing, to test re-using the storage
+	for (k = 0; k < 2; k++) {
+		// a token larger than the first storage block
+		memset(big, 'a', sizeof(big) - 1);
+		add_token(T(big));
+
+		for (i = 0; i < n; i++) {
+			// 'tok' and 'TOK' share a type
+			sprintf(buf, i % 2 ? "TOK %d" : "tok %d", i / 2);
+			tok = T(buf);
+			add_token(tok);
+		}
+
+		ck_assert_int_eq(tab.ntoken, n + 1);
+		ck_assert_int_eq(tab.ntype, n / 2 + 1);
+
+		for (i = 0; i < n; i++) {
+			sprintf(buf, i % 2 ? "TOK %d" : "tok %d", i / 2);
+			ck_assert(has_token(T(buf)));
+		}
+		ck_assert(has_token(T(big)));
+
+		ck_assert(has_type(T("tok 7")));
+		corpus_symtab_has_type(&tab, T("tok 7"), &type_id);
+		ck_assert_int_eq(tab.types[type_id].ntoken, 2);
+
+		corpus_symtab_clear(&tab);
+		ck_assert_int_eq(tab.ntoken, 0);
+		ck_assert(!has_token(T("tok 0")));
+	}
+}
+END_TEST
+
+
+START_TEST(test_shared)
+{
+	struct corpus_symtab_shared sh;
+	struct corpus_symtab tab2;
+	const struct corpus_symtab_token *token;
+	int id1, id2, id3;
+
+	ck_assert(!corpus_symtab_shared_init(&sh));
+	ck_assert(!corpus_symtab_init(&tab2, UTF8LITE_TEXTMAP_CASE));
+
+	// existing tokens get shared when attaching
+	add_token(T("Hello"));
+	ck_assert(!corpus_symtab_set_shared(&tab, &sh));
+	ck_assert(!corpus_symtab_set_shared(&tab2, &sh));
+
+	// the other table sees the same IDs, in a different order
+	ck_assert(!corpus_symtab_add_token(&tab2, T("world"), &id1));
+	ck_assert(!corpus_symtab_add_token(&tab2, T("Hello"), &id2));
+	ck_assert_int_eq(tab2.tokens[id2].shared_id,
+			 tab.tokens[0].shared_id);
+	ck_assert_int_eq(tab2.types[tab2.tokens[id2].type_id].shared_id,
+			 tab.types[tab.tokens[0].type_id].shared_id);
+
+	id3 = add_token(T("world"));
+	ck_assert_int_eq(tab.tokens[id3].shared_id,
+			 tab2.tokens[id1].shared_id);
+
+	// the shared table has the text and types
+	ck_assert_int_eq(corpus_symtab_shared_ntoken(&sh), 2);
+	token = corpus_symtab_shared_token(&sh, tab.tokens[id3].shared_id);
+	assert_text_eq(&token->text, T("world"));
+	assert_text_eq(corpus_symtab_shared_type(&sh, token->type_id),
+		       T("world"));
+
+	// 'hello' and 'Hello' share a type but not a token
+	ck_assert(!corpus_symtab_add_token(&tab2, T("hello"), &id1));
+	ck_assert_int_eq(corpus_symtab_shared_ntoken(&sh), 3);
+	ck_assert_int_eq(corpus_symtab_shared_ntype(&sh), 2);
+
+	corpus_symtab_destroy(&tab2);
+	corpus_symtab_shared_destroy(&sh);
+}
+END_TEST
+
+
+START_TEST(test_freeze)
+{
+	char buf[256];
+	int i, id, n = 5000;
+
+	add_token(T("Caf\\u00e9"));
+	add_token(T("CAF\u00c9"));
+	add_token(T(""));
+	for (i = 0; i < n; i++) {
+		sprintf(buf, i % 2 ? "TOK %d" : "tok %d", i / 2);
+		add_token(T(buf));
+	}
+
+	ck_assert(!corpus_symtab_freeze(&tab));
+	ck_assert(tab.frozen);
+
+	// it should find the existing tokens and types
+	for (i = 0; i < tab.ntoken; i++) {
+		ck_assert(has_token(&tab.tokens[i].text));
+		corpus_symtab_has_token(&tab, &tab.tokens[i].text, &id);
+		ck_assert_int_eq(id, i);
+	}
+	for (i = 0; i < tab.ntype; i++) {
+		corpus_symtab_has_type(&tab, &tab.types[i].text, &id);
+		ck_assert_int_eq(id, i);
+	}
+
+	// escaped and unescaped text should get the same ID
+	corpus_symtab_has_token(&tab, T("Caf\u00e9"), &id);
+	ck_assert_int_eq(id, 0);
+
+	// it should not find new tokens or types
+	ck_assert(!has_token(T("tok 2500")));
+	ck_assert(!has_token(T("Tok 0")));
+	ck_assert(!has_type(T("foo")));
+
+	// it should allow adding existing tokens, but not new ones
+	ck_assert(!corpus_symtab_add_token(&tab, T("TOK 7"), &id));
+	ck_assert_int_eq(id, 15 + 3);
+	ck_assert(corpus_symtab_add_token(&tab, T("Tok 7"), &id)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert(corpus_symtab_add_type(&tab, T("foo"), &id)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert_int_eq(tab.ntoken, n + 3);
+
+	// clearing should un-freeze the table
+	corpus_symtab_clear(&tab);
+	ck_assert(!tab.frozen);
+	add_token(T("tok 0"));
+	ck_assert(has_token(T("tok 0")));
+
+	// an empty table can get frozen
+	corpus_symtab_clear(&tab);
+	ck_assert(!corpus_symtab_freeze(&tab));
+	ck_assert(!has_token(T("tok 0")));
+	ck_assert(!has_type(T("tok 0")));
+}
+END_TEST
+
+
+#define FILE_NAME "check_symtab.tmp"
+
+START_TEST(test_save_load)
+{
+	struct corpus_symtab tab2;
+	char buf[256];
+	int i, j, id, n = 1000;
+
+	add_token(T("Caf\\u00e9"));
+	add_token(T("CAF\u00c9"));
+	add_token(T(""));
+	for (i = 0; i < n; i++) {
+		sprintf(buf, i % 2 ? "TOK %d" : "tok %d", i / 2);
+		add_token(T(buf));
+	}
+	add_type(T("extra"));
+
+	ck_assert(!corpus_symtab_save(&tab, FILE_NAME));
+
+	// it should reject a table with a different type kind
+	ck_assert(!corpus_symtab_init(&tab2, UTF8LITE_TEXTMAP_CASE));
+	ck_assert(corpus_symtab_load(&tab2, FILE_NAME, NULL)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert_int_eq(tab2.ntoken, 0);
+	corpus_symtab_destroy(&tab2);
+
+	ck_assert(!corpus_symtab_init(&tab2, tab.typemap.type));
+	ck_assert(!corpus_symtab_load(&tab2, FILE_NAME, NULL));
+
+	// it should keep the IDs, text, and token lists
+	ck_assert_int_eq(tab2.ntoken, tab.ntoken);
+	ck_assert_int_eq(tab2.ntype, tab.ntype);
+	for (i = 0; i < tab.ntoken; i++) {
+		assert_text_eq(&tab2.tokens[i].text, &tab.tokens[i].text);
+		ck_assert_int_eq(tab2.tokens[i].type_id,
+				 tab.tokens[i].type_id);
+		ck_assert(corpus_symtab_has_token(&tab2, &tab.tokens[i].text,
+						  &id));
+		ck_assert_int_eq(id, i);
+	}
+	for (i = 0; i < tab.ntype; i++) {
+		assert_text_eq(&tab2.types[i].text, &tab.types[i].text);
+		ck_assert(corpus_symtab_has_type(&tab2, &tab.types[i].text,
+						 &id));
+		ck_assert_int_eq(id, i);
+		ck_assert_int_eq(tab2.types[i].ntoken, tab.types[i].ntoken);
+		for (j = 0; j < tab.types[i].ntoken; j++) {
+			ck_assert_int_eq(tab2.types[i].token_ids[j],
+					 tab.types[i].token_ids[j]);
+		}
+	}
+
+	// it should allow adding new tokens to existing types
+	ck_assert(!corpus_symtab_add_token(&tab2, T("Tok 0"), &id));
+	ck_assert_int_eq(id, tab.ntoken);
+	ck_assert_int_eq(tab2.ntype, tab.ntype);
+	ck_assert(corpus_symtab_has_type(&tab2, T("tok 0"), &i));
+	ck_assert_int_eq(tab2.types[i].ntoken, 3);
+	ck_assert_int_eq(tab2.types[i].token_ids[2], id);
+
+	// it should reject a table that is not empty
+	ck_assert(corpus_symtab_load(&tab2, FILE_NAME, NULL)
+		  == CORPUS_ERROR_INVAL);
+	ck_assert_int_eq(tab2.ntoken, tab.ntoken + 1);
+
+	corpus_symtab_destroy(&tab2);
+	remove(FILE_NAME);
+}
+END_TEST
+
+
+START_TEST(test_save_over_loaded)
+{
+	struct corpus_symtab tab2, tab3;
+	char buf[256];
+	int i, id, n = 1000;
+
+	for (i = 0; i < n; i++) {
+		sprintf(buf, "tok %d", i);
+		add_token(T(buf));
+	}
+	ck_assert(!corpus_symtab_save(&tab, FILE_NAME));
+
+	// load the table, add a token, and save it back to the same file,
+	// which holds the text for the loaded tokens
+	ck_assert(!corpus_symtab_init(&tab2, tab.typemap.type));
+	ck_assert(!corpus_symtab_load(&tab2, FILE_NAME, NULL));
+	ck_assert(!corpus_symtab_add_token(&tab2, T("new"), &id));
+	ck_assert_int_eq(id, n);
+	ck_assert(!corpus_symtab_save(&tab2, FILE_NAME));
+
+	// the loaded text should still be readable
+	for (i = 0; i < n; i++) {
+		assert_text_eq(&tab2.tokens[i].text, &tab.tokens[i].text);
+	}
+
+	ck_assert(!corpus_symtab_init(&tab3, tab.typemap.type));
+	ck_assert(!corpus_symtab_load(&tab3, FILE_NAME, NULL));
+	ck_assert_int_eq(tab3.ntoken, n + 1);
+	for (i = 0; i < tab2.ntoken; i++) {
+		assert_text_eq(&tab3.tokens[i].text, &tab2.tokens[i].text);
+	}
+	ck_assert(corpus_symtab_has_token(&tab3, T("new"), &id));
+	ck_assert_int_eq(id, n);
+
+	corpus_symtab_destroy(&tab3);
+	corpus_symtab_destroy(&tab2);
+	remove(FILE_NAME);
+}
+END_TEST
+
+
+#define NTHREAD 4
+#define NWORD 20000
+
+struct shared_worker {
+	struct corpus_symtab_shared *shared;
+	int offset;
+	int ids[NWORD];
+	int err;
+};
+
+
+static void *shared_work(void *arg)
+{
+	struct shared_worker *w = arg;
+	struct corpus_symtab tab;
+	struct utf8lite_text text;
+	char buf[32];
+	int i, k, id, len;
+
+	if ((w->err = corpus_symtab_init(&tab, UTF8LITE_TEXTMAP_CASE))) {
+		return NULL;
+	}
+	if ((w->err = corpus_symtab_set_shared(&tab, w->shared))) {
+		goto out;
+	}
+
+	// each worker adds the same words, starting at a different one
+	for (k = 0; k < NWORD; k++) {
+		i = (k + w->offset) % NWORD;
+		len = sprintf(buf, "word%d", i);
+		utf8lite_text_assign(&text, (uint8_t *)buf, (size_t)len, 0,
+				     NULL);
+		if ((w->err = corpus_symtab_add_token(&tab, &text, &id))) {
+			goto out;
+		}
+		w->ids[i] = tab.tokens[id].shared_id;
+	}
+
+out:
+	corpus_symtab_destroy(&tab);
+	return NULL;
+}
+
+
+START_TEST(test_shared_threads)
+{
+	static struct shared_worker workers[NTHREAD];
+	struct corpus_symtab_shared sh;
+	const struct corpus_symtab_token *token;
+	pthread_t threads[NTHREAD];
+	char buf[32];
+	int i, t;
+
+	ck_assert(!corpus_symtab_shared_init(&sh));
+
+	for (t = 0; t < NTHREAD; t++) {
+		workers[t].shared = &sh;
+		workers[t].offset = t * (NWORD / NTHREAD);
+		ck_assert(!pthread_create(&threads[t], NULL, shared_work,
+					  &workers[t]));
+	}
+	for (t = 0; t < NTHREAD; t++) {
+		ck_assert(!pthread_join(threads[t], NULL));
+		ck_assert(!workers[t].err);
+	}
+
+	// the IDs agree across workers and are consecutive
+	ck_assert_int_eq(corpus_symtab_shared_ntoken(&sh), NWORD);
+	ck_assert_int_eq(corpus_symtab_shared_ntype(&sh), NWORD);
+	for (i = 0; i < NWORD; i++) {
+		for (t = 1; t < NTHREAD; t++) {
+			ck_assert_int_eq(workers[t].ids[i], workers[0].ids[i]);
+		}
+		sprintf(buf, "word%d", i);
+		token = corpus_symtab_shared_token(&sh, workers[0].ids[i]);
+		assert_text_eq(&token->text, T(buf));
+	}
+
+	corpus_symtab_shared_destroy(&sh);
+}
+END_TEST
+
+
 Suite *symtab_suite(void)
 {
         Suite *s;
@@ -380,6 +808,14 @@ Suite *symtab_suite(void)
         tcase_add_test(tc, test_many_add_typ);
         tcase_add_test(tc, test_many_add_tok);
         tcase_add_test(tc, test_casefold);
+        tcase_add_test(tc, test_ascii_types);
+        tcase_add_test(tc, test_many_blocks);
+        tcase_add_test(tc, test_shared);
+        tcase_add_test(tc, test_shared_threads);
+        tcase_add_test(tc, test_freeze);
+        tcase_add_test(tc, test_save_load);
+        tcase_add_test(tc, test_save_over_loaded);
+        tcase_add_test(tc, test_limit);
         suite_add_tcase(s, tc);
 
         return s;
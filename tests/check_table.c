@@ -0,0 +1,288 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <check.h>
+#include "../src/table.h"
+#include "testutil.h"
+
+#define NITEM_MAX 20000
+
+struct corpus_tagtable table;
+unsigned hashes[NITEM_MAX];
+int nitem;
+
+
+void setup_table(void)
+{
+	setup();
+	ck_assert(!corpus_tagtable_init(&table));
+	nitem = 0;
+}
+
+
+void teardown_table(void)
+{
+	corpus_tagtable_destroy(&table);
+	teardown();
+}
+
+
+// distinct hash codes, spread over all of the bits
+unsigned hash_of(int i)
+{
+	return (unsigned)i * 0x9E3779B1U + 0x7F4A7C15U;
+}
+
+
+// number of times the probe for the hash code reports the item
+int count(unsigned hash, int item)
+{
+	struct corpus_tagtable_probe probe;
+	int n = 0;
+
+	corpus_tagtable_probe_make(&probe, &table, hash);
+	while (corpus_tagtable_probe_advance(&probe)) {
+		ck_assert(0 <= probe.current);
+		ck_assert(probe.current < nitem);
+		ck_assert_uint_eq(hashes[probe.current], hash);
+		if (probe.current == item) {
+			n++;
+		}
+	}
+	return n;
+}
+
+
+int has_any(unsigned hash)
+{
+	struct corpus_tagtable_probe probe;
+
+	corpus_tagtable_probe_make(&probe, &table, hash);
+	return corpus_tagtable_probe_advance(&probe);
+}
+
+
+void add(unsigned hash)
+{
+	ck_assert(nitem < NITEM_MAX);
+	ck_assert(!corpus_tagtable_grow(&table, 1));
+	corpus_tagtable_add(&table, hash, nitem);
+	hashes[nitem] = hash;
+	nitem++;
+	ck_assert_int_eq(table.count, nitem);
+}
+
+
+void check_all(void)
+{
+	int i;
+
+	for (i = 0; i < nitem; i++) {
+		ck_assert_int_eq(count(hashes[i], i), 1);
+	}
+}
+
+
+START_TEST(test_init)
+{
+	ck_assert_int_eq(table.count, 0);
+	ck_assert(!table.resizing);
+	ck_assert(!has_any(0));
+	ck_assert(!has_any(hash_of(0)));
+}
+END_TEST
+
+
+START_TEST(test_add_resize)
+{
+	int i, nresize = 0;
+
+	for (i = 0; i < 2000; i++) {
+		add(hash_of(i));
+		if (table.resizing) {
+			nresize++;
+		}
+
+		// look up the old and new keys after each insertion,
+		// including the ones in the middle of a resize
+		check_all();
+	}
+
+	ck_assert(nresize > 0);
+}
+END_TEST
+
+
+START_TEST(test_absent)
+{
+	int i, nresize = 0;
+
+	for (i = 0; i < 2000; i++) {
+		add(hash_of(2 * i));
+		if (table.resizing) {
+			nresize++;
+			ck_assert(!has_any(hash_of(2 * i + 1)));
+			ck_assert(!has_any(hash_of(2 * i + 2)));
+		}
+	}
+	ck_assert(nresize > 0);
+
+	for (i = 0; i < 2000; i++) {
+		ck_assert(!has_any(hash_of(2 * i + 1)));
+	}
+}
+END_TEST
+
+
+START_TEST(test_same_hash)
+{
+	unsigned hash = hash_of(7);
+	int i, n, nresize = 0;
+
+	// the colliding items fill several groups, so that the probe
+	// sequence has to continue past full groups
+	for (i = 0; i < 300; i++) {
+		add(hash);
+		if (table.resizing) {
+			nresize++;
+		}
+		check_all();
+	}
+	ck_assert(nresize > 0);
+
+	// the same tag and group, but a different hash code
+	ck_assert(!has_any(hash ^ 1));
+
+	n = 0;
+	for (i = 0; i < nitem; i++) {
+		n += count(hash, i);
+	}
+	ck_assert_int_eq(n, nitem);
+}
+END_TEST
+
+
+START_TEST(test_grow_many)
+{
+	int i, capacity;
+
+	ck_assert(!corpus_tagtable_grow(&table, 1000));
+	ck_assert(table.capacity >= 1000);
+	capacity = table.capacity;
+
+	// no more growing needed
+	for (i = 0; i < 1000; i++) {
+		corpus_tagtable_add(&table, hash_of(i), nitem);
+		hashes[nitem] = hash_of(i);
+		nitem++;
+	}
+	ck_assert_int_eq(table.capacity, capacity);
+	check_all();
+}
+END_TEST
+
+
+START_TEST(test_grow_many_resizing)
+{
+	int i;
+
+	// stop in the middle of a resize
+	i = 0;
+	do {
+		add(hash_of(i++));
+	} while (!table.resizing || i < 100);
+	ck_assert(table.resizing);
+
+	// growing past the current capacity finishes the old resize
+	ck_assert(!corpus_tagtable_grow(&table,
+					table.capacity - table.count + 5000));
+	ck_assert(table.capacity - table.count >= 5000);
+	check_all();
+
+	for (; i < 6000; i++) {
+		add(hash_of(i));
+	}
+	check_all();
+}
+END_TEST
+
+
+START_TEST(test_clear_resizing)
+{
+	int i;
+
+	i = 0;
+	do {
+		add(hash_of(i++));
+	} while (!table.resizing || i < 100);
+	ck_assert(table.resizing);
+
+	corpus_tagtable_clear(&table);
+	ck_assert_int_eq(table.count, 0);
+	ck_assert(!table.resizing);
+	for (i = 0; i < nitem; i++) {
+		ck_assert(!has_any(hashes[i]));
+	}
+
+	nitem = 0;
+	for (i = 0; i < 2000; i++) {
+		add(hash_of(i + 10000));
+	}
+	check_all();
+	ck_assert(!has_any(hash_of(0)));
+}
+END_TEST
+
+
+Suite *table_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("table");
+
+	tc = tcase_create("tagtable");
+	tcase_add_checked_fixture(tc, setup_table, teardown_table);
+	tcase_add_test(tc, test_init);
+	tcase_add_test(tc, test_add_resize);
+	tcase_add_test(tc, test_absent);
+	tcase_add_test(tc, test_same_hash);
+	tcase_add_test(tc, test_grow_many);
+	tcase_add_test(tc, test_grow_many_resizing);
+	tcase_add_test(tc, test_clear_resizing);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+
+int main(void)
+{
+	int nfail;
+	Suite *s;
+	SRunner *sr;
+
+	s = table_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+	nfail = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}